@@ -37,10 +37,19 @@
 #include "ErrorRedirector.h"
 #include <wx/wfstream.h>
 #include <wx/txtstrm.h>
+#include <algorithm>
+#include <iterator>
+#include <iostream>
 
 AutoComplete::AutoComplete(Configuration *configuration)
 {
   m_configuration = configuration;
+  for (int i = command; i <= unit; i++)
+    m_wordIndex[i] = CreateIndex(wxArrayString());
+  m_worksheetWordIndex = CreateIndex(wxArrayString());
+  m_worksheetWordsChanged = false;
+  m_loadFilesDirModified = 0;
+  m_demoFilesDirModified = 0;
 }
 
 void AutoComplete::ClearWorksheetWords()
@@ -48,7 +57,10 @@ void AutoComplete::ClearWorksheetWords()
   #ifdef HAVE_OPENMP_TASKS
   #pragma omp critical (AutocompleteBuiltins)
   #endif
-  m_worksheetWords.clear();
+  {
+    m_worksheetWords.clear();
+    m_worksheetWordsChanged = true;
+  }
 }
 
 void AutoComplete::ClearDemofileList()
@@ -56,7 +68,41 @@ void AutoComplete::ClearDemofileList()
   #ifdef HAVE_OPENMP_TASKS
   #pragma omp critical (AutocompleteFiles)
   #endif
-  m_wordList[demofile] = m_builtInDemoFiles;
+  {
+    m_wordList[demofile] = m_builtInDemoFiles;
+    m_demoFilesDir = wxEmptyString;
+    UpdateIndex(demofile);
+  }
+}
+
+AutoComplete::WordIndex AutoComplete::CreateIndex(wxArrayString words)
+{
+  // Sorted by the same operator< AppendPrefixMatches() searches with
+  std::sort(words.begin(), words.end());
+  std::shared_ptr<SortedWords> index = std::make_shared<SortedWords>();
+  index->Alloc(words.GetCount());
+  index->letters.reserve(words.GetCount());
+  for (wxArrayString::const_iterator it = words.begin(); it != words.end(); ++it)
+    if (index->IsEmpty() || (index->Last() != *it))
+    {
+      index->Add(*it);
+      index->letters.push_back(LetterMask(*it));
+    }
+  return index;
+}
+
+void AutoComplete::UpdateIndex(autoCompletionType type)
+{
+  std::atomic_store(&m_wordIndex[type], CreateIndex(m_wordList[type]));
+}
+
+void AutoComplete::AppendPrefixMatches(const wxArrayString &index, const wxString &partial,
+                                       wxArrayString &matches)
+{
+  // All words that start with partial directly follow the place partial would be sorted to.
+  for (wxArrayString::const_iterator it = std::lower_bound(index.begin(), index.end(), partial);
+       (it != index.end()) && (it->StartsWith(partial)); ++it)
+    matches.Add(*it);
 }
 
 void AutoComplete::AddSymbols(wxString xml)
@@ -128,6 +174,9 @@ void AutoComplete::AddSymbols_Backgroundtask(wxString xml)
         children = children->GetNext();
       }
     }
+    UpdateIndex(command);
+    UpdateIndex(tmplte);
+    UpdateIndex(unit);
   }
 }
 void AutoComplete::AddWorksheetWords(wxArrayString wordlist)
@@ -138,7 +187,8 @@ void AutoComplete::AddWorksheetWords(wxArrayString wordlist)
   {
     wxArrayString::const_iterator it;
     for (it = wordlist.begin(); it != wordlist.end(); ++it)
-      m_worksheetWords[*it] = 1;
+      m_worksheetWords[*it]++;
+    m_worksheetWordsChanged = true;
   }
 }
 
@@ -245,6 +295,11 @@ void AutoComplete::BuiltinSymbols_BackgroundTask()
         text.Flush();
       }
     }
+    UpdateKnownWords();
+    UpdateIndex(command);
+    UpdateIndex(tmplte);
+    UpdateIndex(esccommand);
+    UpdateIndex(unit);
   }
 }
 
@@ -256,72 +311,242 @@ void AutoComplete::LoadSymbols_BackgroundTask()
   {
     // Error dialogues need to be created by the foreground thread.
     SuppressErrorDialogs suppressor;
-    
-    // Prepare a list of all built-in loadable files of maxima.
+
+    m_builtInLoadFiles.Clear();
+    m_builtInDemoFiles.Clear();
+    // The lists UpdateLoadFiles() and UpdateDemoFiles() have created are based
+    // on the old lists.
+    m_loadFilesDir = wxEmptyString;
+    m_demoFilesDir = wxEmptyString;
+
+    // Prepare a list of all built-in loadable files and demos of maxima.
+    wxString sharedir = m_configuration->MaximaShareDir();
+    sharedir.Replace("\n","");
+    sharedir.Replace("\r","");
+    if(sharedir.IsEmpty())
+      wxLogMessage(_("Seems like the package with the maxima share files isn't installed."));
+    else
     {
-      GetMacFiles_includingSubdirs maximaLispIterator (m_builtInLoadFiles);
-      wxString sharedir = m_configuration->MaximaShareDir();
-      sharedir.Replace("\n","");
-      sharedir.Replace("\r","");
-      if(sharedir.IsEmpty())
-        wxLogMessage(_("Seems like the package with the maxima share files isn't installed."));
-      else
-      {
-        wxFileName shareDir(sharedir + "/");
-        shareDir.MakeAbsolute();
-        wxLogMessage(
-          wxString::Format(
-            _("Autocompletion: Scanning %s recursively for loadable lisp files."),
-            shareDir.GetFullPath().utf8_str()));
-        wxDir maximadir(shareDir.GetFullPath());
-        if(maximadir.IsOpened())
-          maximadir.Traverse(maximaLispIterator); //todo
-      }
-      GetMacFiles userLispIterator (m_builtInLoadFiles);
-      wxFileName userDir(Dirstructure::Get()->UserConfDir() + "/");
-      userDir.MakeAbsolute();
-      wxDir maximauserfilesdir(userDir.GetFullPath());
-      wxLogMessage(
-        wxString::Format(
-          _("Autocompletion: Scanning %s for loadable lisp files."),
-          userDir.GetFullPath().utf8_str()));
-      if(maximauserfilesdir.IsOpened())
-        maximauserfilesdir.Traverse(userLispIterator);
+      wxFileName shareDirName(sharedir + "/");
+      shareDirName.MakeAbsolute();
+      wxString shareDir = shareDirName.GetPath();
+      shareDirName.RemoveLastDir();
+      wxString demoDir = shareDirName.GetPath();
       wxLogMessage(
         wxString::Format(
-          _("Found %li loadable files."),
-          (unsigned long)m_builtInLoadFiles.GetCount()
-          )
-        );
-    }
-  
+          _("Autocompletion: Scanning %s recursively for loadable lisp files and %s for demo files."),
+          shareDir.utf8_str(), demoDir.utf8_str()));
 
-    // Prepare a list of all built-in demos of maxima.
-    {
-      wxFileName demoDir(m_configuration->MaximaShareDir() + "/");
-      demoDir.MakeAbsolute();
-      demoDir.RemoveLastDir();
-      GetDemoFiles_includingSubdirs maximaLispIterator (m_builtInDemoFiles);
+      wxString cacheFile = Dirstructure::Get()->UserFileCacheFile();
+      FileDirectories cache = ReadFileCache(cacheFile);
+      FileDirectories dirs;
+      long dirsRead = 0;
+      ScanFileDirectory(demoDir, cache, dirs, dirsRead);
+      ScanFileDirectory(shareDir, cache, dirs, dirsRead);
       wxLogMessage(
         wxString::Format(
-          _("Autocompletion: Scanning %s for loadable demo files."),
-          demoDir.GetFullPath().utf8_str()));
+          _("Autocompletion: %li of %li directories had changed since they were cached."),
+          dirsRead, (long)dirs.size()));
+      if ((dirsRead > 0) || (dirs.size() != cache.size()))
+        WriteFileCache(cacheFile, dirs);
 
-      wxDir maximadir(demoDir.GetFullPath());
-      if(maximadir.IsOpened())
-        maximadir.Traverse(maximaLispIterator);
+      for(FileDirectories::const_iterator it = dirs.begin(); it != dirs.end(); ++it)
+      {
+        if((it->first == shareDir) || (it->first.StartsWith(shareDir + "/")))
+          WX_APPEND_ARRAY(m_builtInLoadFiles, it->second.loadFiles);
+        if((it->first == demoDir) || (it->first.StartsWith(demoDir + "/")))
+          WX_APPEND_ARRAY(m_builtInDemoFiles, it->second.demoFiles);
+      }
     }
+
+    // The user directory contains only a few files and isn't cached.
+    GetMacFiles userLispIterator (m_builtInLoadFiles);
+    wxFileName userDir(Dirstructure::Get()->UserConfDir() + "/");
+    userDir.MakeAbsolute();
+    wxDir maximauserfilesdir(userDir.GetFullPath());
+    wxLogMessage(
+      wxString::Format(
+        _("Autocompletion: Scanning %s for loadable lisp files."),
+        userDir.GetFullPath().utf8_str()));
+    if(maximauserfilesdir.IsOpened())
+      maximauserfilesdir.Traverse(userLispIterator);
+
+    // Sort the lists and drop the files that exist in more than one directory.
+    m_builtInLoadFiles = *CreateIndex(m_builtInLoadFiles);
+    m_builtInDemoFiles = *CreateIndex(m_builtInDemoFiles);
+    wxLogMessage(
+      wxString::Format(
+        _("Found %li loadable files."),
+        (unsigned long)m_builtInLoadFiles.GetCount()
+        )
+      );
     wxLogMessage(
       wxString::Format(
         _("Found %li demo files."),
         (unsigned long)m_builtInDemoFiles.GetCount()
         )
       );
-    m_builtInLoadFiles.Sort();
-    m_builtInDemoFiles.Sort();
   }
 }
 
+bool AutoComplete::IgnoredDirectory(const wxString &dirname)
+{
+  return (dirname.EndsWith(".git")) ||
+    (dirname.EndsWith("/share/share")) ||
+    (dirname.EndsWith("/src/src")) ||
+    (dirname.EndsWith("/doc/doc")) ||
+    (dirname.EndsWith("/interfaces/interfaces"));
+}
+
+time_t AutoComplete::DirModificationTime(const wxString &dir)
+{
+  if(!wxDirExists(dir))
+    return 0;
+  wxDateTime modified = wxFileName::DirName(dir).GetModificationTime();
+  if(!modified.IsValid())
+    return 0;
+  return modified.GetTicks();
+}
+
+void AutoComplete::ScanFileDirectory(const wxString &dir, const FileDirectories &cache,
+                                     FileDirectories &dirs, long &dirsRead)
+{
+  // Don't read a directory twice, even if symlinks lead to it twice.
+  if(dirs.find(dir) != dirs.end())
+    return;
+
+  time_t modified = DirModificationTime(dir);
+  if(modified == 0)
+    return;
+
+  FileDirectories::const_iterator cached = cache.find(dir);
+  if((cached != cache.end()) && (cached->second.modified == modified))
+    dirs[dir] = cached->second;
+  else
+  {
+    wxDir directory(dir);
+    if(!directory.IsOpened())
+      return;
+    dirsRead++;
+    FileDirectory contents;
+    // Modification times only have a resolution of a second: If the directory
+    // has been modified within the last few seconds it might be modified again
+    // without its modification time changing.
+    if(modified < wxDateTime::Now().GetTicks() - 2)
+      contents.modified = modified;
+    wxString name;
+    for(bool found = directory.GetFirst(&name, wxEmptyString, wxDIR_FILES | wxDIR_HIDDEN);
+        found; found = directory.GetNext(&name))
+    {
+      if((name.EndsWith(".mac")) || (name.EndsWith(".lisp")) || (name.EndsWith(".wxm")))
+        contents.loadFiles.Add("\"" + wxFileName(name).GetName() + "\"");
+      else if(name.EndsWith(".dem"))
+        contents.demoFiles.Add("\"" + wxFileName(name).GetName() + "\"");
+    }
+    for(bool found = directory.GetFirst(&name, wxEmptyString, wxDIR_DIRS | wxDIR_HIDDEN);
+        found; found = directory.GetNext(&name))
+    {
+      wxString subdir = dir + "/" + name;
+      if(!IgnoredDirectory(subdir))
+        contents.subdirs.Add(subdir);
+    }
+    dirs[dir] = contents;
+  }
+
+  // Even if this directory hasn't changed its subdirectories might have.
+  wxArrayString subdirs = dirs[dir].subdirs;
+  for(wxArrayString::const_iterator it = subdirs.begin(); it != subdirs.end(); ++it)
+    ScanFileDirectory(*it, cache, dirs, dirsRead);
+}
+
+AutoComplete::FileDirectories AutoComplete::ReadFileCache(const wxString &file)
+{
+  FileDirectories dirs;
+  if(!wxFileExists(file))
+    return dirs;
+  wxFileInputStream input(file);
+  if(!input.IsOk())
+    return dirs;
+  wxTextInputStream text(input, wxT("\t"), wxConvUTF8);
+  if(text.ReadLine() != m_fileCacheHeader)
+    return dirs;
+
+  // Each directory starts with a "D" line; the following lines list its contents.
+  FileDirectory *current = NULL;
+  while(!input.Eof())
+  {
+    wxString line = text.ReadLine();
+    if(line.Length() < 2)
+      continue;
+    wxString value = line.Mid(2);
+    switch(wxChar(line[0]))
+    {
+    case 'D':
+    {
+      wxString modified = value.BeforeFirst(wxT('\t'));
+      long long ticks = 0;
+      modified.ToLongLong(&ticks);
+      current = &dirs[value.AfterFirst(wxT('\t'))];
+      current->modified = ticks;
+      break;
+    }
+    case 'L':
+      if(current)
+        current->loadFiles.Add(value);
+      break;
+    case 'E':
+      if(current)
+        current->demoFiles.Add(value);
+      break;
+    case 'S':
+      if(current)
+        current->subdirs.Add(value);
+      break;
+    }
+  }
+  return dirs;
+}
+
+void AutoComplete::WriteFileCache(const wxString &file, const FileDirectories &dirs)
+{
+  // Other wxMaxima windows might read the cache while we write it => Write a
+  // temporary file and replace the cache by it.
+  wxString tempFile = wxFileName::CreateTempFileName(file);
+  if(tempFile.IsEmpty())
+    return;
+  {
+    wxFileOutputStream output(tempFile);
+    if(!output.IsOk())
+      return;
+    wxTextOutputStream text(output, wxEOL_UNIX, wxConvUTF8);
+    text << m_fileCacheHeader << "\n";
+    for(FileDirectories::const_iterator it = dirs.begin(); it != dirs.end(); ++it)
+    {
+      text << "D\t" << wxString::Format(wxT("%lld"), (long long)it->second.modified)
+           << "\t" << it->first << "\n";
+      for(wxArrayString::const_iterator name = it->second.loadFiles.begin();
+          name != it->second.loadFiles.end(); ++name)
+        text << "L\t" << *name << "\n";
+      for(wxArrayString::const_iterator name = it->second.demoFiles.begin();
+          name != it->second.demoFiles.end(); ++name)
+        text << "E\t" << *name << "\n";
+      for(wxArrayString::const_iterator subdir = it->second.subdirs.begin();
+          subdir != it->second.subdirs.end(); ++subdir)
+        text << "S\t" << *subdir << "\n";
+    }
+    text.Flush();
+    if(!output.Close())
+    {
+      wxRemoveFile(tempFile);
+      return;
+    }
+  }
+  if(!wxRenameFile(tempFile, file, true))
+    wxRemoveFile(tempFile);
+}
+
+const wxString AutoComplete::m_fileCacheHeader(wxT("wxMaxima file cache, version 1"));
+
 void AutoComplete::UpdateDemoFiles(wxString partial, wxString maximaDir)
 {
   #ifdef HAVE_OPENMP_TASKS
@@ -351,16 +576,27 @@ void AutoComplete::UpdateDemoFiles(wxString partial, wxString maximaDir)
     if((partial != wxEmptyString) && wxDirExists(partial))
       partial += "/";
 
-    // Remove all files from the maxima directory from the demo file list
-    ClearDemofileList();
-
-    // Add all files from the maxima directory to the demo file list
-    if(partial != wxT("//"))
+    // If the directory hasn't changed since we last read it the list is still valid.
+    time_t modified = DirModificationTime(partial);
+    if((modified == 0) || (modified != m_demoFilesDirModified) ||
+       (m_demoFilesDir != prefix + partial))
     {
-      GetDemoFiles userLispIterator(m_wordList[demofile], prefix);
-      wxDir demofilesdir(partial);
-      if(demofilesdir.IsOpened())
-        demofilesdir.Traverse(userLispIterator);
+      m_demoFilesDir = prefix + partial;
+      m_demoFilesDirModified = modified;
+
+      // Remove all files from the maxima directory from the demo file list.
+      // ClearDemofileList() would try to enter the critical section we are in.
+      m_wordList[demofile] = m_builtInDemoFiles;
+
+      // Add all files from the maxima directory to the demo file list
+      if(partial != wxT("//"))
+      {
+        GetDemoFiles userLispIterator(m_wordList[demofile], prefix);
+        wxDir demofilesdir(partial);
+        if(demofilesdir.IsOpened())
+          demofilesdir.Traverse(userLispIterator);
+      }
+      UpdateIndex(demofile);
     }
   }
 }
@@ -402,6 +638,7 @@ void AutoComplete::UpdateGeneralFiles(wxString partial, wxString maximaDir)
       if(generalfilesdir.IsOpened())
         generalfilesdir.Traverse(fileIterator);
     }
+    UpdateIndex(generalfile);
   }
 }
 
@@ -435,16 +672,26 @@ void AutoComplete::UpdateLoadFiles(wxString partial, wxString maximaDir)
     if((partial != wxEmptyString) && wxDirExists(partial))
       partial += "/";
 
-    // Remove all files from the maxima directory from the load file list
-    m_wordList[loadfile] = m_builtInLoadFiles;
-
-    // Add all files from the maxima directory to the load file list
-    if(partial != wxT("//"))
+    // If the directory hasn't changed since we last read it the list is still valid.
+    time_t modified = DirModificationTime(partial);
+    if((modified == 0) || (modified != m_loadFilesDirModified) ||
+       (m_loadFilesDir != prefix + partial))
     {
-      GetMacFiles userLispIterator(m_wordList[loadfile], prefix);
-      wxDir loadfilesdir(partial);
-      if(loadfilesdir.IsOpened())
-        loadfilesdir.Traverse(userLispIterator);
+      m_loadFilesDir = prefix + partial;
+      m_loadFilesDirModified = modified;
+
+      // Remove all files from the maxima directory from the load file list
+      m_wordList[loadfile] = m_builtInLoadFiles;
+
+      // Add all files from the maxima directory to the load file list
+      if(partial != wxT("//"))
+      {
+        GetMacFiles userLispIterator(m_wordList[loadfile], prefix);
+        wxDir loadfilesdir(partial);
+        if(loadfilesdir.IsOpened())
+          loadfilesdir.Traverse(userLispIterator);
+      }
+      UpdateIndex(loadfile);
     }
   }
 }
@@ -453,68 +700,292 @@ void AutoComplete::UpdateLoadFiles(wxString partial, wxString maximaDir)
 wxArrayString AutoComplete::CompleteSymbol(wxString partial, autoCompletionType type)
 {
   wxArrayString completions;
-  wxArrayString perfectCompletions;
+
+  if(
+    ((type == AutoComplete::demofile) || (type == AutoComplete::loadfile)) &&
+    (partial.EndsWith("\""))
+    )
+    partial = partial.Left(partial.Length() - 1);
+
+  wxASSERT_MSG((type >= command) && (type <= unit), _("Bug: Autocompletion requested for unknown type of item."));
+
+  // An index is never changed after it has been published => We don't need to
+  // lock the word lists while we search it.
+  WordIndex index = std::atomic_load(&m_wordIndex[type]);
+
+  if (type == tmplte)
+  {
+    // If we have templates for exactly the function the user has typed in we
+    // offer only these.
+    wxArrayString perfectCompletions;
+    AppendPrefixMatches(*index, partial + wxT("("), perfectCompletions);
+    if (perfectCompletions.Count() > 0)
+      return perfectCompletions;
+  }
+
+  AppendPrefixMatches(*index, partial, completions);
+
+  // Add a list of words that were definied on the work sheet but that aren't
+  // defined as maxima commands or functions.
+  if (type == command)
+  {
+    UpdateWorksheetWordIndex();
+    wxArrayString worksheetCompletions;
+    AppendPrefixMatches(*std::atomic_load(&m_worksheetWordIndex), partial, worksheetCompletions);
+
+    // Both lists are sorted => merging them drops the duplicates.
+    wxArrayString merged;
+    std::set_union(completions.begin(), completions.end(),
+                   worksheetCompletions.begin(), worksheetCompletions.end(),
+                   std::back_inserter(merged));
+    completions = merged;
+  }
+
+  // Only if nothing starts with what the user has typed we search for fuzzy
+  // matches: A single prefix match is inserted directly.
+  if ((completions.IsEmpty()) && (m_configuration->FuzzyAutocomplete()) &&
+      ((type == command) || (type == unit)) && (partial.Length() >= 2))
+  {
+    std::vector<ScoredWord> matches;
+    AppendFuzzyMatches(*index, partial, matches);
+    if (type == command)
+      AppendFuzzyMatches(*std::atomic_load(&m_worksheetWordIndex), partial, matches);
+    return RankFuzzyMatches(matches);
+  }
+
+  return completions;
+}
+
+void AutoComplete::UpdateWorksheetWordIndex()
+{
+  if (!m_worksheetWordsChanged)
+    return;
 
   #ifdef HAVE_OPENMP_TASKS
   #pragma omp critical (AutocompleteBuiltins)
-  #pragma omp critical (AutocompleteFiles)
   #endif
   {
-    if(
-      ((type == AutoComplete::demofile) || (type == AutoComplete::loadfile)) &&
-      (partial.EndsWith("\""))
-      )
-      partial = partial.Left(partial.Length() - 1);
-  
-    wxASSERT_MSG((type >= command) && (type <= unit), _("Bug: Autocompletion requested for unknown type of item."));
-  
-    if (type != tmplte)
+    wxArrayString words;
+    words.Alloc(m_worksheetWords.size());
+    WorksheetWords::const_iterator it;
+    for (it = m_worksheetWords.begin(); it != m_worksheetWords.end(); ++it)
+      words.Add(it->first);
+    std::atomic_store(&m_worksheetWordIndex, CreateIndex(words));
+    m_worksheetWordUsage = m_worksheetWords;
+    m_worksheetWordsChanged = false;
+  }
+}
+
+void AutoComplete::AddUsage(wxString command)
+{
+  #ifdef HAVE_OPENMP_TASKS
+  #pragma omp critical (AutocompleteUsage)
+  #endif
+  {
+    size_t start = 0;
+    for (size_t i = 0; i <= command.Length(); i++)
     {
-      for (size_t i = 0; i < m_wordList[type].GetCount(); i++)
-      {
-        if (m_wordList[type][i].StartsWith(partial) &&
-            completions.Index(m_wordList[type][i]) == wxNOT_FOUND)
-          completions.Add(m_wordList[type][i]);
-      }
+      if ((i < command.Length()) &&
+          (wxIsalnum(command[i]) || (command[i] == wxT('_')) || (command[i] == wxT('%'))))
+        continue;
+      // We have found the end of a word. Numbers aren't symbols.
+      if ((i > start) && (!wxIsdigit(command[start])))
+        m_usage[command.SubString(start, i - 1)]++;
+      start = i + 1;
     }
-    else
+  }
+}
+
+//! Compares two letters, ignoring their case if asked to
+static bool SameLetter(wxChar a, wxChar b, bool ignoreCase)
+{
+  if (ignoreCase)
+    return wxTolower(a) == wxTolower(b);
+  else
+    return a == b;
+}
+
+int AutoComplete::FuzzyScore(const wxString &word, const wxString &partial, bool ignoreCase)
+{
+  // Each kind of match gets a range of +-500 around its base score.
+  int wordLength = word.Length();
+  int partialLength = partial.Length();
+  if (word.StartsWith(partial))
+    return m_prefixScore - std::min(wordLength - partialLength, 100);
+
+  // Look for the letters of partial in the right order. Letters that start a
+  // part of the word and letters that directly follow each other are more likely
+  // to be what the user meant.
+  int score = 0;
+  int pos = 0;
+  int lastMatch = -1;
+  int i;
+  for (i = 0; i < partialLength; i++)
+  {
+    while ((pos < wordLength) && (!SameLetter(word[pos], partial[i], ignoreCase)))
+      pos++;
+    if (pos >= wordLength)
+      break;
+    score += 4;
+    if (pos == 0)
+      score += 12;
+    else if ((word[pos - 1] == wxT('_')) || (word[pos - 1] == wxT('%')) ||
+             (wxIsupper(word[pos]) && wxIslower(word[pos - 1])))
+      score += 10;
+    if (lastMatch >= 0)
     {
-      for (size_t i = 0; i < m_wordList[type].GetCount(); i++)
-      {
-        wxString templ = m_wordList[type][i];
-        if (templ.StartsWith(partial))
-        {
-          if (completions.Index(templ) == wxNOT_FOUND)
-            completions.Add(templ);
-          if (templ.SubString(0, templ.Find(wxT("(")) - 1) == partial &&
-              perfectCompletions.Index(templ) == wxNOT_FOUND)
-            perfectCompletions.Add(templ);
-        }
-      }
+      if (pos == lastMatch + 1)
+        score += 8;
+      else
+        score -= std::min(pos - lastMatch - 1, 5);
     }
+    lastMatch = pos;
+    pos++;
+  }
+  if (i == partialLength)
+    return m_subsequenceScore + std::min(score, 400) - std::min(wordLength / 4, 50);
 
-    // Add a list of words that were definied on the work sheet but that aren't
-    // defined as maxima commands or functions.
-    if (type == command)
+  // Typos are looked for only if the first letter is right: That nearly always
+  // is the case and keeps this search fast enough for every keystroke.
+  if ((partialLength < 3) || (wordLength == 0) || (!SameLetter(word[0], partial[0], ignoreCase)))
+    return -1;
+  int maxEdits = (partialLength < 6) ? 1 : 2;
+  int edits = PrefixEditDistance(word, partial, ignoreCase, maxEdits);
+  if (edits > maxEdits)
+    return -1;
+  return m_typoScore - 100 * edits - std::min(wordLength / 4, 50);
+}
+
+int AutoComplete::PrefixEditDistance(const wxString &word, const wxString &partial,
+                                     bool ignoreCase, int maxEdits)
+{
+  int m = partial.Length();
+  int n = std::min((int)word.Length(), m + maxEdits);
+  // The rows of the table of edit distances between the beginnings of both words
+  // we need for the current row.
+  std::vector<int> twoRowsBack(n + 1), lastRow(n + 1), row(n + 1);
+  for (int j = 0; j <= n; j++)
+    lastRow[j] = j;
+  for (int i = 1; i <= m; i++)
+  {
+    row[0] = i;
+    int rowMin = row[0];
+    for (int j = 1; j <= n; j++)
     {
-      WorksheetWords::const_iterator it;
-      for (it = m_worksheetWords.begin(); it != m_worksheetWords.end(); ++it)
-      {
-        if (it->first.StartsWith(partial))
-        {
-          if (completions.Index(it->first) == wxNOT_FOUND)
-          {
-            completions.Add(it->first);
-          }
-        }
-      }
+      int cost = SameLetter(partial[i - 1], word[j - 1], ignoreCase) ? 0 : 1;
+      row[j] = std::min(std::min(lastRow[j] + 1, row[j - 1] + 1), lastRow[j - 1] + cost);
+      if ((i > 1) && (j > 1) &&
+          SameLetter(partial[i - 1], word[j - 2], ignoreCase) &&
+          SameLetter(partial[i - 2], word[j - 1], ignoreCase))
+        row[j] = std::min(row[j], twoRowsBack[j - 2] + 1);
+      rowMin = std::min(rowMin, row[j]);
     }
+    // The distance can only grow from here on
+    if (rowMin > maxEdits)
+      return maxEdits + 1;
+    twoRowsBack.swap(lastRow);
+    lastRow.swap(row);
+  }
+  // partial may match a beginning of word of any length
+  return *std::min_element(lastRow.begin(), lastRow.end());
+}
+
+wxUint64 AutoComplete::LetterMask(const wxString &word)
+{
+  wxUint64 mask = 0;
+  for (wxString::const_iterator it = word.begin(); it != word.end(); ++it)
+  {
+    wxChar ch = *it;
+    ch = wxTolower(ch);
+    int bit;
+    if ((ch >= wxT('a')) && (ch <= wxT('z')))
+      bit = ch - wxT('a');
+    else if ((ch >= wxT('0')) && (ch <= wxT('9')))
+      bit = 26 + ch - wxT('0');
+    else if (ch == wxT('_'))
+      bit = 36;
+    else if (ch == wxT('%'))
+      bit = 37;
+    else
+      bit = 63;
+    mask |= ((wxUint64) 1) << bit;
+  }
+  return mask;
+}
 
-    completions.Sort();
+void AutoComplete::AppendFuzzyMatches(const SortedWords &index, const wxString &partial,
+                                      std::vector<ScoredWord> &matches)
+{
+  // Case only matters if the user has typed an uppercase letter.
+  bool ignoreCase = (partial.Lower() == partial);
+  size_t first = matches.size();
+
+  // FuzzyScore() only accepts words that contain all letters of partial or,
+  // for typos, that start with the same letter => we don't need to score the
+  // others.
+  wxUint64 partialLetters = LetterMask(partial);
+  bool typosPossible = (partial.Length() >= 3);
+  wxChar firstLetter = partial[0];
+  firstLetter = wxTolower(firstLetter);
+  for (size_t i = 0; i < index.GetCount(); i++)
+  {
+    const wxString &word = index[i];
+    if (((index.letters[i] & partialLetters) != partialLetters) &&
+        ((!typosPossible) || word.IsEmpty() || (!SameLetter(word[0], firstLetter, true))))
+      continue;
+    int score = FuzzyScore(word, partial, ignoreCase);
+    if (score >= 0)
+      matches.push_back(ScoredWord(score, word));
+  }
+
+  // Words that are used often move up a bit: 10 points per doubling of their uses.
+  #ifdef HAVE_OPENMP_TASKS
+  #pragma omp critical (AutocompleteUsage)
+  #endif
+  for (size_t i = first; i < matches.size(); i++)
+  {
+    long uses = 0;
+    WorksheetWords::const_iterator it = m_usage.find(matches[i].word);
+    if (it != m_usage.end())
+      uses += it->second;
+    it = m_worksheetWordUsage.find(matches[i].word);
+    if (it != m_worksheetWordUsage.end())
+      uses += it->second;
+    int bonus = 0;
+    while ((uses > 0) && (bonus < 60))
+    {
+      bonus += 10;
+      uses /= 2;
+    }
+    matches[i].score += bonus;
   }
-  if (perfectCompletions.Count() > 0)
-    return perfectCompletions;
-  return completions;
+}
+
+wxArrayString AutoComplete::RankFuzzyMatches(std::vector<ScoredWord> &matches)
+{
+  std::sort(matches.begin(), matches.end(),
+            [](const ScoredWord &a, const ScoredWord &b) {
+              if (a.score != b.score)
+                return a.score > b.score;
+              return a.word < b.word;
+            });
+
+  wxArrayString result;
+  size_t fuzzyMatches = 0;
+  for (std::vector<ScoredWord>::const_iterator it = matches.begin(); it != matches.end(); ++it)
+  {
+    // A word from the worksheet that is a maxima command, too, gets the same score twice.
+    if ((!result.IsEmpty()) && (result.Last() == it->word))
+      continue;
+    if (it->score < m_prefixScore - 500)
+    {
+      if (fuzzyMatches >= m_maxFuzzyMatches)
+        break;
+      fuzzyMatches++;
+    }
+    result.Add(it->word);
+  }
+  return result;
 }
 
 void AutoComplete::AddSymbol(wxString fun, autoCompletionType type)
@@ -522,10 +993,29 @@ void AutoComplete::AddSymbol(wxString fun, autoCompletionType type)
   #ifdef HAVE_OPENMP_TASKS
   #pragma omp critical (AutocompleteBuiltins)
   #endif
-  AddSymbol_nowait(fun, type);
+  {
+    type = AddSymbol_nowait(fun, type);
+    // Sorting the whole list again for every symbol the user defines would be
+    // slow for big lists => we insert the new word into a copy of the index.
+    if (!m_wordList[type].IsEmpty())
+      InsertIntoIndex(type, m_wordList[type].Last());
+  }
+}
+
+void AutoComplete::InsertIntoIndex(autoCompletionType type, const wxString &word)
+{
+  WordIndex index = std::atomic_load(&m_wordIndex[type]);
+  wxArrayString::const_iterator pos = std::lower_bound(index->begin(), index->end(), word);
+  if ((pos != index->end()) && (*pos == word))
+    return;
+  size_t offset = pos - index->begin();
+  std::shared_ptr<SortedWords> newIndex = std::make_shared<SortedWords>(*index);
+  newIndex->Insert(word, offset);
+  newIndex->letters.insert(newIndex->letters.begin() + offset, LetterMask(word));
+  std::atomic_store(&m_wordIndex[type], WordIndex(newIndex));
 }
 
-void AutoComplete::AddSymbol_nowait(wxString fun, autoCompletionType type)
+AutoComplete::autoCompletionType AutoComplete::AddSymbol_nowait(wxString fun, autoCompletionType type)
 {
   /// Check for function of template
   if (fun.StartsWith(wxT("FUNCTION: ")))
@@ -545,28 +1035,154 @@ void AutoComplete::AddSymbol_nowait(wxString fun, autoCompletionType type)
   }
 
   /// Add symbols
-  if ((type != tmplte) && m_wordList[type].Index(fun, true, true) == wxNOT_FOUND)
+  if ((type == command) || (type == unit))
+  {
+    if (m_knownWords[type].insert(fun).second)
+      m_wordList[type].Add(fun);
+  }
+  else if ((type != tmplte) && m_wordList[type].Index(fun, true, true) == wxNOT_FOUND)
     m_wordList[type].Add(fun);
 
   /// Add templates - for given function and given argument count we
-  /// only add one template. We count the arguments by counting '<'
+  /// only add one template.
   if (type == tmplte)
   {
     fun = FixTemplate(fun);
-    wxString funName = fun.SubString(0, fun.Find(wxT("(")));
-    long count = fun.Freq('<');
-    size_t i = 0;
-    for (i = 0; i < m_wordList[type].GetCount(); i++)
-    {
-      wxString t = m_wordList[type][i];
-      if (t.StartsWith(funName) && (t.Freq('<') == count))
-        break;
-    }
-    if (i == m_wordList[type].GetCount())
+    if (m_knownTemplates.insert(TemplateSignature(fun)).second)
       m_wordList[type].Add(fun);
   }
+  return type;
+}
+
+
+wxString AutoComplete::TemplateSignature(const wxString &templ)
+{
+  // We count the arguments by counting '<'
+  return templ.SubString(0, templ.Find(wxT("("))) + wxString::Format(wxT("%li"), (long)templ.Freq('<'));
 }
 
+void AutoComplete::UpdateKnownWords()
+{
+  for (int type = command; type <= unit; type++)
+    m_knownWords[type].clear();
+  m_knownTemplates.clear();
+  for (wxArrayString::const_iterator it = m_wordList[command].begin(); it != m_wordList[command].end(); ++it)
+    m_knownWords[command].insert(*it);
+  for (wxArrayString::const_iterator it = m_wordList[unit].begin(); it != m_wordList[unit].end(); ++it)
+    m_knownWords[unit].insert(*it);
+  for (wxArrayString::const_iterator it = m_wordList[tmplte].begin(); it != m_wordList[tmplte].end(); ++it)
+    m_knownTemplates.insert(TemplateSignature(*it));
+}
+
+bool AutoComplete::Benchmark()
+{
+  // Symbol names that look a bit like maxima's
+  const wxString parts[] = {wxT("plot"), wxT("draw"), wxT("integrate"), wxT("sum"), wxT("lin"),
+                            wxT("solve"), wxT("mat"), wxT("rix"), wxT("ex"), wxT("pand"),
+                            wxT("fac"), wxT("tor"), wxT("list"), wxT("set"), wxT("diff"),
+                            wxT("eq"), wxT("trig"), wxT("simp"), wxT("num"), wxT("val")};
+  const long symbols = 50000;
+  wxString xml = wxT("<wxxml-symbols>");
+  long entries = 0;
+  for (long i = 0; i < symbols; i++)
+  {
+    wxString name = parts[i % 20] + parts[(i / 20) % 20] + wxT("_") + parts[(i / 400) % 20] +
+      wxString::Format(wxT("%li"), i / 8000);
+    xml += wxT("<function>") + name + wxT("</function>");
+    entries++;
+    // Every 10th symbol is sent twice, and so are the templates that belong to them.
+    if (i % 10 == 0)
+    {
+      xml += wxT("<value>") + name + wxT("</value>");
+      entries++;
+    }
+    if (i % 5 == 0)
+    {
+      // Maxima sends the "<" and ">" around the arguments as XML entities.
+      wxString templ = name + wxT("(&lt;x&gt;");
+      for (long arg = 0; arg < (i / 5) % 3; arg++)
+        templ += wxString::Format(wxT(", &lt;y_%li&gt;"), arg);
+      templ += wxT(")");
+      xml += wxT("<template>") + templ + wxT("</template>");
+      entries++;
+      if (i % 10 == 0)
+      {
+        xml += wxT("<template>") + templ + wxT("</template>");
+        entries++;
+      }
+    }
+  }
+  xml += wxT("</wxxml-symbols>");
+
+  wxBitmap bitmap(10, 10);
+  wxMemoryDC dc(bitmap);
+  Configuration configuration(&dc);
+  configuration.FuzzyAutocomplete(true);
+  AutoComplete autocomplete(&configuration);
+
+  wxStopWatch stopwatch;
+  autocomplete.AddSymbols_Backgroundtask(xml);
+  long addTime = stopwatch.Time();
+
+  // No symbol starts with any of these queries => all of them are answered by
+  // the fuzzy search.
+  const wxString queries[] = {wxT("pltdraw"), wxT("intgrate"), wxT("sd_"), wxT("mtrx_sum"),
+                              wxT("slvfac")};
+  const int runs = 20;
+  long matches = 0;
+  stopwatch.Start();
+  for (int run = 0; run < runs; run++)
+    for (int i = 0; i < 5; i++)
+      matches += autocomplete.CompleteSymbol(queries[i], command).GetCount();
+  long queryTime = stopwatch.TimeInMicro().ToLong() / (5 * runs);
+
+  std::cout << "Adding " << entries << " symbols and templates: " << addTime << " ms\n";
+  std::cout << "Fuzzy completion among " << autocomplete.m_wordList[command].GetCount()
+            << " symbols: " << queryTime << " us per query, "
+            << matches / runs << " matches per " << 5 << " queries\n";
+
+  // The candidate filter of AppendFuzzyMatches() mustn't lose any match:
+  // Compare its results to the ones scoring every word yields.
+  WordIndex index = std::atomic_load(&autocomplete.m_wordIndex[command]);
+  for (int i = 0; i < 5; i++)
+  {
+    wxArrayString completions = autocomplete.CompleteSymbol(queries[i], command);
+    std::vector<ScoredWord> scored;
+    for (wxArrayString::const_iterator it = index->begin(); it != index->end(); ++it)
+    {
+      int score = FuzzyScore(*it, queries[i], true);
+      if (score >= 0)
+        scored.push_back(ScoredWord(score, *it));
+    }
+    if (completions != RankFuzzyMatches(scored))
+    {
+      std::cerr << "The fuzzy matches for \"" << queries[i] << "\" differ from the ones "
+                << "scoring all symbols yields\n";
+      return false;
+    }
+    if ((!completions.IsEmpty()) && (completions[0].StartsWith(queries[i])))
+    {
+      std::cerr << "The query \"" << queries[i] << "\" doesn't test the fuzzy search\n";
+      return false;
+    }
+  }
+
+  size_t symbolsLoaded = autocomplete.m_wordList[command].GetCount();
+  size_t templatesLoaded = autocomplete.m_wordList[tmplte].GetCount();
+  if ((symbolsLoaded < (size_t)symbols) || (templatesLoaded < (size_t)symbols / 5))
+  {
+    std::cerr << "Not all symbols were loaded: " << symbolsLoaded << " of " << symbols
+              << " symbols, " << templatesLoaded << " of " << symbols / 5 << " templates\n";
+    return false;
+  }
+  if ((symbolsLoaded > (size_t)symbols) || (templatesLoaded > (size_t)symbols / 5))
+  {
+    std::cerr << "Duplicate symbols were added: " << symbolsLoaded << " symbols, "
+              << templatesLoaded << " templates\n";
+    return false;
+  }
+  return true;
+}
 
 wxString AutoComplete::FixTemplate(wxString templ)
 {
@@ -35,6 +35,10 @@
 #include <wx/arrstr.h>
 #include <wx/regex.h>
 #include <wx/filename.h>
+#include <wx/hashset.h>
+#include <atomic>
+#include <memory>
+#include <vector>
 #include "Configuration.h"
 
 /* The autocompletion logic
@@ -45,10 +49,21 @@
        "values" and "functions" after a package is loaded.
      - all words that appear in the worksheet
      - and a list of maxima's builtin commands.
+
+   CompleteSymbol() doesn't search these lists, but a sorted copy of them
+   without duplicates that is replaced as a whole every time a list changes:
+   This way finding all words that start with a given prefix is a binary search
+   and doesn't need to wait for the background tasks that add words.
+
+   If Configuration::FuzzyAutocomplete() is set commands and units are also
+   offered if they contain the typed letters in the right order or if they
+   differ from what was typed by a typo. The results are then ranked by how well
+   they match and by how often the symbol was used.
  */
 class AutoComplete
 {
   WX_DECLARE_STRING_HASH_MAP(int, WorksheetWords);
+  WX_DECLARE_HASH_SET(wxString, wxStringHash, wxStringEqual, WordSet);
 
 public:
   //! All types of things we can autocomplete
@@ -100,14 +115,120 @@ public:
   //! Clear the list of files demo() can be applied on
   void ClearDemofileList();
   
-  //! Returns a list of possible autocompletions for the string "partial"
+  /*! Counts how often the symbols in a command that was sent to maxima are used
+
+    Symbols that are used often are ranked higher by fuzzy autocompletion.
+   */
+  void AddUsage(wxString command);
+
+  /*! Returns a list of possible autocompletions for the string "partial"
+
+    If words start with partial the list contains only these, sorted
+    alphabetically. Else, if fuzzy autocompletion is enabled, it contains the
+    words that match partial best, sorted by how well they match.
+   */
   wxArrayString CompleteSymbol(wxString partial, autoCompletionType type = command);
   //! Basically runs a regex over templates
   static wxString FixTemplate(wxString templ);
 
+  /*! Measures how fast symbol lists from maxima are added and completions are found
+
+    Adds a generated list of 50000 symbols and 10000 templates, a part of them
+    twice, and prints the time this took and the time a fuzzy completion takes.
+    \return false, if the duplicates weren't dropped or the fuzzy search has
+            missed a match.
+   */
+  static bool Benchmark();
+
 private:
-  //! An AddSymbol that doesn't wait for background tasks to finish
-  void AddSymbol_nowait(wxString fun, autoCompletionType type = command);
+  /*! An AddSymbol that doesn't wait for background tasks to finish
+
+    \return The list the symbol was added to
+   */
+  autoCompletionType AddSymbol_nowait(wxString fun, autoCompletionType type = command);
+
+  //! A sorted list of words without duplicates, with what the fuzzy search needs to know about them
+  class SortedWords : public wxArrayString
+  {
+  public:
+    //! The LetterMask() of each word
+    std::vector<wxUint64> letters;
+  };
+  //! A SortedWords list that is never changed once it is published
+  typedef std::shared_ptr<const SortedWords> WordIndex;
+  //! Creates the sorted list of words without duplicates CompleteSymbol() searches in
+  static WordIndex CreateIndex(wxArrayString words);
+  //! Replaces the index of m_wordList[type]. The caller must hold the lock for that list.
+  void UpdateIndex(autoCompletionType type);
+  /*! Replaces the index of m_wordList[type] by one that contains word, too
+
+    Doesn't sort the index again. The caller must hold the lock for that list.
+   */
+  void InsertIntoIndex(autoCompletionType type, const wxString &word);
+  //! Appends all words from index that start with partial to matches
+  static void AppendPrefixMatches(const wxArrayString &index, const wxString &partial,
+                                  wxArrayString &matches);
+
+  //! A word and how well it matches what the user has typed
+  struct ScoredWord
+  {
+    ScoredWord(int score_, const wxString &word_) : score(score_), word(word_) {}
+    int score;
+    wxString word;
+  };
+
+  //! The score fuzzy matches that start with the word the user has typed get
+  static const int m_prefixScore = 3000;
+  //! The score fuzzy matches that contain the typed letters in the right order get
+  static const int m_subsequenceScore = 2000;
+  //! The score fuzzy matches that differ from the typed word by a typo get
+  static const int m_typoScore = 1000;
+  //! How many fuzzy matches that don't start with the typed word we offer
+  static const size_t m_maxFuzzyMatches = 100;
+
+  /*! Returns how well word matches partial
+
+    \param word The word that might be offered as completion
+    \param partial What the user has typed
+    \param ignoreCase true = upper- and lowercase letters are the same thing
+    \return The score, or -1 if word doesn't match at all.
+   */
+  static int FuzzyScore(const wxString &word, const wxString &partial, bool ignoreCase);
+
+  /*! Which letters a word contains, ignoring their case and how often they appear
+
+    A word can only contain the letters of partial in the right order if its
+    mask contains all bits of partial's mask => AppendFuzzyMatches() scores
+    only the words that pass this test or that are candidates for a typo.
+   */
+  static wxUint64 LetterMask(const wxString &word);
+
+  /*! The number of edits that turn partial into the beginning of word
+
+    Insertions, deletions, replacements and swapping two adjacent letters
+    each count as one edit.
+    \return The number of edits, or maxEdits + 1, if more than maxEdits are needed.
+   */
+  static int PrefixEditDistance(const wxString &word, const wxString &partial,
+                                bool ignoreCase, int maxEdits);
+
+  //! Appends all words of index that match partial to matches
+  void AppendFuzzyMatches(const SortedWords &index, const wxString &partial,
+                          std::vector<ScoredWord> &matches);
+
+  //! Sorts the matches by their score and drops duplicates and all but the best matches
+  static wxArrayString RankFuzzyMatches(std::vector<ScoredWord> &matches);
+
+  //! Updates m_worksheetWordIndex, if the worksheet words have changed
+  void UpdateWorksheetWordIndex();
+
+  /*! What makes two templates duplicates: The function name and the number of arguments
+
+    For a given function and argument count we only keep one template.
+   */
+  static wxString TemplateSignature(const wxString &templ);
+  //! Recreates m_knownWords and m_knownTemplates from the word lists
+  void UpdateKnownWords();
   //! The configuration storage
   Configuration *m_configuration;
   //! Loads the list of loadable files and can be run in a background task
@@ -121,6 +242,52 @@ private:
   wxArrayString m_builtInLoadFiles;
   //! The list of demo files maxima provides
   wxArrayString m_builtInDemoFiles;
+  //! The directory UpdateLoadFiles() has read last and the prefix it has used
+  wxString m_loadFilesDir;
+  //! When m_loadFilesDir was modified last when it was read
+  time_t m_loadFilesDirModified;
+  //! The directory UpdateDemoFiles() has read last and the prefix it has used
+  wxString m_demoFilesDir;
+  //! When m_demoFilesDir was modified last when it was read
+  time_t m_demoFilesDirModified;
+
+  //! The loadable and demo files directly in a directory of maxima's
+  struct FileDirectory
+  {
+    FileDirectory() : modified(0) {}
+    //! When the directory was modified last [seconds since the epoch]. 0 = unknown.
+    time_t modified;
+    //! The names of the loadable files, in the format the load file list uses
+    wxArrayString loadFiles;
+    //! The names of the demo files, in the format the demo file list uses
+    wxArrayString demoFiles;
+    //! The full paths of the subdirectories
+    wxArrayString subdirs;
+  };
+  WX_DECLARE_STRING_HASH_MAP(FileDirectory, FileDirectories);
+
+  /*! Adds a directory and all of its subdirectories to dirs
+
+    Traversing maxima's share directory on every startup can take seconds.
+    Therefore the directories are cached on disk and a directory is only read
+    again if it has been modified since it was cached.
+    \param dir The directory
+    \param cache The directories as they were cached
+    \param dirs The directories we have found this time
+    \param dirsRead Is increased by the number of directories that had to be read
+   */
+  static void ScanFileDirectory(const wxString &dir, const FileDirectories &cache,
+                                FileDirectories &dirs, long &dirsRead);
+  //! Reads the cache ScanFileDirectory() uses. Returns an empty cache, if it cannot be read.
+  static FileDirectories ReadFileCache(const wxString &file);
+  //! Writes the cache ScanFileDirectory() uses
+  static void WriteFileCache(const wxString &file, const FileDirectories &dirs);
+  //! When a directory was modified last [seconds since the epoch], or 0, if it doesn't exist.
+  static time_t DirModificationTime(const wxString &dir);
+  //! Is this one of the directories we don't search for loadable files?
+  static bool IgnoredDirectory(const wxString &dirname);
+  //! The first line of the file ReadFileCache() reads
+  static const wxString m_fileCacheHeader;
 
   //! Scans the maxima directory for a list of loadable files
   class GetGeneralFiles : public wxDirTraverser
@@ -176,12 +343,7 @@ private:
       }
     virtual wxDirTraverseResult OnDir(const wxString& dirname) override
       {
-        if((dirname.EndsWith(".git")) ||
-           (dirname.EndsWith("/share/share")) ||
-           (dirname.EndsWith("/src/src")) ||
-           (dirname.EndsWith("/doc/doc")) ||
-           (dirname.EndsWith("/interfaces/interfaces"))
-          )
+        if(IgnoredDirectory(dirname))
           return wxDIR_STOP;
         else
           return wxDIR_CONTINUE;
@@ -229,12 +391,7 @@ private:
       }
     virtual wxDirTraverseResult OnDir(const wxString& dirname) override
       {
-        if((dirname.EndsWith(".git")) ||
-           (dirname.EndsWith("/share/share")) ||
-           (dirname.EndsWith("/src/src")) ||
-           (dirname.EndsWith("/doc/doc")) ||
-           (dirname.EndsWith("/interfaces/interfaces"))
-          )
+        if(IgnoredDirectory(dirname))
           return wxDIR_STOP;
         else
           return wxDIR_CONTINUE;
@@ -264,8 +421,25 @@ private:
 
   //! The lists of autocompletible symbols for the classes defined in autoCompletionType
   wxArrayString m_wordList[7];
+  //! The sorted and duplicate-free versions of m_wordList. Accessed by std::atomic_load/store only.
+  WordIndex m_wordIndex[7];
+  //! The words of m_wordList[command] and m_wordList[unit] so AddSymbol_nowait() finds duplicates fast
+  WordSet m_knownWords[7];
+  //! The TemplateSignature()s of m_wordList[tmplte]
+  WordSet m_knownTemplates;
   static wxRegEx m_args;
   WorksheetWords m_worksheetWords;
+  //! The sorted version of m_worksheetWords. Accessed by std::atomic_load/store only.
+  WordIndex m_worksheetWordIndex;
+  //! Has m_worksheetWords changed since m_worksheetWordIndex was created?
+  std::atomic<bool> m_worksheetWordsChanged;
+  //! How often each symbol has been used in commands that were sent to maxima
+  WorksheetWords m_usage;
+  /*! How often each word appears in the worksheet, as of m_worksheetWordIndex
+
+    Only accessed by CompleteSymbol().
+   */
+  WorksheetWords m_worksheetWordUsage;
 };
 
 #endif // AUTOCOMPLETE_H
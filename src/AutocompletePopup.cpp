@@ -37,8 +37,8 @@
 
 void AutocompletePopup::UpdateResults()
 {
+  // The completions are already sorted, either alphabetically or by how well they match.
   m_completions = m_autocomplete->CompleteSymbol(m_partial, m_type);
-  m_completions.Sort();
 
   switch (m_completions.GetCount())
   {
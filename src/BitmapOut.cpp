@@ -289,7 +289,7 @@ void BitmapOut::Draw()
   m_ppi.y *= m_scale;
 }
 
-wxSize BitmapOut::ToFile(wxString file)
+wxImage BitmapOut::GetImage() const
 {
   // Assign an resolution to the bitmap.
   wxImage img = m_bmp.ConvertToImage();
@@ -297,6 +297,17 @@ wxSize BitmapOut::ToFile(wxString file)
   if (resolution <= 0)
     resolution = 75;
   img.SetOption(wxIMAGE_OPTION_RESOLUTION, resolution * m_scale);
+  return img;
+}
+
+wxSize BitmapOut::GetRealSize() const
+{
+  return wxSize(GetRealWidth(), GetRealHeight());
+}
+
+wxSize BitmapOut::ToFile(wxString file)
+{
+  wxImage img = GetImage();
 
   bool success = false;
   if (file.Right(4) == wxT(".bmp"))
@@ -312,19 +323,10 @@ wxSize BitmapOut::ToFile(wxString file)
     success = img.SaveFile(file, wxBITMAP_TYPE_PNG);
   }
 
-  wxSize retval;
   if (success)
-  {
-    retval.x = GetRealWidth();
-    retval.y = GetRealHeight();
-    return retval;
-  }
+    return GetRealSize();
   else
-  {
-    retval.x = -1;
-    retval.y = -1;
-    return retval;
-  };
+    return wxSize(-1, -1);
 }
 
 bool BitmapOut::ToClipboard()
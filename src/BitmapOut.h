@@ -65,6 +65,16 @@ public:
    */
   wxSize ToFile(wxString file);
 
+  /*! Returns the image ToFile() would write, with the resolution already set
+
+    Encoding the image doesn't need the worksheet any more and therefore can be
+    done in a background task.
+   */
+  wxImage GetImage() const;
+
+  //! The size ToFile() returns if it succeeds
+  wxSize GetRealSize() const;
+
   //! Returns the bitmap representation of the list of cells that was passed to SetData()
   wxBitmap GetBitmap() const
   { return m_bmp; }
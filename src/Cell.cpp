@@ -76,7 +76,7 @@ Cell::Cell(Cell *group, Configuration **config, CellPointers *cellPointers)
   m_width = -1;
   m_height = -1;
   m_center = -1;
-  SoftLineBreak(false);
+  m_breakLine = false;
   m_breakPage = false;
   m_forceBreakLine = false;
   m_bigSkip = false;
@@ -263,8 +263,7 @@ void Cell::AppendCell(Cell *p_next)
 {
   if (p_next == NULL)
     return;
-  m_maxDrop = -1;
-  m_maxCenter = -1;
+  InvalidateLineMetrics();
 
   // Search the last cell in the list
   Cell *LastInList = this;
@@ -279,6 +278,8 @@ void Cell::AppendCell(Cell *p_next)
   Cell *LastToDraw = LastInList;
   while (LastToDraw->m_nextToDraw != NULL)
     LastToDraw = LastToDraw->m_nextToDraw;
+  // The last line of this list grows.
+  LastToDraw->InvalidateLineMetrics();
 
   // Append p_next to this list.
   LastToDraw->m_nextToDraw = p_next;
@@ -295,20 +296,71 @@ Cell *Cell::GetGroup()
  */
 int Cell::GetCenterList()
 {
-  if ((m_maxCenter < 0) || ((*m_configuration)->RecalculationForce()))
+  if (!LineMetricsValid())
+    UpdateLineMetrics();
+  return m_maxCenter;
+}
+
+bool Cell::LineMetricsValid() const
+{
+  return (m_lineBox != NULL) && (m_lineBox->valid) && (m_maxCenter >= 0) && (m_maxDrop >= 0);
+}
+
+void Cell::UpdateLineMetrics()
+{
+  // Collect the cells between this one and the end of the line. If we meet a
+  // cell whose metrics are still valid it already knows the metrics of the
+  // rest of the line.
+  std::vector<Cell *> cells;
+  Cell *tmp = this;
+  while ((tmp != NULL) && ((tmp == this) || (!tmp->m_breakLine)) &&
+         ((tmp == this) || (!tmp->LineMetricsValid())))
   {
-    Cell *tmp = this;
-    m_maxCenter  = 0;
-    while (tmp != NULL)
+    cells.push_back(tmp);
+    tmp = tmp->m_nextToDraw;
+  }
+
+  int maxCenter = 0;
+  int maxDrop = 0;
+  std::shared_ptr<LineBox> lineBox;
+  if ((tmp != NULL) && (!tmp->m_breakLine))
+  {
+    maxCenter = tmp->m_maxCenter;
+    maxDrop = tmp->m_maxDrop;
+    lineBox = tmp->m_lineBox;
+  }
+  else
+  {
+    lineBox = std::make_shared<LineBox>();
+    if (tmp != NULL)
+      tmp->m_endedLineBox = lineBox;
+  }
+
+  // Each cell caches the metrics of the part of the line that starts with it
+  for (std::vector<Cell *>::reverse_iterator it = cells.rbegin(); it != cells.rend(); ++it)
+  {
+    if (!(*it)->m_isBrokenIntoLines)
     {
-      if ((tmp != this) && (tmp->m_breakLine))
-        break;
-      if(!tmp->m_isBrokenIntoLines)
-        m_maxCenter = wxMax(m_maxCenter, tmp->m_center);
-      tmp = tmp->m_nextToDraw;
+      maxCenter = wxMax(maxCenter, (*it)->m_center);
+      maxDrop = wxMax(maxDrop, (*it)->m_height - (*it)->m_center);
     }
+    (*it)->m_maxCenter = maxCenter;
+    (*it)->m_maxDrop = maxDrop;
+    (*it)->m_lineBox = lineBox;
   }
-  return m_maxCenter;
+}
+
+void Cell::InvalidateLineMetrics()
+{
+  m_maxCenter = -1;
+  m_maxDrop = -1;
+  if (m_lineBox)
+    m_lineBox->valid = false;
+  m_lineBox.reset();
+  // If this cell starts a line the end of the previous line might change, too.
+  if (m_endedLineBox)
+    m_endedLineBox->valid = false;
+  m_endedLineBox.reset();
 }
 
 bool Cell::NeedsRecalculation(int fontSize)
@@ -329,19 +381,8 @@ bool Cell::NeedsRecalculation(int fontSize)
  */
 int Cell::GetMaxDrop()
 {
-//  if ((m_maxDrop < 0) || ((*m_configuration)->RecalculationForce()))
-  {
-    m_maxDrop = 0;
-    Cell *tmp = this;
-    while (tmp != NULL)
-    {
-      if ((tmp != this) && (tmp->m_breakLine))
-        break;
-      if(!tmp->m_isBrokenIntoLines)
-        m_maxDrop = wxMax(m_maxDrop, tmp->m_height - tmp->m_center);
-      tmp = tmp->m_nextToDraw;
-    }
-  }
+  if (!LineMetricsValid())
+    UpdateLineMetrics();
   return m_maxDrop;
 }
 
@@ -1166,8 +1207,7 @@ void Cell::ResetData()
 {
   m_fullWidth = -1;
   m_lineWidth = -1;
-  m_maxCenter = -1;
-  m_maxDrop   = -1;
+  InvalidateLineMetrics();
   std::list<std::shared_ptr<Cell>> cellList = GetInnerCells();
   for (std::list<std::shared_ptr<Cell>>::const_iterator it = cellList.begin(); it != cellList.end(); ++it)
     {
@@ -1522,6 +1562,9 @@ Cell::CellPointers::CellPointers(wxScrolledCanvas *mathCtrl)
   m_selectionStart = NULL;
   m_selectionEnd = NULL;
   m_currentTextCell = NULL;
+  m_groupIndexOutdated = true;
+  m_lookalikeIndexOutdated = true;
+  m_lookalikeIndexGeneration = 0;
 }
 
 wxString Cell::CellPointers::WXMXGetNewFileName()
@@ -1531,6 +1574,22 @@ wxString Cell::CellPointers::WXMXGetNewFileName()
   return file;
 }
 
+void Cell::CellPointers::WXMXAddFile(const wxString &name, const wxMemoryBuffer &data)
+{
+  // wxMemoryBuffer shares its data between copies without locking => make a
+  // copy that is owned by the file list alone.
+  std::shared_ptr<wxMemoryBuffer> contents(new wxMemoryBuffer(data.GetDataLen()));
+  contents->AppendData(data.GetData(), data.GetDataLen());
+  m_wxmxFiles.push_back(WXMXFile(name, contents));
+}
+
+Cell::CellPointers::WXMXFileList Cell::CellPointers::WXMXTakeFiles()
+{
+  WXMXFileList files;
+  files.swap(m_wxmxFiles);
+  return files;
+}
+
 bool Cell::CellPointers::ErrorList::Contains(Cell *cell)
 {
   for(std::list<Cell *>::const_iterator it = m_errorList.begin(); it != m_errorList.end();++it)
@@ -39,6 +39,7 @@
 #include "Configuration.h"
 #include "TextStyle.h"
 #include <memory>
+#include <vector>
 
 /*! The supported types of math cells
  */
@@ -148,6 +149,21 @@ class Cell
     int WXMXImageCount() const
       { return m_wxmxImgCounter; }
 
+    /*! A file ToXML() wants to be stored in the .wxmx archive, along with its contents
+
+      The contents is a copy that isn't shared with any cell so it can be
+      written to the disk by a background task.
+    */
+    typedef std::pair<wxString, std::shared_ptr<const wxMemoryBuffer>> WXMXFile;
+    //! A list of files ToXML() wants to be stored in the .wxmx archive
+    typedef std::vector<WXMXFile> WXMXFileList;
+
+    //! Add a file to the list of files the .wxmx archive needs to contain
+    void WXMXAddFile(const wxString &name, const wxMemoryBuffer &data);
+
+    //! Returns all files WXMXAddFile() has collected and empties this list
+    WXMXFileList WXMXTakeFiles();
+
     //! A list of editor cells containing error messages.
     class ErrorList
     {
@@ -251,6 +267,29 @@ class Cell
     Cell *m_selectionEnd;
     WX_DECLARE_VOIDPTR_HASH_MAP( int, SlideShowTimersList);
     SlideShowTimersList m_slideShowTimers;
+    /*! The LazyCells that have been scrolled into view
+
+      The worksheet parses the next part of their contents in the idle loop.
+    */
+    std::list<Cell *> m_lazyCellsToExpand;
+    /*! Has the list of GroupCells changed since the worksheet has last indexed it?
+
+      Is also set if a GroupCell has changed its height, which means that the
+      GroupCells below it have to be moved.
+    */
+    bool m_groupIndexOutdated;
+    /*! Have the GroupCells or the names they contain changed since the worksheet
+      has last searched for lookalike names in different cells?
+    */
+    bool m_lookalikeIndexOutdated;
+    /*! The GroupCells whose names have changed since the worksheet has last
+      searched for lookalike names in different cells
+
+      Only these cells are re-indexed unless m_lookalikeIndexOutdated is set.
+    */
+    std::list<Cell *> m_lookalikeGroupsChanged;
+    //! Is increased every time the worksheet rebuilds its lookalike index from scratch
+    long m_lookalikeIndexGeneration;
 
     wxScrolledCanvas *GetMathCtrl(){return m_mathCtrl;}
 
@@ -263,6 +302,8 @@ class Cell
     wxScrolledCanvas *m_mathCtrl;
     //! The image counter for saving .wxmx files
     int m_wxmxImgCounter;
+    //! The files WXMXAddFile() has collected
+    WXMXFileList m_wxmxFiles;
   };
 
 
@@ -350,7 +391,11 @@ class Cell
 
   //! Do we want this cell to start with a linebreak?
   void SoftLineBreak(bool breakLine = true)
-  { m_breakLine = breakLine; }
+  {
+    if (m_breakLine != breakLine)
+      InvalidateLineMetrics();
+    m_breakLine = breakLine;
+  }
 
   //! Does this cell to start with a linebreak?
   bool LineBreakAtBeginning() const
@@ -449,7 +494,10 @@ class Cell
      - false: Remove the forced linebreak
    */
   void ForceBreakLine(bool force = true)
-  { m_forceBreakLine = m_breakLine = force; }
+  {
+    SoftLineBreak(force);
+    m_forceBreakLine = force;
+  }
 
   /*! Get the height of this cell
 
@@ -596,7 +644,10 @@ class Cell
 
   //! Mark the cached height information as "to be calculated".
   void ResetSize()
-  { m_width = m_height = m_center = m_maxCenter = m_maxDrop = m_fullWidth = m_lineWidth = -1; }
+  {
+    m_width = m_height = m_center = m_fullWidth = m_lineWidth = -1;
+    InvalidateLineMetrics();
+  }
 
   //! Mark the cached height information of the whole list of cells as "to be calculated".
   void ResetSizeList();
@@ -1049,8 +1100,33 @@ protected:
   */
   int m_lineWidth;
   int m_center;
+  //! The maximum center of the part of the line that starts with this cell. See m_lineBox.
   int m_maxCenter;
+  //! The maximum drop of the part of the line that starts with this cell. See m_lineBox.
   int m_maxDrop;
+
+  /*! The line of cells m_maxCenter and m_maxDrop have been calculated for
+
+    All cells of a line share one LineBox so a change of any of them can mark
+    the metrics of the whole line as outdated at once: Calculating them anew for
+    every cell would make the layout of long lines quadratic.
+   */
+  struct LineBox
+  {
+    LineBox() : valid(true) {}
+    //! false = a cell of the line has changed since the line was measured
+    bool valid;
+  };
+  //! The line this cell is part of, or NULL, if it hasn't been measured yet
+  std::shared_ptr<LineBox> m_lineBox;
+  //! The line that ends before this cell, as far as it has been measured
+  std::shared_ptr<LineBox> m_endedLineBox;
+  //! Are m_maxCenter and m_maxDrop up to date?
+  bool LineMetricsValid() const;
+  //! Calculate m_maxCenter and m_maxDrop for this cell and the rest of its line
+  void UpdateLineMetrics();
+  //! Mark m_maxCenter and m_maxDrop of the line(s) this cell influences as outdated
+  void InvalidateLineMetrics();
   CellType m_type;
   TextStyle m_textStyle;
   //! The font size is smaller in super- and subscripts.
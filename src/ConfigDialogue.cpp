@@ -319,6 +319,8 @@ void ConfigDialogue::SetProperties()
           _("The default height for embedded plots. Can be read out or overridden by the maxima variable wxplot_size."));
   m_displayedDigits->SetToolTip(
           _("If numbers are getting longer than this number of digits they will be displayed abbreviated by an ellipsis."));
+  m_imageCacheMegabytes->SetToolTip(
+          _("How much memory the images that are displayed on the worksheet may occupy. If they need more the ones that weren't displayed for the longest time are decoded again when they are needed."));
   m_AnimateLaTeX->SetToolTip(
           _("Some PDF viewers are able to display moving images and wxMaxima is able to output them. If this option is selected additional LaTeX packages might be needed in order to compile the output, though."));
   m_TeXExponentsAfterSubscript->SetToolTip(
@@ -344,7 +346,7 @@ void ConfigDialogue::SetProperties()
           _("Try to antialias lines (which allows to move them by a fraction of a pixel, but reduces their sharpness)."));
   m_matchParens->SetToolTip(
           _("Automatically insert matching parenthesis in text controls. Automatic highlighting of matching parenthesis can be suppressed by setting the respective color to match the background of ordinary text."));
-  m_showLength->SetToolTip(_("Show long expressions in wxMaxima document."));
+  m_showLength->SetToolTip(_("How much of a long expression to display at once. The rest of the expression is displayed as soon as it is scrolled into view."));
   m_autosubscript->SetToolTip(
           _("false=Don't generate subscripts\ntrue=Automatically convert underscores to subscript markers if the would-be subscript is a number or a single letter\nall=_ marks subscripts."));
   m_language->SetToolTip(_("Language used for wxMaxima GUI."));
@@ -354,6 +356,7 @@ void ConfigDialogue::SetProperties()
   m_documentclassOptions->SetToolTip(_("The options the document class LaTeX is instructed to use for our documents gets."));
   m_fixedFontInTC->SetToolTip(_("Set fixed font in text controls."));
   m_offerKnownAnswers->SetToolTip(_("wxMaxima remembers the answers to maxima's questions. If this checkbox is set it automatically offers to enter the last answer to this question the user has input."));
+  m_fuzzyAutocomplete->SetToolTip(_("If this checkbox is set and no symbol begins with the typed letters autocompletion offers symbols that contain the typed letters in the right order or that differ from what was typed by a typo. Symbols that are used often are offered first."));
   m_getFont->SetToolTip(_("Font used for display in document."));
   m_getMathFont->SetToolTip(_("Font used for displaying math characters in document."));
   m_changeAsterisk->SetToolTip(_("Use centered dot and Minus, not Star and Hyphen"));
@@ -475,6 +478,7 @@ void ConfigDialogue::SetProperties()
   m_notifyIfIdle->SetValue(configuration->NotifyIfIdle());
   m_fixedFontInTC->SetValue(fixedFontTC);
   m_offerKnownAnswers->SetValue(m_configuration->OfferKnownAnswers());
+  m_fuzzyAutocomplete->SetValue(m_configuration->FuzzyAutocomplete());
   m_useJSMath->SetValue(usejsmath);
   m_keepPercentWithSpecials->SetValue(keepPercent);
   m_abortOnError->SetValue(configuration->GetAbortOnError());
@@ -483,6 +487,7 @@ void ConfigDialogue::SetProperties()
   m_defaultPlotWidth->SetValue(defaultPlotWidth);
   m_defaultPlotHeight->SetValue(defaultPlotHeight);
   m_displayedDigits->SetValue(configuration->GetDisplayedDigits());
+  m_imageCacheMegabytes->SetValue(configuration->ImageCacheMegabytes());
   m_symbolPaneAdditionalChars->SetValue(configuration->SymbolPaneAdditionalChars());
   if (m_styleFor->GetSelection() >= 14 && m_styleFor->GetSelection() <= 18)
     m_getStyleFont->Enable(true);
@@ -525,6 +530,12 @@ wxPanel *ConfigDialogue::CreateWorksheetPanel()
   grid_sizer->Add(dd, 0, wxALL | wxALIGN_CENTER_VERTICAL, 5);
   grid_sizer->Add(m_displayedDigits, 0, wxALL | wxALIGN_CENTER_VERTICAL, 5);
 
+  wxStaticText *icm = new wxStaticText(panel, -1, _("Memory for displaying images (MB):"));
+  m_imageCacheMegabytes = new wxSpinCtrl(panel, -1, wxEmptyString, wxDefaultPosition, wxSize(150*GetContentScaleFactor(), -1), wxSP_ARROW_KEYS, 16,
+                                         65536);
+  grid_sizer->Add(icm, 0, wxALL | wxALIGN_CENTER_VERTICAL, 5);
+  grid_sizer->Add(m_imageCacheMegabytes, 0, wxALL | wxALIGN_CENTER_VERTICAL, 5);
+
   wxStaticText *sl = new wxStaticText(panel, -1, _("Show long expressions:"));
   grid_sizer->Add(sl, 0, wxALL | wxALIGN_CENTER_VERTICAL, 5);
   wxArrayString showLengths;
@@ -613,6 +624,9 @@ wxPanel *ConfigDialogue::CreateWorksheetPanel()
 
   m_offerKnownAnswers = new wxCheckBox(panel, -1, _("Offer known answers"));
   vsizer->Add(m_offerKnownAnswers, 0, wxALL, 5);
+
+  m_fuzzyAutocomplete = new wxCheckBox(panel, -1, _("Fuzzy autocompletion"));
+  vsizer->Add(m_fuzzyAutocomplete, 0, wxALL, 5);
   
   vsizer->AddGrowableRow(10);
   panel->SetSizer(vsizer);
@@ -1162,6 +1176,7 @@ void ConfigDialogue::WriteSettings()
   configuration->SetAutosubscript_Num(m_autosubscript->GetSelection());
   config->Write(wxT("fixedFontTC"), m_fixedFontInTC->GetValue());
   configuration->OfferKnownAnswers(m_offerKnownAnswers->GetValue());
+  configuration->FuzzyAutocomplete(m_fuzzyAutocomplete->GetValue());
   configuration->SetChangeAsterisk(m_changeAsterisk->GetValue());
   configuration->HidemultiplicationSign(m_hidemultiplicationSign->GetValue());
   configuration->Latin2Greek(m_latin2Greek->GetValue());
@@ -1191,6 +1206,7 @@ void ConfigDialogue::WriteSettings()
   config->Write(wxT("defaultPlotWidth"), m_defaultPlotWidth->GetValue());
   config->Write(wxT("defaultPlotHeight"), m_defaultPlotHeight->GetValue());
   configuration->SetDisplayedDigits(m_displayedDigits->GetValue());
+  configuration->ImageCacheMegabytes(m_imageCacheMegabytes->GetValue());
   config->Write(wxT("AnimateLaTeX"), m_AnimateLaTeX->GetValue());
   config->Write(wxT("TeXExponentsAfterSubscript"), m_TeXExponentsAfterSubscript->GetValue());
   config->Write(wxT("usePartialForDiff"), m_usePartialForDiff->GetValue());
@@ -268,6 +268,7 @@ protected:
   wxTextCtrl *m_symbolPaneAdditionalChars;
   wxCheckBox *m_abortOnError;
   wxCheckBox *m_offerKnownAnswers;
+  wxCheckBox *m_fuzzyAutocomplete;
   wxCheckBox *m_restartOnReEvaluation;
   wxCheckBox *m_wrapLatexMath;
   wxCheckBox *m_savePanes;
@@ -277,6 +278,8 @@ protected:
   wxSpinCtrl *m_defaultPlotWidth;
   wxSpinCtrl *m_defaultPlotHeight;
   wxSpinCtrl *m_displayedDigits;
+  //! How much memory the scaled bitmaps of the images may use
+  wxSpinCtrl *m_imageCacheMegabytes;
   //! A checkbox that allows to select if the LaTeX file should contain animations.
   wxCheckBox *m_AnimateLaTeX;
   //! A checkbox that asks if TeX should put the exponents above or after the subscripts.
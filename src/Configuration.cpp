@@ -42,6 +42,12 @@ Configuration::Configuration(wxDC *dc) :
   m_documentclassOptions("fleqn"),
   m_symbolPaneAdditionalChars("Øü§")
 {
+  m_fontCacheHits = 0;
+  m_fontCacheMisses = 0;
+  m_textExtentCacheSize = 0;
+  m_currentTextExtents = NULL;
+  m_textExtentCacheHits = 0;
+  m_textExtentCacheMisses = 0;
   SetBackgroundBrush(*wxWHITE_BRUSH);
   m_hidemultiplicationsign = true;
   m_autoSaveAsTempFile = false;
@@ -98,8 +104,10 @@ Configuration::Configuration(wxDC *dc) :
   m_copySVG = true;
   m_copyEMF = false;
   m_showLength = 2;
+  m_imageCacheMegabytes = 256;
   m_useUnicodeMaths = true;
   m_offerKnownAnswers = true;
+  m_fuzzyAutocomplete = true;
   m_escCodes["pm"]    = wxT("\u00B1");
   m_escCodes["+/-"]   = wxT("\u00B1");
   m_escCodes["alpha"] = wxT("\u03B1");
@@ -365,6 +373,7 @@ void Configuration::ReadConfig()
     m_autoSaveAsTempFile = (autoSaveMinutes == 0);
   }
   config->Read("offerKnownAnswers", &m_offerKnownAnswers);
+  config->Read("fuzzyAutocomplete", &m_fuzzyAutocomplete);
   config->Read(wxT("documentclass"), &m_documentclass);
   config->Read(wxT("documentclassoptions"), &m_documentclassOptions);
   config->Read(wxT("latin2greek"), &m_latin2greek);
@@ -391,6 +400,9 @@ void Configuration::ReadConfig()
   config->Read("defaultPort",&m_defaultPort);
   config->Read(wxT("fixReorderedIndices"), &m_fixReorderedIndices);
   config->Read(wxT("showLength"), &m_showLength);
+  config->Read(wxT("imageCacheMegabytes"), &m_imageCacheMegabytes);
+  if (m_imageCacheMegabytes < 16)
+    m_imageCacheMegabytes = 16;
   config->Read(wxT("printScale"), &m_printScale);
   config->Read(wxT("useSVG"), &m_useSVG);
   config->Read(wxT("copyBitmap"), &m_copyBitmap);
@@ -460,6 +472,82 @@ void Configuration::ReadConfig()
 }
 
 wxFont Configuration::GetFont(TextStyle textStyle, int fontSize) const
+{
+  FontKey key;
+  key.style = textStyle;
+  key.fontSize = fontSize;
+  key.zoomFactor = GetZoomFactor();
+
+  std::map<FontKey, FontList::iterator>::iterator cached = m_fontCacheIndex.find(key);
+  if (cached != m_fontCacheIndex.end())
+  {
+    m_fontCacheHits++;
+    // Mark the font as the most recently used one
+    m_fontCache.splice(m_fontCache.begin(), m_fontCache, cached->second);
+    return cached->second->second;
+  }
+
+  m_fontCacheMisses++;
+  wxFont font = BuildFont(textStyle, fontSize);
+  m_fontCache.push_front(std::make_pair(key, font));
+  m_fontCacheIndex[key] = m_fontCache.begin();
+  if (m_fontCache.size() > FONT_CACHE_SIZE)
+  {
+    m_fontCacheIndex.erase(m_fontCache.back().first);
+    m_fontCache.pop_back();
+  }
+  return font;
+}
+
+void Configuration::ClearFontCache()
+{
+  m_fontCache.clear();
+  m_fontCacheIndex.clear();
+}
+
+wxSize Configuration::GetTextExtent(const wxString &text)
+{
+  wxDC *dc = GetDC();
+  wxFont font = dc->GetFont();
+
+  // Most of the time we are asked for many texts in a row that all use the same
+  // font object => only look up the list of sizes for this font if the font has changed.
+  if ((m_currentTextExtents == NULL) || (!font.IsSameAs(m_textExtentFont)))
+  {
+    m_textExtentFont = font;
+    m_currentTextExtents = &m_textExtents[font.GetNativeFontInfoDesc()];
+  }
+
+  TextExtentHash::const_iterator it = m_currentTextExtents->find(text);
+  if (it != m_currentTextExtents->end())
+  {
+    m_textExtentCacheHits++;
+    return it->second;
+  }
+
+  // Ask wxWidgets to return this text piece's size (slow, but the only way if
+  // there is no cached size).
+  m_textExtentCacheMisses++;
+  wxSize sz = dc->GetTextExtent(text);
+  if (m_textExtentCacheSize >= TEXT_EXTENT_CACHE_SIZE)
+  {
+    ClearTextExtentCache();
+    m_textExtentFont = font;
+    m_currentTextExtents = &m_textExtents[font.GetNativeFontInfoDesc()];
+  }
+  (*m_currentTextExtents)[text] = sz;
+  m_textExtentCacheSize++;
+  return sz;
+}
+
+void Configuration::ClearTextExtentCache()
+{
+  m_textExtents.clear();
+  m_textExtentCacheSize = 0;
+  m_currentTextExtents = NULL;
+}
+
+wxFont Configuration::BuildFont(TextStyle textStyle, int fontSize) const
 {
   wxString fontName;
   wxFontStyle fontStyle;
@@ -735,6 +823,7 @@ wxString Configuration::MaximaDefaultLocation()
 
 void Configuration::ReadStyles(wxString file)
 {
+  ClearFontCache();
   wxConfigBase *config = NULL;
   if (file == wxEmptyString)
     config = wxConfig::Get();
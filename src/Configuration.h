@@ -26,11 +26,17 @@
 #include <wx/config.h>
 #include <wx/display.h>
 #include <wx/fontenum.h>
+#include <list>
+#include <map>
 #include "LoggingMessageDialog.h"
 #include "TextStyle.h"
 
 #define MC_LINE_SKIP Scale_Px(2)
 #define MC_TEXT_PADDING Scale_Px(1)
+//! The maximum number of fonts Configuration::GetFont() keeps cached
+#define FONT_CACHE_SIZE 256
+//! The maximum number of text extents Configuration::GetTextExtent() keeps cached
+#define TEXT_EXTENT_CACHE_SIZE 100000
 
 #define PAREN_OPEN_TOP_UNICODE     "\u239b"
 #define PAREN_OPEN_EXTEND_UNICODE  "\u239c"
@@ -264,6 +270,7 @@ public:
   void SetFontEncoding(wxFontEncoding encoding)
   {
     m_fontEncoding = encoding;
+    ClearFontCache();
   }
 
   int GetLabelWidth() const
@@ -347,7 +354,11 @@ public:
     {
       m_fontChanged = fontChanged;
       if(fontChanged)
+      {
         RecalculationForce(true);
+        ClearFontCache();
+        ClearTextExtentCache();
+      }
       m_charsInFontMap.clear();
     }
   
@@ -754,6 +765,13 @@ public:
     }
   int ShowLength() const {return m_showLength;}
 
+  //! How many megabytes the scaled bitmaps of all images may occupy together
+  int ImageCacheMegabytes() const {return m_imageCacheMegabytes;}
+  void ImageCacheMegabytes(int megabytes)
+    {
+      wxConfig::Get()->Write(wxT("imageCacheMegabytes"), m_imageCacheMegabytes = megabytes);
+    }
+
   //! Sets the default toolTip for new cells
   void SetDefaultCellToolTip(wxString defaultToolTip){m_defaultToolTip = defaultToolTip;}
   //! Gets the default toolTip for new cells
@@ -783,6 +801,29 @@ public:
    */
   wxFont GetFont(TextStyle textStyle, int fontSize) const;
 
+  //! Forget all fonts GetFont() has cached. Needed if the style settings have changed.
+  void ClearFontCache();
+  //! How many GetFont() calls since the last ResetFontCacheStatistics() were cache hits?
+  long GetFontCacheHits() const {return m_fontCacheHits;}
+  //! How many GetFont() calls since the last ResetFontCacheStatistics() had to create a font?
+  long GetFontCacheMisses() const {return m_fontCacheMisses;}
+  void ResetFontCacheStatistics(){m_fontCacheHits = m_fontCacheMisses = 0;}
+
+  /*! Determine the size of a text snippet in the font GetDC() is set to
+
+    Text extents are cached for all cells together: Snippets like "+", "x", "(%o1)"
+    or small numbers occur thousands of times in a typical worksheet, and 
+    asking wxWidgets for the size of a text is slow.
+   */
+  wxSize GetTextExtent(const wxString &text);
+  //! Forget all text extents GetTextExtent() has cached.
+  void ClearTextExtentCache();
+  //! How many GetTextExtent() calls since the last ResetTextExtentCacheStatistics() were cache hits?
+  long GetTextExtentCacheHits() const {return m_textExtentCacheHits;}
+  //! How many GetTextExtent() calls since the last ResetTextExtentCacheStatistics() had to measure the text?
+  long GetTextExtentCacheMisses() const {return m_textExtentCacheMisses;}
+  void ResetTextExtentCacheStatistics(){m_textExtentCacheHits = m_textExtentCacheMisses = 0;}
+
   //! Get the worksheet this configuration storage is valid for
   wxWindow *GetWorkSheet() const {return m_workSheet;}
   //! Set the worksheet this configuration storage is valid for
@@ -797,6 +838,11 @@ public:
   bool OfferKnownAnswers() const {return m_offerKnownAnswers;}
   void OfferKnownAnswers(bool offerKnownAnswers)
     {wxConfig::Get()->Write("offerKnownAnswers",m_offerKnownAnswers = offerKnownAnswers);}
+
+  //! Does autocompletion offer symbols that only approximately match what the user has typed?
+  bool FuzzyAutocomplete() const {return m_fuzzyAutocomplete;}
+  void FuzzyAutocomplete(bool fuzzy)
+    {wxConfig::Get()->Write("fuzzyAutocomplete",m_fuzzyAutocomplete = fuzzy);}
   
   wxString Documentclass() const {return m_documentclass;}
   void Documentclass(wxString clss){wxConfig::Get()->Write("documentclass",m_documentclass = clss);}
@@ -808,7 +854,7 @@ public:
   void HTMLequationFormat(htmlExportFormat HTMLequationFormat)
     {wxConfig::Get()->Write("HTMLequationFormat", (int) (m_htmlEquationFormat = HTMLequationFormat));}
 
-  void MathFontName(wxString name){m_mathFontName = name;}
+  void MathFontName(wxString name){m_mathFontName = name; ClearFontCache();}
   wxString MathFontName()const {return m_mathFontName;}
   //! Get the worksheet this configuration storage is valid for
   int GetAutosubscript_Num() const {return m_autoSubscript;}
@@ -865,6 +911,46 @@ private:
   bool CharsExistInFont(wxFont font, wxString char1, wxString char2, wxString char3);
   //! Caches the information on how to draw big parenthesis for GetParenthesisDrawMode().
   drawMode m_parenthesisDrawMode;
+  //! The properties that tell which font GetFont() returns
+  struct FontKey
+  {
+    int style;
+    int fontSize;
+    double zoomFactor;
+    bool operator<(const FontKey &other) const
+      {
+        if (style != other.style)
+          return style < other.style;
+        if (fontSize != other.fontSize)
+          return fontSize < other.fontSize;
+        return zoomFactor < other.zoomFactor;
+      }
+  };
+  typedef std::list<std::pair<FontKey, wxFont> > FontList;
+  /*! The fonts GetFont() has created, the most recently used one first.
+
+    Creating a wxFont is expensive and GetFont() is called for every cell on
+    every recalculation.
+   */
+  mutable FontList m_fontCache;
+  //! Allows to find the entry for a font in m_fontCache without traversing it
+  mutable std::map<FontKey, FontList::iterator> m_fontCacheIndex;
+  mutable long m_fontCacheHits;
+  mutable long m_fontCacheMisses;
+  //! Create the font GetFont() returns if it isn't in the cache, yet.
+  wxFont BuildFont(TextStyle textStyle, int fontSize) const;
+  WX_DECLARE_STRING_HASH_MAP(wxSize, TextExtentHash);
+  WX_DECLARE_STRING_HASH_MAP(TextExtentHash, FontTextExtentHash);
+  //! The text extents GetTextExtent() knows, one TextExtentHash per font
+  FontTextExtentHash m_textExtents;
+  //! The number of text extents in m_textExtents
+  long m_textExtentCacheSize;
+  //! The font GetTextExtent() was called for the last time
+  wxFont m_textExtentFont;
+  //! The text extents that are valid for m_textExtentFont
+  TextExtentHash *m_currentTextExtents;
+  long m_textExtentCacheHits;
+  long m_textExtentCacheMisses;
   wxString m_workingdir;
 
   wxString m_maximaUserLocation;
@@ -932,6 +1018,7 @@ private:
   bool m_copyMathML;
   bool m_copyMathMLHTML;
   int m_showLength;
+  int m_imageCacheMegabytes;
   //!< don't add ; in lisp mode
   bool m_inLispMode;
   bool m_enterEvaluates;
@@ -945,6 +1032,7 @@ private:
   bool m_abortOnError;
   bool m_hidemultiplicationsign;
   bool m_offerKnownAnswers;
+  bool m_fuzzyAutocomplete;
   int m_defaultPort;
   wxString m_documentclass;
   wxString m_documentclassOptions;
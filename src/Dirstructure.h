@@ -75,6 +75,10 @@ public:
    */
   wxString UserAutocompleteFile();
 
+  //! The file the list of maxima's loadable and demo files is cached in
+  wxString UserFileCacheFile() const
+  { return UserConfDir() + wxT("wxmaxima.filecache"); }
+
   //! The path to wxMaxima's own AutoComplete file
   wxString AutocompleteFile() const
   { return DataDir() + wxT("/autocomplete.txt"); }
@@ -70,6 +70,8 @@ EditorCell::EditorCell(Cell *parent, Configuration **config,
   m_containsChanges = false;
   m_containsChangesCheck = false;
   m_firstLineOnly = false;
+  m_tokenizedChangeAsterisk = false;
+  m_tokenizedInLispMode = false;
   m_historyPosition = -1;
   SetValue(TabExpand(text, 0));
   ResetSize();  
@@ -630,25 +632,23 @@ void EditorCell::ConvertNumToUNicodeChar()
 void EditorCell::RecalculateWidths(int fontsize)
 {
   Configuration *configuration = (*m_configuration);
-  if (configuration->GetZoomFactor() != m_lastZoomFactor)
-    m_widths.clear();
 
   m_isDirty = false;
   if (NeedsRecalculation(fontsize))
   {
     StyleText();
     m_fontSize_Last = Scale_Px(fontsize);
-    wxDC *dc = configuration->GetDC();
     SetFont();
 
     // Measure the text hight using characters that might extend below or above the region
     // ordinary characters move in.
-    int charWidth;
-    dc->GetTextExtent(wxT("äXÄgy"), &charWidth, &m_charHeight);
+    wxSize charSize = GetTextSize(wxT("äXÄgy"));
+    int charWidth = charSize.GetWidth();
+    m_charHeight = charSize.GetHeight();
 
     // We want a little bit of vertical space between two text lines (and between two labels).
     m_charHeight += 2 * MC_TEXT_PADDING;
-    int width = 0, tokenwidth, tokenheight, linewidth = 0;
+    int width = 0, linewidth = 0;
 
     m_numberOfLines = 1;
 
@@ -667,8 +667,7 @@ void EditorCell::RecalculateWidths(int fontsize)
       }
       else
       {
-        dc->GetTextExtent(textSnippet->GetText(), &tokenwidth, &tokenheight);
-        linewidth += tokenwidth;
+        linewidth += GetTextSize(textSnippet->GetText()).GetWidth();
         width = wxMax(width, linewidth);
       }
     }
@@ -1024,13 +1023,11 @@ void EditorCell::Draw(wxPoint point)
 
 void EditorCell::SetType(CellType type)
 {
-  m_widths.clear();
   Cell::SetType(type);
 }
 
 void EditorCell::SetStyle(TextStyle style)
 {
-  m_widths.clear();
   Cell::SetStyle(style);
 }
 
@@ -1097,17 +1094,8 @@ void EditorCell::SetFont()
 
 wxSize EditorCell::GetTextSize(wxString const &text)
 {
-  wxDC *dc = (*m_configuration)->GetDC();
-  StringHash::const_iterator it = m_widths.find(text);
-
-  // If we already know this text piece's size we return the cached value
-  if(it != m_widths.end())
-    return it->second;
-
-  // Ask wxWidgets to return this text piece's size (slow!)
-  wxSize sz = dc->GetTextExtent(text);
-  m_widths[text] = sz;
-  return sz;
+  // The text extents are cached by the configuration for all cells together.
+  return (*m_configuration)->GetTextExtent(text);
 }
 
 void EditorCell::SetForeground()
@@ -2261,11 +2249,6 @@ bool EditorCell::HandleOrdinaryKey(wxKeyEvent &event)
     return false;
   }
 
-  // It may be not too intelligent to cache all pieces of a word we arrived at
-  // during typing
-  if(keyCode == ' ')
-    m_widths.clear();
-
   if (m_historyPosition != -1)
   {
     int len = m_textHistory.GetCount() - m_historyPosition;
@@ -3215,7 +3198,8 @@ bool EditorCell::CutToClipboard()
 
   ClearSelection();
   m_paren1 = m_paren2 = -1;
-  m_width = m_height = m_maxDrop = m_center = -1;
+  m_width = m_height = m_center = -1;
+  InvalidateLineMetrics();
 
   return true;
 }
@@ -3353,7 +3337,8 @@ void EditorCell::Undo()
 
   m_paren1 = m_paren2 = -1;
   m_isDirty = true;
-  m_width = m_height = m_maxDrop = m_center = -1;
+  m_width = m_height = m_center = -1;
+  InvalidateLineMetrics();
 }
 
 
@@ -3383,7 +3368,8 @@ void EditorCell::Redo()
 
   m_paren1 = m_paren2 = -1;
   m_isDirty = true;
-  m_width = m_height = m_maxDrop = m_center = -1;
+  m_width = m_height = m_center = -1;
+  InvalidateLineMetrics();
 }
 
 
@@ -3457,6 +3443,110 @@ void EditorCell::HandleSoftLineBreaks_Code(StyledText *&lastSpace, int &lineWidt
   }
 }
 
+void EditorCell::UpdateTokens(const wxString &text)
+{
+  Configuration *configuration = (*m_configuration);
+
+  // In lisp mode the start of the text is tokenized differently and the asterisk
+  // setting changes the text of the tokens => in these cases we re-tokenize everything.
+  if (m_tokens.empty() || configuration->InLispMode() || m_tokenizedInLispMode ||
+      (configuration->GetChangeAsterisk() != m_tokenizedChangeAsterisk))
+    m_tokens = MaximaTokenizer(text, configuration).GetTokens();
+  else
+  {
+    size_t oldLength = m_tokenizedText.Length();
+    size_t newLength = text.Length();
+
+    // Determine which part of the text has changed
+    size_t editStart = 0;
+    wxString::const_iterator oldIt = m_tokenizedText.begin();
+    wxString::const_iterator newIt = text.begin();
+    while ((oldIt < m_tokenizedText.end()) && (newIt < text.end()) && (*oldIt == *newIt))
+    {
+      ++oldIt;
+      ++newIt;
+      editStart++;
+    }
+    if ((editStart == oldLength) && (editStart == newLength))
+      return;
+    size_t unchangedEnd = 0;
+    oldIt = m_tokenizedText.end();
+    newIt = text.end();
+    while ((unchangedEnd < oldLength - editStart) && (unchangedEnd < newLength - editStart))
+    {
+      --oldIt;
+      --newIt;
+      if (*oldIt != *newIt)
+        break;
+      unchangedEnd++;
+    }
+    size_t editEnd = newLength - unchangedEnd;
+
+    // Find the start of the line the change begins in
+    LineStartList::iterator line = m_tokenLineStarts.begin();
+    for (LineStartList::iterator i = m_tokenLineStarts.begin();
+         (i != m_tokenLineStarts.end()) && (i->first <= editStart); ++i)
+      line = i;
+    // The tokenizer looks past the spaces and newlines following a name to decide
+    // if it is a function or a variable => re-tokenize starting with the last line
+    // that contains more than whitespace before the change.
+    while (line != m_tokenLineStarts.begin())
+    {
+      wxString lineStart = m_tokenizedText.Mid(line->first, editStart - line->first);
+      if (!lineStart.Trim(true).IsEmpty())
+        break;
+      --line;
+    }
+
+    // Tokenize line after line until we arrive at a line start in the unchanged
+    // part of the text the old tokens had a line start at, too: From there on the
+    // tokens will be the same as the last time.
+    size_t pos = line->first;
+    MaximaTokenizer::TokenList::iterator replaceStart = line->second;
+    MaximaTokenizer::TokenList::iterator replaceEnd = m_tokens.end();
+    MaximaTokenizer::TokenList newTokens;
+    LineStartList::iterator oldLine = line;
+    while (pos < newLength)
+    {
+      MaximaTokenizer tokenizer(text, configuration, pos, wxMax(editEnd, pos));
+      MaximaTokenizer::TokenList lineTokens = tokenizer.GetTokens();
+      newTokens.splice(newTokens.end(), lineTokens);
+      pos = tokenizer.GetEndPos();
+      if (pos >= newLength)
+        break;
+
+      size_t oldPos = oldLength - (newLength - pos);
+      while ((oldLine != m_tokenLineStarts.end()) && (oldLine->first < oldPos))
+        ++oldLine;
+      if ((oldLine != m_tokenLineStarts.end()) && (oldLine->first == oldPos))
+      {
+        replaceEnd = oldLine->second;
+        break;
+      }
+    }
+    m_tokens.erase(replaceStart, replaceEnd);
+    m_tokens.splice(replaceEnd, newTokens);
+  }
+
+  m_tokenizedText = text;
+  m_tokenizedChangeAsterisk = configuration->GetChangeAsterisk();
+  m_tokenizedInLispMode = configuration->InLispMode();
+
+  // Remember where the lines start
+  m_tokenLineStarts.clear();
+  size_t pos = 0;
+  bool lineStart = true;
+  for (MaximaTokenizer::TokenList::iterator it = m_tokens.begin(); it != m_tokens.end(); ++it)
+  {
+    if (lineStart)
+      m_tokenLineStarts.push_back(std::make_pair(pos, it));
+    wxString tokenText = (*it)->GetText();
+    pos += tokenText.Length();
+    lineStart = (tokenText == wxT("\n")) || (tokenText == wxT("\u2028")) ||
+      (tokenText == wxT("\u2029"));
+  }
+}
+
 void EditorCell::StyleTextCode()
 {
   // We have to style code
@@ -3487,7 +3577,7 @@ void EditorCell::StyleTextCode()
   }
 
   // Split the line into commands, numbers etc.
-  m_tokens = MaximaTokenizer(textToStyle, *m_configuration).GetTokens();
+  UpdateTokens(textToStyle);
 
   // Now handle the text pieces one by one
   wxString lastTokenWithText;
@@ -571,7 +571,6 @@ protected:
     {
       ResetSize();
       ResetData();
-      m_widths.clear();
     }
 private:
   //! Determines the size of a text snippet
@@ -730,9 +729,6 @@ private:
     We need to know this in order to be able to detect we need a full recalculation.
    */
   double m_fontSize_Last;
-  WX_DECLARE_STRING_HASH_MAP(wxSize, StringHash);
-  //! Cached widths of text snippets, one width per style
-  StringHash m_widths;
   int m_charHeight;
   int m_paren1, m_paren2;
   //! Does this cell's size have to be recalculated?
@@ -751,6 +747,22 @@ private:
   bool m_firstLineOnly;
   //! The individual commands, parenthesis, strings and whitespaces a code cell consists of
   MaximaTokenizer::TokenList m_tokens;
+  //! The text m_tokens has been generated from
+  wxString m_tokenizedText;
+  //! Did GetChangeAsterisk() hold when m_tokens was generated?
+  bool m_tokenizedChangeAsterisk;
+  //! Were we in lisp mode when m_tokens was generated?
+  bool m_tokenizedInLispMode;
+  typedef std::vector<std::pair<size_t, MaximaTokenizer::TokenList::iterator> > LineStartList;
+  //! The position and the first token of each line of m_tokenizedText
+  LineStartList m_tokenLineStarts;
+  /*! Update m_tokens to match text
+
+    Only the lines from the first line that has changed to the first line
+    the tokenizer arrives in the same state as the last time are tokenized
+    again. 
+   */
+  void UpdateTokens(const wxString &text);
 };
 
 #endif // EDITORCELL_H
@@ -108,6 +108,6 @@ void ErrorRedirector::Flush()
         m_logNew->Flush();
 }
 
-int ErrorRedirector::m_messages_logPaneOnly = 0;
+std::atomic<int> ErrorRedirector::m_messages_logPaneOnly(0);
 
 bool ErrorRedirector::m_logToStdErr = false;
@@ -30,6 +30,7 @@
 #define ERRORREDIRECTOR_H
 
 #include <wx/log.h>
+#include <atomic>
 
 //! Redirect error messages (but not warnings) to a second target.
 class ErrorRedirector : public wxLog
@@ -37,9 +38,10 @@ class ErrorRedirector : public wxLog
 public:
   /*! A variable used by the SuppressErrorDialogs class
 
-    >=0 means: Messages should appear in the log pane only.
+    >=0 means: Messages should appear in the log pane only. Is atomic as
+    background tasks that save files use SuppressErrorDialogs, too.
    */
-  static int m_messages_logPaneOnly;
+  static std::atomic<int> m_messages_logPaneOnly;
   /**
      Sets the specified @c logger (which may be NULL) as the default log
      target but the log messages are also passed to the previous log target if any.
@@ -38,6 +38,7 @@
 #include "ImgCell.h"
 #include "BitmapOut.h"
 #include "list"
+#include <unordered_map>
 
 GroupCell::GroupCell(Configuration **config, GroupType groupType, CellPointers *cellPointers, wxString initString) :
   Cell(this, config, cellPointers)
@@ -48,6 +49,13 @@ GroupCell::GroupCell(Configuration **config, GroupType groupType, CellPointers *
   m_cellsInGroup = 1;
   m_inEvaluationQueue = false;
   m_lastInEvaluationQueue = false;
+  m_recalculationNeeded = true;
+  m_confusableCharWarningsOutdated = false;
+  m_lookalikeIndexGeneration = -1;
+  m_lookalikeChangeQueued = false;
+  m_xmlCacheValid = false;
+  m_wxmCacheValid = false;
+  m_macCacheValid = false;
   m_labelWidth_cached = 0;
   m_hiddenTree = NULL;
   m_hiddenTreeParent = NULL;
@@ -170,6 +178,7 @@ void GroupCell::SetCellStyle(int style)
 {
   if(GetEditable() == NULL)
     return;
+  InvalidateSerializationCache();
   
   switch (style)
   {
@@ -298,6 +307,32 @@ void GroupCell::ResetInputLabelList()
 }
 
 wxString GroupCell::ToWXM(bool wxm)
+{
+  // Saving or copying a big worksheet would otherwise generate the code for
+  // all cells again, even if only one of them has changed.
+  if (wxm)
+  {
+    if ((!m_wxmCacheValid) || InputChangedSinceCaching())
+    {
+      PrepareCacheUpdate();
+      m_wxmCache = ToWXMUncached(true);
+      m_wxmCacheValid = true;
+    }
+    return m_wxmCache;
+  }
+  else
+  {
+    if ((!m_macCacheValid) || InputChangedSinceCaching())
+    {
+      PrepareCacheUpdate();
+      m_macCache = ToWXMUncached(false);
+      m_macCacheValid = true;
+    }
+    return m_macCache;
+  }
+}
+
+wxString GroupCell::ToWXMUncached(bool wxm)
 {
   wxString retval;
   bool trailingNewline = true;
@@ -426,6 +461,13 @@ GroupCell::~GroupCell()
 
 void GroupCell::MarkAsDeleted()
 {
+  m_cellPointers->m_groupIndexOutdated = true;
+  m_cellPointers->m_lookalikeIndexOutdated = true;
+  if(m_lookalikeChangeQueued)
+  {
+    m_cellPointers->m_lookalikeGroupsChanged.remove(this);
+    m_lookalikeChangeQueued = false;
+  }
   if(this == m_cellPointers->m_selectionStart)
     m_cellPointers->m_selectionStart = NULL;
   if(this == m_cellPointers->m_selectionEnd)
@@ -467,12 +509,14 @@ void GroupCell::SetInput(Cell *input)
 {
   if (input == NULL)
     return;
+  InvalidateSerializationCache();
   m_inputLabel = std::shared_ptr<Cell>(input);
   m_inputLabel->SetGroup(this);
 }
 
 void GroupCell::AppendInput(Cell *cell)
 {
+  InvalidateSerializationCache();
   if (m_inputLabel == NULL)
   {
     m_inputLabel = std::shared_ptr<Cell>(cell);
@@ -498,6 +542,7 @@ void GroupCell::AppendInput(Cell *cell)
 
 void GroupCell::SetOutput(Cell *output)
 {
+  InvalidateSerializationCache();
   if((m_cellPointers->m_answerCell) &&(m_cellPointers->m_answerCell->GetGroup() == this))
     m_cellPointers->m_answerCell = NULL;
   
@@ -525,6 +570,7 @@ void GroupCell::RemoveOutput()
   m_numberedAnswersCount = 0;
   if (m_output == NULL)
     return;
+  InvalidateSerializationCache();
   // If there is nothing to do we can skip the rest of this action.
 
   if((m_cellPointers->m_answerCell) &&(m_cellPointers->m_answerCell->GetGroup() == this))
@@ -561,6 +607,7 @@ void GroupCell::AppendOutput(Cell *cell)
 {
   wxASSERT_MSG(cell != NULL, _("Bug: Trying to append NULL to a group cell."));
   if (cell == NULL) return;
+  InvalidateSerializationCache();
   cell->SetGroupList(this);
   if (m_output == NULL)
   {
@@ -589,20 +636,244 @@ void GroupCell::AppendOutput(Cell *cell)
     if(m_lastInOutput != NULL)
       while (m_lastInOutput->m_next != NULL)
         m_lastInOutput = m_lastInOutput->m_next;
+
+    // If the new cells begin a new line and we already know the layout of the
+    // rest of this cell it suffices to layout the new cells: A full recalculation
+    // for every line a loop print()s would make the output quadratically slow.
+    if (cell->HardLineBreak() && (m_height > 0) && (!m_isHidden) &&
+        (!RecalculationNeeded()))
+    {
+      LayoutAppendedOutput(cell);
+      return;
+    }
   }
+  // A cell that never has been laid out (which is the case for all cells of a
+  // file that is being loaded) is laid out by Worksheet::RecalculateIfNeeded(),
+  // anyway: Laying it out here, too, would double the time loading a file needs.
+  bool laidOut = (m_height >= 0);
   m_output->ResetSize();
   m_output->ResetSize();
   m_outputHeight = -1;
   ResetSize();
   ResetData();
-  GroupCell::Recalculate();
+  if (laidOut)
+    GroupCell::Recalculate();
+  else
+    m_recalculationNeeded = true;
   UpdateCellsInGroup();
   UpdateConfusableCharWarnings();
 }
 
+void GroupCell::LayoutAppendedOutput(Cell *cell)
+{
+  Configuration *configuration = (*m_configuration);
+
+  Cell *tmp = cell;
+  while (tmp != NULL)
+  {
+    tmp->RecalculateWidths(tmp->IsMath() ?
+                           configuration->GetMathFontSize() :
+                           configuration->GetDefaultFontSize());
+    tmp = tmp->m_next;
+  }
+
+  BreakLines(cell);
+
+  tmp = cell;
+  while (tmp != NULL)
+  {
+    tmp->RecalculateHeight(tmp->IsMath() ?
+                           configuration->GetMathFontSize() :
+                           configuration->GetDefaultFontSize());
+    tmp->ResetData();
+    tmp = tmp->m_next;
+  }
+
+  AddOutputLineHeights(cell);
+  ResetData();
+  m_cellsInGroup += cell->CellsInListRecursive();
+
+  // Searching the whole cell for lookalike chars can wait until maxima has
+  // finished sending output to it.
+  m_confusableCharWarningsOutdated = true;
+
+  // The cells that follow this one have to be moved by the amount this cell has
+  // grown.
+  m_cellPointers->m_groupIndexOutdated = true;
+  configuration->AdjustWorksheetSize(true);
+}
+
+void GroupCell::OutputFinished()
+{
+  if (m_confusableCharWarningsOutdated)
+    UpdateConfusableCharWarnings();
+}
+
+void GroupCell::ExpandLazyCell(LazyCell *cell)
+{
+  if ((cell == NULL) || (m_output == NULL))
+    return;
+
+  // MathParser::ParseLine() always places a LazyCell behind the part of the
+  // expression it has parsed => this cell has a predecessor.
+  wxASSERT_MSG(cell->m_previous != NULL, _("Bug: LazyCell at the start of a GroupCell's output"));
+  if (cell->m_previous == NULL)
+    return;
+
+  // Only the line the LazyCell is drawn in and the lines up to the next hard
+  // line break change. If we know the layout of the rest of this cell it
+  // suffices to layout these lines: Laying out the whole cell for every part
+  // of the expression that is scrolled into view would be quadratically slow.
+  bool incremental = (m_height > 0) && (!m_isHidden) && (!RecalculationNeeded());
+  Cell *lineStart = cell->m_previous;
+  while ((!lineStart->BreakLineHere()) && (lineStart->m_previous != NULL))
+    lineStart = lineStart->m_previous;
+  // The height of the first output line isn't accounted for by
+  // AddOutputLineHeights() => if that line changes we need a full relayout.
+  if (!lineStart->BreakLineHere())
+    incremental = false;
+  Cell *regionEnd = cell->m_next;
+  while ((regionEnd != NULL) && (!regionEnd->HardLineBreak()))
+    regionEnd = regionEnd->m_next;
+  for (Cell *tmp = lineStart; incremental && (tmp != regionEnd); tmp = tmp->m_next)
+    if (tmp->m_isBrokenIntoLines)
+      incremental = false;
+  int oldHeight = 0;
+  if (incremental)
+    oldHeight = GetOutputLinesHeight(lineStart, regionEnd);
+  bool softLineStart = !lineStart->HardLineBreak();
+
+  Cell *expansion = cell->Expand();
+  if (expansion != NULL)
+  {
+    expansion->SetGroupList(this);
+    m_cellsInGroup += expansion->CellsInListRecursive();
+    Cell *last = expansion;
+    while (last->m_next != NULL)
+      last = last->m_next;
+
+    // Find the cell that is drawn in front of the LazyCell
+    Cell *previousToDraw = cell->m_previous;
+    while ((previousToDraw != NULL) && (previousToDraw->m_nextToDraw != cell))
+      previousToDraw = previousToDraw->m_nextToDraw;
+
+    cell->m_previous->m_next = expansion;
+    expansion->m_previous = cell->m_previous;
+    if (previousToDraw != NULL)
+      previousToDraw->m_nextToDraw = expansion;
+    last->m_next = cell;
+    last->m_nextToDraw = cell;
+    cell->m_previous = last;
+  }
+
+  if (cell->IsExpanded())
+  {
+    Cell *previous = cell->m_previous;
+    Cell *previousToDraw = previous;
+    while ((previousToDraw != NULL) && (previousToDraw->m_nextToDraw != cell))
+      previousToDraw = previousToDraw->m_nextToDraw;
+    if (previousToDraw != NULL)
+      previousToDraw->m_nextToDraw = cell->m_nextToDraw;
+    previous->m_next = cell->m_next;
+    if (cell->m_next != NULL)
+      cell->m_next->m_previous = previous;
+    if (m_lastInOutput == cell)
+      m_lastInOutput = previous;
+    cell->m_next = NULL;
+    cell->m_nextToDraw = NULL;
+    wxDELETE(cell);
+    m_cellsInGroup--;
+  }
+
+  if (!incremental)
+  {
+    m_output->ResetSizeList();
+    m_outputHeight = -1;
+    ResetSize();
+    ResetData();
+    m_recalculationNeeded = true;
+    return;
+  }
+
+  Configuration *configuration = (*m_configuration);
+  for (Cell *tmp = lineStart; tmp != regionEnd; tmp = tmp->m_next)
+    tmp->RecalculateWidths(tmp->IsMath() ?
+                           configuration->GetMathFontSize() :
+                           configuration->GetDefaultFontSize());
+
+  BreakLines(lineStart);
+  // BreakLines() treats lineStart as the start of a line, but keeps a line
+  // break there only if it is a hard one.
+  if (softLineStart)
+    lineStart->SoftLineBreak(true);
+
+  for (Cell *tmp = lineStart; tmp != regionEnd; tmp = tmp->m_next)
+  {
+    tmp->RecalculateHeight(tmp->IsMath() ?
+                           configuration->GetMathFontSize() :
+                           configuration->GetDefaultFontSize());
+    tmp->ResetData();
+  }
+
+  m_height -= oldHeight;
+  m_outputRect.height -= oldHeight;
+  AddOutputLineHeights(lineStart, regionEnd);
+  ResetData();
+
+  // The cells that follow this one have to be moved by the amount this cell has
+  // grown.
+  m_cellPointers->m_groupIndexOutdated = true;
+  configuration->AdjustWorksheetSize(true);
+}
+
+wxString GroupCell::Skeleton(const wxString &name)
+{
+  // Maps every lookalike char to one representative of all chars that look
+  // like it. Is generated from m_lookalikeChars on first use.
+  static std::unordered_map<wxChar, wxChar> representatives;
+  if (representatives.empty())
+  {
+    for (wxString::const_iterator it = m_lookalikeChars.begin(); it < m_lookalikeChars.end(); ++it)
+    {
+      wxChar ch1 = *it;
+      ++it;
+      wxASSERT(it < m_lookalikeChars.end());
+      wxChar ch2 = *it;
+      while (representatives.find(ch1) != representatives.end())
+        ch1 = representatives[ch1];
+      while (representatives.find(ch2) != representatives.end())
+        ch2 = representatives[ch2];
+      if (ch1 != ch2)
+        representatives[ch2] = ch1;
+    }
+    // Let every char point to its representative directly
+    for (std::unordered_map<wxChar, wxChar>::iterator it = representatives.begin();
+         it != representatives.end(); ++it)
+      while (representatives.find(it->second) != representatives.end())
+        it->second = representatives[it->second];
+  }
+
+  wxString skeleton;
+  for (wxString::const_iterator it = name.begin(); it < name.end(); ++it)
+  {
+    std::unordered_map<wxChar, wxChar>::const_iterator representative = representatives.find(*it);
+    if (representative != representatives.end())
+      skeleton += representative->second;
+    else
+      skeleton += *it;
+  }
+  return skeleton;
+}
+
 void GroupCell::UpdateConfusableCharWarnings()
 {
-  ClearToolTip();
+  m_confusableCharWarningsOutdated = false;
+  if(!m_lookalikeChangeQueued)
+  {
+    m_cellPointers->m_lookalikeGroupsChanged.push_back(this);
+    m_lookalikeChangeQueued = true;
+  }
+  m_lookalikeWarnings = wxEmptyString;
 
   wxString code;
   if(GetInput())
@@ -610,55 +881,51 @@ void GroupCell::UpdateConfusableCharWarnings()
   if(GetOutput())
     code += GetOutput()->VariablesAndFunctionsList();
   // Extract all variable and command names from the cell including input and output
-  CmdsAndVariables cmdsAndVariables;
+  m_cmdsAndVariables.clear();
+  m_skeletons.clear();
   MaximaTokenizer::TokenList
     m_tokens = MaximaTokenizer(code, *m_configuration).GetTokens();
   for(MaximaTokenizer::TokenList::const_iterator it = m_tokens.begin(); it != m_tokens.end(); ++it)
     if(((*it)->GetStyle() == TS_CODE_VARIABLE) || ((*it)->GetStyle() == TS_CODE_FUNCTION))
-      cmdsAndVariables[(*it)->GetText()] = 1;
-  
-  // Now we step through all the words we found
-  while(!cmdsAndVariables.empty())
-  {
-    CmdsAndVariables::iterator cmp = cmdsAndVariables.begin();
-    wxString word;
-    word = cmp->first;
-    cmdsAndVariables.erase(cmp);
-    // Now iterate through all remaining words
-    cmp = cmdsAndVariables.begin();
-    while(cmp != cmdsAndVariables.end())
+      m_cmdsAndVariables[(*it)->GetText()] = 1;
+
+  // Names that only differ by lookalike chars have the same skeleton => sorting
+  // the names by their skeleton finds all lookalikes without comparing every
+  // name with every other one.
+  NamesBySkeleton lookalikes;
+  for (CmdsAndVariables::const_iterator it = m_cmdsAndVariables.begin();
+       it != m_cmdsAndVariables.end(); ++it)
+  {
+    wxString skeleton = Skeleton(it->first);
+    m_skeletons[it->first] = skeleton;
+    wxArrayString &names = lookalikes[skeleton];
+    for (size_t i = 0; i < names.GetCount(); i++)
     {
-      // iterate through all lookalike chars
-      for (wxString::const_iterator it = m_lookalikeChars.begin(); it < m_lookalikeChars.end(); ++it)
-      {
-        wxChar ch1 = *it;
-        ++it;
-        wxASSERT(it < m_lookalikeChars.end());
-        wxChar ch2 = *it;
-        wxString word_subst = word;
-        if(word_subst.Replace(ch1,ch2))
-        {
-          if(cmp->first == word_subst)
-            AddToolTip(_("Warning: Lookalike chars: ") +
-                       cmp->first.utf8_str() + wxT("\u2260") +
-                       word.utf8_str()
-              );
-        }
-        word_subst = word;
-        if(word_subst.Replace(ch2,ch1))
-        {
-          if(cmp->first == word_subst)
-            AddToolTip(_("Warning: Lookalike chars: ") +
-                       cmp->first +
-                       wxT(" \u2260 ") +
-                       word
-              );
-        }
-          
-      }
-      ++cmp;
+      if((!m_lookalikeWarnings.IsEmpty()) && (!m_lookalikeWarnings.EndsWith("\n")))
+        m_lookalikeWarnings += "\n";
+      m_lookalikeWarnings += _("Warning: Lookalike chars: ") + names[i] +
+        wxT(" \u2260 ") + it->first;
     }
+    names.Add(it->first);
   }
+  UpdateLookalikeToolTip();
+}
+
+void GroupCell::SetLookalikesInOtherCells(const wxString &warnings)
+{
+  if (m_otherCellsLookalikeWarnings == warnings)
+    return;
+  m_otherCellsLookalikeWarnings = warnings;
+  UpdateLookalikeToolTip();
+}
+
+void GroupCell::UpdateLookalikeToolTip()
+{
+  ClearToolTip();
+  if (!m_lookalikeWarnings.IsEmpty())
+    AddToolTip(m_lookalikeWarnings);
+  if (!m_otherCellsLookalikeWarnings.IsEmpty())
+    AddToolTip(m_otherCellsLookalikeWarnings);
 }
 
 void GroupCell::Recalculate()
@@ -667,6 +934,7 @@ void GroupCell::Recalculate()
   m_mathFontSize = (*m_configuration)->GetMathFontSize();
   GroupCell::RecalculateWidths((*m_configuration)->GetDefaultFontSize());
   GroupCell::RecalculateHeight((*m_configuration)->GetDefaultFontSize());
+  m_recalculationNeeded = false;
 }
 
 void GroupCell::RecalculateWidths(int fontsize)
@@ -895,41 +1163,49 @@ void GroupCell::RecalculateHeightOutput()
   }
 
   // Update heights
-  tmp = m_output.get();
-  tmp->ForceBreakLine(true);
-  while (tmp != NULL)
+  m_output->ForceBreakLine(true);
+  AddOutputLineHeights(m_output.get());
+
+  ResetData();
+  
+  // The cells that follow this one have to be moved by the amount this cell has
+  // grown. Worksheet::RecalculateIfNeeded() or the next redraw will do so.
+  m_cellPointers->m_groupIndexOutdated = true;
+  (*m_configuration)->AdjustWorksheetSize(true);
+}
+
+int GroupCell::GetOutputLinesHeight(Cell *start, Cell *end)
+{
+  Configuration *configuration = (*m_configuration);
+  int height = 0;
+  for (Cell *tmp = start; tmp != end; tmp = tmp->m_nextToDraw)
   {
     if (tmp->BreakLineHere())
     {
-      int height_Delta = tmp->GetHeightList();
-      m_width = wxMax(m_width, tmp->GetLineWidth());
-      m_height            += height_Delta;
-      m_outputRect.width = m_width;
-      m_outputRect.height += height_Delta;
-      
+      height += tmp->GetHeightList();
       if (tmp->m_previous != NULL &&
           ((tmp->GetStyle() == TS_LABEL) || (tmp->GetStyle() == TS_USERLABEL)))
-      {
-        m_height            += configuration->GetInterEquationSkip();
-        m_outputRect.height += configuration->GetInterEquationSkip();
-      }
-
+        height += configuration->GetInterEquationSkip();
       if (tmp->m_bigSkip)
-      {
-        m_height            += MC_LINE_SKIP;
-        m_outputRect.height += MC_LINE_SKIP;
-      }
+        height += MC_LINE_SKIP;
     }
-    tmp = tmp->m_nextToDraw;
   }
+  return height;
+}
 
-  ResetData();
-  
-  // Move all cells that follow the current one down by the amount this cell has grown.
-  GroupCell *cell = this;
-  while(cell != NULL)
-    cell = cell->UpdateYPosition();
-  (*m_configuration)->AdjustWorksheetSize(true);
+void GroupCell::AddOutputLineHeights(Cell *start, Cell *end)
+{
+  for (Cell *tmp = start; tmp != end; tmp = tmp->m_nextToDraw)
+  {
+    if (tmp->BreakLineHere())
+    {
+      m_width = wxMax(m_width, tmp->GetLineWidth());
+      m_outputRect.width = m_width;
+    }
+  }
+  int height = GetOutputLinesHeight(start, end);
+  m_height            += height;
+  m_outputRect.height += height;
 }
 
 bool GroupCell::NeedsRecalculation(int fontSize)
@@ -1827,6 +2103,53 @@ wxString GroupCell::ToXML()
   return str;
 }
 
+const wxString &GroupCell::ToXMLCached(CellPointers::WXMXFileList &files)
+{
+  if (!XMLCacheValid())
+  {
+    PrepareCacheUpdate();
+    m_xmlCache = ToXML();
+    m_xmlCacheFiles = m_cellPointers->WXMXTakeFiles();
+    m_xmlCacheValid = true;
+  }
+  files.insert(files.end(), m_xmlCacheFiles.begin(), m_xmlCacheFiles.end());
+  return m_xmlCache;
+}
+
+bool GroupCell::XMLCacheValid() const
+{
+  return m_xmlCacheValid && !InputChangedSinceCaching();
+}
+
+bool GroupCell::InputChangedSinceCaching() const
+{
+  // Typing doesn't inform the GroupCell => compare the input to the cached one.
+  if (GetInput() == NULL)
+    return !m_cachedInput.IsEmpty();
+  return GetInput()->GetValue() != m_cachedInput;
+}
+
+void GroupCell::PrepareCacheUpdate()
+{
+  if (!InputChangedSinceCaching())
+    return;
+  InvalidateSerializationCache();
+  if (GetInput() != NULL)
+    m_cachedInput = GetInput()->GetValue();
+  else
+    m_cachedInput = wxEmptyString;
+}
+
+void GroupCell::InvalidateSerializationCache()
+{
+  m_xmlCacheValid = false;
+  m_wxmCacheValid = false;
+  m_macCacheValid = false;
+  // The XML of a folded cell contains the cells it hides.
+  if (m_hiddenTreeParent != NULL)
+    m_hiddenTreeParent->InvalidateSerializationCache();
+}
+
 void GroupCell::SelectRectGroup(const wxRect &rect, const wxPoint &one, const wxPoint &two,
                                 Cell **first, Cell **last)
 {
@@ -2194,6 +2517,7 @@ void GroupCell::Hide(bool hide)
     return;
 
   m_isHidden = hide;
+  InvalidateSerializationCache();
   if ((m_groupType == GC_TYPE_TEXT) || (m_groupType == GC_TYPE_CODE))
     GetEditable()->SetFirstLineOnly(m_isHidden);
 
@@ -2219,6 +2543,7 @@ bool GroupCell::HideTree(GroupCell *tree)
     return false;
   m_hiddenTree = tree;
   m_hiddenTree->SetHiddenTreeParent(this);
+  InvalidateSerializationCache();
 
   // Clear cached images from cells that are hidden
   GroupCell *tmp = m_hiddenTree;
@@ -2237,6 +2562,7 @@ GroupCell *GroupCell::UnhideTree()
   GroupCell *tree = m_hiddenTree;
   m_hiddenTree->SetHiddenTreeParent(m_hiddenTreeParent);
   m_hiddenTree = NULL;
+  InvalidateSerializationCache();
   return tree;
 }
 
@@ -32,6 +32,7 @@
 
 #include "Cell.h"
 #include "EditorCell.h"
+#include "LazyCell.h"
 
 #define EMPTY_INPUT_LABEL wxT(" -->  ")
 
@@ -95,6 +96,7 @@ public:
   bool AutoAnswer() const {return m_autoAnswer;}
   //! Does this GroupCell save the answer to a question?
   void AutoAnswer(bool autoAnswer){
+    InvalidateSerializationCache();
     m_autoAnswer = autoAnswer;
     if(GetEditable() != NULL) GetEditable()->AutoAnswer(autoAnswer);
   }
@@ -102,7 +104,10 @@ public:
   void SetAnswer(wxString question, wxString answer)
     {
       if(answer != wxEmptyString)
+      {
+        InvalidateSerializationCache();
         m_knownAnswers[question] = answer;
+      }
     }
   /*! Tell this cell to remove it from all gui actions.
 
@@ -170,6 +175,15 @@ public:
   EditorCell *GetEditable() const; // returns pointer to editor (if there is one)
   void AppendOutput(Cell *cell);
 
+  /*! Parses the next part of the expression a LazyCell in our output stands for
+
+    The new cells are inserted in front of the LazyCell; The LazyCell is deleted 
+    as soon as it is completely expanded. If this cell already has been laid out
+    only the lines that contain the new cells are laid out again. Else
+    RecalculationNeeded() is set.
+  */
+  void ExpandLazyCell(LazyCell *cell);
+
   /*! Remove all output cells attached to this one
 
     If called on an image cell it will not remove the image attached to it (even if the image
@@ -180,6 +194,25 @@ public:
 
   //! GroupCells warn if they contain both greek and latin lookalike chars.
   void UpdateConfusableCharWarnings();
+
+  /*! Replace a name by a "skeleton" all names that look like it share
+
+    Names that only differ by lookalike chars like a latin "A" and a greek "Alpha"
+    have the same skeleton.
+   */
+  static wxString Skeleton(const wxString &name);
+
+  /*! Set the warnings about names in other cells that look like names in this one
+
+    Are generated by Worksheet::UpdateLookalikeWarnings().
+   */
+  void SetLookalikesInOtherCells(const wxString &warnings);
+
+  /*! Run the checks AppendOutput() has deferred
+
+    Is called as soon as maxima has finished sending output to this cell.
+   */
+  void OutputFinished();
   
   wxString ToTeX(wxString imgDir, wxString filename, int *imgCounter);
 
@@ -188,6 +221,8 @@ public:
     \param wxm:
     - true: We mean to export to a .wxm file.
     - false: We generate a.mac file instead that doesn't look nice with a dedicated comment per input line.
+
+    The result is cached until the cell changes.
    */
   wxString ToWXM(bool wxm = true);
 
@@ -204,6 +239,25 @@ public:
 
   wxString ToXML() override;
 
+  /*! The result of ToXML(), taken from a cache if the cell hasn't changed since
+
+    Allows saving a worksheet without serializing the cells that haven't changed
+    since the last save.
+    \param files The images and gnuplot files the XML code refers to are appended
+    to this list.
+   */
+  const wxString &ToXMLCached(CellPointers::WXMXFileList &files);
+
+  //! Would ToXMLCached() return the XML code from the cache?
+  bool XMLCacheValid() const;
+
+  /*! Tell this cell that its contents has changed
+
+    Invalidates the results ToXMLCached() and ToWXM() have cached. Changes of
+    the input are detected automatically.
+  */
+  void InvalidateSerializationCache();
+
   void Hide(bool hide);
 
   void SwitchHide();
@@ -279,6 +333,18 @@ public:
   */
   void Recalculate();
 
+  //! Tell this cell that Worksheet::RecalculateIfNeeded() has to recalculate its size
+  void SetRecalculationNeeded(bool needed = true)
+  { m_recalculationNeeded = needed; }
+
+  /*! Does this cell need to be recalculated?
+
+    If it doesn't Worksheet::RecalculateIfNeeded() only moves it to its new 
+    y position.
+  */
+  bool RecalculationNeeded()
+  { return m_recalculationNeeded || NeedsRecalculation((*m_configuration)->GetDefaultFontSize()); }
+
   /*! Attempt to split math objects that are wider than the screen into multiple lines.
     
     \retval true, if this action has changed the height of cells.
@@ -426,9 +492,23 @@ public:
   void InputHeightChanged();
 
   WX_DECLARE_STRING_HASH_MAP(int, CmdsAndVariables);  
+  WX_DECLARE_STRING_HASH_MAP(wxArrayString, NamesBySkeleton);
+  //! The names of all variables and functions UpdateConfusableCharWarnings() has found
+  const CmdsAndVariables &GetCmdsAndVariables() const {return m_cmdsAndVariables;}
   WX_DECLARE_STRING_HASH_MAP(wxString, StringHash);
+  //! The skeletons of all names UpdateConfusableCharWarnings() has found
+  const StringHash &GetSkeletons() const {return m_skeletons;}
   //! A list of answers provided by the user
   StringHash m_knownAnswers;
+  /*! The names and skeletons this cell currently has in the worksheet's lookalike index
+
+    Is maintained by Worksheet::UpdateLookalikeWarnings().
+  */
+  StringHash m_indexedSkeletons;
+  //! The rebuild of the worksheet's lookalike index m_indexedSkeletons belongs to
+  long m_lookalikeIndexGeneration;
+  //! Is this cell in CellPointers::m_lookalikeGroupsChanged?
+  bool m_lookalikeChangeQueued;
   
 #if wxUSE_ACCESSIBILITY
   wxAccStatus GetDescription(int childId, wxString *description) override;
@@ -511,6 +591,19 @@ protected:
   bool NeedsRecalculation(int fontSize) override;
   int GetInputIndent();
   int GetLineIndent(Cell *cell);
+  /*! Layout output cells that have been appended to an already layouted output
+
+    \param cell The first of the new cells. Must begin a new line.
+   */
+  void LayoutAppendedOutput(Cell *cell);
+  /*! Add the heights of the output lines that begin between start and end to this cell's height
+
+    \param end The first cell that isn't taken into account. NULL means: All
+           cells up to the end of the output.
+   */
+  void AddOutputLineHeights(Cell *start, Cell *end = NULL);
+  //! The height the output lines that begin between start and end (exclusive) add to this cell
+  int GetOutputLinesHeight(Cell *start, Cell *end);
   GroupCell *m_hiddenTree; //!< here hidden (folded) tree of GCs is stored
   GroupCell *m_hiddenTreeParent; //!< store linkage to the parent of the fold
   //! Which type this cell is of?
@@ -529,6 +622,42 @@ private:
   wxRect m_outputRect;
   bool m_inEvaluationQueue;
   bool m_lastInEvaluationQueue;
+  //! Has a recalculation of this cell been requested by the worksheet?
+  bool m_recalculationNeeded;
+  //! Has AppendOutput() deferred UpdateConfusableCharWarnings()?
+  bool m_confusableCharWarningsOutdated;
+  //! The names of all variables and functions in this cell
+  CmdsAndVariables m_cmdsAndVariables;
+  //! The skeleton of each name in m_cmdsAndVariables
+  StringHash m_skeletons;
+  //! Warnings about lookalike names within this cell
+  wxString m_lookalikeWarnings;
+  //! Warnings about names in other cells that look like names in this one
+  wxString m_otherCellsLookalikeWarnings;
+  //! Set the tooltip to the lookalike warnings
+  void UpdateLookalikeToolTip();
+  //! The XML code ToXMLCached() has generated
+  wxString m_xmlCache;
+  //! The files m_xmlCache refers to
+  CellPointers::WXMXFileList m_xmlCacheFiles;
+  //! Is m_xmlCache up to date, provided the input hasn't changed?
+  bool m_xmlCacheValid;
+  //! The result of ToWXM(true), if m_wxmCacheValid
+  wxString m_wxmCache;
+  //! Is m_wxmCache up to date, provided the input hasn't changed?
+  bool m_wxmCacheValid;
+  //! The result of ToWXM(false), if m_macCacheValid
+  wxString m_macCache;
+  //! Is m_macCache up to date, provided the input hasn't changed?
+  bool m_macCacheValid;
+  //! The input the cached XML and wxm code has been generated from
+  wxString m_cachedInput;
+  //! Has the input changed since the XML or wxm code was cached?
+  bool InputChangedSinceCaching() const;
+  //! Discard all caches if the input has changed since they were generated
+  void PrepareCacheUpdate();
+  //! The wxm code of this cell, generated from scratch
+  wxString ToWXMUncached(bool wxm);
   int m_inputWidth, m_inputHeight, m_outputWidth, m_outputHeight;
   //! The number of cells the current group contains (-1, if no GroupCell)
   int m_cellsInGroup;
@@ -33,9 +33,15 @@
 #include <wx/txtstrm.h>
 #include <wx/regex.h>
 #include <wx/stdpaths.h>
+#include <vector>
 #include "SvgBitmap.h"
 #include "ErrorRedirector.h"
 
+std::list<Image *> Image::m_bitmapCache;
+long Image::m_bitmapCacheBytes = 0;
+long Image::m_bitmapCacheHits = 0;
+long Image::m_bitmapCacheMisses = 0;
+
 wxMemoryBuffer Image::ReadCompressedImage(wxInputStream *data)
 {
   wxMemoryBuffer retval;
@@ -82,8 +88,8 @@ wxBitmap Image::GetUnscaledBitmap()
 Image::Image(Configuration **config)
 {
   #ifdef HAVE_OMP_HEADER
-  omp_init_lock(&m_gnuplotLock);
   omp_init_lock(&m_imageLoadLock);
+  omp_init_lock(&m_scaledImageLock);
   #endif
   m_configuration = config;
   m_width = 1;
@@ -96,13 +102,21 @@ Image::Image(Configuration **config)
   m_maxHeight = -1;
   m_svgImage = NULL;
   m_svgRast = NULL;
+  m_scaledBitmapIsPreview = false;
+  m_scaledImageSize = wxDefaultSize;
+  m_scaleTaskRunning = false;
+  m_discardMipmaps = false;
+  m_gnuplotTaskRunning = false;
+  m_mipmapBytes = 0;
+  m_inBitmapCache = false;
+  m_bitmapCacheBytesUsed = 0;
 }
 
 Image::Image(Configuration **config, wxMemoryBuffer image, wxString type)
 {
   #ifdef HAVE_OMP_HEADER
-  omp_init_lock(&m_gnuplotLock);
   omp_init_lock(&m_imageLoadLock);
+  omp_init_lock(&m_scaledImageLock);
   #endif
   m_configuration = config;
   m_scaledBitmap.Create(1, 1);
@@ -115,6 +129,14 @@ Image::Image(Configuration **config, wxMemoryBuffer image, wxString type)
   m_originalHeight = 480;
   m_svgImage = NULL;
   m_svgRast = NULL;
+  m_scaledBitmapIsPreview = false;
+  m_scaledImageSize = wxDefaultSize;
+  m_scaleTaskRunning = false;
+  m_discardMipmaps = false;
+  m_gnuplotTaskRunning = false;
+  m_mipmapBytes = 0;
+  m_inBitmapCache = false;
+  m_bitmapCacheBytesUsed = 0;
   
   wxImage Image;
   if (m_compressedImage.GetDataLen() > 0)
@@ -132,11 +154,19 @@ Image::Image(Configuration **config, wxMemoryBuffer image, wxString type)
 Image::Image(Configuration **config, const wxBitmap &bitmap)
 {
   #ifdef HAVE_OMP_HEADER
-  omp_init_lock(&m_gnuplotLock);
   omp_init_lock(&m_imageLoadLock);
+  omp_init_lock(&m_scaledImageLock);
   #endif
   m_svgImage = NULL;
   m_svgRast = NULL;
+  m_scaledBitmapIsPreview = false;
+  m_scaledImageSize = wxDefaultSize;
+  m_scaleTaskRunning = false;
+  m_discardMipmaps = false;
+  m_gnuplotTaskRunning = false;
+  m_mipmapBytes = 0;
+  m_inBitmapCache = false;
+  m_bitmapCacheBytesUsed = 0;
   m_configuration = config;
   m_isOk = false;
   m_width = 1;
@@ -151,11 +181,19 @@ Image::Image(Configuration **config, wxString image, const std::shared_ptr<wxFil
   m_fs_keepalive_imagedata(filesystem)
 {
   #ifdef HAVE_OMP_HEADER
-  omp_init_lock(&m_gnuplotLock);
   omp_init_lock(&m_imageLoadLock);
+  omp_init_lock(&m_scaledImageLock);
   #endif
   m_svgImage = NULL;
   m_svgRast = NULL;
+  m_scaledBitmapIsPreview = false;
+  m_scaledImageSize = wxDefaultSize;
+  m_scaleTaskRunning = false;
+  m_discardMipmaps = false;
+  m_gnuplotTaskRunning = false;
+  m_mipmapBytes = 0;
+  m_inBitmapCache = false;
+  m_bitmapCacheBytesUsed = 0;
   m_configuration = config;
   m_scaledBitmap.Create(1, 1);
   m_isOk = false;
@@ -166,12 +204,77 @@ Image::Image(Configuration **config, wxString image, const std::shared_ptr<wxFil
   LoadImage(image, filesystem, remove);
 }
 
+Image::Image(const Image &image)
+{
+  #ifdef HAVE_OMP_HEADER
+  omp_init_lock(&m_imageLoadLock);
+  omp_init_lock(&m_scaledImageLock);
+  #endif
+  // The copy starts without any of the scaled bitmaps, mipmaps and background
+  // tasks of the original: They belong to the original, only.
+  m_svgImage = NULL;
+  m_svgRast = NULL;
+  m_scaledBitmap.Create(1, 1);
+  m_scaledBitmapIsPreview = false;
+  m_scaledImageSize = wxDefaultSize;
+  m_scaleTaskRunning = false;
+  m_discardMipmaps = false;
+  m_gnuplotTaskRunning = false;
+  m_mipmapBytes = 0;
+  m_inBitmapCache = false;
+  m_bitmapCacheBytesUsed = 0;
+  m_configuration = image.m_configuration;
+  m_width = 1;
+  m_height = 1;
+  m_maxWidth = image.m_maxWidth;
+  m_maxHeight = image.m_maxHeight;
+
+  {
+    #ifdef HAVE_OMP_HEADER
+    WaitForLoad waitforload(const_cast<omp_lock_t *>(&image.m_imageLoadLock));
+    #endif
+    m_compressedImage = image.m_compressedImage;
+    m_extension = image.m_extension;
+    m_imageName = image.m_imageName;
+    m_originalWidth = image.m_originalWidth;
+    m_originalHeight = image.m_originalHeight;
+    m_isOk = image.m_isOk;
+  }
+  {
+    std::unique_lock<std::mutex> lock = image.WaitForGnuplotTask();
+    m_gnuplotSource_Compressed = image.m_gnuplotSource_Compressed;
+    m_gnuplotData_Compressed = image.m_gnuplotData_Compressed;
+    m_gnuplotSource = image.m_gnuplotSource;
+    m_gnuplotData = image.m_gnuplotData;
+  }
+
+  // The parsed svg image is deleted together with the image that owns it =>
+  // the copy needs one of its own.
+  if(image.m_svgImage && (m_extension == "svgz"))
+  {
+    wxString svgContents_string;
+    wxMemoryInputStream istream(m_compressedImage.GetData(), m_compressedImage.GetDataLen());
+    wxZlibInputStream zstream(istream);
+    wxTextInputStream textIn(zstream);
+    while(!zstream.Eof())
+      svgContents_string += textIn.ReadLine() + wxT("\n");
+    ParseSVG(svgContents_string);
+  }
+}
+
 Image::~Image()
 {
   m_isOk = false;
-  #ifdef HAVE_OPENMP_TASKS
-  #pragma omp taskwait
+  // Wait for the background tasks that work on this image, but not for
+  // unrelated ones like a background autosave.
+  WaitForGnuplotTask();
+  WaitForScaleTask();
+  #ifdef HAVE_OMP_HEADER
+  {
+    WaitForLoad waitforload(&m_imageLoadLock);
+  }
   #endif
+  BitmapCacheRemove();
   {
     if(!m_gnuplotSource.IsEmpty())
     {
@@ -233,18 +336,50 @@ void Image::GnuplotSource(wxString gnuplotFilename, wxString dataFilename, const
 {
   m_fs_keepalive_gnuplotdata = filesystem;
   std::shared_ptr<wxFileSystem> keepFilesystemAlive(filesystem);
+  // The flag is set before the task starts so nobody can read the gnuplot
+  // data before the task has had a chance to load it.
+  {
+    std::unique_lock<std::mutex> lock = WaitForGnuplotTask();
+    m_gnuplotTaskRunning = true;
+  }
   #ifdef HAVE_OPENMP_TASKS
   wxLogMessage(_("Starting backgound task that loads the gnuplot data for a plot."));
   #pragma omp task
   #endif
-  LoadGnuplotSource_Backgroundtask(gnuplotFilename, dataFilename, filesystem);
+  {
+    LoadGnuplotSource_Backgroundtask(gnuplotFilename, dataFilename, keepFilesystemAlive);
+    {
+      std::lock_guard<std::mutex> lock(m_gnuplotMutex);
+      m_gnuplotTaskRunning = false;
+    }
+    m_gnuplotTaskDone.notify_all();
+  }
 }
 
-void Image::LoadGnuplotSource_Backgroundtask(wxString gnuplotFilename, wxString dataFilename, const std::shared_ptr<wxFileSystem> &filesystem)
+std::unique_lock<std::mutex> Image::WaitForGnuplotTask() const
 {
-  #ifdef HAVE_OMP_HEADER
-  omp_set_lock(&m_gnuplotLock);
+  std::unique_lock<std::mutex> lock(m_gnuplotMutex);
+  m_gnuplotTaskDone.wait(lock, [this]{return !m_gnuplotTaskRunning;});
+  return lock;
+}
+
+void Image::WaitForScaleTask()
+{
+  #if defined HAVE_OMP_HEADER && defined HAVE_OPENMP_TASKS
+  while(true)
+  {
+    omp_set_lock(&m_scaledImageLock);
+    bool running = m_scaleTaskRunning;
+    omp_unset_lock(&m_scaledImageLock);
+    if(!running)
+      break;
+    #pragma omp taskyield
+  }
   #endif
+}
+
+void Image::LoadGnuplotSource_Backgroundtask(wxString gnuplotFilename, wxString dataFilename, const std::shared_ptr<wxFileSystem> &filesystem)
+{
   // Error dialogues need to be created by the foreground thread.
   SuppressErrorDialogs suppressor;
 
@@ -262,9 +397,6 @@ void Image::LoadGnuplotSource_Backgroundtask(wxString gnuplotFilename, wxString
       {
         wxLogMessage(_("Too much gnuplot data => Not storing it in the worksheet"));
         m_gnuplotData_Compressed.Clear();
-        #ifdef HAVE_OMP_HEADER
-        omp_unset_lock(&m_gnuplotLock);
-        #endif
         return;
       }
       
@@ -444,122 +576,91 @@ void Image::LoadGnuplotSource_Backgroundtask(wxString gnuplotFilename, wxString
     }
   }
   m_fs_keepalive_gnuplotdata.reset();
-  #ifdef HAVE_OMP_HEADER
-  omp_unset_lock(&m_gnuplotLock);
-  #endif
 }
 
 wxMemoryBuffer Image::GetGnuplotSource()
 {
   wxMemoryBuffer retval;
-  #ifdef HAVE_OMP_HEADER
-  omp_set_lock(&m_gnuplotLock);
-  #else
-  #ifdef HAVE_OPENMP_TASKS
-  #pragma omp taskwait
-  #endif
-  #endif
-  {  
+  wxMemoryBuffer compressed;
+  {
+    std::unique_lock<std::mutex> lock = WaitForGnuplotTask();
     if(
       (m_gnuplotSource_Compressed.GetDataLen() < 2) || 
       (m_gnuplotData_Compressed.GetDataLen() < 2))
-    {
-      #ifdef HAVE_OMP_HEADER
-      omp_unset_lock(&m_gnuplotLock);
-      #endif
       return retval;
-    }
-    wxMemoryOutputStream output;
-    wxTextOutputStream textOut(output);
-    if(output.IsOk())
-    {
-      wxMemoryInputStream mstream(
-        m_gnuplotSource_Compressed.GetData(),
-        m_gnuplotSource_Compressed.GetDataLen()
-        );
-      wxZlibInputStream zstream(mstream);
-      wxTextInputStream textIn(zstream);
-      wxString line;
-  
-      while(!zstream.Eof())
-      {
-        line = textIn.ReadLine();
-        textOut << line + wxT("\n");
-      }
-      textOut.Flush();
+    // Uncompressing the data may take a while => we hold the lock only while
+    // taking a copy. A deep one as the reference count of a wxMemoryBuffer
+    // isn't thread-safe.
+    compressed.AppendData(m_gnuplotSource_Compressed.GetData(),
+                          m_gnuplotSource_Compressed.GetDataLen());
+  }
 
-      retval.AppendData(output.GetOutputStreamBuffer()->GetBufferStart(),
-                        output.GetOutputStreamBuffer()->GetBufferSize());
+  wxMemoryOutputStream output;
+  wxTextOutputStream textOut(output);
+  if(output.IsOk())
+  {
+    wxMemoryInputStream mstream(compressed.GetData(), compressed.GetDataLen());
+    wxZlibInputStream zstream(mstream);
+    wxTextInputStream textIn(zstream);
+    wxString line;
+  
+    while(!zstream.Eof())
+    {
+      line = textIn.ReadLine();
+      textOut << line + wxT("\n");
     }
-  }
-  #ifdef HAVE_OMP_HEADER
-  omp_unset_lock(&m_gnuplotLock);
-  #endif
+    textOut.Flush();
 
+    retval.AppendData(output.GetOutputStreamBuffer()->GetBufferStart(),
+                      output.GetOutputStreamBuffer()->GetBufferSize());
+  }
   return retval;
 }
 
 wxMemoryBuffer Image::GetGnuplotData()
 {
   wxMemoryBuffer retval;
-  #ifdef HAVE_OMP_HEADER
-  omp_set_lock(&m_gnuplotLock);
-  #else
-  #ifdef HAVE_OPENMP_TASKS
-  #pragma omp taskwait
-  #endif
-  #endif
+  wxMemoryBuffer compressed;
   {
+    std::unique_lock<std::mutex> lock = WaitForGnuplotTask();
     if(
       (m_gnuplotSource_Compressed.GetDataLen() < 2) || 
       (m_gnuplotData_Compressed.GetDataLen() < 2))
-    {
-      #ifdef HAVE_OMP_HEADER
-      omp_unset_lock(&m_gnuplotLock);
-      #endif
       return retval;
-    }
-    
-    wxMemoryOutputStream output;
-    wxTextOutputStream textOut(output);
-    if(output.IsOk())
-    {
-      wxMemoryInputStream mstream(
-        m_gnuplotData_Compressed.GetData(),
-        m_gnuplotData_Compressed.GetDataLen()
-        );
-      wxZlibInputStream zstream(mstream);
-      wxTextInputStream textIn(zstream);
-      wxString line;
-  
-      while(!zstream.Eof())
-      {
-        line = textIn.ReadLine();
-        textOut << line + wxT("\n");
-      }
-      textOut.Flush();
+    // Uncompressing the data may take a while => we hold the lock only while
+    // taking a copy. A deep one as the reference count of a wxMemoryBuffer
+    // isn't thread-safe.
+    compressed.AppendData(m_gnuplotData_Compressed.GetData(),
+                          m_gnuplotData_Compressed.GetDataLen());
+  }
 
-      retval.AppendData(output.GetOutputStreamBuffer()->GetBufferStart(),
-                        output.GetOutputStreamBuffer()->GetBufferSize());
+  wxMemoryOutputStream output;
+  wxTextOutputStream textOut(output);
+  if(output.IsOk())
+  {
+    wxMemoryInputStream mstream(compressed.GetData(), compressed.GetDataLen());
+    wxZlibInputStream zstream(mstream);
+    wxTextInputStream textIn(zstream);
+    wxString line;
+  
+    while(!zstream.Eof())
+    {
+      line = textIn.ReadLine();
+      textOut << line + wxT("\n");
     }
+    textOut.Flush();
+
+    retval.AppendData(output.GetOutputStreamBuffer()->GetBufferStart(),
+                      output.GetOutputStreamBuffer()->GetBufferSize());
   }
-  #ifdef HAVE_OMP_HEADER
-  omp_unset_lock(&m_gnuplotLock);
-  #endif
   return retval;
 }
 
 wxString Image::GnuplotData()
 {
+  std::unique_lock<std::mutex> lock = WaitForGnuplotTask();
   if((!m_gnuplotData.IsEmpty()) && (!wxFileExists(m_gnuplotData)))
   {
-    #ifdef HAVE_OMP_HEADER
-    omp_set_lock(&m_gnuplotLock);
-    #else
-    #ifdef HAVE_OPENMP_TASKS
-    #pragma omp taskwait
-    #endif
-    #endif
     {
     // Move the gnuplot data and data file into our temp directory
       wxFileName gnuplotSourceFile(m_gnuplotSource);
@@ -588,23 +689,14 @@ wxString Image::GnuplotData()
       }
     }
   }
-  #ifdef HAVE_OMP_HEADER
-  omp_unset_lock(&m_gnuplotLock);
-  #endif
   return m_gnuplotData;
 }
 
 wxString Image::GnuplotSource()
 {
-  if((!m_gnuplotSource.IsEmpty()) && (!wxFileExists(m_gnuplotSource)))
   {
-    #ifdef HAVE_OMP_HEADER
-    omp_set_lock(&m_gnuplotLock);
-    #else
-    #ifdef HAVE_OPENMP_TASKS
-    #pragma omp taskwait
-    #endif
-    #endif
+    std::unique_lock<std::mutex> lock = WaitForGnuplotTask();
+    if((!m_gnuplotSource.IsEmpty()) && (!wxFileExists(m_gnuplotSource)))
     {
       // Move the gnuplot source and data file into our temp directory
       wxFileName gnuplotSourceFile(m_gnuplotSource);
@@ -635,9 +727,6 @@ wxString Image::GnuplotSource()
       }
     }
   }
-  #ifdef HAVE_OMP_HEADER
-  omp_unset_lock(&m_gnuplotLock);
-  #endif
   // Restore the data file, as well.
   GnuplotData();
   return m_gnuplotSource;
@@ -725,81 +814,356 @@ wxBitmap Image::GetBitmap(double scale)
   #endif
 
   // Let's see if we have cached the scaled bitmap with the right size
-  if (m_scaledBitmap.GetWidth() == m_width)
+  if (ScaledBitmapReady())
+  {
+    m_bitmapCacheHits++;
+    BitmapCacheTouch();
     return m_scaledBitmap;
+  }
   
   // Seems like we need to create a new scaled bitmap.
-  if (m_svgRast)
+  std::vector<wxImage> mipmaps;
+  SetScaledBitmap(ScaledImage(m_width, m_height, m_compressedImage, mipmaps));
+  return m_scaledBitmap;
+}
+
+wxBitmap Image::GetScreenBitmap(const wxRect &redrawRect)
+{
+  Recalculate();
+  #ifdef HAVE_OMP_HEADER
+  WaitForLoad waitforload(&m_imageLoadLock);
+  #endif
+
+  if (ScaledBitmapReady())
   {
-    // First create rgba data
-    std::unique_ptr<unsigned char> imgdata(new unsigned char[m_width*m_height*4]);
-    if(!imgdata)
+    m_bitmapCacheHits++;
+    BitmapCacheTouch();
+    return m_scaledBitmap;
+  }
+
+  if (ScaleInBackground(redrawRect))
+    return m_scaledBitmap;
+
+  // Until the scaled image is ready we display a quickly-scaled version of the
+  // last bitmap we had or, if there is none, an empty area.
+  if ((m_scaledBitmap.GetWidth() != m_width) || (m_scaledBitmap.GetHeight() != m_height))
+  {
+    if ((m_scaledBitmap.GetWidth() > 1) || (m_scaledBitmap.GetHeight() > 1))
     {
-      #ifdef HAVE_OMP_HEADER
-      omp_unset_lock(&m_gnuplotLock);
-      #endif
-      return wxBitmap();
+      wxImage img = m_scaledBitmap.ConvertToImage();
+      img.Rescale(m_width, m_height, wxIMAGE_QUALITY_NEAREST);
+      m_scaledBitmap = wxBitmap(img);
     }
-    nsvgRasterize(m_svgRast, m_svgImage, 0,0,
-                  ((double)m_width)/((double)m_originalWidth),
-                  imgdata.get(), m_width, m_height, m_width*4);
-    #ifdef HAVE_OMP_HEADER
-    omp_unset_lock(&m_gnuplotLock);
+    else
+    {
+      m_scaledBitmap.Create(m_width, m_height);
+      wxMemoryDC dc;
+      dc.SelectObject(m_scaledBitmap);
+      dc.SetBackground(*(wxTheBrushList->FindOrCreateBrush((*m_configuration)->DefaultBackgroundColor())));
+      dc.Clear();
+    }
+    m_scaledBitmapIsPreview = true;
+  }
+  BitmapCacheTouch();
+  return m_scaledBitmap;
+}
+
+void Image::Prefetch()
+{
+  Recalculate();
+  #ifdef HAVE_OMP_HEADER
+  WaitForLoad waitforload(&m_imageLoadLock);
+  #endif
+
+  if (!ScaledBitmapReady())
+    ScaleInBackground(wxRect());
+}
+
+bool Image::ScaleInBackground(const wxRect &redrawRect)
+{
+  if (TakeScaledImage())
+    return true;
+
+  bool startTask = false;
+  #ifdef HAVE_OMP_HEADER
+  omp_set_lock(&m_scaledImageLock);
+  #endif
+  if (!m_scaleTaskRunning)
+    startTask = m_scaleTaskRunning = true;
+  #ifdef HAVE_OMP_HEADER
+  omp_unset_lock(&m_scaledImageLock);
+  #endif
+
+  if (startTask)
+  {
+    // wxMemoryBuffer isn't thread-safe => the task gets a copy of its own.
+    wxMemoryBuffer *compressedImage = new wxMemoryBuffer;
+    compressedImage->AppendData(m_compressedImage.GetData(), m_compressedImage.GetDataLen());
+    std::shared_ptr<const wxMemoryBuffer> compressedImageCopy(compressedImage);
+    wxWindow *worksheet = (*m_configuration)->GetWorkSheet();
+    long width = m_width;
+    long height = m_height;
+    #if defined HAVE_OMP_HEADER && defined HAVE_OPENMP_TASKS
+    #pragma omp task
     #endif
-    return m_scaledBitmap = SvgBitmap::RGBA2wxBitmap(imgdata.get(), m_width, m_height);
+    ScaleImage_Backgroundtask(width, height, compressedImageCopy, worksheet, redrawRect);
+
+    // Without background tasks the image has been scaled by now.
+    return TakeScaledImage();
   }
-  else
+  return false;
+}
+
+bool Image::TakeScaledImage()
+{
+  wxImage image;
+  bool found = false;
+  #ifdef HAVE_OMP_HEADER
+  omp_set_lock(&m_scaledImageLock);
+  #endif
+  if (m_scaledImageSize == wxSize(m_width, m_height))
+  {
+    image = m_scaledImage;
+    found = true;
+  }
+  if (!m_scaleTaskRunning)
+  {
+    m_scaledImage = wxImage();
+    m_scaledImageSize = wxDefaultSize;
+  }
+  #ifdef HAVE_OMP_HEADER
+  omp_unset_lock(&m_scaledImageLock);
+  #endif
+
+  if (found)
+    SetScaledBitmap(image);
+  return found;
+}
+
+void Image::ScaleImage_Backgroundtask(long width, long height,
+                                      std::shared_ptr<const wxMemoryBuffer> compressedImage,
+                                      wxWindow *worksheet, wxRect redrawRect)
+{
+  // Take over the mipmaps: While we own them nobody else may touch their
+  // (not thread-safe) reference counts.
+  std::vector<wxImage> mipmaps;
+  #ifdef HAVE_OMP_HEADER
+  omp_set_lock(&m_scaledImageLock);
+  #endif
+  mipmaps.swap(m_mipmaps);
+  #ifdef HAVE_OMP_HEADER
+  omp_unset_lock(&m_scaledImageLock);
+  #endif
+
+  wxImage image = ScaledImage(width, height, *compressedImage, mipmaps);
+  long mipmapBytes = 0;
+  for (std::vector<wxImage>::const_iterator it = mipmaps.begin(); it != mipmaps.end(); ++it)
+    mipmapBytes += (long)it->GetWidth() * it->GetHeight() * (it->HasAlpha() ? 4 : 3);
+
+  #ifdef HAVE_OMP_HEADER
+  omp_set_lock(&m_scaledImageLock);
+  #endif
+  m_scaledImage = image;
+  m_scaledImageSize = wxSize(width, height);
+  // If ClearCache() has been called in the meantime this image has left the
+  // cache of scaled bitmaps and nobody would account for the mipmaps.
+  if (!m_discardMipmaps)
+  {
+    m_mipmaps.swap(mipmaps);
+    m_mipmapBytes = mipmapBytes;
+  }
+  m_discardMipmaps = false;
+  mipmaps.clear();
+  m_scaleTaskRunning = false;
+  // wxImage's reference counting isn't thread-safe => Only m_scaledImage may
+  // refer to the image data once we release the lock.
+  image = wxImage();
+  #ifdef HAVE_OMP_HEADER
+  omp_unset_lock(&m_scaledImageLock);
+  #endif
+
+  #if defined HAVE_OMP_HEADER && defined HAVE_OPENMP_TASKS
+  // Tell the worksheet to draw the image we have scaled
+  if ((worksheet != NULL) && (!redrawRect.IsEmpty()))
+  {
+    wxThreadEvent *event = new wxThreadEvent(wxEVT_THREAD);
+    event->SetPayload(redrawRect);
+    worksheet->GetEventHandler()->QueueEvent(event);
+  }
+  #else
+  wxUnusedVar(worksheet);
+  wxUnusedVar(redrawRect);
+  #endif
+}
+
+wxImage Image::ScaledImage(long width, long height, const wxMemoryBuffer &compressedImage,
+                           std::vector<wxImage> &mipmaps)
+{
+  // Make sure we stay within sane defaults
+  if (width < 1) width = 1;
+  if (height < 1) height = 1;
+
+  if (m_svgImage)
+  {
+    // The rasterizer stores intermediate results => every task needs one of its own.
+    struct NSVGrasterizer *svgRast = nsvgCreateRasterizer();
+    if (svgRast == NULL)
+      return wxImage();
+    std::vector<unsigned char> imgdata(width * height * 4);
+    nsvgRasterize(svgRast, m_svgImage, 0,0,
+                  ((double)width)/((double)m_svgImage->width),
+                  imgdata.data(), width, height, width*4);
+    nsvgDeleteRasterizer(svgRast);
+    return SvgBitmap::RGBA2wxImage(imgdata.data(), width, height);
+  }
+
+  // The smallest mipmap level that is at least as big as the image we need
+  std::vector<wxImage>::const_iterator level = mipmaps.end();
+  for (std::vector<wxImage>::const_iterator it = mipmaps.begin(); it != mipmaps.end(); ++it)
+    if ((it->GetWidth() >= width) && (it->GetHeight() >= height))
+      level = it;
+  // The first level is allowed to be smaller than the requested size only
+  // if it is the unscaled image: Upscaling it is what we would do, anyway.
+  if ((level == mipmaps.end()) && (!mipmaps.empty()) &&
+      (mipmaps.front().GetWidth() == (int)m_originalWidth))
+    level = mipmaps.begin();
+
+  if (level == mipmaps.end())
   {
+    // No level is big enough => decode the image again and create new levels.
+    mipmaps.clear();
     wxImage img;
-    if (m_compressedImage.GetDataLen() > 0)
+    if (compressedImage.GetDataLen() > 0)
     {
-      wxMemoryInputStream istream(m_compressedImage.GetData(), m_compressedImage.GetDataLen());
-
+      wxMemoryInputStream istream(compressedImage.GetData(), compressedImage.GetDataLen());
       img = wxImage(istream, wxBITMAP_TYPE_ANY);
     }
-    m_isOk = true;
+    if (!img.Ok())
+      return img;
 
-    if (img.Ok())
-      m_scaledBitmap = wxBitmap(img);
-    else
+    if ((img.GetWidth() <= width) || (img.GetHeight() <= height))
     {
-      m_isOk = false;
-      // Create a "image not loaded" bitmap.
-      m_scaledBitmap.Create(m_width, m_height);
-
-      wxString error;
-      if(m_imageName != wxEmptyString)
-        error = wxString::Format(_("Error: Cannot render %s."), m_imageName.utf8_str());
-      else
-        error = wxString::Format(_("Error: Cannot render the image."));
+      // Zooming in won't ever need anything but this level
+      mipmaps.push_back(img);
+      return img.Scale(width, height, wxIMAGE_QUALITY_BICUBIC);
+    }
 
-      wxMemoryDC dc;
-      dc.SelectObject(m_scaledBitmap);
+    // The first level is at most twice the current size: It allows to zoom in
+    // a bit without needing to decode the image again, but doesn't keep much
+    // more pixels in memory than we need.
+    while ((img.GetWidth() >= 2 * width) && (img.GetHeight() >= 2 * height))
+      img = img.ShrinkBy(2, 2);
+    // The rest of the levels allows to zoom out quickly.
+    while ((mipmaps.size() < 6) && (img.GetWidth() >= 32) && (img.GetHeight() >= 32))
+    {
+      mipmaps.push_back(img);
+      img = img.ShrinkBy(2, 2);
+    }
+    if (mipmaps.empty())
+      mipmaps.push_back(img);
+    return ScaledImage(width, height, compressedImage, mipmaps);
+  }
 
-      int width = 0, height = 0;
-      dc.GetTextExtent(error, &width, &height);
+  // The level is less than twice as big as the image we need: A fast
+  // scaling algorithm will produce a good result.
+  if ((level->GetWidth() == width) && (level->GetHeight() == height))
+    return level->Copy();
+  return level->Scale(width, height, wxIMAGE_QUALITY_BILINEAR);
+}
 
-      dc.DrawRectangle(0, 0, m_width - 1, m_height - 1);
-      dc.DrawLine(0, 0, m_width - 1, m_height - 1);
-      dc.DrawLine(0, m_height - 1, m_width - 1, 0);
+void Image::ClearCache()
+{
+  if ((m_scaledBitmap.GetWidth() > 1) || (m_scaledBitmap.GetHeight() > 1))
+    m_scaledBitmap.Create(1, 1);
+  #ifdef HAVE_OMP_HEADER
+  omp_set_lock(&m_scaledImageLock);
+  #endif
+  m_mipmaps.clear();
+  m_mipmapBytes = 0;
+  // A running scale task owns the mipmaps it works with => it drops them.
+  if (m_scaleTaskRunning)
+    m_discardMipmaps = true;
+  #ifdef HAVE_OMP_HEADER
+  omp_unset_lock(&m_scaledImageLock);
+  #endif
+  BitmapCacheRemove();
+}
 
-      dc.GetTextExtent(error, &width, &height);
-      dc.DrawText(error, (m_width - width) / 2, (m_height - height) / 2);
-    }
+void Image::SetScaledBitmap(const wxImage &image)
+{
+  m_bitmapCacheMisses++;
+  m_scaledBitmapIsPreview = false;
+  if (image.Ok())
+  {
+    m_isOk = true;
+    if (m_svgImage)
+      m_scaledBitmap = wxBitmap(image);
+    else
+      m_scaledBitmap = wxBitmap(image, 24);
+    BitmapCacheTouch();
+    return;
   }
 
-  // Make sure we stay within sane defaults
-  if (m_width < 1)m_width = 1;
-  if (m_height < 1)m_height = 1;
+  m_isOk = false;
+  // Create a "image not loaded" bitmap.
+  m_scaledBitmap.Create(m_width, m_height);
+
+  wxString error;
+  if(m_imageName != wxEmptyString)
+    error = wxString::Format(_("Error: Cannot render %s."), m_imageName.utf8_str());
+  else
+    error = wxString::Format(_("Error: Cannot render the image."));
+
+  wxMemoryDC dc;
+  dc.SelectObject(m_scaledBitmap);
+
+  int width = 0, height = 0;
+  dc.GetTextExtent(error, &width, &height);
 
-  // Create a scaled bitmap and return it.
-  wxImage img = m_scaledBitmap.ConvertToImage();
-  img.Rescale(m_width, m_height, wxIMAGE_QUALITY_BICUBIC);
-  m_scaledBitmap = wxBitmap(img, 24);
+  dc.DrawRectangle(0, 0, m_width - 1, m_height - 1);
+  dc.DrawLine(0, 0, m_width - 1, m_height - 1);
+  dc.DrawLine(0, m_height - 1, m_width - 1, 0);
+
+  dc.GetTextExtent(error, &width, &height);
+  dc.DrawText(error, (m_width - width) / 2, (m_height - height) / 2);
+  BitmapCacheTouch();
+}
+
+void Image::BitmapCacheTouch()
+{
+  long bytes = (long)m_scaledBitmap.GetWidth() * m_scaledBitmap.GetHeight() * 4;
   #ifdef HAVE_OMP_HEADER
-  omp_unset_lock(&m_gnuplotLock);
+  omp_set_lock(&m_scaledImageLock);
   #endif
-  return m_scaledBitmap;
+  bytes += m_mipmapBytes;
+  #ifdef HAVE_OMP_HEADER
+  omp_unset_lock(&m_scaledImageLock);
+  #endif
+  if (m_inBitmapCache)
+    m_bitmapCache.erase(m_bitmapCachePosition);
+  m_bitmapCache.push_front(this);
+  m_bitmapCachePosition = m_bitmapCache.begin();
+  m_inBitmapCache = true;
+  m_bitmapCacheBytes += bytes - m_bitmapCacheBytesUsed;
+  m_bitmapCacheBytesUsed = bytes;
+
+  long budget = (long)(*m_configuration)->ImageCacheMegabytes() * 1024 * 1024;
+  if (m_bitmapCacheBytes <= budget)
+    return;
+
+  // Forget the bitmaps that weren't displayed for the longest time.
+  while ((m_bitmapCacheBytes > budget) && (m_bitmapCache.back() != this))
+    m_bitmapCache.back()->ClearCache();
+}
+
+void Image::BitmapCacheRemove()
+{
+  if (!m_inBitmapCache)
+    return;
+  m_bitmapCache.erase(m_bitmapCachePosition);
+  m_inBitmapCache = false;
+  m_bitmapCacheBytes -= m_bitmapCacheBytesUsed;
+  m_bitmapCacheBytesUsed = 0;
 }
 
 void Image::LoadImage(const wxBitmap &bitmap)
@@ -820,6 +1184,7 @@ void Image::LoadImage(const wxBitmap &bitmap)
   m_originalWidth = image.GetWidth();
   m_originalHeight = image.GetHeight();
   m_scaledBitmap.Create(1, 1);
+  BitmapCacheRemove();
   m_width = 1;
   m_height = 1;
 }
@@ -872,6 +1237,7 @@ void Image::LoadImage_Backgroundtask(wxString image, const std::shared_ptr<wxFil
     // Closing and deleting fsfile is important: If this line is missing
     // opening .wxmx files containing hundreds of images might lead to a
     // "too many open files" error.
+    wxDELETE(fsfile);
   }
   else
   {
@@ -942,31 +1308,7 @@ void Image::LoadImage_Backgroundtask(wxString image, const std::shared_ptr<wxFil
           svgContents_string += line + wxT("\n");
         }
       }
-      // Convert the data we have read to a modifyable char * containing the svg file's contents.
-      char *svgContents;
-      svgContents = (char *)strdup(svgContents_string.utf8_str());
-
-      // Parse the svg file's contents
-      int ppi;
-      if((*m_configuration)->GetDC()->GetPPI().x > 50)
-        ppi = (*m_configuration)->GetDC()->GetPPI().x;
-      else
-        ppi = 96;
-      
-      if(svgContents)
-      {
-        m_svgImage = nsvgParse(svgContents, "px", ppi);
-        delete(svgContents);
-      }
-
-      if(m_svgImage)
-      {
-	m_svgRast = nsvgCreateRasterizer();
-        if(m_svgRast)
-          m_isOk = true;
-        m_originalWidth = m_svgImage->width;
-        m_originalHeight = m_svgImage->height;
-      }
+      ParseSVG(svgContents_string);
     }
     else
     {   
@@ -991,6 +1333,35 @@ void Image::LoadImage_Backgroundtask(wxString image, const std::shared_ptr<wxFil
   #endif
 }
 
+void Image::ParseSVG(const wxString &svgContents_string)
+{
+  // Convert the data we have read to a modifyable char * containing the svg file's contents.
+  char *svgContents;
+  svgContents = (char *)strdup(svgContents_string.utf8_str());
+
+  // Parse the svg file's contents
+  int ppi;
+  if((*m_configuration)->GetDC()->GetPPI().x > 50)
+    ppi = (*m_configuration)->GetDC()->GetPPI().x;
+  else
+    ppi = 96;
+
+  if(svgContents)
+  {
+    m_svgImage = nsvgParse(svgContents, "px", ppi);
+    delete(svgContents);
+  }
+
+  if(m_svgImage)
+  {
+    m_svgRast = nsvgCreateRasterizer();
+    if(m_svgRast)
+      m_isOk = true;
+    m_originalWidth = m_svgImage->width;
+    m_originalHeight = m_svgImage->height;
+  }
+}
+
 void Image::Recalculate(double scale)
 {
   #ifdef HAVE_OMP_HEADER
@@ -1055,8 +1426,6 @@ void Image::Recalculate(double scale)
     m_height = 100;
     m_width = 100;
   }
-// Clear this cell's image cache if it doesn't contain an image of the size
-  // we need right now.
-  if (m_scaledBitmap.GetWidth() != m_width)
-    ClearCache();
+  // A scaled bitmap of the wrong size isn't cleared here: GetScreenBitmap()
+  // displays it until a bitmap of the right size is ready.
 }
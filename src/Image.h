@@ -36,6 +36,10 @@
 #include <wx/filesys.h>
 #include <wx/fs_arc.h>
 #include <wx/buffer.h>
+#include <list>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
 #include "nanoSVG/nanosvg.h"
 #include "nanoSVG/nanosvgrast.h"
 
@@ -91,6 +95,16 @@ public:
    */
   Image(Configuration **config, wxString image, const std::shared_ptr<wxFileSystem> &filesystem, bool remove = true);
 
+  /*! A copy constructor
+
+    The copy shares neither the scaled bitmap nor the mipmaps or the background
+    tasks of the original: It scales the image itself once it is drawn.
+   */
+  Image(const Image &image);
+
+  //! Images are copied by the copy constructor, only.
+  Image &operator=(const Image &image) = delete;
+
   ~Image();
 
   /*! Sets the name of the gnuplot source and data file of this image
@@ -130,8 +144,14 @@ public:
 
     Will recreate the scaled image as soon as needed.
    */
-  void ClearCache()
-    { if ((m_scaledBitmap.GetWidth() > 1) || (m_scaledBitmap.GetHeight() > 1))m_scaledBitmap.Create(1, 1); }
+  void ClearCache();
+
+  //! How often a scaled bitmap could be reused since wxMaxima was started
+  static long BitmapCacheHits(){return m_bitmapCacheHits;}
+  //! How often an image had to be decoded and scaled since wxMaxima was started
+  static long BitmapCacheMisses(){return m_bitmapCacheMisses;}
+  //! How many bytes the scaled bitmaps of all images currently occupy
+  static long BitmapCacheBytes(){return m_bitmapCacheBytes;}
   
   //! Reads the compressed image into a memory buffer
   static wxMemoryBuffer ReadCompressedImage(wxInputStream *data);
@@ -160,6 +180,27 @@ public:
   //! Returns the bitmap being displayed with custom scale
   wxBitmap GetBitmap(double scale = 1.0);
 
+  /*! Returns the bitmap to be displayed on the worksheet
+
+    Decoding and scaling the image is done in a background task so scrolling 
+    past a plot doesn't have to wait for it. Until the task is finished a 
+    preliminary bitmap is returned: The last bitmap we had, quickly scaled to 
+    the new size, or an empty one.
+    \param redrawRect The part of the worksheet that has to be redrawn as soon
+                      as the scaled bitmap is ready.
+   */
+  wxBitmap GetScreenBitmap(const wxRect &redrawRect);
+
+  /*! Starts scaling the image to the size it will be displayed with in the background
+
+    Allows an animation to prepare the frames it will show next.
+   */
+  void Prefetch();
+
+  //! Does m_scaledBitmap contain the image at the size it is displayed with?
+  bool ScaledBitmapReady() const
+    { return (m_scaledBitmap.GetWidth() == m_width) && (!m_scaledBitmapIsPreview); }
+
   //! Does the image show an actual image or an "broken image" symbol?
   bool IsOk();
   
@@ -218,6 +259,55 @@ protected:
   size_t m_originalHeight;
   //! The bitmap, scaled down to the screen size
   wxBitmap m_scaledBitmap;
+  //! Is m_scaledBitmap only a stand-in until the background task has scaled the image?
+  bool m_scaledBitmapIsPreview;
+  //! The image the last background task has scaled
+  wxImage m_scaledImage;
+  //! The size the background task was asked to scale m_scaledImage to
+  wxSize m_scaledImageSize;
+  //! Is a background task currently scaling this image?
+  bool m_scaleTaskRunning;
+  //! Has ClearCache() been called while the scale task owned the mipmaps?
+  bool m_discardMipmaps;
+  //! Is a background task currently loading the gnuplot data of this image?
+  bool m_gnuplotTaskRunning;
+  //! Guards m_gnuplotTaskRunning and, once no task loads them, the gnuplot data
+  mutable std::mutex m_gnuplotMutex;
+  //! Notified when the task that loads the gnuplot data has finished
+  mutable std::condition_variable m_gnuplotTaskDone;
+  /*! Wait until the task that loads the gnuplot data has finished
+
+    \return A lock on m_gnuplotMutex the caller may access the gnuplot data
+            with until it releases it.
+   */
+  std::unique_lock<std::mutex> WaitForGnuplotTask() const;
+  //! Wait until the task that scales this image has finished
+  void WaitForScaleTask();
+  /*! The mipmap levels ScaledImage() has created for this image
+
+    Allow to quickly scale the image to a new size on zooming. While a 
+    background task scales the image it owns them and this vector is empty.
+  */
+  std::vector<wxImage> m_mipmaps;
+  //! The number of bytes m_mipmaps occupies
+  long m_mipmapBytes;
+  //! Are we in m_bitmapCache?
+  bool m_inBitmapCache;
+  //! Our position in m_bitmapCache
+  std::list<Image *>::iterator m_bitmapCachePosition;
+  //! The number of bytes we have added to m_bitmapCacheBytes
+  long m_bitmapCacheBytesUsed;
+  /*! All images that keep a scaled bitmap, the one that was used most recently first
+
+    Only accessed from the main thread as wxBitmaps may only be created there, anyway.
+  */
+  static std::list<Image *> m_bitmapCache;
+  //! The number of bytes the scaled bitmaps in m_bitmapCache occupy
+  static long m_bitmapCacheBytes;
+  //! How often a scaled bitmap could be reused
+  static long m_bitmapCacheHits;
+  //! How often an image had to be decoded and scaled
+  static long m_bitmapCacheMisses;
   //! The file extension for the current image type
   wxString m_extension;
   //! Does this image contain an actual image?
@@ -227,6 +317,46 @@ protected:
   //! The gnuplot data file for this image, if any.
   wxString m_gnuplotData;
   void LoadImage_Backgroundtask(wxString image, const std::shared_ptr<wxFileSystem> &filesystem, bool remove);
+  //! Creates m_svgImage and m_svgRast from the contents of a .svg file
+  void ParseSVG(const wxString &svgContents);
+  /*! Decodes the image and scales it to width x height
+
+    Creates no wxBitmaps which means that it can be called from a background task.
+    \param mipmaps Copies of the decoded image, each of them half the size of
+                   the previous one. If one of them is at least as big as the 
+                   requested size it is scaled down instead of decoding the 
+                   image again. Else the levels are created anew.
+    \return The scaled image or an invalid wxImage, if the image could not be decoded.
+   */
+  wxImage ScaledImage(long width, long height, const wxMemoryBuffer &compressedImage,
+                      std::vector<wxImage> &mipmaps);
+  //! Scales the image and stores the result in m_scaledImage
+  void ScaleImage_Backgroundtask(long width, long height,
+                                 std::shared_ptr<const wxMemoryBuffer> compressedImage,
+                                 wxWindow *worksheet, wxRect redrawRect);
+  //! Makes m_scaledBitmap from image, or an "image cannot be rendered" bitmap, if it isn't ok.
+  void SetScaledBitmap(const wxImage &image);
+  /*! Takes over the image a background task has scaled, if it has the current size
+
+    \return true, if m_scaledBitmap now is up-to-date.
+  */
+  bool TakeScaledImage();
+  /*! Starts a background task that scales the image to the current size, if needed
+
+    \param redrawRect The part of the worksheet that is to be redrawn once the task
+                      has finished. An empty rectangle means: Nothing.
+    \return true, if m_scaledBitmap already is up-to-date.
+  */
+  bool ScaleInBackground(const wxRect &redrawRect);
+
+  /*! Tell the cache of scaled bitmaps that m_scaledBitmap has just been used
+
+    If the scaled bitmaps of all images need more memory than the configuration
+    allows for the ones that weren't used for the longest time are cleared.
+  */
+  void BitmapCacheTouch();
+  //! Tell the cache of scaled bitmaps that we don't keep a scaled bitmap any more
+  void BitmapCacheRemove();
   void LoadGnuplotSource_Backgroundtask(wxString gnuplotFilename, wxString dataFilename, const std::shared_ptr<wxFileSystem> &filesystem);
 
 private:
@@ -244,8 +374,9 @@ private:
   std::shared_ptr<wxFileSystem> m_fs_keepalive_gnuplotdata;
   std::shared_ptr<wxFileSystem> m_fs_keepalive_imagedata;
   #ifdef HAVE_OMP_HEADER
-  omp_lock_t m_gnuplotLock;
   omp_lock_t m_imageLoadLock;
+  //! Guards m_scaledImage, m_scaledImageSize, m_scaleTaskRunning, m_discardMipmaps and m_mipmaps
+  omp_lock_t m_scaledImageLock;
   #endif
   
 };
@@ -36,7 +36,6 @@
 #include <wx/file.h>
 #include <wx/filename.h>
 #include <wx/filesys.h>
-#include <wx/fs_mem.h>
 #include <wx/clipbrd.h>
 #include <wx/mstream.h>
 
@@ -198,7 +197,14 @@ void ImgCell::Draw(wxPoint point)
       dc->DrawRectangle(wxRect(point.x, point.y - m_center, m_width, m_height));
 
     // Use printing-scale while in printing-mode.
-    wxBitmap bitmap = (configuration->GetPrinting() ? m_image->GetBitmap(configuration->GetZoomFactor() * PRINT_SIZE_MULTIPLIER) : m_image->GetBitmap());
+    wxBitmap bitmap;
+    if (configuration->GetPrinting())
+      bitmap = m_image->GetBitmap(configuration->GetZoomFactor() * PRINT_SIZE_MULTIPLIER);
+    else if (configuration->ClipToDrawRegion())
+      // Drawing the worksheet: Don't wait for the image to be scaled.
+      bitmap = m_image->GetScreenBitmap(GetRect());
+    else
+      bitmap = m_image->GetBitmap();
     bitmapDC.SelectObject(bitmap);
 
     if ((m_drawBoundingBox == false) || (m_imageBorderWidth > 0))
@@ -294,10 +300,8 @@ wxString ImgCell::ToXML()
   if (m_image)
   {
     if (m_image->GetCompressedImage())
-      wxMemoryFSHandler::AddFile(basename + m_image->GetExtension(),
-                                 m_image->GetCompressedImage().GetData(),
-                                 m_image->GetCompressedImage().GetDataLen()
-      );
+      m_cellPointers->WXMXAddFile(basename + m_image->GetExtension(),
+                                  m_image->GetCompressedImage());
   }
 
   wxString flags;
@@ -336,10 +340,7 @@ wxString ImgCell::ToXML()
       wxMemoryBuffer data = m_image->GetGnuplotSource();
       if(data.GetDataLen() > 0)
       {
-        wxMemoryFSHandler::AddFile(gnuplotSource,
-                                   data.GetData(),
-                                   data.GetDataLen()
-          );
+        m_cellPointers->WXMXAddFile(gnuplotSource, data);
       }
     }
     if(gnuplotData != wxEmptyString)
@@ -348,10 +349,7 @@ wxString ImgCell::ToXML()
       wxMemoryBuffer data = m_image->GetGnuplotData();
       if(data.GetDataLen() > 0)
       {
-        wxMemoryFSHandler::AddFile(gnuplotData,
-                                   data.GetData(),
-                                   data.GetDataLen()
-          );
+        m_cellPointers->WXMXAddFile(gnuplotData, data);
       }
     }
   }
@@ -0,0 +1,181 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2019 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//  SPDX-License-Identifier: GPL-2.0+
+
+/*! \file
+  This file defines the class LazyCell
+
+  LazyCell is the Cell type that stands for the part of a long expression that
+  hasn't been parsed, yet.
+ */
+
+#include <algorithm>
+#include "LazyCell.h"
+#include "MathParser.h"
+
+LazyCell::LazyCell(Cell *parent, Configuration **config, CellPointers *cellPointers,
+                   const std::list<wxString> &chunks, CellType parserStyle) :
+  TextCell(parent, config, cellPointers, wxEmptyString, TS_DEFAULT),
+  m_chunks(chunks),
+  m_parserStyle(parserStyle)
+{
+  UpdateText();
+}
+
+LazyCell::LazyCell(const LazyCell &cell) :
+  TextCell(cell),
+  m_chunks(cell.m_chunks),
+  m_parserStyle(cell.m_parserStyle)
+{
+}
+
+LazyCell::~LazyCell()
+{
+  LazyCell::MarkAsDeleted();
+}
+
+void LazyCell::MarkAsDeleted()
+{
+  m_cellPointers->m_lazyCellsToExpand.remove(this);
+  TextCell::MarkAsDeleted();
+}
+
+void LazyCell::UpdateText()
+{
+  SetValue(wxString::Format(_("(%lu more parts of this expression are displayed once they are scrolled into view)"),
+                            (unsigned long) m_chunks.size()));
+}
+
+Cell *LazyCell::Expand()
+{
+  MathParser parser(m_configuration, m_cellPointers);
+  Cell *retval = NULL;
+  while ((retval == NULL) && (!m_chunks.empty()))
+    retval = parser.ParseChunks(m_chunks, m_parserStyle);
+  UpdateText();
+  return retval;
+}
+
+Cell *LazyCell::ParseAll()
+{
+  std::list<wxString> chunks(m_chunks);
+  MathParser parser(m_configuration, m_cellPointers);
+  Cell *retval = NULL;
+  Cell *last = NULL;
+  while (!chunks.empty())
+  {
+    Cell *cell = parser.ParseChunks(chunks, m_parserStyle);
+    if (cell == NULL)
+      continue;
+    if (retval == NULL)
+      retval = last = cell;
+    else
+      last->AppendCell(cell);
+    while (last->m_next != NULL)
+      last = last->m_next;
+  }
+  if (retval != NULL)
+    retval->SetGroupList(m_group);
+  return retval;
+}
+
+void LazyCell::Draw(wxPoint point)
+{
+  TextCell::Draw(point);
+
+  // We are visible => The next part of the expression is needed.
+  if ((*m_configuration)->ClipToDrawRegion() && DrawThisCell(point) && (!IsExpanded()))
+  {
+    std::list<Cell *> &toExpand = m_cellPointers->m_lazyCellsToExpand;
+    if (std::find(toExpand.begin(), toExpand.end(), this) == toExpand.end())
+      toExpand.push_back(this);
+  }
+}
+
+wxString LazyCell::ToString()
+{
+  Cell *cells = ParseAll();
+  if (cells == NULL)
+    return wxEmptyString;
+  wxString retval = cells->ListToString();
+  if (cells->BreakLineHere())
+    retval = wxT("\n") + retval;
+  wxDELETE(cells);
+  return retval;
+}
+
+wxString LazyCell::ToMatlab()
+{
+  Cell *cells = ParseAll();
+  if (cells == NULL)
+    return wxEmptyString;
+  wxString retval = cells->ListToMatlab();
+  wxDELETE(cells);
+  return retval;
+}
+
+wxString LazyCell::ToTeX()
+{
+  Cell *cells = ParseAll();
+  if (cells == NULL)
+    return wxEmptyString;
+  wxString retval = cells->ListToTeX();
+  wxDELETE(cells);
+  return retval;
+}
+
+wxString LazyCell::ToMathML()
+{
+  Cell *cells = ParseAll();
+  if (cells == NULL)
+    return wxEmptyString;
+  wxString retval = cells->ListToMathML();
+  wxDELETE(cells);
+  return retval;
+}
+
+wxString LazyCell::ToOMML()
+{
+  Cell *cells = ParseAll();
+  if (cells == NULL)
+    return wxEmptyString;
+  wxString retval = cells->ListToOMML();
+  wxDELETE(cells);
+  return retval;
+}
+
+wxString LazyCell::ToRTF()
+{
+  Cell *cells = ParseAll();
+  if (cells == NULL)
+    return wxEmptyString;
+  wxString retval = cells->ListToRTF();
+  wxDELETE(cells);
+  return retval;
+}
+
+wxString LazyCell::ToXML()
+{
+  // The chunks already are in the format .wxmx files store math in.
+  wxString retval;
+  for (std::list<wxString>::const_iterator it = m_chunks.begin(); it != m_chunks.end(); ++it)
+    retval += *it;
+  return retval;
+}
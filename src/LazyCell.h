@@ -0,0 +1,105 @@
+// -*- mode: c++; c-file-style: "linux"; c-basic-offset: 2; indent-tabs-mode: nil -*-
+//
+//  Copyright (C) 2019 Gunter Königsmann <wxMaxima@physikbuch.de>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//  SPDX-License-Identifier: GPL-2.0+
+
+/*! \file
+  This file declares the class LazyCell
+
+  LazyCell is the Cell type that stands for the part of a long expression that
+  hasn't been parsed, yet.
+*/
+
+#ifndef LAZYCELL_H
+#define LAZYCELL_H
+
+#include <list>
+#include "TextCell.h"
+
+/*! The part of a long expression that hasn't been converted to cells, yet
+
+  MathParser::ParseLine() only parses as much of a long expression as the
+  "show long expressions" setting allows to be displayed at once. The xml of the
+  rest of the expression is kept in this cell that displays a short note instead.
+
+  As soon as this cell is drawn it asks the worksheet to parse the next part of
+  the expression: GroupCell::ExpandLazyCell() inserts the resulting cells in front
+  of this cell and removes this cell once all of the expression has been parsed.
+  Which means that the number of cells that are created and layouted only grows
+  as the user scrolls down the expression.
+ */
+class LazyCell : public TextCell
+{
+public:
+  /*! The constructor
+
+    \param chunks The xml chunks MathParser::ParseLine() hasn't parsed, yet.
+    \param parserStyle The CellType the cells that are parsed from these chunks get.
+   */
+  LazyCell(Cell *parent, Configuration **config, CellPointers *cellPointers,
+           const std::list<wxString> &chunks, CellType parserStyle);
+  LazyCell(const LazyCell &cell);
+  Cell *Copy() override {return new LazyCell(*this);}
+  //! This class can be derived from wxAccessible which has no copy constructor
+  LazyCell &operator=(const LazyCell&) = delete;
+
+  ~LazyCell();
+
+  void MarkAsDeleted() override;
+
+  /*! Parses the next part of the expression
+
+    \return The cells the next part of the expression consists of or NULL, 
+    if all of the expression has already been parsed.
+   */
+  Cell *Expand();
+
+  //! Is all of the expression parsed?
+  bool IsExpanded() const {return m_chunks.empty();}
+
+  void Draw(wxPoint point) override;
+
+  wxString ToString() override;
+
+  wxString ToMatlab() override;
+
+  wxString ToTeX() override;
+
+  wxString ToMathML() override;
+
+  wxString ToOMML() override;
+
+  wxString ToRTF() override;
+
+  wxString ToXML() override;
+
+private:
+  //! Parses all of the remaining expression without changing this cell
+  Cell *ParseAll();
+
+  //! Updates the note this cell displays
+  void UpdateText();
+
+  //! The xml chunks that haven't been parsed, yet
+  std::list<wxString> m_chunks;
+  //! The CellType the parsed cells get
+  CellType m_parserStyle;
+};
+
+#endif // LAZYCELL_H
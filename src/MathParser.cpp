@@ -29,6 +29,10 @@
 #include <wx/sstream.h>
 #include <wx/regex.h>
 #include <wx/intl.h>
+#include <wx/dir.h>
+#include <wx/filename.h>
+#include <wx/stopwatch.h>
+#include <iostream>
 
 #include "MathParser.h"
 
@@ -50,6 +54,7 @@
 #include "SubSupCell.h"
 #include "SlideShowCell.h"
 #include "GroupCell.h"
+#include "LazyCell.h"
 
 wxXmlNode *MathParser::SkipWhitespaceNode(wxXmlNode *node)
 {
@@ -90,6 +95,13 @@ MathParser::MathParser(Configuration **cfg, Cell::CellPointers *cellPointers, wx
   }
 }
 
+MathParser::MathParser(Configuration **cfg, Cell::CellPointers *cellPointers,
+                       const std::shared_ptr<wxFileSystem> &filesystem) :
+  MathParser(cfg, cellPointers)
+{
+  m_fileSystem = filesystem;
+}
+
 MathParser::~MathParser()
 {
 }
@@ -315,208 +327,11 @@ Cell *MathParser::ParseEditorTag(wxXmlNode *node)
   return editor;
 }
 
-Cell *MathParser::ParseFracTag(wxXmlNode *node)
-{
-  FracCell *frac = new FracCell(NULL, m_configuration, m_cellPointers);
-  frac->SetFracStyle(m_FracStyle);
-  frac->SetHighlight(m_highlight);
-  wxXmlNode *child = node->GetChildren();
-  child = SkipWhitespaceNode(child);
-  frac->SetNum(HandleNullPointer(ParseTag(child, false)));
-  child = GetNextTag(child);
-  frac->SetDenom(HandleNullPointer(ParseTag(child, false)));
-  
-  if (node->GetAttribute(wxT("line")) == wxT("no"))
-    frac->SetFracStyle(FracCell::FC_CHOOSE);
-  if (node->GetAttribute(wxT("diffstyle")) == wxT("yes"))
-    frac->SetFracStyle(FracCell::FC_DIFF);
-  frac->SetType(m_ParserStyle);
-  frac->SetStyle(TS_VARIABLE);
-  frac->SetupBreakUps();
-  ParseCommonAttrs(node, frac);
-  return frac;
-}
-
-Cell *MathParser::ParseDiffTag(wxXmlNode *node)
-{
-  DiffCell *diff = new DiffCell(NULL, m_configuration, m_cellPointers);
-  wxXmlNode *child = node->GetChildren();
-  child = SkipWhitespaceNode(child);
-  if (child)
-  {
-    int fc = m_FracStyle;
-    m_FracStyle = FracCell::FC_DIFF;
-
-    diff->SetDiff(HandleNullPointer(ParseTag(child, false)));
-    m_FracStyle = fc;
-    child = GetNextTag(child);
-
-    diff->SetBase(HandleNullPointer(ParseTag(child, true)));
-    diff->SetType(m_ParserStyle);
-    diff->SetStyle(TS_VARIABLE);
-  }
-  ParseCommonAttrs(node, diff);
-  return diff;
-}
-
-Cell *MathParser::ParseSupTag(wxXmlNode *node)
-{
-  ExptCell *expt = new ExptCell(NULL, m_configuration, m_cellPointers);
-  if (node->GetAttributes() != NULL)
-    expt->IsMatrix(true);
-  wxXmlNode *child = node->GetChildren();
-  child = SkipWhitespaceNode(child);
-
-  Cell *baseCell;
-    expt->SetBase(baseCell = HandleNullPointer(ParseTag(child, false)));
-  child = GetNextTag(child);
-
-  Cell *power = HandleNullPointer(ParseTag(child, false));
-  power->SetExponentFlag();
-  expt->SetPower(power);
-  expt->SetType(m_ParserStyle);
-  expt->SetStyle(TS_VARIABLE);
-
-  ParseCommonAttrs(node, expt);
-  if(node->GetAttribute(wxT("mat"), wxT("false")) == wxT("true"))
-    expt->SetAltCopyText(baseCell->ToString()+wxT("^^")+power->ToString());
-
-  return expt;
-}
-
-Cell *MathParser::ParseSubSupTag(wxXmlNode *node)
-{
-  SubSupCell *subsup = new SubSupCell(NULL, m_configuration, m_cellPointers);
-  wxXmlNode *child = node->GetChildren();
-  child = SkipWhitespaceNode(child);
-  subsup->SetBase(HandleNullPointer(ParseTag(child, false)));
-  child = GetNextTag(child);
-  wxString pos;
-  if((child != NULL) && (child->GetAttribute("pos", wxEmptyString) != wxEmptyString))
-  {
-    while(child != NULL)
-    {
-      Cell *cell = HandleNullPointer(ParseTag(child, false));
-      pos = child->GetAttribute("pos", wxEmptyString);
-      if(pos == "presub")
-        subsup->SetPreSub(cell);
-      if(pos == "presup")
-        subsup->SetPreSup(cell);
-      if(pos == "postsup")
-        subsup->SetPostSup(cell);
-      if(pos == "postsub")
-        subsup->SetPostSub(cell);
-      child = SkipWhitespaceNode(child);
-      child = GetNextTag(child);
-    }
-  }
-  else
-  {
-    Cell *index = HandleNullPointer(ParseTag(child, false));
-    index->SetExponentFlag();
-    subsup->SetIndex(index);
-    child = GetNextTag(child);
-    Cell *power = HandleNullPointer(ParseTag(child, false));
-    power->SetExponentFlag();
-    subsup->SetExponent(power);
-    subsup->SetType(m_ParserStyle);
-    subsup->SetStyle(TS_VARIABLE);
-    ParseCommonAttrs(node, subsup);
-  }
-  return subsup;
-}
-
-Cell *MathParser::ParseMmultiscriptsTag(wxXmlNode *node)
-{
-  bool pre = false;
-  bool subscript = true;
-  SubSupCell *subsup = new SubSupCell(NULL, m_configuration, m_cellPointers);
-  wxXmlNode *child = node->GetChildren();
-  child = SkipWhitespaceNode(child);
-  subsup->SetBase(HandleNullPointer(ParseTag(child, false)));
-  child = GetNextTag(child);
-  while(child != NULL)
-  {
-    if(child->GetName() == "mprescripts")
-    {
-      pre = true;
-      subscript = true;
-      child = GetNextTag(child);
-      continue;
-    }
-    
-    if(child->GetName() != "none")
-    {
-      if(pre && subscript)
-        subsup->SetPreSub(ParseTag(child, false));
-      if(pre && (!subscript))
-        subsup->SetPreSup(ParseTag(child, false));
-      if((!pre) && subscript)
-        subsup->SetPostSub(ParseTag(child, false));
-      if((!pre) && (!subscript))
-        subsup->SetPostSup(ParseTag(child, false));
-    }
-    subscript = !subscript;
-    child = SkipWhitespaceNode(child);
-    child = GetNextTag(child);
-  }
-  return subsup;
-}
-
-Cell *MathParser::ParseSubTag(wxXmlNode *node)
-{
-  SubCell *sub = new SubCell(NULL, m_configuration, m_cellPointers);
-  wxXmlNode *child = node->GetChildren();
-  child = SkipWhitespaceNode(child);
-  sub->SetBase(HandleNullPointer(ParseTag(child, false)));
-  child = GetNextTag(child);
-  Cell *index = HandleNullPointer(ParseTag(child, false));
-  sub->SetIndex(index);
-  index->SetExponentFlag();
-  sub->SetType(m_ParserStyle);
-  sub->SetStyle(TS_VARIABLE);
-  ParseCommonAttrs(node, sub);
-  return sub;
-}
-
-Cell *MathParser::ParseAtTag(wxXmlNode *node)
-{
-  AtCell *at = new AtCell(NULL, m_configuration, m_cellPointers);
-  wxXmlNode *child = node->GetChildren();
-  child = SkipWhitespaceNode(child);
-
-  at->SetBase(HandleNullPointer(ParseTag(child, false)));
-  at->SetHighlight(m_highlight);
-  child = GetNextTag(child);
-  at->SetIndex(HandleNullPointer(ParseTag(child, false)));
-  at->SetType(m_ParserStyle);
-  at->SetStyle(TS_VARIABLE);
-  ParseCommonAttrs(node, at);
-  return at;
-}
-
-Cell *MathParser::ParseFunTag(wxXmlNode *node)
-{
-  FunCell *fun = new FunCell(NULL, m_configuration, m_cellPointers);
-  wxXmlNode *child = node->GetChildren();
-  child = SkipWhitespaceNode(child);
-
-  fun->SetName(HandleNullPointer(ParseTag(child, false)));
-  child = GetNextTag(child);
-  fun->SetType(m_ParserStyle);
-  fun->SetStyle(TS_FUNCTION);
-  fun->SetArg(HandleNullPointer(ParseTag(child, false)));
-  ParseCommonAttrs(node, fun);
-  if((fun != NULL) && (fun->ToString().Contains(")(")))
-    fun->SetToolTip(_("If this isn't a function returning a lambda() expression a multiplication sign (*) between closing and opening parenthesis is missing here."));
-  return fun;
-}
-
-Cell *MathParser::ParseText(wxXmlNode *node, TextStyle style)
+Cell *MathParser::ParseText(const wxString &text, TextStyle style)
 {
-  wxString str;
+  wxString str(text);
   TextCell *retval = NULL;
-  if ((node != NULL) && ((str = node->GetContent()) != wxEmptyString))
+  if (str != wxEmptyString)
   {
     str.Replace(wxT("-"), wxT("\u2212")); // unicode minus sign
 
@@ -562,33 +377,14 @@ Cell *MathParser::ParseText(wxXmlNode *node, TextStyle style)
   if (retval == NULL)
     retval = new TextCell(NULL, m_configuration, m_cellPointers);
 
-  ParseCommonAttrs(node, retval);
   return retval;
 }
 
-void MathParser::ParseCommonAttrs(wxXmlNode *node, Cell *cell)
-{
-  if(cell == NULL)
-    return;
-  if(node == NULL)
-    return;
-
-  if(node->GetAttribute(wxT("breakline"), wxT("false")) == wxT("true"))
-    cell->ForceBreakLine(true);
-
-  wxString val;
-  
-  if(node->GetAttribute(wxT("tooltip"), &val))
-    cell->SetToolTip(val);
-  if(node->GetAttribute(wxT("altCopy"), &val))
-    cell->SetAltCopyText(val);
-}
-
-Cell *MathParser::ParseCharCode(wxXmlNode *node, TextStyle style)
+Cell *MathParser::ParseCharCode(const wxString &text, TextStyle style)
 {
   TextCell *cell = new TextCell(NULL, m_configuration, m_cellPointers);
-  wxString str;
-  if ((node != NULL) && ((str = node->GetContent()) != wxEmptyString))
+  wxString str(text);
+  if (str != wxEmptyString)
   {
     long code;
     if (str.ToLong(&code))
@@ -598,504 +394,999 @@ Cell *MathParser::ParseCharCode(wxXmlNode *node, TextStyle style)
     cell->SetStyle(style);
     cell->SetHighlight(m_highlight);
   }
-  ParseCommonAttrs(node, cell);
   return cell;
 }
 
-Cell *MathParser::ParseSqrtTag(wxXmlNode *node)
+Cell *MathParser::ParseTag(wxXmlNode *node, bool all)
 {
-  wxXmlNode *child = node->GetChildren();
-  child = SkipWhitespaceNode(child);
+  // The cells are collected as the children of an element that isn't part of the xml.
+  Element root;
+  node = SkipWhitespaceNode(node);
+  while (node)
+  {
+    ParseNode(node, root);
+    if (!all)
+      break;
+    node = GetNextTag(node);
+  }
+  Cell *retval = TakeChildren(root, 0);
+  DeleteChildren(root);
+  return retval;
+}
+
+void MathParser::ParseNode(wxXmlNode *node, Element &parent)
+{
+  if ((node->GetType() == wxXML_TEXT_NODE) || (node->GetType() == wxXML_CDATA_SECTION_NODE))
+  {
+    AddText(parent, node->GetContent());
+    return;
+  }
+  if (node->GetType() != wxXML_ELEMENT_NODE)
+    return;
 
-  SqrtCell *cell = new SqrtCell(NULL, m_configuration, m_cellPointers);
+  Element element;
+  element.name = node->GetName();
+  for (wxXmlAttribute *attr = node->GetAttributes(); attr != NULL; attr = attr->GetNext())
+    element.attributes.push_back(std::make_pair(attr->GetName(), attr->GetValue()));
 
-  cell->SetInner(HandleNullPointer(ParseTag(child, true)));
-  cell->SetType(m_ParserStyle);
-  cell->SetStyle(TS_VARIABLE);
-  cell->SetHighlight(m_highlight);
-  ParseCommonAttrs(node, cell);
-  return cell;
+  if ((element.name == wxT("cell")) || (element.name == wxT("editor")))
+  {
+    // Worksheet cells only occur in .wxmx files and aren't made of the cells
+    // of their children.
+    Cell *cell;
+    if (element.name == wxT("cell"))
+      cell = ParseCellTag(node);
+    else
+      cell = ParseEditorTag(node);
+    ParseCommonAttrs(element, cell);
+    parent.children.push_back(ElementChild());
+    ElementChild &child = parent.children.back();
+    child.cell = cell;
+    child.name = element.name;
+    child.attributes.swap(element.attributes);
+    return;
+  }
+
+  BeginElement(element, &parent);
+  for (wxXmlNode *child = node->GetChildren(); child != NULL; child = child->GetNext())
+    ParseNode(child, element);
+  EndElement(element, &parent);
 }
 
-Cell *MathParser::ParseAbsTag(wxXmlNode *node)
+wxString MathParser::GetAttribute(const Attributes &attributes,
+                                  const wxString &attrName,
+                                  const wxString &defaultVal)
 {
-  wxXmlNode *child = node->GetChildren();
-  child = SkipWhitespaceNode(child);
-  AbsCell *cell = new AbsCell(NULL, m_configuration, m_cellPointers);
-  cell->SetInner(HandleNullPointer(ParseTag(child, true)));
-  cell->SetType(m_ParserStyle);
-  cell->SetStyle(TS_VARIABLE);
-  cell->SetHighlight(m_highlight);
-  ParseCommonAttrs(node, cell);
-  return cell;
+  for (Attributes::const_iterator it = attributes.begin(); it != attributes.end(); ++it)
+    if (it->first == attrName)
+      return it->second;
+  return defaultVal;
 }
 
-Cell *MathParser::ParseConjugateTag(wxXmlNode *node)
+wxString MathParser::Element::GetAttribute(const wxString &attrName,
+                                           const wxString &defaultVal) const
 {
-  wxXmlNode *child = node->GetChildren();
-  child = SkipWhitespaceNode(child);
-  ConjugateCell *cell = new ConjugateCell(NULL, m_configuration, m_cellPointers);
-  cell->SetInner(HandleNullPointer(ParseTag(child, true)));
-  cell->SetType(m_ParserStyle);
-  cell->SetStyle(TS_VARIABLE);
-  cell->SetHighlight(m_highlight);
-  ParseCommonAttrs(node, cell);
-  return cell;
+  return MathParser::GetAttribute(attributes, attrName, defaultVal);
+}
+
+void MathParser::ParseCommonAttrs(const Element &element, Cell *cell)
+{
+  if(cell == NULL)
+    return;
+
+  for (Attributes::const_iterator it = element.attributes.begin(); it != element.attributes.end(); ++it)
+  {
+    if ((it->first == wxT("breakline")) && (it->second == wxT("true")))
+      cell->ForceBreakLine(true);
+    if (it->first == wxT("tooltip"))
+      cell->SetToolTip(it->second);
+    if (it->first == wxT("altCopy"))
+      cell->SetAltCopyText(it->second);
+  }
 }
 
-Cell *MathParser::ParseParenTag(wxXmlNode *node)
+Cell *MathParser::TakeChild(Element &element, size_t n)
 {
-  wxXmlNode *child = node->GetChildren();
-  child = SkipWhitespaceNode(child);
-  ParenCell *cell = new ParenCell(NULL, m_configuration, m_cellPointers);
-  // No special Handling for NULL args here: They are completely legal in this case.
-  cell->SetInner(ParseTag(child, true), m_ParserStyle);
-  cell->SetHighlight(m_highlight);
-  cell->SetStyle(TS_VARIABLE);
-  if (node->GetAttributes() != NULL)
-    cell->SetPrint(false);
-  ParseCommonAttrs(node, cell);
+  if (n >= element.children.size())
+    return NULL;
+  Cell *cell = element.children[n].cell;
+  element.children[n].cell = NULL;
   return cell;
 }
 
-Cell *MathParser::ParseLimitTag(wxXmlNode *node)
+Cell *MathParser::TakeChildren(Element &element, size_t n)
 {
-  LimitCell *limit = new LimitCell(NULL, m_configuration, m_cellPointers);
-  wxXmlNode *child = node->GetChildren();
-  child = SkipWhitespaceNode(child);
-  limit->SetName(HandleNullPointer(ParseTag(child, false)));
-  child = GetNextTag(child);
-  limit->SetUnder(HandleNullPointer(ParseTag(child, false)));
-  child = GetNextTag(child);
-  limit->SetBase(HandleNullPointer(ParseTag(child, false)));
-  limit->SetType(m_ParserStyle);
-  limit->SetStyle(TS_VARIABLE);
-  ParseCommonAttrs(node, limit);
-  return limit;
+  Cell *retval = NULL;
+  Cell *last = NULL;
+  for (; n < element.children.size(); n++)
+  {
+    Cell *cell = TakeChild(element, n);
+    if (cell == NULL)
+      continue;
+    if (retval == NULL)
+      retval = cell;
+    else
+      last->AppendCell(cell);
+    last = cell;
+    while (last->m_next != NULL)
+      last = last->m_next;
+  }
+  return retval;
 }
 
-Cell *MathParser::ParseSumTag(wxXmlNode *node)
+void MathParser::DeleteChildren(Element &element)
 {
-  SumCell *sum = new SumCell(NULL, m_configuration, m_cellPointers);
-  wxXmlNode *child = node->GetChildren();
-  child = SkipWhitespaceNode(child);
-  wxString type = node->GetAttribute(wxT("type"), wxT("sum"));
-
-  if (type == wxT("prod"))
-    sum->SetSumStyle(SM_PROD);
-  sum->SetHighlight(m_highlight);
-  sum->SetUnder(HandleNullPointer(ParseTag(child, false)));
-  child = GetNextTag(child);
-  if (type != wxT("lsum"))
-    sum->SetOver(HandleNullPointer(ParseTag(child, false)));
-  child = GetNextTag(child);
-  sum->SetBase(HandleNullPointer(ParseTag(child, false)));
-  sum->SetType(m_ParserStyle);
-  sum->SetStyle(TS_VARIABLE);
-  ParseCommonAttrs(node, sum);
-  return sum;
+  for (std::vector<ElementChild>::iterator it = element.children.begin(); it != element.children.end(); ++it)
+  {
+    wxDELETE(it->cell);
+    for (std::vector<Cell *>::iterator col = it->rowCells.begin(); col != it->rowCells.end(); ++col)
+      wxDELETE(*col);
+  }
+  element.children.clear();
+}
+
+//! The tags whose first child is a text node we read the contents of
+static bool IsTextTag(const wxString &name)
+{
+  return (name == wxT("v")) || (name == wxT("mi")) || (name == wxT("mo")) ||
+    (name == wxT("t")) || (name == wxT("n")) || (name == wxT("mn")) ||
+    (name == wxT("h")) || (name == wxT("g")) || (name == wxT("s")) ||
+    (name == wxT("fnm")) || (name == wxT("lbl")) || (name == wxT("st")) ||
+    (name == wxT("ascii")) || (name == wxT("img")) || (name == wxT("slide"));
 }
 
-Cell *MathParser::ParseIntTag(wxXmlNode *node)
+//! Does the char belong to the [[:cntrl:]] class m_graphRegex replaces?
+static bool IsControlChar(const wxUniChar &ch)
 {
-  IntCell *in = new IntCell(NULL, m_configuration, m_cellPointers);
-  wxXmlNode *child = node->GetChildren();
-  child = SkipWhitespaceNode(child);
-  in->SetHighlight(m_highlight);
-  wxString definiteAtt = node->GetAttribute(wxT("def"), wxT("true"));
-  if (definiteAtt != wxT("true"))
+  wxUniChar::value_type val = ch.GetValue();
+  return (val < 0x20) || ((val >= 0x7F) && (val <= 0x9F));
+}
+
+void MathParser::AddText(Element &element, const wxString &text)
+{
+  if (IsTextTag(element.name))
   {
-    in->SetBase(HandleNullPointer(ParseTag(child, false)));
-    child = GetNextTag(child);
-    in->SetVar(HandleNullPointer(ParseTag(child, true)));
-    in->SetType(m_ParserStyle);
-    in->SetStyle(TS_VARIABLE);
+    // Only the first child node of a text tag is read.
+    if (element.children.empty() && element.text.IsEmpty())
+      element.text = text;
+    return;
   }
+
+  // Skip whitespace the same way SkipWhitespaceNode() does
+  wxString contents(text);
+  contents.Trim();
+  if (contents.Length() <= 1)
+    return;
+
+  element.children.push_back(ElementChild());
+  element.children.back().cell = ParseText(text);
+}
+
+void MathParser::BeginElement(Element &element, const Element *parent)
+{
+  element.highlight = m_highlight;
+  element.fracStyle = m_FracStyle;
+
+  // The first argument of a diff tag is the part that contains the fractions
+  // that are drawn as "d/dx".
+  if ((parent != NULL) && (parent->name == wxT("d")) && (parent->children.empty()))
+    m_FracStyle = FracCell::FC_DIFF;
+  if (element.name == wxT("hl"))
+    m_highlight = true;
+}
+
+Cell *MathParser::EndElement(Element &element, Element *parent)
+{
+  Cell *retval = NULL;
+  if (parent == NULL)
+    // The root element: Like ParseLineDOM() we return the cells it contains.
+    retval = TakeChildren(element, 0);
   else
   {
-    // A Definite integral
-    in->SetIntStyle(IntCell::INT_DEF);
-    in->SetUnder(HandleNullPointer(ParseTag(child, false)));
-    child = GetNextTag(child);
-    in->SetOver(HandleNullPointer(ParseTag(child, false)));
-    child = GetNextTag(child);
-    in->SetBase(HandleNullPointer(ParseTag(child, false)));
-    child = GetNextTag(child);
-    in->SetVar(HandleNullPointer(ParseTag(child, true)));
-    in->SetType(m_ParserStyle);
-    in->SetStyle(TS_VARIABLE);
+    bool tableRow = (parent->name == wxT("tb"));
+    parent->children.push_back(ElementChild());
+    ElementChild &child = parent->children.back();
+    child.name = element.name;
+    if (tableRow)
+    {
+      // A table row: The table needs each of its cells separately.
+      for (size_t i = 0; i < element.children.size(); i++)
+        child.rowCells.push_back(TakeChild(element, i));
+    }
+    else
+    {
+      child.cell = ParseElement(element);
+      ParseCommonAttrs(element, child.cell);
+    }
+    child.attributes.swap(element.attributes);
   }
-  ParseCommonAttrs(node, in);
-  return in;
+
+  DeleteChildren(element);
+  m_highlight = element.highlight;
+  m_FracStyle = element.fracStyle;
+  return retval;
 }
 
-Cell *MathParser::ParseTableTag(wxXmlNode *node)
+Cell *MathParser::ParseElement(Element &element)
 {
-  MatrCell *matrix = new MatrCell(NULL, m_configuration, m_cellPointers);
-  matrix->SetHighlight(m_highlight);
+  const wxString &tagName = element.name;
 
-  if (node->GetAttribute(wxT("special"), wxT("false")) == wxT("true"))
-    matrix->SetSpecialFlag(true);
-  if (node->GetAttribute(wxT("inference"), wxT("false")) == wxT("true"))
+  if ((tagName == wxT("v")) || (tagName == wxT("mi")))
+    return ParseText(element.text, TS_VARIABLE);
+
+  if ((tagName == wxT("mo")) || (tagName == wxT("fnm")))
+    return ParseText(element.text, TS_FUNCTION);
+
+  if (tagName == wxT("t"))
+  {
+    TextStyle style = TS_DEFAULT;
+    if (element.GetAttribute(wxT("type")) == wxT("error"))
+      style = TS_ERROR;
+    if (element.GetAttribute(wxT("type")) == wxT("warning"))
+      style = TS_WARNING;
+    return ParseText(element.text, style);
+  }
+
+  if ((tagName == wxT("n")) || (tagName == wxT("mn")))
+    return ParseText(element.text, TS_NUMBER);
+
+  if (tagName == wxT("h"))
+  {
+    Cell *cell = ParseText(element.text);
+    cell->m_isHidableMultSign = true;
+    return cell;
+  }
+
+  if (tagName == wxT("g"))
+    return ParseText(element.text, TS_GREEK_CONSTANT);
+
+  if (tagName == wxT("s"))
+    return ParseText(element.text, TS_SPECIAL_CONSTANT);
+
+  if (tagName == wxT("st"))
+    return ParseText(element.text, TS_STRING);
+
+  if (tagName == wxT("ascii"))
+    return ParseCharCode(element.text);
+
+  if (tagName == wxT("mspace"))
+    return new TextCell(NULL, m_configuration, m_cellPointers, wxT(" "));
+
+  if (tagName == wxT("p"))
+  {
+    ParenCell *cell = new ParenCell(NULL, m_configuration, m_cellPointers);
+    // No special Handling for NULL args here: They are completely legal in this case.
+    cell->SetInner(TakeChildren(element, 0), m_ParserStyle);
+    cell->SetHighlight(m_highlight);
+    cell->SetStyle(TS_VARIABLE);
+    if (!element.attributes.empty())
+      cell->SetPrint(false);
+    return cell;
+  }
+
+  if ((tagName == wxT("f")) || (tagName == wxT("mfrac")))
+  {
+    FracCell *frac = new FracCell(NULL, m_configuration, m_cellPointers);
+    frac->SetFracStyle(m_FracStyle);
+    frac->SetHighlight(m_highlight);
+    frac->SetNum(HandleNullPointer(TakeChild(element, 0)));
+    frac->SetDenom(HandleNullPointer(TakeChild(element, 1)));
+    if (element.GetAttribute(wxT("line")) == wxT("no"))
+      frac->SetFracStyle(FracCell::FC_CHOOSE);
+    if (element.GetAttribute(wxT("diffstyle")) == wxT("yes"))
+      frac->SetFracStyle(FracCell::FC_DIFF);
+    frac->SetType(m_ParserStyle);
+    frac->SetStyle(TS_VARIABLE);
+    frac->SetupBreakUps();
+    return frac;
+  }
+
+  if ((tagName == wxT("e")) || (tagName == wxT("msup")))
+  {
+    ExptCell *expt = new ExptCell(NULL, m_configuration, m_cellPointers);
+    if (!element.attributes.empty())
+      expt->IsMatrix(true);
+    Cell *baseCell = HandleNullPointer(TakeChild(element, 0));
+    expt->SetBase(baseCell);
+    Cell *power = HandleNullPointer(TakeChild(element, 1));
+    power->SetExponentFlag();
+    expt->SetPower(power);
+    expt->SetType(m_ParserStyle);
+    expt->SetStyle(TS_VARIABLE);
+    if (element.GetAttribute(wxT("mat"), wxT("false")) == wxT("true"))
+      expt->SetAltCopyText(baseCell->ToString()+wxT("^^")+power->ToString());
+    return expt;
+  }
+
+  if ((tagName == wxT("i")) || (tagName == wxT("munder")))
+  {
+    SubCell *sub = new SubCell(NULL, m_configuration, m_cellPointers);
+    sub->SetBase(HandleNullPointer(TakeChild(element, 0)));
+    Cell *index = HandleNullPointer(TakeChild(element, 1));
+    sub->SetIndex(index);
+    index->SetExponentFlag();
+    sub->SetType(m_ParserStyle);
+    sub->SetStyle(TS_VARIABLE);
+    return sub;
+  }
+
+  if (tagName == wxT("fn"))
+  {
+    FunCell *fun = new FunCell(NULL, m_configuration, m_cellPointers);
+    fun->SetName(HandleNullPointer(TakeChild(element, 0)));
+    fun->SetType(m_ParserStyle);
+    fun->SetStyle(TS_FUNCTION);
+    fun->SetArg(HandleNullPointer(TakeChild(element, 1)));
+    ParseCommonAttrs(element, fun);
+    if (fun->ToString().Contains(")("))
+      fun->SetToolTip(_("If this isn't a function returning a lambda() expression a multiplication sign (*) between closing and opening parenthesis is missing here."));
+    return fun;
+  }
+
+  if (tagName == wxT("q"))
   {
-    matrix->SetInferenceFlag(true);
-    matrix->SetSpecialFlag(true);
+    SqrtCell *cell = new SqrtCell(NULL, m_configuration, m_cellPointers);
+    cell->SetInner(HandleNullPointer(TakeChildren(element, 0)));
+    cell->SetType(m_ParserStyle);
+    cell->SetStyle(TS_VARIABLE);
+    cell->SetHighlight(m_highlight);
+    return cell;
   }
-  if (node->GetAttribute(wxT("colnames"), wxT("false")) == wxT("true"))
-    matrix->ColNames(true);
-  if (node->GetAttribute(wxT("rownames"), wxT("false")) == wxT("true"))
-    matrix->RowNames(true);
-  if (node->GetAttribute(wxT("roundedParens"), wxT("false")) == wxT("true"))
-    matrix->RoundedParens(true);
-
-  wxXmlNode *rows = SkipWhitespaceNode(node->GetChildren());
-  while (rows)
+
+  if (tagName == wxT("d"))
   {
-    matrix->NewRow();
-    wxXmlNode *cells = SkipWhitespaceNode(rows->GetChildren());
-    while (cells)
+    DiffCell *diff = new DiffCell(NULL, m_configuration, m_cellPointers);
+    if (!element.children.empty())
     {
-      matrix->NewColumn();
-      matrix->AddNewCell(HandleNullPointer(ParseTag(cells, false)));
-      cells = GetNextTag(cells);
+      diff->SetDiff(HandleNullPointer(TakeChild(element, 0)));
+      diff->SetBase(HandleNullPointer(TakeChildren(element, 1)));
+      diff->SetType(m_ParserStyle);
+      diff->SetStyle(TS_VARIABLE);
     }
-    rows = GetNextTag(rows);
+    return diff;
   }
-  matrix->SetType(m_ParserStyle);
-  matrix->SetStyle(TS_VARIABLE);
-  matrix->SetDimension();
-  ParseCommonAttrs(node, matrix);
-  return matrix;
-}
 
-Cell *MathParser::ParseTag(wxXmlNode *node, bool all)
-{
-  //  wxYield();
-  Cell *retval = NULL;
-  Cell *cell = NULL;
-  bool warning = all;
-  wxString altCopy;
+  if (tagName == wxT("sm"))
+  {
+    SumCell *sum = new SumCell(NULL, m_configuration, m_cellPointers);
+    wxString type = element.GetAttribute(wxT("type"), wxT("sum"));
+    if (type == wxT("prod"))
+      sum->SetSumStyle(SM_PROD);
+    sum->SetHighlight(m_highlight);
+    sum->SetUnder(HandleNullPointer(TakeChild(element, 0)));
+    if (type != wxT("lsum"))
+      sum->SetOver(HandleNullPointer(TakeChild(element, 1)));
+    sum->SetBase(HandleNullPointer(TakeChild(element, 2)));
+    sum->SetType(m_ParserStyle);
+    sum->SetStyle(TS_VARIABLE);
+    return sum;
+  }
 
-  node = SkipWhitespaceNode(node);
+  if (tagName == wxT("in"))
+  {
+    IntCell *in = new IntCell(NULL, m_configuration, m_cellPointers);
+    in->SetHighlight(m_highlight);
+    if (element.GetAttribute(wxT("def"), wxT("true")) != wxT("true"))
+    {
+      in->SetBase(HandleNullPointer(TakeChild(element, 0)));
+      in->SetVar(HandleNullPointer(TakeChildren(element, 1)));
+    }
+    else
+    {
+      // A Definite integral
+      in->SetIntStyle(IntCell::INT_DEF);
+      in->SetUnder(HandleNullPointer(TakeChild(element, 0)));
+      in->SetOver(HandleNullPointer(TakeChild(element, 1)));
+      in->SetBase(HandleNullPointer(TakeChild(element, 2)));
+      in->SetVar(HandleNullPointer(TakeChildren(element, 3)));
+    }
+    in->SetType(m_ParserStyle);
+    in->SetStyle(TS_VARIABLE);
+    return in;
+  }
 
-  while (node)
+  if (tagName == wxT("at"))
+  {
+    AtCell *at = new AtCell(NULL, m_configuration, m_cellPointers);
+    at->SetBase(HandleNullPointer(TakeChild(element, 0)));
+    at->SetHighlight(m_highlight);
+    at->SetIndex(HandleNullPointer(TakeChild(element, 1)));
+    at->SetType(m_ParserStyle);
+    at->SetStyle(TS_VARIABLE);
+    return at;
+  }
+
+  if (tagName == wxT("a"))
   {
-    if (node->GetType() == wxXML_ELEMENT_NODE)
+    AbsCell *cell = new AbsCell(NULL, m_configuration, m_cellPointers);
+    cell->SetInner(HandleNullPointer(TakeChildren(element, 0)));
+    cell->SetType(m_ParserStyle);
+    cell->SetStyle(TS_VARIABLE);
+    cell->SetHighlight(m_highlight);
+    return cell;
+  }
+
+  if (tagName == wxT("cj"))
+  {
+    ConjugateCell *cell = new ConjugateCell(NULL, m_configuration, m_cellPointers);
+    cell->SetInner(HandleNullPointer(TakeChildren(element, 0)));
+    cell->SetType(m_ParserStyle);
+    cell->SetStyle(TS_VARIABLE);
+    cell->SetHighlight(m_highlight);
+    return cell;
+  }
+
+  if (tagName == wxT("ie"))
+  {
+    SubSupCell *subsup = new SubSupCell(NULL, m_configuration, m_cellPointers);
+    subsup->SetBase(HandleNullPointer(TakeChild(element, 0)));
+    if ((element.children.size() > 1) &&
+        (GetAttribute(element.children[1].attributes, wxT("pos")) != wxEmptyString))
     {
-      // Parse XML tags. The only other type of element we recognize are text
-      // nodes.
-      wxString tagName(node->GetName());
-
-      Cell *tmp = NULL;
-      if ((tagName == "v") || (tagName == "mi"))
-      {               // Variables (atoms)
-        tmp = ParseText(node->GetChildren(), TS_VARIABLE);
-      }
-      else if (tagName == wxT("mo"))
-      {          // operator
-        tmp = ParseText(node->GetChildren(), TS_FUNCTION);
-      }
-      else if (tagName == wxT("t"))
-      {          // Other text
-        TextStyle style = TS_DEFAULT;
-        if (node->GetAttribute(wxT("type")) == wxT("error"))
-          style = TS_ERROR;
-        if (node->GetAttribute(wxT("type")) == wxT("warning"))
-          style = TS_WARNING;
-        tmp = ParseText(node->GetChildren(), style);
-      }
-      else if ((tagName == "n") || (tagName == "mn"))
-      {          // Numbers
-        tmp = ParseText(node->GetChildren(), TS_NUMBER);
-      }
-      else if (tagName == wxT("h"))
-      {          // Hidden cells (*)
-        tmp = ParseText(node->GetChildren());
-        tmp->m_isHidableMultSign = true;
-      }
-      else if (tagName == wxT("p"))
-      {          // Parenthesis
-        tmp = ParseParenTag(node);
-      }
-      else if ((tagName == wxT("f")) || (tagName == wxT("mfrac")))
-      {               // Fractions
-        tmp = ParseFracTag(node);
-      }
-      else if (tagName == "e" || (tagName == "msup"))
-      {          // Exponentials
-        tmp = ParseSupTag(node);
-      }
-      else if ((tagName == "i") || (tagName == "munder"))
-      {          // Subscripts
-        tmp = ParseSubTag(node);
-      }
-      else if (tagName == wxT("fn"))
-      {         // Functions
-        tmp = ParseFunTag(node);
-      }
-      else if (tagName == wxT("g"))
-      {          // Greek constants
-        tmp = ParseText(node->GetChildren(), TS_GREEK_CONSTANT);
-      }
-      else if (tagName == wxT("s"))
-      {          // Special constants %e,...
-        tmp = ParseText(node->GetChildren(), TS_SPECIAL_CONSTANT);
-      }
-      else if (tagName == wxT("fnm"))
-      {         // Function names
-        tmp = ParseText(node->GetChildren(), TS_FUNCTION);
-      }
-      else if (tagName == wxT("q"))
-      {          // Square roots
-        tmp = ParseSqrtTag(node);
-      }
-      else if (tagName == wxT("d"))
-      {          // Differentials
-        tmp = ParseDiffTag(node);
-      }
-      else if (tagName == wxT("sm"))
-      {         // Sums
-        tmp = ParseSumTag(node);
-      }
-      else if (tagName == wxT("in"))
-      {         // integrals
-        tmp = ParseIntTag(node);
-      }
-      else if (tagName == wxT("mspace"))
+      for (size_t i = 1; i < element.children.size(); i++)
       {
-        tmp = new TextCell(NULL, m_configuration, m_cellPointers, wxT(" "));
+        wxString pos = GetAttribute(element.children[i].attributes, wxT("pos"));
+        Cell *cell = HandleNullPointer(TakeChild(element, i));
+        if (pos == wxT("presub"))
+          subsup->SetPreSub(cell);
+        else if (pos == wxT("presup"))
+          subsup->SetPreSup(cell);
+        else if (pos == wxT("postsup"))
+          subsup->SetPostSup(cell);
+        else if (pos == wxT("postsub"))
+          subsup->SetPostSub(cell);
+        else
+          wxDELETE(cell);
       }
-      else if (tagName == wxT("at"))
+    }
+    else
+    {
+      Cell *index = HandleNullPointer(TakeChild(element, 1));
+      index->SetExponentFlag();
+      subsup->SetIndex(index);
+      Cell *power = HandleNullPointer(TakeChild(element, 2));
+      power->SetExponentFlag();
+      subsup->SetExponent(power);
+      subsup->SetType(m_ParserStyle);
+      subsup->SetStyle(TS_VARIABLE);
+    }
+    return subsup;
+  }
+
+  if (tagName == wxT("mmultiscripts"))
+  {
+    bool pre = false;
+    bool subscript = true;
+    SubSupCell *subsup = new SubSupCell(NULL, m_configuration, m_cellPointers);
+    subsup->SetBase(HandleNullPointer(TakeChild(element, 0)));
+    for (size_t i = 1; i < element.children.size(); i++)
+    {
+      if (element.children[i].name == wxT("mprescripts"))
       {
-        tmp = ParseAtTag(node);
+        pre = true;
+        subscript = true;
+        continue;
       }
-      else if (tagName == wxT("a"))
+      if (element.children[i].name != wxT("none"))
       {
-        tmp = ParseAbsTag(node);
+        Cell *cell = TakeChild(element, i);
+        if (pre && subscript)
+          subsup->SetPreSub(cell);
+        if (pre && (!subscript))
+          subsup->SetPreSup(cell);
+        if ((!pre) && subscript)
+          subsup->SetPostSub(cell);
+        if ((!pre) && (!subscript))
+          subsup->SetPostSup(cell);
       }
-      else if (tagName == wxT("cj"))
+      subscript = !subscript;
+    }
+    return subsup;
+  }
+
+  if (tagName == wxT("lm"))
+  {
+    LimitCell *limit = new LimitCell(NULL, m_configuration, m_cellPointers);
+    limit->SetName(HandleNullPointer(TakeChild(element, 0)));
+    limit->SetUnder(HandleNullPointer(TakeChild(element, 1)));
+    limit->SetBase(HandleNullPointer(TakeChild(element, 2)));
+    limit->SetType(m_ParserStyle);
+    limit->SetStyle(TS_VARIABLE);
+    return limit;
+  }
+
+  if ((tagName == wxT("r")) || (tagName == wxT("mrow")) || (tagName == wxT("hl")))
+    return TakeChildren(element, 0);
+
+  if (tagName == wxT("tb"))
+  {
+    MatrCell *matrix = new MatrCell(NULL, m_configuration, m_cellPointers);
+    matrix->SetHighlight(m_highlight);
+    if (element.GetAttribute(wxT("special"), wxT("false")) == wxT("true"))
+      matrix->SetSpecialFlag(true);
+    if (element.GetAttribute(wxT("inference"), wxT("false")) == wxT("true"))
+    {
+      matrix->SetInferenceFlag(true);
+      matrix->SetSpecialFlag(true);
+    }
+    if (element.GetAttribute(wxT("colnames"), wxT("false")) == wxT("true"))
+      matrix->ColNames(true);
+    if (element.GetAttribute(wxT("rownames"), wxT("false")) == wxT("true"))
+      matrix->RowNames(true);
+    if (element.GetAttribute(wxT("roundedParens"), wxT("false")) == wxT("true"))
+      matrix->RoundedParens(true);
+
+    for (std::vector<ElementChild>::iterator row = element.children.begin();
+         row != element.children.end(); ++row)
+    {
+      matrix->NewRow();
+      for (std::vector<Cell *>::iterator col = row->rowCells.begin();
+           col != row->rowCells.end(); ++col)
       {
-        tmp = ParseConjugateTag(node);
+        matrix->NewColumn();
+        matrix->AddNewCell(HandleNullPointer(*col));
+        *col = NULL;
       }
-      else if (tagName == wxT("ie"))
+    }
+    matrix->SetType(m_ParserStyle);
+    matrix->SetStyle(TS_VARIABLE);
+    matrix->SetDimension();
+    return matrix;
+  }
+
+  if ((tagName == wxT("mth")) || (tagName == wxT("line")))
+  {
+    Cell *cell = TakeChildren(element, 0);
+    if (cell != NULL)
+      cell->ForceBreakLine(true);
+    else
+      cell = new TextCell(NULL, m_configuration, m_cellPointers, wxT(" "));
+    return cell;
+  }
+
+  if (tagName == wxT("lbl"))
+  {
+    wxString user_lbl = element.GetAttribute(wxT("userdefinedlabel"), m_userDefinedLabel);
+    TextCell *cell;
+    if (element.GetAttribute(wxT("userdefined"), wxT("no")) != wxT("yes"))
+      cell = dynamic_cast<TextCell *>(ParseText(element.text, TS_LABEL));
+    else
+    {
+      cell = dynamic_cast<TextCell *>(ParseText(element.text, TS_USERLABEL));
+
+      // Backwards compatibility to 17.04/17.12:
+      // If we cannot find the user-defined label's text but still know that there
+      // is one it's value has been saved as "automatic label" instead.
+      if(user_lbl == wxEmptyString)
       {
-        tmp = ParseSubSupTag(node);
+        user_lbl = cell->GetValue();
+        user_lbl = user_lbl.substr(1,user_lbl.Length() - 2);
       }
-      else if (tagName == wxT("mmultiscripts"))
+    }
+    cell->SetUserDefinedLabel(user_lbl);
+    cell->ForceBreakLine(true);
+    return cell;
+  }
+
+  if (tagName == wxT("img"))
+  {
+    ImgCell *imageCell;
+    wxString filename(element.text);
+
+    if (m_fileSystem) // loading from zip
+      imageCell = new ImgCell(NULL, m_configuration, m_cellPointers, filename, m_fileSystem, false);
+    else
+    {
+      if (element.GetAttribute(wxT("del"), wxT("yes")) != wxT("no"))
       {
-        tmp = ParseMmultiscriptsTag(node);
-      }
-      else if (tagName == wxT("lm"))
-      { // A limit tag
-        tmp = ParseLimitTag(node);
+        std::shared_ptr <wxFileSystem> noFS;
+        imageCell = new ImgCell(NULL, m_configuration, m_cellPointers, filename, noFS, true);
       }
-      else if ((tagName == "r") || (tagName == "mrow"))
-      { // A group of tags
-        tmp = ParseTag(node->GetChildren());
-      }
-      else if (tagName == wxT("tb"))
+      else
       {
-        tmp = ParseTableTag(node);
+        // This is the only case show_image() produces ergo this is the only
+        // case we might get a local path
+
+        if (
+                (!wxFileExists(filename)) &&
+                (wxFileExists((*m_configuration)->GetWorkingDirectory() + wxT("/") + filename))
+                )
+          filename = (*m_configuration)->GetWorkingDirectory() + wxT("/") + filename;
+        std::shared_ptr <wxFileSystem> noFS;
+        imageCell = new ImgCell(NULL, m_configuration, m_cellPointers, filename, noFS, false);
       }
-      else if ((tagName == wxT("mth")) || (tagName == wxT("line")))
+    }
+    wxString gnuplotSource = element.GetAttribute(wxT("gnuplotsource"), wxEmptyString);
+    wxString gnuplotData = element.GetAttribute(wxT("gnuplotdata"), wxEmptyString);
+    if((imageCell != NULL) && (gnuplotSource != wxEmptyString))
+    {
+      imageCell->GnuplotSource(gnuplotSource, gnuplotData, m_fileSystem);
+    }
+    if (element.GetAttribute(wxT("rect"), wxT("true")) == wxT("false"))
+      imageCell->DrawRectangle(false);
+
+    wxString sizeString;
+    if ((sizeString = element.GetAttribute(wxT("maxWidth"), wxT("-1"))) != wxT("-1"))
+    {
+      double width;
+      if(sizeString.ToDouble(&width))
+        imageCell->SetMaxWidth(width);
+    }
+    if ((sizeString = element.GetAttribute(wxT("maxHeight"), wxT("-1"))) != wxT("-1"))
+    {
+      double height;
+      if(sizeString.ToDouble(&height))
+        imageCell->SetMaxWidth(height);
+    }
+    return imageCell;
+  }
+
+  if (tagName == wxT("slide"))
+  {
+    bool del = element.GetAttribute(wxT("del"), wxT("false")) == wxT("true");
+    SlideShow *slideShow = new SlideShow(NULL, m_configuration, m_cellPointers, m_fileSystem);
+    wxArrayString images;
+    wxString framerate;
+    wxStringTokenizer tokens(element.text, wxT(";"));
+    framerate = element.GetAttribute(wxT("fr"));
+    if (framerate != wxEmptyString)
+    {
+      long fr;
+      if (framerate.ToLong(&fr))
+        slideShow->SetFrameRate(fr);
+    }
+    framerate = element.GetAttribute(wxT("frame"));
+    if (framerate != wxEmptyString)
+    {
+      long frame;
+      if (framerate.ToLong(&frame))
+        slideShow->SetDisplayedIndex(frame);
+    }
+    if (element.GetAttribute(wxT("running"), wxT("true")) == wxT("false"))
+      slideShow->AnimationRunning(false);
+    while (tokens.HasMoreTokens())
+    {
+      wxString token = tokens.GetNextToken();
+      if (token.Length())
       {
-        tmp = ParseTag(node->GetChildren());
-        if (tmp != NULL)
-          tmp->ForceBreakLine(true);
-        else
-          tmp = new TextCell(NULL, m_configuration, m_cellPointers, wxT(" "));
+        images.Add(token);
       }
-      else if (tagName == wxT("lbl"))
+    }
+    slideShow->LoadImages(images, del);
+    return slideShow;
+  }
+
+  // An unknown tag: Use its contents.
+  return TakeChildren(element, 0);
+}
+
+bool MathParser::ReadStreamEntity(wxString::const_iterator &it,
+                                  const wxString::const_iterator &end,
+                                  wxString &text)
+{
+  // Skip the "&"
+  ++it;
+  wxString entity;
+  while ((it != end) && (*it != wxT(';')) && (entity.Length() < 10))
+  {
+    entity += *it;
+    ++it;
+  }
+  if ((it == end) || (*it != wxT(';')))
+    return false;
+  ++it;
+
+  wxString number;
+  unsigned long code;
+  if (entity == wxT("lt"))
+    text += wxT('<');
+  else if (entity == wxT("gt"))
+    text += wxT('>');
+  else if (entity == wxT("amp"))
+    text += wxT('&');
+  else if (entity == wxT("quot"))
+    text += wxT('"');
+  else if (entity == wxT("apos"))
+    text += wxT('\'');
+  else if (entity.StartsWith(wxT("#x"), &number) || entity.StartsWith(wxT("#X"), &number))
+  {
+    if ((!number.ToULong(&code, 16)) || (code == 0) || (code > 0x10FFFF) ||
+        ((sizeof(wchar_t) < 4) && (code > 0xFFFF)))
+      return false;
+    text += wxUniChar(code);
+  }
+  else if (entity.StartsWith(wxT("#"), &number))
+  {
+    if ((!number.ToULong(&code, 10)) || (code == 0) || (code > 0x10FFFF) ||
+        ((sizeof(wchar_t) < 4) && (code > 0xFFFF)))
+      return false;
+    text += wxUniChar(code);
+  }
+  else
+    return false;
+  return true;
+}
+
+void MathParser::OpenStreamFrame(std::vector<Element> &stack, const wxString &name,
+                                 Attributes &attributes)
+{
+  stack.push_back(Element());
+  Element &element = stack.back();
+  element.name = name;
+  element.attributes.swap(attributes);
+  BeginElement(element, (stack.size() > 1) ? &stack[stack.size() - 2] : NULL);
+}
+
+Cell *MathParser::CloseStreamFrame(std::vector<Element> &stack)
+{
+  Element element;
+  std::swap(element, stack.back());
+  stack.pop_back();
+  return EndElement(element, stack.empty() ? NULL : &stack.back());
+}
+
+bool MathParser::ParseStream(const wxString &s, Cell **result)
+{
+  *result = NULL;
+  bool highlight = m_highlight;
+  int fracStyle = m_FracStyle;
+
+  std::vector<Element> stack;
+  bool rootRead = false;
+  bool ok = true;
+  // The text the next text node will contain
+  wxString text;
+  wxString::const_iterator it = s.begin();
+  const wxString::const_iterator end = s.end();
+
+  while (ok && (it != end))
+  {
+    if (*it == wxT('&'))
+    {
+      ok = ReadStreamEntity(it, end, text);
+      continue;
+    }
+
+    if (*it != wxT('<'))
+    {
+      // Copy runs of ordinary chars in one go
+      wxString::const_iterator runStart = it;
+      while ((it != end) && (*it != wxT('<')) && (*it != wxT('&')) && (!IsControlChar(*it)))
+        ++it;
+      text.append(runStart, it);
+      if ((it != end) && IsControlChar(*it))
       {
-        wxString user_lbl = node->GetAttribute(wxT("userdefinedlabel"), m_userDefinedLabel);
-        wxString userdefined = node->GetAttribute(wxT("userdefined"), wxT("no"));
-        
-        if ( userdefined != wxT("yes"))
-        {
-          tmp = ParseText(node->GetChildren(), TS_LABEL);
-        }
-        else
-        {
-          tmp = ParseText(node->GetChildren(), TS_USERLABEL);
+        text += wxT('\uFFFD');
+        ++it;
+      }
+      continue;
+    }
 
-          // Backwards compatibility to 17.04/17.12:
-          // If we cannot find the user-defined label's text but still know that there
-          // is one it's value has been saved as "automatic label" instead.
-          if(user_lbl == wxEmptyString)
-          {
-            user_lbl = dynamic_cast<TextCell *>(tmp)->GetValue();
-            user_lbl = user_lbl.substr(1,user_lbl.Length() - 2);
-          }
-        }
+    // A tag, a comment, a CDATA section or a processing instruction
+    ++it;
+    if (it == end)
+    {
+      ok = false;
+      break;
+    }
 
-        dynamic_cast<TextCell *>(tmp)->SetUserDefinedLabel(user_lbl);
-        tmp->ForceBreakLine(true);
+    if ((*it == wxT('?')) || (*it == wxT('!')))
+    {
+      wxString::const_iterator markupStart = it;
+      wxString markupEnd = wxT(">");
+      bool cdata = false;
+      wxString markup;
+      while ((it != end) && (markup.Length() < 8))
+      {
+        markup += *it;
+        ++it;
       }
-      else if (tagName == wxT("st"))
+      if (markup.StartsWith(wxT("?")))
+        markupEnd = wxT("?>");
+      else if (markup.StartsWith(wxT("!--")))
+        markupEnd = wxT("-->");
+      else if (markup.StartsWith(wxT("![CDATA[")))
       {
-        tmp = ParseText(node->GetChildren(), TS_STRING);
+        markupEnd = wxT("]]>");
+        cdata = true;
       }
-      else if (tagName == wxT("hl"))
+      else
       {
-        bool highlight = m_highlight;
-        m_highlight = true;
-        tmp = ParseTag(node->GetChildren());
-        m_highlight = highlight;
+        // A DTD
+        ok = false;
+        break;
       }
-      else if (tagName == wxT("img"))
+      if (!cdata)
+        it = markupStart;
+      wxString contents;
+      while ((it != end) && (!contents.EndsWith(markupEnd)))
       {
-        ImgCell *imageCell;
-        wxString filename(node->GetChildren()->GetContent());
+        contents += *it;
+        ++it;
+      }
+      if (!contents.EndsWith(markupEnd))
+        ok = false;
+      else if (cdata)
+        text += contents.Left(contents.Length() - markupEnd.Length());
+      continue;
+    }
 
-        if (m_fileSystem) // loading from zip
-          imageCell = new ImgCell(NULL, m_configuration, m_cellPointers, filename, m_fileSystem, false);
-        else
-        {
-          if (node->GetAttribute(wxT("del"), wxT("yes")) != wxT("no"))
-          {
-            std::shared_ptr <wxFileSystem> noFS;
-            imageCell = new ImgCell(NULL, m_configuration, m_cellPointers, filename, noFS, true);
-          }
-          else
-          {
-            // This is the only case show_image() produces ergo this is the only
-            // case we might get a local path
-
-            if (
-                    (!wxFileExists(filename)) &&
-                    (wxFileExists((*m_configuration)->GetWorkingDirectory() + wxT("/") + filename))
-                    )
-              filename = (*m_configuration)->GetWorkingDirectory() + wxT("/") + filename;
-            std::shared_ptr <wxFileSystem> noFS;
-            imageCell = new ImgCell(NULL, m_configuration, m_cellPointers, filename, noFS, false);
-          }
-        }
-        wxString gnuplotSource = node->GetAttribute(wxT("gnuplotsource"), wxEmptyString);
-        wxString gnuplotData = node->GetAttribute(wxT("gnuplotdata"), wxEmptyString);
-        if((imageCell != NULL) && (gnuplotSource != wxEmptyString))
-        {
-          imageCell->GnuplotSource(gnuplotSource, gnuplotData, m_fileSystem);
-        }
-        if (node->GetAttribute(wxT("rect"), wxT("true")) == wxT("false"))
-          imageCell->DrawRectangle(false);
+    // The text before this tag is complete.
+    if (!text.IsEmpty())
+    {
+      if (!stack.empty())
+        AddText(stack.back(), text);
+      else
+      {
+        // Outside the root element only whitespace is allowed
+        for (wxString::const_iterator ch = text.begin(); ch != text.end(); ++ch)
+          if (*ch != wxT(' '))
+            ok = false;
+      }
+      text.Clear();
+    }
 
-        wxString sizeString;
-        if ((sizeString = node->GetAttribute(wxT("maxWidth"), wxT("-1"))) != wxT("-1"))
-        {
-          double width;
-          if(sizeString.ToDouble(&width))
-            imageCell->SetMaxWidth(width);
-        }
-        if ((sizeString = node->GetAttribute(wxT("maxHeight"), wxT("-1"))) != wxT("-1"))
-        {
-          double height;
-          if(sizeString.ToDouble(&height))
-            imageCell->SetMaxWidth(height);
-        }
+    bool endTag = false;
+    if (*it == wxT('/'))
+    {
+      endTag = true;
+      ++it;
+    }
+
+    wxString name;
+    while ((it != end) && (*it != wxT(' ')) && (*it != wxT('>')) && (*it != wxT('/')) &&
+           (*it != wxT('=')) && (*it != wxT('<')) && (!IsControlChar(*it)))
+    {
+      name += *it;
+      ++it;
+    }
+    if (name.IsEmpty())
+    {
+      ok = false;
+      break;
+    }
 
-        tmp = imageCell;
+    Attributes attributes;
+    bool emptyElement = false;
+    while (ok)
+    {
+      while ((it != end) && (*it == wxT(' ')))
+        ++it;
+      if (it == end)
+      {
+        ok = false;
+        break;
       }
-      else if (tagName == wxT("slide"))
+      if (*it == wxT('>'))
       {
-        bool del = node->GetAttribute(wxT("del"), wxT("false")) == wxT("true");
-        SlideShow *slideShow = new SlideShow(NULL, m_configuration, m_cellPointers, m_fileSystem);
-        wxString str(node->GetChildren()->GetContent());
-        wxArrayString images;
-        wxString framerate;
-        wxStringTokenizer tokens(str, wxT(";"));
-        if (node->GetAttribute(wxT("fr"), &framerate))
-        {
-          long fr;
-          if (framerate.ToLong(&fr))
-            slideShow->SetFrameRate(fr);
-        }
-        if (node->GetAttribute(wxT("frame"), &framerate))
-        {
-          long frame;
-          if (framerate.ToLong(&frame))
-            slideShow->SetDisplayedIndex(frame);
-        }
-        if (node->GetAttribute(wxT("running"), wxT("true")) == wxT("false"))
-          slideShow->AnimationRunning(false);
-        while (tokens.HasMoreTokens())
+        ++it;
+        break;
+      }
+      if ((*it == wxT('/')) && (!endTag))
+      {
+        ++it;
+        if ((it == end) || (*it != wxT('>')))
         {
-          wxString token = tokens.GetNextToken();
-          if (token.Length())
-          {
-            images.Add(token);
-          }
+          ok = false;
+          break;
         }
-        if (slideShow)
-          slideShow->LoadImages(images, del);
-        tmp = slideShow;
+        ++it;
+        emptyElement = true;
+        break;
       }
-      else if (tagName == wxT("editor"))
+      if (endTag)
       {
-        tmp = ParseEditorTag(node);
+        ok = false;
+        break;
       }
-      else if (tagName == wxT("cell"))
+
+      // An attribute
+      wxString attrName;
+      while ((it != end) && (*it != wxT('=')) && (*it != wxT(' ')) && (*it != wxT('>')) &&
+             (*it != wxT('/')) && (*it != wxT('<')) && (!IsControlChar(*it)))
       {
-        tmp = ParseCellTag(node);
+        attrName += *it;
+        ++it;
       }
-      else if (tagName == wxT("ascii"))
+      while ((it != end) && (*it == wxT(' ')))
+        ++it;
+      if (attrName.IsEmpty() || (it == end) || (*it != wxT('=')))
       {
-        tmp = ParseCharCode(node->GetChildren());
+        ok = false;
+        break;
       }
-      else if (node->GetChildren())
+      ++it;
+      while ((it != end) && (*it == wxT(' ')))
+        ++it;
+      if ((it == end) || ((*it != wxT('"')) && (*it != wxT('\''))))
       {
-        tmp = ParseTag(node->GetChildren());
+        ok = false;
+        break;
       }
-
-      // Append the cell we found (tmp) to the list of cells we parsed so far (cell).
-      if (tmp != NULL)
+      wxUniChar quote = *it;
+      ++it;
+      wxString value;
+      while (ok && (it != end) && (*it != quote))
       {
-        ParseCommonAttrs(node, tmp);
-        if (cell == NULL)
-          cell = tmp;
+        if (*it == wxT('<'))
+          ok = false;
+        else if (*it == wxT('&'))
+          ok = ReadStreamEntity(it, end, value);
         else
-          cell->AppendCell(tmp);
+        {
+          if (IsControlChar(*it))
+            value += wxT('\uFFFD');
+          else
+            value += *it;
+          ++it;
+        }
       }
+      if ((!ok) || (it == end))
+      {
+        ok = false;
+        break;
+      }
+      ++it;
+      attributes.push_back(std::make_pair(attrName, value));
     }
-    else
-    {
-      // We didn't get a tag but got a text cell => Parse the text.
-      if (cell == NULL)
-        cell = ParseText(node);
-      else
-        cell->AppendCell(ParseText(node));
-    }
+    if (!ok)
+      break;
 
-    if (cell != NULL)
+    if (endTag)
     {
-      // Append the new cell to the return value
-      if (retval == NULL)
-        retval = cell;
-      else
-        cell = cell->m_next;
+      if (stack.empty() || (stack.back().name != name))
+      {
+        ok = false;
+        break;
+      }
+      Cell *cell = CloseStreamFrame(stack);
+      if (stack.empty())
+      {
+        rootRead = true;
+        *result = cell;
+      }
     }
-    else if ((warning) && (!all))
+    else
     {
-      // Tell the user we ran into problems.
-      wxString name;
-      name.Trim(true);
-      name.Trim(false);
-      if (cell != NULL) name = cell->ToString();
-      if (name.Length() != 0)
+      // Worksheet cells only occur in .wxmx files. Leave them to wxXmlDocument.
+      if ((stack.empty() && rootRead) || (name == wxT("cell")) || (name == wxT("editor")))
+      {
+        ok = false;
+        break;
+      }
+      OpenStreamFrame(stack, name, attributes);
+      if (emptyElement)
       {
-        LoggingMessageBox(_("Parts of the document will not be loaded correctly:\nFound unknown XML Tag name " + name),
-                     _("Warning"),
-                     wxOK | wxICON_WARNING);
-        warning = false;
+        Cell *cell = CloseStreamFrame(stack);
+        if (stack.empty())
+        {
+          rootRead = true;
+          *result = cell;
+        }
       }
     }
-
-    node = GetNextTag(node);
-    
-    if (!all)
-      break;
   }
 
-  return retval;
+  // Text after the root element
+  for (wxString::const_iterator ch = text.begin(); ch != text.end(); ++ch)
+    if (*ch != wxT(' '))
+      ok = false;
+
+  if (!stack.empty() || !rootRead)
+    ok = false;
+
+  if (!ok)
+  {
+    while (!stack.empty())
+    {
+      DeleteChildren(stack.back());
+      stack.pop_back();
+    }
+    wxDELETE(*result);
+    m_highlight = highlight;
+    m_FracStyle = fracStyle;
+  }
+  return ok;
 }
 
 /***
@@ -1107,53 +1398,396 @@ Cell *MathParser::ParseLine(wxString s, CellType style)
   m_ParserStyle = style;
   m_FracStyle = FracCell::FC_NORMAL;
   m_highlight = false;
+
+  long maxLength = MaxParseLength();
+  if ((maxLength == 0) || ((long) s.Length() <= maxLength))
+    return ParseFragment(s);
+
+  // A long expression: Parse only the first chunks of it now and let a LazyCell
+  // parse the rest once it is scrolled into view.
+  std::list<wxString> chunks;
+  if (!SplitLine(s, maxLength / 4, chunks))
+    return ParseFragment(s);
+
   Cell *cell = NULL;
+  while ((cell == NULL) && (!chunks.empty()))
+    cell = ParseChunks(chunks, style);
+
+  if (!chunks.empty())
+    cell->AppendCell(new LazyCell(NULL, m_configuration, m_cellPointers, chunks, style));
+  return cell;
+}
+
+Cell *MathParser::ParseChunks(std::list<wxString> &chunks, CellType style)
+{
+  m_ParserStyle = style;
+  m_FracStyle = FracCell::FC_NORMAL;
+  m_highlight = false;
+
+  long maxLength = MaxParseLength();
+  wxString xml;
+  while ((!chunks.empty()) &&
+         ((xml.IsEmpty()) || (maxLength == 0) ||
+          ((long) (xml.Length() + chunks.front().Length()) <= maxLength)))
+  {
+    xml += chunks.front();
+    chunks.pop_front();
+  }
+  return ParseFragment(wxT("<span>") + xml + wxT("</span>"));
+}
 
-  int showLength;
+Cell *MathParser::ParseFragment(const wxString &s)
+{
+  Cell *cell = NULL;
+  if (!ParseStream(s, &cell))
+    cell = ParseLineDOM(s);
+  return cell;
+}
 
+long MathParser::MaxParseLength() const
+{
   switch ((*m_configuration)->ShowLength())
   {
     case 0:
-      showLength = 6000;
-      break;
+      return 6000;
     case 1:
-      showLength = 20000;
-      break;
+      return 20000;
     case 2:
-      showLength = 250000;
-      break;
+      return 250000;
     case 3:
-      showLength = 0;
-      break;
+      return 0;
   default:
-      showLength = 50000;    
+      return 50000;
   }
+}
 
-  m_graphRegex.Replace(&s, wxT("\uFFFD"));
+bool MathParser::SplitLine(const wxString &s, size_t chunkSize, std::list<wxString> &chunks)
+{
+  size_t start = s.find(wxT('<'));
+  if (start == wxString::npos)
+    return false;
+  size_t end = FindElementEnd(s, start);
+  if (end == wxString::npos)
+    return false;
+
+  wxString chunk;
+  bool newLine = false;
+  std::vector<wxString> chunkAttributes;
+  if (!SplitElement(s, start, end, chunkSize, chunks, chunk, newLine, chunkAttributes))
+    return false;
+  FlushChunk(chunks, chunk, newLine, chunkAttributes);
+  return true;
+}
 
-  if (((long) s.Length() < showLength) || (showLength == 0))
+bool MathParser::SplitElement(const wxString &s, size_t start, size_t end, size_t chunkSize,
+                              std::list<wxString> &chunks, wxString &chunk, bool &newLine,
+                              std::vector<wxString> &chunkAttributes)
+{
+  size_t contentStart = FindMarkupEnd(s, start);
+  size_t contentEnd = s.rfind(wxT('<'), end - 1);
+  if ((contentStart == wxString::npos) || (contentEnd == wxString::npos) ||
+      (contentEnd < contentStart))
+    return false;
+
+  // The contents of a <mth> tag start a new line.
+  wxString name = GetTagName(s, start);
+  if ((name == wxT("mth")) || (name == wxT("line")))
   {
+    FlushChunk(chunks, chunk, newLine, chunkAttributes);
+    newLine = true;
+  }
 
-    wxXmlDocument xml;
-
-    wxStringInputStream xmlStream(s);
+  // The attributes of the element (tooltips, line breaks,...) belong to the
+  // first cell of its contents => we keep them on the chunk that starts it.
+  wxString attributes = s.Mid(start + 1 + name.Length(),
+                              contentStart - start - 2 - name.Length());
+  attributes.Trim(true);
+  attributes.Trim(false);
+  if (!attributes.IsEmpty())
+  {
+    FlushChunk(chunks, chunk, newLine, chunkAttributes);
+    chunkAttributes.push_back(attributes);
+  }
 
-    xml.Load(xmlStream, wxT("UTF-8"), wxXMLDOC_KEEP_WHITESPACE_NODES);
+  size_t pos = contentStart;
+  while (pos < contentEnd)
+  {
+    size_t childStart = s.find(wxT('<'), pos);
+    if ((childStart == wxString::npos) || (childStart >= contentEnd))
+    {
+      chunk += s.Mid(pos, contentEnd - pos);
+      break;
+    }
+    chunk += s.Mid(pos, childStart - pos);
 
-    wxXmlNode *doc = xml.GetRoot();
+    size_t childEnd = FindElementEnd(s, childStart);
+    if ((childEnd == wxString::npos) || (childEnd > contentEnd))
+      return false;
 
-    if (doc != NULL)
-      cell = ParseTag(doc->GetChildren());
+    wxString childName = GetTagName(s, childStart);
+    if ((childEnd - childStart > chunkSize) &&
+        ((childName == wxT("r")) || (childName == wxT("mrow")) ||
+         (childName == wxT("mth")) || (childName == wxT("line")) ||
+         (childName == wxT("span"))))
+    {
+      // The children of this tag are drawn one after another => we can split it.
+      if (!SplitElement(s, childStart, childEnd, chunkSize, chunks, chunk, newLine,
+                        chunkAttributes))
+        return false;
+    }
+    else
+    {
+      chunk += s.Mid(childStart, childEnd - childStart);
+      if (chunk.Length() >= chunkSize)
+        FlushChunk(chunks, chunk, newLine, chunkAttributes);
+    }
+    pos = childEnd;
   }
+  return true;
+}
+
+void MathParser::FlushChunk(std::list<wxString> &chunks, wxString &chunk, bool &newLine,
+                            std::vector<wxString> &chunkAttributes)
+{
+  if (chunk.IsEmpty() && !newLine)
+    return;
+
+  for (std::vector<wxString>::const_reverse_iterator it = chunkAttributes.rbegin();
+       it != chunkAttributes.rend(); ++it)
+    chunk = wxT("<span ") + *it + wxT(">") + chunk + wxT("</span>");
+  chunkAttributes.clear();
+
+  if (newLine)
+    chunks.push_back(wxT("<mth>") + chunk + wxT("</mth>"));
   else
+    chunks.push_back(chunk);
+  chunk.Clear();
+  newLine = false;
+}
+
+wxString MathParser::GetTagName(const wxString &s, size_t start)
+{
+  size_t end = start + 1;
+  while ((end < s.Length()) && (s[end] != wxT('>')) && (s[end] != wxT('/')) &&
+         (!wxIsspace(s[end])))
+    end++;
+  return s.Mid(start + 1, end - start - 1);
+}
+
+size_t MathParser::FindMarkupEnd(const wxString &s, size_t start)
+{
+  size_t end;
+  if (s.compare(start, 4, wxT("<!--")) == 0)
   {
-    cell = new TextCell(NULL, m_configuration, m_cellPointers,
-                        _("(Expression longer than allowed by the configuration setting)"),
-      TS_WARNING);
-    cell->SetToolTip(_("The maximum size of the expressions wxMaxima is allowed to display "
-                       "can be changed in the configuration dialogue."
-                       ));
-    cell->ForceBreakLine(true);
+    end = s.find(wxT("-->"), start + 4);
+    return (end == wxString::npos) ? end : end + 3;
+  }
+  if (s.compare(start, 9, wxT("<![CDATA[")) == 0)
+  {
+    end = s.find(wxT("]]>"), start + 9);
+    return (end == wxString::npos) ? end : end + 3;
+  }
+  if (s.compare(start, 2, wxT("<?")) == 0)
+  {
+    end = s.find(wxT("?>"), start + 2);
+    return (end == wxString::npos) ? end : end + 2;
+  }
+
+  // A tag. Attribute values may contain a ">".
+  wxUniChar quote = wxT('\0');
+  for (end = start + 1; end < s.Length(); end++)
+  {
+    wxUniChar ch = s[end];
+    if (quote != wxT('\0'))
+    {
+      if (ch == quote)
+        quote = wxT('\0');
+    }
+    else if ((ch == wxT('"')) || (ch == wxT('\'')))
+      quote = ch;
+    else if (ch == wxT('>'))
+      return end + 1;
+  }
+  return wxString::npos;
+}
+
+size_t MathParser::FindElementEnd(const wxString &s, size_t start)
+{
+  size_t end = FindMarkupEnd(s, start);
+  if ((end == wxString::npos) || (start + 1 >= s.Length()))
+    return wxString::npos;
+
+  wxUniChar ch = s[start + 1];
+  if (ch == wxT('/'))
+    return wxString::npos;
+  if ((ch == wxT('!')) || (ch == wxT('?')) || (s[end - 2] == wxT('/')))
+    return end;
+
+  int depth = 1;
+  while (depth > 0)
+  {
+    size_t pos = s.find(wxT('<'), end);
+    if (pos == wxString::npos)
+      return wxString::npos;
+    end = FindMarkupEnd(s, pos);
+    if ((end == wxString::npos) || (pos + 1 >= s.Length()))
+      return wxString::npos;
+
+    ch = s[pos + 1];
+    if (ch == wxT('/'))
+      depth--;
+    else if ((ch != wxT('!')) && (ch != wxT('?')) && (s[end - 2] != wxT('/')))
+      depth++;
   }
+  return end;
+}
+
+Cell *MathParser::ParseLineDOM(wxString s)
+{
+  Cell *cell = NULL;
+  m_graphRegex.Replace(&s, wxT("\uFFFD"));
+
+  wxXmlDocument xml;
+
+  wxStringInputStream xmlStream(s);
+
+  xml.Load(xmlStream, wxT("UTF-8"), wxXMLDOC_KEEP_WHITESPACE_NODES);
+
+  wxXmlNode *doc = xml.GetRoot();
+
+  if (doc != NULL)
+    cell = ParseTag(doc->GetChildren());
   return cell;
 }
+
+//! The xml for a list of cells, without collecting the files of the images it contains
+static wxString BenchmarkXML(Cell *cell, Cell::CellPointers *cellPointers)
+{
+  if (cell == NULL)
+    return wxEmptyString;
+  // Images are named after the number of images written so far.
+  cellPointers->WXMXResetCounter();
+  wxString xml = cell->ListToXML();
+  cellPointers->WXMXTakeFiles();
+  return xml;
+}
+
+bool MathParser::Benchmark(const wxString &corpus)
+{
+  wxArrayString files;
+  if (wxDirExists(corpus))
+    wxDir::GetAllFiles(corpus, &files, wxT("*.wxmx"));
+  else
+    files.Add(corpus);
+
+  Configuration *configuration = new Configuration();
+  Cell::CellPointers cellPointers(NULL);
+  bool retval = true;
+  const int runs = 10;
+  long outputs = 0;
+  long chars = 0;
+  int differences = 0;
+  int notStreamable = 0;
+  int worksheetCells = 0;
+  wxStopWatch domTime;
+  domTime.Pause();
+  wxStopWatch streamTime;
+  streamTime.Pause();
+  wxFileSystem fileSystem;
+  for (size_t i = 0; i < files.GetCount(); i++)
+  {
+    wxFileName filename(files[i]);
+    filename.MakeAbsolute();
+    wxFSFile *fsfile = fileSystem.OpenFile(
+      wxFileSystem::FileNameToURL(filename) + wxT("#zip:content.xml"));
+    if (fsfile == NULL)
+    {
+      std::cerr << "Cannot read " << files[i] << "\n";
+      retval = false;
+      break;
+    }
+    wxStringOutputStream xmlStream;
+    fsfile->GetStream()->Read(xmlStream);
+    wxDELETE(fsfile);
+    wxString xml = xmlStream.GetString();
+
+    // Load the images the output refers to from the .wxmx file, not from the disk
+    MathParser parser(&configuration, &cellPointers, filename.GetFullPath());
+
+    // Parse all maxima output that is stored in the .wxmx file with both front ends
+    size_t start = 0;
+    while ((start = xml.find(wxT("<mth>"), start)) != wxString::npos)
+    {
+      size_t end = xml.find(wxT("</mth>"), start);
+      if (end == wxString::npos)
+        break;
+      end += 6;
+      // wxMaxima::DoConsoleAppend() does the same to maxima's output
+      wxString line = xml.Mid(start, end - start);
+      line.Replace(wxT("\n"), wxT(" "));
+      chars += line.Length();
+      outputs++;
+      start = end;
+      line = wxT("<span>") + line + wxT("</span>");
+
+      // Loading an image takes much longer than parsing the tag that names it
+      // and is the same for both front ends.
+      int lineRuns = runs;
+      if (line.Contains(wxT("<img")) || line.Contains(wxT("<slide")))
+        lineRuns = 1;
+
+      wxString domXML;
+      wxString streamXML;
+      bool streamable = true;
+      for (int run = 0; run < lineRuns; run++)
+      {
+        parser.m_ParserStyle = MC_TYPE_DEFAULT;
+        parser.m_FracStyle = FracCell::FC_NORMAL;
+        parser.m_highlight = false;
+        domTime.Resume();
+        Cell *cell = parser.ParseLineDOM(line);
+        domTime.Pause();
+        if (run == 0)
+          domXML = BenchmarkXML(cell, &cellPointers);
+        wxDELETE(cell);
+
+        streamTime.Resume();
+        streamable = parser.ParseStream(line, &cell);
+        streamTime.Pause();
+        if (run == 0)
+          streamXML = BenchmarkXML(cell, &cellPointers);
+        wxDELETE(cell);
+      }
+      if (!streamable)
+      {
+        // wxMaxima stores the answers to maxima's questions as editor cells
+        // within the output. These are left to wxXmlDocument on purpose.
+        if (line.Contains(wxT("<editor")) || line.Contains(wxT("<cell")))
+          worksheetCells++;
+        else
+        {
+          notStreamable++;
+          std::cerr << "The streaming parser cannot read " << line << "\n";
+        }
+      }
+      else if (domXML != streamXML)
+      {
+        differences++;
+        std::cerr << "The parsers disagree about " << line << ":\n  "
+                  << domXML << "\n  " << streamXML << "\n";
+      }
+    }
+  }
+
+  std::cout << outputs << " math outputs (" << chars << " chars) from "
+            << files.GetCount() << " files, up to " << runs << " runs each\n";
+  std::cout << "wxXmlDocument parser: " << domTime.Time() << " ms\n";
+  std::cout << "Streaming parser:     " << streamTime.Time() << " ms\n";
+  std::cout << worksheetCells << " outputs contained worksheet cells, "
+            << notStreamable << " other outputs needed wxXmlDocument, "
+            << differences << " outputs were parsed differently\n";
+  if ((differences != 0) || (notStreamable != 0))
+    retval = false;
+  wxDELETE(configuration);
+  return retval;
+}
@@ -32,6 +32,9 @@ The header file for the xml cell parser
 
 #include <wx/filesys.h>
 #include <wx/fs_arc.h>
+#include <vector>
+#include <list>
+#include <utility>
 
 #include "Cell.h"
 #include "TextCell.h"
@@ -41,12 +44,25 @@ The header file for the xml cell parser
 /*! This class handles parsing the xml representation of a cell tree.
 
 The xml representation of a cell tree can be found in the file contents.xml 
-inside a wxmx file
+inside a wxmx file.
+
+Maxima's output is read by a streaming front end that creates the cells while 
+it reads the xml text instead of first building a wxXmlDocument for it. Only 
+xml the streaming front end cannot handle is passed to wxXmlDocument. Both front
+ends only collect the attributes, the text and the child cells of each element:
+ParseElement() decides which cells they are converted to.
+
+Expressions that are longer than the "show long expressions" setting allows to
+be displayed at once are split into chunks: The first chunks are parsed at once,
+the rest is kept in a LazyCell that parses them when they are scrolled into view.
  */
 class MathParser
 {
 public:
   MathParser(Configuration **cfg, Cell::CellPointers *cellPointers, wxString zipfile = wxEmptyString);
+  //! A parser that loads the images its input refers to from filesystem
+  MathParser(Configuration **cfg, Cell::CellPointers *cellPointers,
+             const std::shared_ptr<wxFileSystem> &filesystem);
   //! This class doesn't have a copy constructor
   MathParser(const MathParser&) = delete;
   //! This class doesn't have a = operator
@@ -56,10 +72,173 @@ public:
   void SetUserLabel(wxString label){ m_userDefinedLabel = label; }
   Cell *ParseLine(wxString s, CellType style = MC_TYPE_DEFAULT);
 
+  /*! Parses the next part of an expression ParseLine() has split into chunks
+
+    Parses chunks from the front of the list until as much xml has been read as
+    the "show long expressions" setting allows to be displayed at once and removes
+    them from the list. At least one chunk is parsed.
+   */
+  Cell *ParseChunks(std::list<wxString> &chunks, CellType style = MC_TYPE_DEFAULT);
+
   Cell *ParseTag(wxXmlNode *node, bool all = true);
 
+  /*! Compares the streaming parser with the wxXmlDocument-based one
+
+    Parses all maxima output contained in a .wxmx file (or in all .wxmx files 
+    in a directory and its subdirectories) with both parsers, prints the times
+    they needed and checks if both create the same cells.
+    \return false, if the cells differ or if the streaming parser cannot read
+            an output that contains no worksheet cells.
+   */
+  static bool Benchmark(const wxString &corpus);
+
 private:
-  static void ParseCommonAttrs(wxXmlNode *node, Cell *cell);
+  //! The attributes of an xml element
+  typedef std::vector<std::pair<wxString, wxString> > Attributes;
+
+  //! A child node of an Element that has already been converted to cells
+  struct ElementChild
+  {
+    ElementChild() : cell(NULL) {}
+    //! The cells this node was converted to. NULL after the parent has taken them.
+    Cell *cell;
+    //! The tag name. wxEmptyString for text nodes.
+    wxString name;
+    Attributes attributes;
+    //! The cells of the columns, if this node is a row of a \<tb\> tag
+    std::vector<Cell *> rowCells;
+  };
+
+  /*! An xml element whose children have already been converted to cells
+
+    Both the streaming front end and the one that reads a wxXmlDocument collect
+    each element in this form and let ParseElement() create its cells.
+   */
+  struct Element
+  {
+    Element() : highlight(false), fracStyle(FracCell::FC_NORMAL) {}
+    wxString name;
+    Attributes attributes;
+    //! All child nodes that aren't whitespace
+    std::vector<ElementChild> children;
+    //! The contents of the first text node, if this is a tag that contains text
+    wxString text;
+    //! The value of m_highlight to restore at the end of this element
+    bool highlight;
+    //! The value of m_FracStyle to restore at the end of this element
+    int fracStyle;
+    //! The attribute's value or, if the attribute isn't set, defaultVal
+    wxString GetAttribute(const wxString &attrName,
+                          const wxString &defaultVal = wxEmptyString) const;
+  };
+
+  /*! Parses xml text without building a xml document first
+
+    \param s The xml text
+    \param result The cells for the children of the root element
+    \return false if the text contains anything this parser doesn't handle:
+            Errors and tags that only occur in .wxmx files.
+   */
+  bool ParseStream(const wxString &s, Cell **result);
+
+  //! The value of an attribute
+  static wxString GetAttribute(const Attributes &attributes,
+                               const wxString &attrName,
+                               const wxString &defaultVal = wxEmptyString);
+
+  //! Parses xml text using wxXmlDocument
+  Cell *ParseLineDOM(wxString s);
+
+  //! Parses xml text using the streaming parser, if possible, else using wxXmlDocument
+  Cell *ParseFragment(const wxString &s);
+
+  //! How many characters of xml we parse at once. 0 means: No limit.
+  long MaxParseLength() const;
+
+  /*! Splits a long xml fragment into chunks that can be parsed one by one
+
+    Only the contents of elements whose children are drawn one after another
+    (\<r\>, \<mth\> and similar) are split, and only at the boundaries of 
+    their children. A chunk that starts a new line is wrapped in a \<mth\> tag.
+    \return false, if s isn't well-formed xml.
+   */
+  static bool SplitLine(const wxString &s, size_t chunkSize, std::list<wxString> &chunks);
+
+  /*! Appends the contents of the element that spans [start, end) in s to the chunks
+
+    \param chunk The chunk that is currently being filled
+    \param newLine true, if the current chunk starts a new line
+    \param chunkAttributes The attributes of the split elements the current chunk
+           starts. FlushChunk() wraps the chunk in a \<span\> tag with each of them.
+   */
+  static bool SplitElement(const wxString &s, size_t start, size_t end, size_t chunkSize,
+                           std::list<wxString> &chunks, wxString &chunk, bool &newLine,
+                           std::vector<wxString> &chunkAttributes);
+
+  //! Appends the current chunk to the list of chunks, if it isn't empty
+  static void FlushChunk(std::list<wxString> &chunks, wxString &chunk, bool &newLine,
+                         std::vector<wxString> &chunkAttributes);
+
+  //! The name of the tag that starts at s[start]
+  static wxString GetTagName(const wxString &s, size_t start);
+
+  //! The position after the tag, comment or similar that starts at s[start]
+  static size_t FindMarkupEnd(const wxString &s, size_t start);
+
+  //! The position after the end of the element that starts at s[start]
+  static size_t FindElementEnd(const wxString &s, size_t start);
+
+  //! Reads a "&...;" entity and appends the char it stands for to text
+  static bool ReadStreamEntity(wxString::const_iterator &it,
+                               const wxString::const_iterator &end,
+                               wxString &text);
+
+  //! Adds a text node to an element
+  void AddText(Element &element, const wxString &text);
+
+  //! Sets up m_highlight and m_FracStyle for the contents of a new element
+  void BeginElement(Element &element, const Element *parent);
+
+  /*! Converts an element whose contents have been read completely to cells
+
+    Appends the cells to the parent's children and restores the values
+    BeginElement() has changed.
+    \return The cells for the element's children, if parent is NULL.
+   */
+  Cell *EndElement(Element &element, Element *parent);
+
+  /*! Creates the cells for an element whose children already have been converted
+
+    This is where both front ends decide which cells a tag stands for.
+   */
+  Cell *ParseElement(Element &element);
+
+  //! Hands the cells of the element's child #n to the caller
+  static Cell *TakeChild(Element &element, size_t n);
+
+  //! Hands the cells of the element's children, starting with #n, to the caller as one list
+  static Cell *TakeChildren(Element &element, size_t n);
+
+  //! Deletes all cells of an element's children nobody has taken
+  static void DeleteChildren(Element &element);
+
+  static void ParseCommonAttrs(const Element &element, Cell *cell);
+
+  //! Starts a new element in the streaming parser
+  void OpenStreamFrame(std::vector<Element> &stack, const wxString &name,
+                       Attributes &attributes);
+
+  /*! Ends the innermost element of the streaming parser
+
+    \return The cells for the root element's children, if this has been the root element.
+   */
+  Cell *CloseStreamFrame(std::vector<Element> &stack);
+
+  /*! Converts a node of a wxXmlDocument and appends the result to the parent's children
+
+    Child nodes are converted first so ParseElement() can put their cells together.
+   */
+  void ParseNode(wxXmlNode *node, Element &parent);
 
   Cell *HandleNullPointer(Cell *cell);
 
@@ -96,44 +275,10 @@ private:
 
   Cell *ParseEditorTag(wxXmlNode *node);
 
-  Cell *ParseFracTag(wxXmlNode *node);
-
-  Cell *ParseText(wxXmlNode *node, TextStyle style = TS_DEFAULT);
-
-  Cell *ParseCharCode(wxXmlNode *node, TextStyle style = TS_DEFAULT);
-
-  Cell *ParseSupTag(wxXmlNode *node);
-
-  Cell *ParseSubTag(wxXmlNode *node);
-
-  Cell *ParseAbsTag(wxXmlNode *node);
-
-  Cell *ParseConjugateTag(wxXmlNode *node);
-
-  Cell *ParseUnderTag(wxXmlNode *node);
-
-  Cell *ParseTableTag(wxXmlNode *node);
-
-  Cell *ParseAtTag(wxXmlNode *node);
-
-  Cell *ParseDiffTag(wxXmlNode *node);
-
-  Cell *ParseSumTag(wxXmlNode *node);
-
-  Cell *ParseIntTag(wxXmlNode *node);
-
-  Cell *ParseFunTag(wxXmlNode *node);
-
-  Cell *ParseSqrtTag(wxXmlNode *node);
-
-  Cell *ParseLimitTag(wxXmlNode *node);
-
-  Cell *ParseParenTag(wxXmlNode *node);
+  Cell *ParseText(const wxString &text, TextStyle style = TS_DEFAULT);
 
-  Cell *ParseSubSupTag(wxXmlNode *node);
+  Cell *ParseCharCode(const wxString &text, TextStyle style = TS_DEFAULT);
 
-  Cell *ParseMmultiscriptsTag(wxXmlNode *node);
-  
   wxString m_userDefinedLabel;
   wxRegEx m_graphRegex;
 
@@ -31,14 +31,27 @@
 #include <wx/string.h>
 
 MaximaTokenizer::MaximaTokenizer(wxString commands, Configuration *configuration)
+{
+  // No line break ends after the end of the string => tokenize everything.
+  Tokenize(commands, configuration, 0, commands.Length() + 1);
+}
+
+MaximaTokenizer::MaximaTokenizer(wxString commands, Configuration *configuration,
+                                 size_t start, size_t stopAfter)
+{
+  Tokenize(commands, configuration, start, stopAfter);
+}
+
+void MaximaTokenizer::Tokenize(const wxString &commands, Configuration *configuration,
+                               size_t start, size_t stopAfter)
 {  
   // ----------------------------------------------------------------
   // --------------------- Step one:                -----------------
   // --------------------- Break a line into tokens -----------------
   // ----------------------------------------------------------------
-  wxString::const_iterator it = commands.begin();
+  wxString::const_iterator it = commands.begin() + (ptrdiff_t) start;
       
-  if(configuration->InLispMode())
+  if(configuration->InLispMode() && (start == 0))
   {
     wxString token;
     while(
@@ -72,6 +85,8 @@ MaximaTokenizer::MaximaTokenizer(wxString commands, Configuration *configuration
     {
       m_tokens.push_back(std::shared_ptr<Token>(new Token(wxChar(Ch))));
       ++it;
+      if ((size_t)(it - commands.begin()) >= stopAfter)
+        break;
       continue;
     }
     // Check for comments
@@ -270,12 +285,14 @@ MaximaTokenizer::MaximaTokenizer(wxString commands, Configuration *configuration
     {
       wxString token = "+";
       m_tokens.push_back(std::shared_ptr<Token>(new Token(token)));
+      ++it;
       continue;
     }
     if (m_minusSigns.Contains(Ch))
     {
       wxString token = "-";
       m_tokens.push_back(std::shared_ptr<Token>(new Token(token)));
+      ++it;
       continue;
     }
     // Merge consecutive spaces into one single token
@@ -394,6 +411,7 @@ MaximaTokenizer::MaximaTokenizer(wxString commands, Configuration *configuration
       continue;
     }
   }
+  m_endPos = it - commands.begin();
 }
 
 bool MaximaTokenizer::IsAlpha(wxChar ch)
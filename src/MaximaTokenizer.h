@@ -45,6 +45,15 @@ class MaximaTokenizer
 {
 public:
   MaximaTokenizer(wxString commands, Configuration *configuration);
+  /*! Break down only a part of commands
+
+    Allows to re-tokenize only the lines of a text that have changed.
+    \param start The position of the first char to tokenize. Needs to be the beginning
+    of the text or the beginning of a line that doesn't lie within a token.
+    \param stopAfter Tokenization stops at the end of the first line break that 
+    ends at or after this position.
+   */
+  MaximaTokenizer(wxString commands, Configuration *configuration, size_t start, size_t stopAfter);
 
   class Token
   {
@@ -81,11 +90,18 @@ public:
       );}
 
   TokenList GetTokens(){return m_tokens;}
+  //! The position of the first char that hasn't been tokenized.
+  size_t GetEndPos() const {return m_endPos;}
 
   
 protected:
+  //! Tokenize commands from start on until the first line break that ends at or after stopAfter
+  void Tokenize(const wxString &commands, Configuration *configuration,
+                size_t start, size_t stopAfter);
   //! The tokens the string is divided into
   TokenList m_tokens;
+  //! The position of the first char that hasn't been tokenized.
+  size_t m_endPos;
   //! ASCII symbols that wxIsalnum() doesn't see as chars, but maxima does.
   static const wxString m_additional_alphas;
   //! Unicode Operators and other special non-ascii characters
@@ -31,19 +31,20 @@
 
 #include "SlideShowCell.h"
 #include "ImgCell.h"
+#include "GroupCell.h"
 
 #include <wx/quantize.h>
 #include <wx/imaggif.h>
 #include <wx/file.h>
 #include <wx/filename.h>
 #include <wx/filesys.h>
-#include <wx/fs_mem.h>
 #include <wx/utils.h>
 #include <wx/clipbrd.h>
 #include <wx/config.h>
 #include <wx/mstream.h>
 #include <wx/wfstream.h>
 #include <wx/anidecod.h>
+#include <wx/time.h>
 
 SlideShow::SlideShow(Cell *parent, Configuration **config, CellPointers *cellPointers, const std::shared_ptr <wxFileSystem> &filesystem, int framerate) :
   Cell(parent, config, cellPointers),
@@ -57,6 +58,11 @@ SlideShow::SlideShow(Cell *parent, Configuration **config, CellPointers *cellPoi
   m_framerate = framerate;
   m_imageBorderWidth = Scale_Px(1);
   m_drawBoundingBox = false;
+  m_nextFrameTime = 0;
+  m_droppedFrames = 0;
+  m_framesToSkip = 0;
+  m_droppedFrame = -1;
+  m_lastDrawnFrame = -1;
   if(m_animationRunning)
     ReloadTimer();
 }
@@ -71,6 +77,11 @@ SlideShow::SlideShow(Cell *parent, Configuration **config, CellPointers *cellPoi
   m_framerate = framerate;
   m_imageBorderWidth = Scale_Px(1);
   m_drawBoundingBox = false;
+  m_nextFrameTime = 0;
+  m_droppedFrames = 0;
+  m_framesToSkip = 0;
+  m_droppedFrame = -1;
+  m_lastDrawnFrame = -1;
   if(m_animationRunning)
     ReloadTimer();
 }
@@ -105,7 +116,29 @@ void SlideShow::ReloadTimer()
   if(m_timer)
   {
     if(!m_timer->IsRunning())
-      m_timer->StartOnce(1000 / GetFrameRate());
+    {
+      // The next frame is due one period after the last one was due, not one
+      // period after it was drawn: Else the time drawing needs would slow down
+      // the animation.
+      long period = 1000 / GetFrameRate();
+      wxLongLong now = wxGetLocalTimeMillis();
+      wxLongLong delay = now - m_nextFrameTime;
+      if ((m_nextFrameTime == 0) || (delay > 1000))
+        // The animation has just been started or has been off-screen.
+        m_nextFrameTime = now;
+      else if (delay > period)
+      {
+        // We are more than a frame late: Give up the frames we have missed.
+        m_framesToSkip = (delay / period).ToLong();
+        m_droppedFrames += m_framesToSkip;
+        m_nextFrameTime = now;
+      }
+      m_nextFrameTime += period;
+      long wait = (m_nextFrameTime - now).ToLong();
+      if (wait < 1)
+        wait = 1;
+      m_timer->StartOnce(wait);
+    }
   }
 }
 
@@ -117,6 +150,8 @@ void SlideShow::StopTimer()
       m_cellPointers->m_slideShowTimers.erase(this);
       m_timer = NULL;
     }
+    m_nextFrameTime = 0;
+    m_framesToSkip = 0;
 }
 
 void SlideShow::AnimationRunning(bool run)
@@ -125,11 +160,22 @@ void SlideShow::AnimationRunning(bool run)
     ReloadTimer();
   else
     StopTimer();
+  if(m_animationRunning != run)
+    InvalidateGroupSerializationCache();
   m_animationRunning = run;
 }
 
+void SlideShow::InvalidateGroupSerializationCache()
+{
+  // The XML of our GroupCell contains the state of the animation
+  GroupCell *group = dynamic_cast<GroupCell *>(m_group);
+  if(group != NULL)
+    group->InvalidateSerializationCache();
+}
+
 int SlideShow::SetFrameRate(int Freq)
 {
+  int oldFramerate = m_framerate;
 
   m_framerate = Freq;
 
@@ -143,6 +189,8 @@ int SlideShow::SetFrameRate(int Freq)
       m_framerate = 200;
   }
 
+  if(m_framerate != oldFramerate)
+    InvalidateGroupSerializationCache();
   return m_framerate;
 }
 
@@ -196,10 +244,22 @@ std::list<std::shared_ptr<Cell>> SlideShow::GetInnerCells()
 
 void SlideShow::SetDisplayedIndex(int ind)
 {
+  int oldDisplayed = m_displayed;
   if (ind >= 0 && ind < m_size)
     m_displayed = ind;
   else
     m_displayed = m_size - 1;
+  if(m_displayed != oldDisplayed)
+    InvalidateGroupSerializationCache();
+}
+
+void SlideShow::ShowNextFrame()
+{
+  if (m_size < 1)
+    return;
+  long framesToSkip = m_framesToSkip;
+  m_framesToSkip = 0;
+  SetDisplayedIndex((m_displayed + 1 + framesToSkip) % m_size);
 }
 
 void SlideShow::RecalculateWidths(int fontsize)
@@ -275,7 +335,38 @@ void SlideShow::Draw(wxPoint point)
 
     dc->DrawRectangle(wxRect(point.x, point.y - m_center, m_width, m_height));
 
-    wxBitmap bitmap = (configuration->GetPrinting() ? m_images[m_displayed]->GetBitmap(configuration->GetZoomFactor() * PRINT_SIZE_MULTIPLIER) : m_images[m_displayed]->GetBitmap());
+    wxBitmap bitmap;
+    if (configuration->GetPrinting())
+      bitmap = m_images[m_displayed]->GetBitmap(configuration->GetZoomFactor() * PRINT_SIZE_MULTIPLIER);
+    else if (configuration->ClipToDrawRegion())
+    {
+      // Drawing the worksheet: Don't wait for the image to be scaled.
+      int frame = m_displayed;
+      if (m_animationRunning)
+      {
+        // Scale the frames we will display next while this one is displayed.
+        m_images[m_displayed]->Prefetch();
+        for (int i = 1; (i <= m_framesToPrefetch) && (i < m_size); i++)
+          if (m_images[(m_displayed + i) % m_size] != NULL)
+            m_images[(m_displayed + i) % m_size]->Prefetch();
+
+        // If the frame isn't ready in time we keep the last one instead of
+        // showing a preview.
+        if ((!m_images[m_displayed]->ScaledBitmapReady()) &&
+            (m_lastDrawnFrame >= 0) && (m_lastDrawnFrame < m_size) &&
+            (m_images[m_lastDrawnFrame]->ScaledBitmapReady()))
+        {
+          if (m_droppedFrame != m_displayed)
+            m_droppedFrames++;
+          m_droppedFrame = m_displayed;
+          frame = m_lastDrawnFrame;
+        }
+      }
+      bitmap = m_images[frame]->GetScreenBitmap(GetRect());
+      m_lastDrawnFrame = frame;
+    }
+    else
+      bitmap = m_images[m_displayed]->GetBitmap();
     bitmapDC.SelectObject(bitmap);
 
     int imageBorderWidth = m_imageBorderWidth;
@@ -326,10 +417,8 @@ wxString SlideShow::ToXML()
     if (m_images[i])
     {
       if (m_images[i]->GetCompressedImage())
-        wxMemoryFSHandler::AddFile(basename + m_images[i]->GetExtension(),
-                                   m_images[i]->GetCompressedImage().GetData(),
-                                   m_images[i]->GetCompressedImage().GetDataLen()
-        );
+        m_cellPointers->WXMXAddFile(basename + m_images[i]->GetExtension(),
+                                    m_images[i]->GetCompressedImage());
     }
 
     images += basename + m_images[i]->GetExtension() + wxT(";");
@@ -414,6 +503,9 @@ wxString SlideShow::GetToolTip(const wxPoint &point)
                "able to understand what maxima wanted to plot.\n"
                "One example of the latter would be: Gnuplot refuses to plot entirely "
                "empty images"));
+    else if (m_droppedFrames > 0)
+      return m_toolTip + wxString::Format(_("\n%li frames of this animation couldn't be displayed in time."),
+                                          m_droppedFrames);
     else
       return m_toolTip;
   }
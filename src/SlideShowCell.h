@@ -33,6 +33,7 @@
 #include "Image.h"
 #include <wx/image.h>
 #include <wx/timer.h>
+#include <wx/longlong.h>
 
 #include <wx/filesys.h>
 #include <wx/fs_arc.h>
@@ -108,6 +109,13 @@ public:
 
   void SetDisplayedIndex(int ind);
 
+  /*! Advance the animation by one frame
+
+    If the last frame was shown too late the frames that were due in the
+    meantime are skipped so the animation keeps its speed.
+   */
+  void ShowNextFrame();
+
   int Length() const
   { return m_size; }
 
@@ -150,7 +158,12 @@ public:
 
   bool AnimationRunning() const {return m_animationRunning;}
   void AnimationRunning(bool run);
+
+  //! How many frames of the animation couldn't be displayed in time
+  long DroppedFrames() const {return m_droppedFrames;}
 protected:
+  //! Tell our GroupCell that its cached XML doesn't contain our current state any more
+  void InvalidateGroupSerializationCache();
   std::shared_ptr<wxTimer> m_timer;
   /*! The framerate of this cell.
 
@@ -187,6 +200,18 @@ protected:
 
 private:
   bool m_drawBoundingBox;
+  //! How many frames are scaled in the background before they are displayed
+  static const int m_framesToPrefetch = 4;
+  //! When the next frame is due [in ms since the epoch]; 0 = not scheduled yet.
+  wxLongLong m_nextFrameTime;
+  //! How many frames couldn't be displayed in time
+  long m_droppedFrames;
+  //! How many frames ShowNextFrame() has to skip as they have been due while we were late
+  long m_framesToSkip;
+  //! The last frame we have counted as dropped
+  int m_droppedFrame;
+  //! The frame that was drawn last; -1 = none
+  int m_lastDrawnFrame;
 };
 
 #endif // SLIDESHOWCELL_H
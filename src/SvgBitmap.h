@@ -45,6 +45,11 @@ public:
 
   //! Converts rgba data to a wxBitmap
   static wxBitmap RGBA2wxBitmap(const unsigned char imgdata[],const int &width, const int &height);
+  /*! Converts rgba data to a wxImage
+
+    Unlike wxBitmaps wxImages can be created in background threads.
+   */
+  static wxImage RGBA2wxImage(const unsigned char imgdata[],const int &width, const int &height);
   //! Sets the bitmap to a new size and renders the svg image at this size.
   const SvgBitmap& SetSize(int width, int height);
   //! Sets the bitmap to a new size and renders the svg image at this size.
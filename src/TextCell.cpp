@@ -88,7 +88,6 @@ std::list<std::shared_ptr<Cell>> TextCell::GetInnerCells()
 
 void TextCell::SetStyle(TextStyle style)
 {
-  m_widths.clear();
   Cell::SetStyle(style);
   if ((m_text == wxT("gamma")) && (m_textStyle == TS_FUNCTION))
     m_displayedText = wxT("\u0393");
@@ -102,7 +101,6 @@ void TextCell::SetStyle(TextStyle style)
 
 void TextCell::SetType(CellType type)
 {
-  m_widths.clear();
   ResetSize();
   ResetData();
   Cell::SetType(type);
@@ -110,7 +108,6 @@ void TextCell::SetType(CellType type)
 
 void TextCell::SetValue(const wxString &text)
 {
-  m_widths.clear();
   SetToolTip(m_initialToolTip);
   m_displayedDigits_old = (*m_configuration)->GetDisplayedDigits();
   m_text = text;
@@ -371,20 +368,8 @@ TextCell::TextCell(const TextCell &cell):
 
 wxSize TextCell::GetTextSize(wxString const &text)
 {
-  wxDC *dc = (*m_configuration)->GetDC();
-  double fontSize = dc->GetFont().GetPointSize();
-
-  SizeHash::const_iterator it = m_widths.find(fontSize);
-
-  // If we already know this text piece's size we return the cached value
-  if(it != m_widths.end())
-    return it->second;
-
-  // Ask wxWidgets to return this text piece's size (slow, but the only way if
-  // there is no cached size).
-  wxSize sz = dc->GetTextExtent(text);
-  m_widths[fontSize] = sz;
-  return sz;
+  // The text extents are cached by the configuration for all cells together.
+  return (*m_configuration)->GetTextExtent(text);
 }
 
 bool TextCell::NeedsRecalculation(int fontSize)
@@ -439,49 +424,15 @@ void TextCell::RecalculateWidths(int fontsize)
         )
     {
       SetValue(m_text);
-      m_numstartWidths.clear();
-      m_ellipsisWidths.clear();
-      m_numEndWidths.clear();
     }
     
     m_lastCalculationFontSize = fontsize;
 
     if(m_numStart != wxEmptyString)
     {      
-      double fontSize = dc->GetFont().GetPointSize();
-      {
-        SizeHash::const_iterator it = m_numstartWidths.find(fontSize);    
-        if(it != m_numstartWidths.end())
-          m_numStartWidth = it->second;
-        else
-        {
-          wxSize sz = dc->GetTextExtent(m_numStart);
-          m_numstartWidths[fontSize] = sz;
-          m_numStartWidth = sz;
-        }
-      }
-      {
-        SizeHash::const_iterator it = m_numEndWidths.find(fontSize);    
-        if(it != m_numEndWidths.end())
-          m_numEndWidth = it->second;
-        else
-        {
-          wxSize sz = dc->GetTextExtent(m_numEnd);
-          m_numEndWidths[fontSize] = sz;
-          m_numEndWidth = sz;
-        }
-      }
-      {
-        SizeHash::const_iterator it = m_ellipsisWidths.find(fontSize);    
-        if(it != m_ellipsisWidths.end())
-          m_ellipsisWidth = it->second;
-        else
-        {
-          wxSize sz = dc->GetTextExtent(m_ellipsis);
-          m_ellipsisWidths[fontSize] = sz;
-          m_ellipsisWidth = sz;
-        }
-      }
+      m_numStartWidth = GetTextSize(m_numStart);
+      m_numEndWidth = GetTextSize(m_numEnd);
+      m_ellipsisWidth = GetTextSize(m_ellipsis);
       m_width = m_numStartWidth.GetWidth() + m_numEndWidth.GetWidth() +
         m_ellipsisWidth.GetWidth();
       m_height = wxMax(
@@ -109,7 +109,6 @@ protected:
     {
       ResetSize();
       ResetData();
-      m_widths.clear();
     }
 
   //! Resets the font size to label size
@@ -142,41 +141,13 @@ protected:
   //! The actual font size for labels (that have a fixed width)
   double m_fontSizeLabel;
 private:
-  class SizeHash_internals
-  {
-  public:
-    SizeHash_internals() { }
-    unsigned long operator()( const double& k ) const
-      {
-        return k * 1000000;
-      }
-    SizeHash_internals& operator=(const SizeHash_internals&) { return *this; }
-  };
-  // comparison operator
-  class DoubleEqual
-  {
-  public:
-    DoubleEqual() { }
-    bool operator()( const double& a, const double& b ) const
-      {
-        return fabs(a-b) < .001;
-      }
-    DoubleEqual& operator=(const DoubleEqual&) { return *this; }
-  };
-  WX_DECLARE_HASH_MAP(
-    double, wxSize, SizeHash_internals, DoubleEqual, SizeHash);
-  //! Remembers all widths of the full text we already have configured
-  SizeHash m_widths;
   //! The size of the first few digits
-  SizeHash m_numstartWidths;
   wxSize m_numStartWidth;
   wxString m_numStart;
   //! The size of the "not all digits displayed" message.
-  SizeHash m_ellipsisWidths;
   wxString m_ellipsis;
   wxSize m_ellipsisWidth;
   //! The size of the last few digits
-  SizeHash m_numEndWidths;
   wxString m_numEnd;
   wxSize m_numEndWidth;
 
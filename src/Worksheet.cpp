@@ -65,6 +65,8 @@
 #include <wx/filesys.h>
 #include <wx/fs_mem.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <set>
 #include "memory"
 
 //! This class represents the worksheet shown in the middle of the wxMaxima window.
@@ -114,6 +116,8 @@ Worksheet::Worksheet(wxWindow *parent, int id, wxPoint pos, wxSize size) :
   m_pointer_x = -1;
   m_pointer_y = -1;
   m_recalculateStart = NULL;
+  m_recalculationForcePending = false;
+  m_fontChangedPending = false;
   m_mouseMotionWas = false;
   m_rectToRefresh = wxRect(-1,-1,-1,-1);
   m_notificationMessage = NULL;
@@ -139,6 +143,8 @@ Worksheet::Worksheet(wxWindow *parent, int id, wxPoint pos, wxSize size) :
   m_windowActive = true;
   m_lastTop = 0;
   m_lastBottom = 0;
+  m_cacheTop = 0;
+  m_cacheBottom = -1;
   m_followEvaluation = true;
   TreeUndo_ActiveCell = NULL;
   m_questionPrompt = false;
@@ -191,6 +197,7 @@ Worksheet::Worksheet(wxWindow *parent, int id, wxPoint pos, wxSize size) :
     wxEVT_MENU, wxCommandEventHandler(Worksheet::OnComplete));
   Connect(wxEVT_SIZE, wxSizeEventHandler(Worksheet::OnSize));
   Connect(wxEVT_PAINT, wxPaintEventHandler(Worksheet::OnPaint));
+  Connect(wxEVT_THREAD, wxThreadEventHandler(Worksheet::OnImageScaled));
   Connect(wxEVT_MOUSE_CAPTURE_LOST, wxMouseCaptureLostEventHandler(Worksheet::OnMouseCaptureLost));
   Connect(wxEVT_LEFT_UP, wxMouseEventHandler(Worksheet::OnMouseLeftUp));
   Connect(wxEVT_LEFT_DOWN, wxMouseEventHandler(Worksheet::OnMouseLeftDown));
@@ -211,6 +218,11 @@ Worksheet::Worksheet(wxWindow *parent, int id, wxPoint pos, wxSize size) :
   Connect(wxEVT_SCROLLWIN_THUMBTRACK, wxScrollWinEventHandler(Worksheet::OnThumbtrack));
 }
 
+void Worksheet::OnImageScaled(wxThreadEvent &event)
+{
+  RequestRedraw(event.GetPayload<wxRect>());
+}
+
 void Worksheet::OnSidebarKey(wxCommandEvent &event)
 {
   SetFocus();
@@ -235,7 +247,7 @@ bool Worksheet::RedrawIfRequested()
 {
   bool redrawIssued = false;
 
-  RecalculateIfNeeded();
+  RecalculateIfNeeded(true);
 
   if(m_mouseMotionWas)
   {
@@ -484,8 +496,9 @@ void Worksheet::OnPaint(wxPaintEvent &WXUNUSED(event))
 
   // We might be triggered after someone changed the worksheet and before the idle
   // loop caused it to be recalculated => Ensure all sizes and positions to be known
-  // before we proceed.
-  RecalculateIfNeeded();
+  // before we proceed. Cells the time-sliced layout hasn't reached yet are
+  // layouted by the drawing loop below if they are visible.
+  RecalculateIfNeeded(true);
 
   // Create a graphics context that supports antialiassing, but on MSW
   // only supports fonts that come in the Right Format.
@@ -618,16 +631,60 @@ void Worksheet::OnPaint(wxPaintEvent &WXUNUSED(event))
   //
   // Draw the cell contents
   //
-  wxPoint point;
-  point.x = m_configuration->GetIndent();
-  point.y = m_configuration->GetBaseIndent() + GetTree()->GetCenterList();
-  // Draw tree
-  GroupCell *tmp = GetTree();
-  
   m_configuration->GetDC()->SetPen(*(wxThePenList->FindOrCreatePen(m_configuration->GetColor(TS_DEFAULT), 1, wxPENSTYLE_SOLID)));
   m_configuration->GetDC()->SetBrush(*(wxTheBrushList->FindOrCreateBrush(m_configuration->GetColor(TS_DEFAULT))));
   
   bool recalculateNecessaryWas = false;
+
+  int width;
+  int height;
+  GetClientSize(&width, &height);
+  
+  wxPoint upperLeftScreenCorner;
+  CalcScrolledPosition(0, 0,
+                       &upperLeftScreenCorner.x, &upperLeftScreenCorner.y);
+  (m_configuration)->SetVisibleRegion(wxRect(upperLeftScreenCorner,
+                                             upperLeftScreenCorner + wxPoint(width,height)));
+  (m_configuration)->SetWorksheetPosition(GetPosition());
+
+  if (m_cellPointers.m_groupIndexOutdated || m_groupIndex.empty())
+    UpdateGroupIndex();
+
+  // Clear the image cache of all cells above or below the viewport.
+  //
+  // Only actually clear the image cache if there is a screen's height between
+  // us and the image's position: Else the chance is too high that we will
+  // very soon have to generated a scaled image again.
+  long keepTop = m_lastBottom - 2 * height;
+  long keepBottom = m_lastTop + 2 * height;
+  for (size_t i = FirstGroupBelow(m_cacheTop); i < m_groupIndex.size(); i++)
+  {
+    GroupCell *tmp = m_groupIndex[i];
+    wxRect cellRect = tmp->GetRect();
+    if (cellRect.GetTop() > m_cacheBottom)
+      break;
+    if ((cellRect.GetTop() >= bottom) || (cellRect.GetBottom() <= top))
+    {
+      if ((cellRect.GetBottom() <= keepTop) || (cellRect.GetTop() >= keepBottom))
+      {
+        if (tmp->GetOutput())
+          tmp->GetOutput()->ClearCacheList();
+      }
+    }
+  }
+  m_cacheTop = wxMin(top, keepTop);
+  m_cacheBottom = wxMax(bottom, keepBottom);
+
+  // Draw only the GroupCells that intersect the region we need to redraw
+  size_t firstVisible = FirstGroupBelow(top);
+  GroupCell *tmp = NULL;
+  wxPoint point;
+  if (firstVisible < m_groupIndex.size())
+  {
+    tmp = m_groupIndex[firstVisible];
+    tmp->UpdateYPosition();
+    point = tmp->GetCurrentPoint();
+  }
   
   while (tmp != NULL)
   {
@@ -638,33 +695,16 @@ void Worksheet::OnPaint(wxPaintEvent &WXUNUSED(event))
       (tmp->GetRect().GetHeight() < 0)
       )
     {
-      tmp->Recalculate();
+      RecalculateGroup(tmp);
       recalculateNecessaryWas = true;
     }
-    
-    wxRect cellRect = tmp->GetRect();
-    
-    int width;
-    int height;
-    GetClientSize(&width, &height);
-    
-    wxPoint upperLeftScreenCorner;
-    CalcScrolledPosition(0, 0,
-                         &upperLeftScreenCorner.x, &upperLeftScreenCorner.y);
-    (m_configuration)->SetVisibleRegion(wxRect(upperLeftScreenCorner,
-                                               upperLeftScreenCorner + wxPoint(width,height)));
-    (m_configuration)->SetWorksheetPosition(GetPosition());
-    // Clear the image cache of all cells above or below the viewport.
-    if ((cellRect.GetTop() >= bottom) || (cellRect.GetBottom() <= top))
+    else if (tmp->RecalculationNeeded())
     {
-      // Only actually clear the image cache if there is a screen's height between
-      // us and the image's position: Else the chance is too high that we will
-      // very soon have to generated a scaled image again.
-      if ((cellRect.GetBottom() <= m_lastBottom - 2 * height) || (cellRect.GetTop() >= m_lastTop + 2 * height))
-      {
-        if (tmp->GetOutput())
-          tmp->GetOutput()->ClearCacheList();
-      }
+      // The time-sliced layout hasn't reached this cell yet => Layout it now
+      // as it is visible. The cells below it are moved by the UpdateYPosition()
+      // calls in this loop.
+      RecalculateGroup(tmp);
+      m_cellPointers.m_groupIndexOutdated = true;
     }
     
     tmp->SetCurrentPoint(point);
@@ -679,6 +719,8 @@ void Worksheet::OnPaint(wxPaintEvent &WXUNUSED(event))
     {
       tmp->UpdateYPosition();
       point = tmp->GetCurrentPoint();
+      if (tmp->GetRect().GetTop() > bottom)
+        break;
     }
   }
   
@@ -754,6 +796,8 @@ GroupCell *Worksheet::InsertGroupCells(
   // make sure m_last still points to the last cell of the worksheet!!
   if (!next) // if there were no further cells
     m_last = lastOfCellsToInsert;
+  m_cellPointers.m_groupIndexOutdated = true;
+  m_cellPointers.m_lookalikeIndexOutdated = true;
 
   if (renumbersections)
     NumberSections();
@@ -772,6 +816,8 @@ GroupCell *Worksheet::InsertGroupCells(
 // m_last is correct
 GroupCell *Worksheet::UpdateMLast()
 {
+  m_cellPointers.m_groupIndexOutdated = true;
+  m_cellPointers.m_lookalikeIndexOutdated = true;
   if (!GetTree())
     m_last = NULL;
   else
@@ -878,7 +924,10 @@ void Worksheet::InsertLine(Cell *newCell, bool forceNewLine)
   tmp->AppendOutput(newCell);
   
   UpdateConfigurationClientSize();
-  Recalculate(tmp);
+  // If AppendOutput() has been able to layout only the new cells the following
+  // cells only need to be moved, which OnPaint() or RecalculateIfNeeded() will do.
+  if (tmp->RecalculationNeeded())
+    Recalculate(tmp);
   
   if (FollowEvaluation())
   {
@@ -937,7 +986,7 @@ void Worksheet::SetZoomFactor(double newzoom, bool recalc)
   ScheduleScrollToCell(cellToScrollTo);
 }
 
-bool Worksheet::RecalculateIfNeeded()
+bool Worksheet::RecalculateIfNeeded(bool timeSliced)
 {
   bool recalculate = true;
   UpdateConfigurationClientSize();
@@ -950,7 +999,11 @@ bool Worksheet::RecalculateIfNeeded()
   if(!recalculate)
   {
     if(m_configuration->AdjustWorksheetSize())
+    {
+      if (m_cellPointers.m_groupIndexOutdated)
+        UpdateGroupIndex();
       AdjustSize();
+    }
     return false;
   }
   m_configuration->AdjustWorksheetSize(false);
@@ -971,57 +1024,272 @@ bool Worksheet::RecalculateIfNeeded()
   int height;
   GetClientSize(&width, &height);
 
+  wxPoint upperLeftScreenCorner;
+  CalcScrolledPosition(0, 0,
+                       &upperLeftScreenCorner.x, &upperLeftScreenCorner.y);
+  m_configuration->SetVisibleRegion(wxRect(upperLeftScreenCorner,
+                                    upperLeftScreenCorner + wxPoint(width,height)));
+  m_configuration->SetWorksheetPosition(GetPosition());
+
+  // A forced relayout only concerns the cells this pass still has to handle:
+  // Mark them and show the flags to the cells only while RecalculateGroup()
+  // layouts them. Else OnPaint() would relayout every visible cell on every
+  // redraw until a time-sliced pass has finished.
+  if (m_configuration->RecalculationForce() || m_configuration->FontChanged())
+  {
+    m_recalculationForcePending = m_recalculationForcePending || m_configuration->RecalculationForce();
+    m_fontChangedPending = m_fontChangedPending || m_configuration->FontChanged();
+    m_configuration->RecalculationForce(false);
+    m_configuration->FontChanged(false);
+    for (GroupCell *group = tmp; group != NULL; group = group->GetNext())
+      group->SetRecalculationNeeded();
+  }
+
+  // Only the cells that have changed need to be recalculated. The cells below
+  // them only need to be moved => UpdateGroupIndex() does that.
+  //
+  // If we are allowed to return to the event loop before we are done we do so
+  // after LAYOUT_TIME_SLICE milliseconds: Big worksheets would otherwise block
+  // the GUI for seconds. The cells that still are to be layouted are skipped
+  // by OnPaint() and are measured on the next idle event.
+  wxStopWatch stopwatch;
   while (tmp != NULL)
   {
-    wxPoint upperLeftScreenCorner;
-    CalcScrolledPosition(0, 0,
-                         &upperLeftScreenCorner.x, &upperLeftScreenCorner.y);
-    m_configuration->SetVisibleRegion(wxRect(upperLeftScreenCorner,
-                                      upperLeftScreenCorner + wxPoint(width,height)));
-    m_configuration->SetWorksheetPosition(GetPosition());
-
-    tmp->Recalculate();
+    if (tmp->RecalculationNeeded())
+      RecalculateGroup(tmp);
     tmp = tmp->GetNext();
+    if (timeSliced && (tmp != NULL) && (stopwatch.Time() > LAYOUT_TIME_SLICE))
+    {
+      m_recalculateStart = tmp;
+      UpdateGroupIndex();
+      AdjustSize();
+      return true;
+    }
   }
 
+  UpdateGroupIndex();
   AdjustSize();
-  m_configuration->RecalculationForce(false);
-  m_configuration->FontChanged(false);
+  if (m_recalculationForcePending)
+  {
+    wxLogDebug(wxString::Format(wxT("Relayout of the worksheet: %li font cache hits, %li misses"),
+                                m_configuration->GetFontCacheHits(),
+                                m_configuration->GetFontCacheMisses()));
+    wxLogDebug(wxString::Format(wxT("Relayout of the worksheet: %li text extent cache hits, %li misses"),
+                                m_configuration->GetTextExtentCacheHits(),
+                                m_configuration->GetTextExtentCacheMisses()));
+    wxLogDebug(wxString::Format(wxT("Scaled bitmap cache: %li hits, %li misses since the start, %li bytes in use"),
+                                Image::BitmapCacheHits(),
+                                Image::BitmapCacheMisses(),
+                                Image::BitmapCacheBytes()));
+  }
+  m_configuration->ResetFontCacheStatistics();
+  m_configuration->ResetTextExtentCacheStatistics();
+  m_recalculationForcePending = false;
+  m_fontChangedPending = false;
 
   m_recalculateStart = NULL;
   return true;
 }
 
+void Worksheet::RecalculateGroup(GroupCell *group)
+{
+  // Flags that have been set since the pass has started are picked up by the
+  // next RecalculateIfNeeded() => keep them.
+  bool force = m_configuration->RecalculationForce();
+  bool fontChanged = m_configuration->FontChanged();
+  m_configuration->RecalculationForce(force || m_recalculationForcePending);
+  m_configuration->FontChanged(fontChanged || m_fontChangedPending);
+  group->Recalculate();
+  m_configuration->RecalculationForce(force);
+  m_configuration->FontChanged(fontChanged);
+}
+
+void Worksheet::UpdateGroupIndex()
+{
+  m_groupIndex.clear();
+  GroupCell *tmp = GetTree();
+  while (tmp != NULL)
+  {
+    m_groupIndex.push_back(tmp);
+    tmp = tmp->UpdateYPosition();
+  }
+  m_cellPointers.m_groupIndexOutdated = false;
+}
+
+size_t Worksheet::FirstGroupBelow(long y)
+{
+  // The GroupCells are drawn one below the other => their bottoms are sorted.
+  std::vector<GroupCell *>::const_iterator it =
+    std::lower_bound(m_groupIndex.begin(), m_groupIndex.end(), y,
+                     [](GroupCell *group, long pos) {return group->GetRect().GetBottom() < pos;});
+  return it - m_groupIndex.begin();
+}
+
+bool Worksheet::ExpandLazyCells()
+{
+  if (m_cellPointers.m_lazyCellsToExpand.empty())
+    return false;
+
+  std::list<Cell *> cells;
+  cells.swap(m_cellPointers.m_lazyCellsToExpand);
+  for (std::list<Cell *>::const_iterator it = cells.begin(); it != cells.end(); ++it)
+  {
+    GroupCell *group = dynamic_cast<GroupCell *>((*it)->GetGroup());
+    if (group == NULL)
+      continue;
+    group->ExpandLazyCell(dynamic_cast<LazyCell *>(*it));
+    // If ExpandLazyCell() has been able to layout only the new lines the
+    // following cells only need to be moved, which OnPaint() will do.
+    if (group->RecalculationNeeded())
+      Recalculate(group);
+    RequestRedraw(group);
+  }
+  return true;
+}
+
+void Worksheet::AddToLookalikeIndex(GroupCell *group, std::set<wxString> *skeletons)
+{
+  group->m_indexedSkeletons = group->GetSkeletons();
+  for (GroupCell::StringHash::const_iterator it = group->m_indexedSkeletons.begin();
+       it != group->m_indexedSkeletons.end(); ++it)
+  {
+    SkeletonIndexEntry &entry = m_skeletonIndex[it->second];
+    entry.names[it->first]++;
+    entry.groups.insert(group);
+    if (skeletons != NULL)
+      skeletons->insert(it->second);
+  }
+}
+
+void Worksheet::RemoveFromLookalikeIndex(GroupCell *group, std::set<wxString> &skeletons)
+{
+  for (GroupCell::StringHash::const_iterator it = group->m_indexedSkeletons.begin();
+       it != group->m_indexedSkeletons.end(); ++it)
+  {
+    SkeletonIndex::iterator entry = m_skeletonIndex.find(it->second);
+    if (entry == m_skeletonIndex.end())
+      continue;
+    skeletons.insert(it->second);
+    GroupCell::CmdsAndVariables::iterator name = entry->second.names.find(it->first);
+    if ((name != entry->second.names.end()) && (--name->second <= 0))
+      entry->second.names.erase(name);
+    entry->second.groups.erase(group);
+    if (entry->second.names.empty())
+      m_skeletonIndex.erase(entry);
+  }
+  group->m_indexedSkeletons.clear();
+}
+
+void Worksheet::UpdateLookalikeWarnings(GroupCell *group)
+{
+  wxString warnings;
+  const GroupCell::StringHash &names = group->m_indexedSkeletons;
+  for (GroupCell::StringHash::const_iterator it = names.begin(); it != names.end(); ++it)
+  {
+    SkeletonIndex::const_iterator entry = m_skeletonIndex.find(it->second);
+    if (entry == m_skeletonIndex.end())
+      continue;
+    const GroupCell::CmdsAndVariables &lookalikes = entry->second.names;
+    for (GroupCell::CmdsAndVariables::const_iterator lookalike = lookalikes.begin();
+         lookalike != lookalikes.end(); ++lookalike)
+    {
+      // Lookalikes within the same cell are reported by the cell itself.
+      if (names.find(lookalike->first) != names.end())
+        continue;
+      if (!warnings.IsEmpty())
+        warnings += "\n";
+      warnings += _("Warning: Lookalike chars in another cell: ") +
+        lookalike->first + wxT(" \u2260 ") + it->first;
+    }
+  }
+  group->SetLookalikesInOtherCells(warnings);
+}
+
+void Worksheet::UpdateLookalikeWarnings()
+{
+  std::list<Cell *> changed;
+  changed.swap(m_cellPointers.m_lookalikeGroupsChanged);
+  for (std::list<Cell *>::const_iterator it = changed.begin(); it != changed.end(); ++it)
+    dynamic_cast<GroupCell *>(*it)->m_lookalikeChangeQueued = false;
+
+  if (m_cellPointers.m_lookalikeIndexOutdated)
+  {
+    // Cells have been added or removed: Rebuild the index from the skeletons
+    // the cells have cached.
+    m_cellPointers.m_lookalikeIndexOutdated = false;
+    m_cellPointers.m_lookalikeIndexGeneration++;
+    m_skeletonIndex.clear();
+    for (GroupCell *group = GetTree(); group != NULL; group = group->GetNext())
+    {
+      group->m_lookalikeIndexGeneration = m_cellPointers.m_lookalikeIndexGeneration;
+      AddToLookalikeIndex(group, NULL);
+    }
+    for (GroupCell *group = GetTree(); group != NULL; group = group->GetNext())
+      UpdateLookalikeWarnings(group);
+    return;
+  }
+
+  // Only the names in some cells have changed: Replace their entries in the
+  // index and update the warnings of all cells that share a skeleton with the
+  // old or the new names.
+  std::set<wxString> skeletons;
+  std::set<GroupCell *> groupsToUpdate;
+  for (std::list<Cell *>::const_iterator it = changed.begin(); it != changed.end(); ++it)
+  {
+    GroupCell *group = dynamic_cast<GroupCell *>(*it);
+    // Cells that weren't part of the worksheet the last time the index was
+    // rebuilt (for example copies in the clipboard) aren't indexed.
+    if (group->m_lookalikeIndexGeneration != m_cellPointers.m_lookalikeIndexGeneration)
+      continue;
+    RemoveFromLookalikeIndex(group, skeletons);
+    AddToLookalikeIndex(group, &skeletons);
+    groupsToUpdate.insert(group);
+  }
+
+  for (std::set<wxString>::const_iterator it = skeletons.begin(); it != skeletons.end(); ++it)
+  {
+    SkeletonIndex::const_iterator entry = m_skeletonIndex.find(*it);
+    if (entry != m_skeletonIndex.end())
+      groupsToUpdate.insert(entry->second.groups.begin(), entry->second.groups.end());
+  }
+
+  for (std::set<GroupCell *>::const_iterator it = groupsToUpdate.begin();
+       it != groupsToUpdate.end(); ++it)
+    UpdateLookalikeWarnings(*it);
+}
+
 void Worksheet::Recalculate(Cell *start, bool force)
 {
+  m_cellPointers.m_groupIndexOutdated = true;
   GroupCell *group = GetTree();
   if(start != NULL)
     group = dynamic_cast<GroupCell *>(start->GetGroup());
+  if(group != NULL)
+    group->SetRecalculationNeeded();
 
   if(force)
     m_configuration->RecalculationForce(force);
 
-  GroupCell *tmp = GetTree();
   if(m_recalculateStart == NULL)
     m_recalculateStart = group;
   else
+  {
     // Move m_recalculateStart backwards to group, if group comes before m_recalculateStart.
-    while(tmp != NULL)
+    for(GroupCell *tmp = GetTree(); tmp != NULL; tmp = tmp->GetNext())
     {
+      if (tmp == m_recalculateStart)
+        return;
+
       if (tmp == group)
       {
         m_recalculateStart = group;
         return;
       }
-
-      if (tmp == m_recalculateStart)
-        return;
-
-      tmp = dynamic_cast<GroupCell *>(tmp -> m_next);
-      // If the cells to recalculate neither contain the start nor the tree we should
-      // better recalculate all.
-      m_recalculateStart = GetTree();
     }
+    // If the cells to recalculate neither contain the start nor the group we should
+    // better recalculate all.
+    m_recalculateStart = GetTree();
+  }
 }
 
 /***
@@ -1110,6 +1378,8 @@ void Worksheet::ClearDocument()
   SetHCaret(NULL); // horizontal caret at the top of document
   m_hCaretPositionStart = m_hCaretPositionEnd = NULL;
   m_recalculateStart = NULL;
+  m_recalculationForcePending = false;
+  m_fontChangedPending = false;
   m_evaluationQueue.Clear();
   TreeUndo_ClearBuffers();
   DestroyTree();
@@ -1303,6 +1573,8 @@ GroupCell *Worksheet::TearOutTree(GroupCell *start, GroupCell *end)
   if (end == m_last)
     m_last = dynamic_cast<GroupCell *>(prev);
 
+  m_cellPointers.m_groupIndexOutdated = true;
+  m_cellPointers.m_lookalikeIndexOutdated = true;
   return start;
 }
 
@@ -4453,11 +4725,7 @@ void Worksheet::OnTimer(wxTimerEvent &event)
       }
       if(slideshow != NULL)
       {
-        int pos = slideshow->GetDisplayedIndex() + 1;
-
-        if (pos >= slideshow->Length())
-          pos = 0;
-        slideshow->SetDisplayedIndex(pos);
+        slideshow->ShowNextFrame();
 
         // Refresh the displayed bitmap
         if (!m_configuration->ClipToDrawRegion())
@@ -4797,7 +5065,7 @@ void Worksheet::CalculateReorderedCellIndices(Cell *tree, int &cellIndex, std::v
 /***
  * Export content to a HTML file.
  */
-bool Worksheet::ExportToHTML(wxString file)
+bool Worksheet::ExportToHTML(wxString file, ExportProgress progress)
 {
   // Show a busy cursor as long as we export.
   wxBusyCursor crs;
@@ -5364,6 +5632,13 @@ bool Worksheet::ExportToHTML(wxString file)
   // Write the actual contents
   //////////////////////////////////////////////
 
+  long cellsDone = 0;
+  long cellsTotal = 0;
+  for (GroupCell *cell = tmp; cell != NULL; cell = cell->GetNext())
+    cellsTotal++;
+  // Set to false by the background tasks that write the bitmaps if they fail
+  bool imagesOK = true;
+
   while (tmp != NULL)
   {
 
@@ -5492,9 +5767,20 @@ bool Worksheet::ExportToHTML(wxString file)
               int bitmapScale = 3;
               ext = wxT(".png");
               wxConfig::Get()->Read(wxT("bitmapScale"), &bitmapScale);
-              size = CopyToFile(imgDir + wxT("/") + filename + wxString::Format(wxT("_%d.png"), count),
-                                &(*chunk),
-                                NULL, true, bitmapScale);
+              // Rendering the equation needs the worksheet's fonts and is done
+              // here. Compressing the bitmap, which takes longer, isn't.
+              wxImage *image;
+              {
+                BitmapOut bmp(&m_configuration, bitmapScale);
+                bmp.SetData(CopySelection(&(*chunk), NULL, true));
+                size = bmp.GetRealSize();
+                image = new wxImage(bmp.GetImage());
+              }
+              wxString imageFile = imgDir + wxT("/") + filename + wxString::Format(wxT("_%d.png"), count);
+              #ifdef HAVE_OPENMP_TASKS
+              #pragma omp task firstprivate(image, imageFile) shared(imagesOK)
+              #endif
+              SaveHTMLImage_Backgroundtask(image, imageFile, &imagesOK);
               int borderwidth = 0;
               wxString alttext = EditorCell::EscapeHTMLChars(chunk->ListToString());
               borderwidth = chunk->m_imageBorderWidth;
@@ -5647,8 +5933,16 @@ bool Worksheet::ExportToHTML(wxString file)
     }
 
     tmp = tmp->GetNext();
+    cellsDone++;
+    if (progress)
+      progress(cellsDone, cellsTotal);
   }
 
+  // Wait for the bitmaps to be written
+  #ifdef HAVE_OPENMP_TASKS
+  #pragma omp taskwait
+  #endif
+
 //////////////////////////////////////////////
 // Footer
 //////////////////////////////////////////////
@@ -5721,7 +6015,19 @@ bool Worksheet::ExportToHTML(wxString file)
 
   m_configuration->ClipToDrawRegion(true);
   RecalculateForce();
-  return outfileOK && cssOK;
+  return outfileOK && cssOK && imagesOK;
+}
+
+void Worksheet::SaveHTMLImage_Backgroundtask(wxImage *image, wxString file, bool *success)
+{
+  if (!image->SaveFile(file, wxBITMAP_TYPE_PNG))
+  {
+    #ifdef HAVE_OPENMP_TASKS
+    #pragma omp critical (HTMLExportImages)
+    #endif
+    *success = false;
+  }
+  wxDELETE(image);
 }
 
 void Worksheet::CodeCellVisibilityChanged()
@@ -6413,91 +6719,43 @@ bool Worksheet::ExportToMAC(wxString file)
 */
 bool Worksheet::ExportToWXMX(wxString file, bool markAsSaved)
 {
-  #ifdef OPENMP
-  #if OPENMP_VER >= 201511
+  // Wait for background autosaves that might write to the same file
+  #ifdef HAVE_OPENMP_TASKS
   #pragma omp taskwait
   #endif
-  #endif
   // Show a busy cursor as long as we export a file.
   wxBusyCursor crs;
   // Don't update the worksheet whilst exporting
   wxWindowUpdateLocker noUpdates(this);
   wxLogMessage(_("Starting to save the worksheet as .wxmx"));
-  // delete temp file if it already exists
-  wxString backupfile = file + wxT("~");
-  if (wxFileExists(backupfile))
-  {
-    if (!wxRemoveFile(backupfile))
-      return false;
-  }
 
-  wxFFileOutputStream out(backupfile);
-  if (!out.IsOk())
+  std::shared_ptr<WXMXSnapshot> snapshot = GetWXMXSnapshot(file);
+  bool invalidXML = false;
+  if (!WriteWXMX(*snapshot, &invalidXML))
+  {
+    // We can still put the erroneous data into the clipboard for debugging purposes.
+    if (invalidXML && wxTheClipboard->Open())
+    {
+      wxDataObjectComposite *data = new wxDataObjectComposite;
+      data->Add(new wxTextDataObject(snapshot->xml));
+      wxTheClipboard->SetData(data);
+      wxLogMessage(_("Produced invalid XML. The erroneous XML data has therefore not been saved but has been put on the clipboard in order to allow to debug it."));
+    }
     return false;
-  wxZipOutputStream zip(out);
-  wxTextOutputStream output(zip);
-
-  /* The first zip entry is a file named "mimetype": This makes sure that the mimetype
-     is always stored at the same position in the file. This is common practice. One
-     example from an ePub file:
-
-     00000000  50 4b 03 04 14 00 00 08  00 00 cd bd 0a 43 6f 61  |PK...........Coa|
-     00000010  ab 2c 14 00 00 00 14 00  00 00 08 00 00 00 6d 69  |.,............mi|
-     00000020  6d 65 74 79 70 65 61 70  70 6c 69 63 61 74 69 6f  |metypeapplicatio|
-     00000030  6e 2f 65 70 75 62 2b 7a  69 70 50 4b 03 04 14 00  |n/epub+zipPK....|
-
-  */
+  }
 
-  // Make sure that the mime type is stored as plain text.
-  //
-  // We will keep that setting for the rest of the file for the following reasons:
-  //  - Compression of the .zip file won't improve compression of the embedded .png images
-  //  - The text part of the file is too small to justify compression
-  //  - not compressing the text part of the file allows version control systems to
-  //    determine which lines have changed and to track differences between file versions
-  //    efficiently (in a compressed text virtually every byte might change when one
-  //    byte at the start of the uncompressed original is)
-  //  - and if anything crashes in a bad way chances are high that the uncompressed
-  //    contents of the .wxmx file can be rescued using a text editor.
-  //  Who would - under these circumstances - care about a kilobyte?
-  zip.SetLevel(0);
-  zip.PutNextEntry(wxT("mimetype"));
-  output << wxT("text/x-wxmathml");
-  zip.CloseEntry();
-  zip.PutNextEntry(wxT("format.txt"));
-  output << wxT(
-    "\n\nThis file contains a wxMaxima session in the .wxmx format.\n"
-    ".wxmx files are .xml-based files contained in a .zip container like .odt\n"
-    "or .docx files. After changing their name to end in .zip the .xml and\n"
-    "eventual bitmap files inside them can be extracted using any .zip file\n"
-    "viewer.\n"
-    "The reason why part of a .wxmx file still might still seem to make sense in a\n"
-    "ordinary text viewer is that the text portion of .wxmx by default\n"
-    "isn't compressed: The text is typically small and compressing it would\n"
-    "mean that changing a single character would (with a high probability) change\n"
-    "big parts of the  whole contents of the compressed .zip archive.\n"
-    "Even if version control tools like git and svn that remember all changes\n"
-    "that were ever made to a file can handle binary files compression would\n"
-    "make the changed part of the file bigger and therefore seriously reduce\n"
-    "the efficiency of version control\n\n"
-    "wxMaxima can be downloaded from https://github.com/wxMaxima-developers/wxmaxima.\n"
-    "It also is part of the windows installer for maxima\n"
-    "(https://wxmaxima-developers.github.io/wxmaxima/).\n\n"
-    "If a .wxmx file is broken but the content.xml portion of the file can still be\n"
-    "viewed using an text editor just save the xml's text as \"content.xml\"\n"
-    "and try to open it using a recent version of wxMaxima.\n"
-    "If it is valid XML (the XML header is intact, all opened tags are closed again,\n"
-    "the text is saved with the text encoding \"UTF8 without BOM\" and the few\n"
-    "special characters XML requires this for are properly escaped)\n"
-    "chances are high that wxMaxima will be able to recover all code and text\n"
-    "from the XML file.\n\n"
-    );
-  zip.CloseEntry();
+  if (markAsSaved)
+    SetSaved(true);
 
-  // next zip entry is "content.xml", xml of GetTree()
+  wxLogMessage(_("wxmx file saved"));
+  return true;
+}
 
-  zip.PutNextEntry(wxT("content.xml"));
-  wxString xmlText;
+std::shared_ptr<Worksheet::WXMXSnapshot> Worksheet::GetWXMXSnapshot(wxString file)
+{
+  std::shared_ptr<WXMXSnapshot> snapshot(new WXMXSnapshot);
+  snapshot->file = file;
+  wxString &xmlText = snapshot->xml;
 
   xmlText << wxT("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
   xmlText << wxT("\n<!--   Created using wxMaxima ") << wxT(GITVERSION) << wxT("   -->");
@@ -6567,116 +6825,152 @@ bool Worksheet::ExportToWXMX(wxString file, bool markAsSaved)
   
   xmlText << ">\n";
 
-  // Reset image counter
-  m_cellPointers.WXMXResetCounter();
+  // Files other exports have left in the list don't belong to this document.
+  m_cellPointers.WXMXTakeFiles();
 
-  if (GetTree())
-    xmlText += GetTree()->ListToXML();
+  // The image counter isn't reset here: The XML code the cells have cached refers
+  // to the image names that were valid when it was generated. This includes the
+  // cells in the undo buffer that might return to the worksheet.
 
-  // Delete all but one control character from the string: there should be
-  // no way for them to enter this string, anyway. But sometimes they still
-  // do...
-  for (wxString::const_iterator it = xmlText.begin(); it != xmlText.end(); ++it)
+  // Let wxWidgets test if the document can be read again by the XML parser before
+  // the user finds out the hard way. A document made of parts that are valid XML
+  // is valid, too => Only the parts that have changed since the last save need to
+  // be tested.
+  snapshot->xmlValid = CanParseXML(xmlText + wxT("\n</wxMaximaDocument>"));
+  for (tmp = GetTree(); tmp != NULL; tmp = tmp->GetNext())
   {
-    wxChar c = *it;
-    if ((c < wxT('\t')) ||
-        ((c > wxT('\n')) && (c < wxT(' '))) ||
-        (c == wxChar((char) 0x7F))
-      )
+    bool cached = tmp->XMLCacheValid();
+    const wxString &cellXML = tmp->ToXMLCached(snapshot->files);
+    if ((!cached) &&
+        (!CanParseXML(wxT("<wxMaximaDocument>") + cellXML + wxT("</wxMaximaDocument>"))))
     {
-      // *it = wxT(' ');
+      snapshot->xmlValid = false;
+      tmp->InvalidateSerializationCache();
     }
+    xmlText += cellXML;
   }
 
   xmlText +=  wxT("\n</wxMaximaDocument>");
+  return snapshot;
+}
 
-  // Prepare reading the files we have stored in memory
-  std::unique_ptr<wxFileSystem> fsystem(new wxFileSystem);
-  fsystem->AddHandler(new wxMemoryFSHandler);
-  fsystem->ChangePathTo(wxT("memory:"), true);
-
-  // In wxWidgets 3.1.1 fsystem->FindFirst crashes if we don't have a file
-  // in the memory filesystem => Let's create a file just to make sure
-  // one exists.
-  wxMemoryBuffer dummyBuf;
-  wxMemoryFSHandler::AddFile("dummyfile",
-                             dummyBuf.GetData(),
-                             dummyBuf.GetDataLen());
+bool Worksheet::CanParseXML(const wxString &xml)
+{
+  wxXmlDocument doc;
+  wxMemoryOutputStream ostream;
+  wxTextOutputStream txtstrm(ostream);
+  txtstrm.WriteString(xml);
+  wxMemoryInputStream istream(ostream);
+  doc.Load(istream);
+  return doc.IsOk();
+}
 
-  // Let wxWidgets test if the document can be read again by the XML parser before
-  // the user finds out the hard way.
+bool Worksheet::WriteWXMX(const WXMXSnapshot &snapshot, bool *invalidXML)
+{
+  // delete temp file if it already exists
+  wxString backupfile = snapshot.file + wxT("~");
+  if (wxFileExists(backupfile))
   {
-    wxXmlDocument doc;
-    {
-      wxMemoryOutputStream ostream;
-      wxTextOutputStream txtstrm(ostream);
-      txtstrm.WriteString(xmlText);
-      wxMemoryInputStream istream(ostream);
-      doc.Load(istream);
-    }
-
-    // If we fail to load the document we abort the safe process as it will
-    // only destroy data.
-    // But we can still put the erroneous data into the clipboard for debugging purposes.
-    if (!doc.IsOk())
-    {
-      if (wxTheClipboard->Open())
-      {
-        wxDataObjectComposite *data = new wxDataObjectComposite;
-        data->Add(new wxTextDataObject(xmlText));
-        wxTheClipboard->SetData(data);
-        wxLogMessage(_("Produced invalid XML. The erroneous XML data has therefore not been saved but has been put on the clipboard in order to allow to debug it."));
-      }
-
-      // Remove all files from our internal filesystem
-      wxString memFsName = fsystem->FindFirst("*", wxFILE);
-      while(memFsName != wxEmptyString)
-      {
-        wxString name = memFsName.Right(memFsName.Length()-7);
-        wxMemoryFSHandler::RemoveFile(name);
-        memFsName = fsystem->FindNext();
-      }
+    if (!wxRemoveFile(backupfile))
       return false;
-    }
   }
 
-  // wxWidgets could pretty-print the XML document now. But as no-one will
-  // look at it, anyway, there might be no good reason to do so.
-  if (GetTree() != NULL)output << xmlText;
-
-  // Move all files we have stored in memory during saving to zip file
-  wxString memFsName = fsystem->FindFirst("*", wxFILE);
-  while(memFsName != wxEmptyString)
+  // If the document cannot be loaded again we abort the save process as it
+  // would only destroy data.
+  if (!snapshot.xmlValid)
   {
-    wxString name = memFsName.Right(memFsName.Length()-7);
-    if(name != wxT("dummyfile"))
-    {
-      zip.CloseEntry();
+    if (invalidXML != NULL)
+      *invalidXML = true;
+    return false;
+  }
 
-      wxFSFile *fsfile;
-      #ifdef HAVE_OPENMP_TASKS
-      #pragma omp critical (OpenFSFile)
-      #endif
-      fsfile = fsystem->OpenFile(memFsName);
+  wxFFileOutputStream out(backupfile);
+  if (!out.IsOk())
+    return false;
+  wxZipOutputStream zip(out);
+  wxTextOutputStream output(zip);
 
-      if (fsfile)
-      {
-        // The data for gnuplot is likely to change in its entirety if it
-        // ever changes => We can store it in a compressed form.
-        if(name.EndsWith(wxT(".data")))
-          zip.SetLevel(9);
-        else
-          zip.SetLevel(0);
+  /* The first zip entry is a file named "mimetype": This makes sure that the mimetype
+     is always stored at the same position in the file. This is common practice. One
+     example from an ePub file:
 
-        zip.PutNextEntry(name);
-        std::unique_ptr<wxInputStream> imagefile(fsfile->GetStream());
+     00000000  50 4b 03 04 14 00 00 08  00 00 cd bd 0a 43 6f 61  |PK...........Coa|
+     00000010  ab 2c 14 00 00 00 14 00  00 00 08 00 00 00 6d 69  |.,............mi|
+     00000020  6d 65 74 79 70 65 61 70  70 6c 69 63 61 74 69 6f  |metypeapplicatio|
+     00000030  6e 2f 65 70 75 62 2b 7a  69 70 50 4b 03 04 14 00  |n/epub+zipPK....|
 
-        while (!(imagefile->Eof()))
-          imagefile->Read(zip);
-      }
-    }
-    wxMemoryFSHandler::RemoveFile(name);
-    memFsName = fsystem->FindNext();
+  */
+
+  // Make sure that the mime type is stored as plain text.
+  //
+  // We will keep that setting for the rest of the file for the following reasons:
+  //  - Compression of the .zip file won't improve compression of the embedded .png images
+  //  - The text part of the file is too small to justify compression
+  //  - not compressing the text part of the file allows version control systems to
+  //    determine which lines have changed and to track differences between file versions
+  //    efficiently (in a compressed text virtually every byte might change when one
+  //    byte at the start of the uncompressed original is)
+  //  - and if anything crashes in a bad way chances are high that the uncompressed
+  //    contents of the .wxmx file can be rescued using a text editor.
+  //  Who would - under these circumstances - care about a kilobyte?
+  zip.SetLevel(0);
+  zip.PutNextEntry(wxT("mimetype"));
+  output << wxT("text/x-wxmathml");
+  zip.CloseEntry();
+  zip.PutNextEntry(wxT("format.txt"));
+  output << wxT(
+    "\n\nThis file contains a wxMaxima session in the .wxmx format.\n"
+    ".wxmx files are .xml-based files contained in a .zip container like .odt\n"
+    "or .docx files. After changing their name to end in .zip the .xml and\n"
+    "eventual bitmap files inside them can be extracted using any .zip file\n"
+    "viewer.\n"
+    "The reason why part of a .wxmx file still might still seem to make sense in a\n"
+    "ordinary text viewer is that the text portion of .wxmx by default\n"
+    "isn't compressed: The text is typically small and compressing it would\n"
+    "mean that changing a single character would (with a high probability) change\n"
+    "big parts of the  whole contents of the compressed .zip archive.\n"
+    "Even if version control tools like git and svn that remember all changes\n"
+    "that were ever made to a file can handle binary files compression would\n"
+    "make the changed part of the file bigger and therefore seriously reduce\n"
+    "the efficiency of version control\n\n"
+    "wxMaxima can be downloaded from https://github.com/wxMaxima-developers/wxmaxima.\n"
+    "It also is part of the windows installer for maxima\n"
+    "(https://wxmaxima-developers.github.io/wxmaxima/).\n\n"
+    "If a .wxmx file is broken but the content.xml portion of the file can still be\n"
+    "viewed using an text editor just save the xml's text as \"content.xml\"\n"
+    "and try to open it using a recent version of wxMaxima.\n"
+    "If it is valid XML (the XML header is intact, all opened tags are closed again,\n"
+    "the text is saved with the text encoding \"UTF8 without BOM\" and the few\n"
+    "special characters XML requires this for are properly escaped)\n"
+    "chances are high that wxMaxima will be able to recover all code and text\n"
+    "from the XML file.\n\n"
+    );
+  zip.CloseEntry();
+
+  // next zip entry is "content.xml", xml of GetTree()
+  zip.PutNextEntry(wxT("content.xml"));
+  // wxWidgets could pretty-print the XML document now. But as no-one will
+  // look at it, anyway, there might be no good reason to do so.
+  output << snapshot.xml;
+
+  // Add the images and the data for gnuplot the cells refer to. Copies of a
+  // cell share their gnuplot files => each file name is stored only once.
+  std::set<wxString> filesWritten;
+  for (Cell::CellPointers::WXMXFileList::const_iterator it = snapshot.files.begin();
+       it != snapshot.files.end(); ++it)
+  {
+    if (!filesWritten.insert(it->first).second)
+      continue;
+    zip.CloseEntry();
+    // The data for gnuplot is likely to change in its entirety if it
+    // ever changes => We can store it in a compressed form.
+    if(it->first.EndsWith(wxT(".data")))
+      zip.SetLevel(9);
+    else
+      zip.SetLevel(0);
+
+    zip.PutNextEntry(it->first);
+    zip.Write(it->second->GetData(), it->second->GetDataLen());
   }
 
   if (!zip.Close())
@@ -6729,14 +7023,14 @@ bool Worksheet::ExportToWXMX(wxString file, bool markAsSaved)
   
   {
     SuppressErrorDialogs suppressor;
-    done = wxRenameFile(backupfile, file, true);
+    done = wxRenameFile(backupfile, snapshot.file, true);
     if(!done)
     {
       // We might have failed to move the file because an over-eager virus scanner wants to
       // scan it and a design decision of a filesystem driver might hinder us from moving
       // it during this action => Wait for a second and retry.
       wxSleep(1);
-      done = wxRenameFile(backupfile, file, true);
+      done = wxRenameFile(backupfile, snapshot.file, true);
     }
     if(!done)
     {
@@ -6744,22 +7038,84 @@ bool Worksheet::ExportToWXMX(wxString file, bool markAsSaved)
       // scan it and a design decision of a filesystem driver might hinder us from moving
       // it during this action => Wait for a second and retry.
       wxSleep(1);
-      done = wxRenameFile(backupfile, file, true);
+      done = wxRenameFile(backupfile, snapshot.file, true);
     }
   }
   if(!done)
   {
     wxSleep(1);
-    if (!wxRenameFile(backupfile, file, true))
+    if (!wxRenameFile(backupfile, snapshot.file, true))
       return false;
   }
-  if (markAsSaved)
-    SetSaved(true);
-
-  wxLogMessage(_("wxmx file saved"));
   return true;
 }
 
+std::shared_ptr<wxFileSystem> Worksheet::ReadWXMX(const wxString &file, wxMemoryBuffer &contentXML)
+{
+  wxFFileInputStream in(file);
+  if (!in.IsOk())
+    return std::shared_ptr<wxFileSystem>();
+  // As the input is seekable wxZipInputStream reads the sizes of the files from
+  // the zip's central directory => we can read the whole archive sequentially.
+  wxZipInputStream zip(in);
+
+  // Every archive gets a directory of its own so the images of two files
+  // that are opened one after the other never get mixed up.
+  static long archivesRead = 0;
+  wxString dir = wxString::Format(wxT("wxmx%li/"), archivesRead++);
+  wxArrayString files;
+  bool contentFound = false;
+  std::unique_ptr<wxZipEntry> entry;
+  while (entry.reset(zip.GetNextEntry()), entry != NULL)
+  {
+    if (entry->IsDir())
+      continue;
+    wxString name = entry->GetName(wxPATH_UNIX);
+    // Some old versions of wxMaxima stored the files with a leading slash
+    if (name.StartsWith(wxT("/")))
+      name = name.Mid(1);
+
+    wxMemoryOutputStream data;
+    zip.Read(data);
+    // A damaged file: Keep what we could read so far.
+    if ((zip.GetLastError() != wxSTREAM_NO_ERROR) && (zip.GetLastError() != wxSTREAM_EOF))
+      break;
+
+    if (name == wxT("content.xml"))
+    {
+      contentXML.Clear();
+      contentXML.AppendData(data.GetOutputStreamBuffer()->GetBufferStart(), data.GetLength());
+      contentFound = true;
+    }
+    else
+    {
+      #ifdef HAVE_OPENMP_TASKS
+      #pragma omp critical (OpenFSFile)
+      #endif
+      wxMemoryFSHandler::AddFile(dir + name, data.GetOutputStreamBuffer()->GetBufferStart(),
+                                 data.GetLength());
+      files.Add(dir + name);
+    }
+  }
+
+  // The files are removed from the memory filesystem as soon as the last cell
+  // that might want to load them has done so.
+  std::shared_ptr<wxFileSystem> filesystem(
+    new wxFileSystem(),
+    [files](wxFileSystem *fs){
+      #ifdef HAVE_OPENMP_TASKS
+      #pragma omp critical (OpenFSFile)
+      #endif
+      for (size_t i = 0; i < files.GetCount(); i++)
+        wxMemoryFSHandler::RemoveFile(files[i]);
+      delete fs;
+    });
+  if (!contentFound)
+    return std::shared_ptr<wxFileSystem>();
+  filesystem->ChangePathTo(wxT("memory:") + dir, true);
+  return filesystem;
+}
+
 bool Worksheet::CanEdit()
 {
   if (m_cellPointers.m_selectionStart == NULL || m_cellPointers.m_selectionEnd != m_cellPointers.m_selectionStart)
@@ -8547,8 +8903,8 @@ bool Worksheet::Autocomplete(AutoComplete::autoCompletionType type)
     }
   }
 
+  // The completions are already sorted, either alphabetically or by how well they match.
   m_completions = m_autocomplete->CompleteSymbol(partial, type);
-  m_completions.Sort();
   m_autocompleteTemplates = (type == AutoComplete::tmplte);
 
   /// No completions - clear the selection and return false
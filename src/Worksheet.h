@@ -35,7 +35,11 @@
 #include <wx/textfile.h>
 #include <wx/fdrepdlg.h>
 #include <wx/dc.h>
+#include <wx/filesys.h>
 #include <list>
+#include <set>
+#include <vector>
+#include <functional>
 
 #include "VariablesPane.h"
 #include "Notification.h"
@@ -50,6 +54,11 @@
 #include "UnicodeSidebar.h"
 #include "ToolBar.h"
 
+/*! The number of milliseconds a time-sliced RecalculateIfNeeded() may spend 
+  layouting cells before it returns to the event loop.
+*/
+#define LAYOUT_TIME_SLICE 50
+
 /*! The canvas that contains the spreadsheet the whole program is about.
 
 This canvas contains all the math-, title-, image- input- ("editor-")- etc.-
@@ -81,6 +90,28 @@ wxMaxima can display it.
 class Worksheet : public wxScrolled<wxWindow>
 {
 private:
+  //! The names that share a skeleton
+  struct SkeletonIndexEntry
+  {
+    //! The names and the number of cells they occur in
+    GroupCell::CmdsAndVariables names;
+    //! The cells that contain one of the names
+    std::set<GroupCell *> groups;
+  };
+  //! For every skeleton of a name: The names that have it and the cells they occur in
+  WX_DECLARE_STRING_HASH_MAP(SkeletonIndexEntry, SkeletonIndex);
+  //! The index UpdateLookalikeWarnings() searches for lookalike names in
+  SkeletonIndex m_skeletonIndex;
+  /*! Add the names of a cell to m_skeletonIndex
+
+    \param group The cell whose names are to be added
+    \param skeletons If not NULL the skeletons of all added names are added to this set.
+   */
+  void AddToLookalikeIndex(GroupCell *group, std::set<wxString> *skeletons);
+  //! Remove the names of a cell from m_skeletonIndex and remember their skeletons
+  void RemoveFromLookalikeIndex(GroupCell *group, std::set<wxString> &skeletons);
+  //! Tell a cell which of its names look like the names in other cells
+  void UpdateLookalikeWarnings(GroupCell *group);
   // The x position to scroll to
   int m_newxPosition;
   // The y position to scroll to
@@ -196,6 +227,24 @@ private:
   long m_lastTop;
   //! The last ending for the area being drawn
   long m_lastBottom;
+  /*! The part of the worksheet the GroupCells that might have cached images lie in
+
+    Used for clearing the image cache of cells that have been scrolled out of view
+    without looking at every GroupCell of the worksheet.
+  */
+  long m_cacheTop, m_cacheBottom;
+  /*! All GroupCells of the worksheet, in the order they are drawn in
+
+    Allows OnPaint() to find the first visible GroupCell by a binary search
+    instead of by traversing the whole worksheet. Is rebuilt by 
+    RecalculateIfNeeded() and, if m_cellPointers.m_groupIndexOutdated has been 
+    set, by OnPaint().
+  */
+  std::vector<GroupCell *> m_groupIndex;
+  //! Rebuilds m_groupIndex and updates the y position of all GroupCells
+  void UpdateGroupIndex();
+  //! The index of the first GroupCell in m_groupIndex that doesn't end above y
+  size_t FirstGroupBelow(long y);
   /*! \defgroup UndoBufferFill Undo methods for cell additions/deletions:
 
     Each EditorCell has its own private undo buffer Additionally wxMaxima
@@ -451,6 +500,9 @@ private:
    */
   void OnPaint(wxPaintEvent &event);
 
+  //! Is called when a background task has scaled an image that needs to be redrawn
+  void OnImageScaled(wxThreadEvent &event);
+
   void OnSize(wxSizeEvent &event);
 
   void OnMouseRightDown(wxMouseEvent &event);
@@ -929,8 +981,31 @@ public:
   */
   void InsertLine(Cell *newCell, bool forceNewLine = false);
 
-  // Actually recalculate the worksheet.
-  bool RecalculateIfNeeded();
+  /*! Actually recalculate the worksheet.
+
+    \param timeSliced If true we return to the caller after LAYOUT_TIME_SLICE
+    milliseconds even if there are still cells left that need to be layouted.
+    RecalculationPending() tells if we did so.
+    \return true, if any cell has been layouted.
+   */
+  bool RecalculateIfNeeded(bool timeSliced = false);
+
+  //! Are there any cells left RecalculateIfNeeded() still has to layout?
+  bool RecalculationPending() const {return m_recalculateStart != NULL;}
+
+  /*! Parse the next part of all long expressions that have been scrolled into view
+
+    \return true, if there was something to parse.
+   */
+  bool ExpandLazyCells();
+
+  /*! Warn about names in different cells that only differ by lookalike chars
+
+    Only does something if a cell or the names it contains have changed. If
+    only the names have changed only the entries of the changed cells are
+    updated and only the cells sharing a skeleton with them get new warnings.
+   */
+  void UpdateLookalikeWarnings();
 
   //! Schedule a recalculation of the worksheet starting with the cell start.
   void Recalculate(Cell *start, bool force = false);
@@ -1105,8 +1180,21 @@ public:
 
   void CalculateReorderedCellIndices(Cell *tree, int &cellIndex, std::vector<int> &cellMap);
 
-  //! Export the file to an html document
-  bool ExportToHTML(wxString file);
+  /*! Is informed about the progress of ExportToHTML()
+
+    \param done The number of cells that have been exported
+    \param total The number of cells the worksheet contains
+   */
+  typedef std::function<void (long done, long total)> ExportProgress;
+
+  /*! Export the file to an html document
+
+    The cells are rendered one after another, but encoding the bitmaps is done
+    in background tasks.
+    \param file The name of the .html file
+    \param progress Is called after each cell. Can be empty.
+   */
+  bool ExportToHTML(wxString file, ExportProgress progress = ExportProgress());
 
   /*! Export a region of the file to a .wxm or .mac file maxima's load command can read
 
@@ -1125,6 +1213,61 @@ public:
   */
   bool ExportToWXMX(wxString file, bool markAsSaved = true);
 
+  //! All data WriteWXMX() needs in order to write a .wxmx file
+  struct WXMXSnapshot
+  {
+    //! The name of the file to write
+    wxString file;
+    //! The contents of the file content.xml
+    wxString xml;
+    //! The images and gnuplot files content.xml refers to
+    Cell::CellPointers::WXMXFileList files;
+    //! false = The XML code of one of the cells could not be parsed again
+    bool xmlValid;
+  };
+
+  /*! Collect the data needed for saving the worksheet as a .wxmx file
+
+    Only the GroupCells that have changed since the last save are serialized
+    again; The XML code of all others is taken from their cache.
+  */
+  std::shared_ptr<WXMXSnapshot> GetWXMXSnapshot(wxString file);
+
+  /*! Write a .wxmx file from a snapshot of the worksheet
+
+    Doesn't access the worksheet, which means it can run in a background task.
+    First saves the data to a backup file and then replaces the original file.
+    \param snapshot The data GetWXMXSnapshot() has collected
+    \param invalidXML Is set to true if the snapshot contains XML the .wxmx
+                      file cannot be read back from.
+  */
+  static bool WriteWXMX(const WXMXSnapshot &snapshot, bool *invalidXML = NULL);
+
+  //! Can wxWidgets' XML parser read the document xml?
+  static bool CanParseXML(const wxString &xml);
+
+  /*! Read all files a .wxmx file contains in a single pass
+
+    The images and gnuplot files are stored in a directory of wxMemoryFSHandler
+    of their own: Opening them from there doesn't require to re-open and to
+    search the .zip archive for every single image. The directory is deleted
+    again when the last copy of the returned wxFileSystem is destroyed.
+    \param file The .wxmx file
+    \param contentXML Receives the contents of content.xml
+    \return A wxFileSystem whose current directory is the one containing the files,
+            or NULL, if file could not be read or contains no content.xml.
+  */
+  static std::shared_ptr<wxFileSystem> ReadWXMX(const wxString &file, wxMemoryBuffer &contentXML);
+
+  /*! Writes a bitmap of the html export to a .png file
+
+    \param image The image. Must not be shared with any other wxImage and is
+           deleted after it has been written.
+    \param file The name of the .png file
+    \param success Is set to false if the file could not be written.
+   */
+  static void SaveHTMLImage_Backgroundtask(wxImage *image, wxString file, bool *success);
+
   //! The start of a RTF document
   wxString RTFStart();
 
@@ -1436,6 +1579,10 @@ public:
   void AddSymbols(wxString xml)
   { m_autocomplete->AddSymbols(xml); }
 
+  //! Tell the autocompletion which symbols a command that is sent to maxima uses
+  void AddSymbolUsage(wxString command)
+  { m_autocomplete->AddUsage(command); }
+
   void SetActiveCellText(wxString text);
 
   bool InsertText(wxString text);
@@ -1559,6 +1706,18 @@ protected:
   void UpdateConfigurationClientSize();
   //! Where to start recalculation. NULL = No recalculation needed.
   GroupCell *m_recalculateStart;
+  /*! Does the pass of RecalculateIfNeeded() that is in progress force all cells to be re-layouted?
+
+    Configuration::RecalculationForce() would make every cell that is drawn
+    while a time-sliced pass is in progress layout itself on every redraw =>
+    RecalculateIfNeeded() moves the flag here and applies it only while it
+    layouts a cell.
+   */
+  bool m_recalculationForcePending;
+  //! Does the pass of RecalculateIfNeeded() that is in progress need to tell the cells the font has changed?
+  bool m_fontChangedPending;
+  //! Layout a GroupCell, applying the forced re-layout a pass of RecalculateIfNeeded() still owes it
+  void RecalculateGroup(GroupCell *group);
   //! The x position of the mouse pointer
   int m_pointer_x;
   //! The y position of the mouse pointer
@@ -29,6 +29,7 @@
 #include <wx/config.h>
 #include <wx/intl.h>
 #include <wx/fs_zip.h>
+#include <wx/fs_mem.h>
 #include <wx/image.h>
 
 #include <wx/cmdline.h>
@@ -198,6 +199,8 @@ bool MyApp::OnInit()
                    "evaluate the file after opening it.", wxCMD_LINE_VAL_NONE , 0},
                   {wxCMD_LINE_SWITCH, "b", "batch",
                    "run the file and exit afterwards. Halts on questions and stops on errors.",  wxCMD_LINE_VAL_NONE, 0},
+                  {wxCMD_LINE_SWITCH, "", "export-html",
+                   "run the file like --batch does and export it to a .html file of the same name before exiting.",  wxCMD_LINE_VAL_NONE, 0},
                   {wxCMD_LINE_SWITCH, "", "logtostdout",
                    "Log all \"debug messages\" sidebar messages to stderr, too.",  wxCMD_LINE_VAL_NONE, 0},
                   {wxCMD_LINE_SWITCH, "", "pipe",
@@ -212,6 +215,12 @@ bool MyApp::OnInit()
                   {wxCMD_LINE_OPTION, "X", "extra-args",
                    "Allows to specify extra Maxima arguments",  wxCMD_LINE_VAL_STRING, 0},
                   { wxCMD_LINE_OPTION, "m", "maxima", "allows to specify the location of the Maxima binary", wxCMD_LINE_VAL_STRING , 0},
+                  {wxCMD_LINE_OPTION, "", "parser-benchmark",
+                   "Compare the xml parsers using the maxima output stored in a .wxmx file or a directory of .wxmx files, then exit.",  wxCMD_LINE_VAL_STRING, 0},
+                  {wxCMD_LINE_OPTION, "", "open-benchmark",
+                   "Print how long opening a .wxmx file takes until the first screenful can be displayed and in total, then exit.",  wxCMD_LINE_VAL_STRING, 0},
+                  {wxCMD_LINE_SWITCH, "", "autocomplete-benchmark",
+                   "Print how long adding 50000 symbols to the autocompletion and completing a symbol takes, then exit.",  wxCMD_LINE_VAL_NONE, 0},
                   {wxCMD_LINE_PARAM, NULL, NULL, "input file", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL | wxCMD_LINE_PARAM_MULTIPLE},
             {wxCMD_LINE_NONE, "", "", "", wxCMD_LINE_VAL_NONE, 0}
           };
@@ -269,6 +278,8 @@ bool MyApp::OnInit()
   wxImage::AddHandler(new wxJPEGHandler);
 
   wxFileSystem::AddHandler(new wxZipFSHandler);
+  // for reading .wxmx files
+  wxFileSystem::AddHandler(new wxMemoryFSHandler);
 
 #ifdef __WXMSW__
   wxString oldWorkingDir = wxGetCwd();
@@ -329,12 +340,28 @@ bool MyApp::OnInit()
     exit(0);
   }
 
+  if (cmdLineParser.Found(wxT("parser-benchmark"), &file))
+    exit(MathParser::Benchmark(file) ? 0 : 1);
+
+  if (cmdLineParser.Found(wxT("open-benchmark"), &file))
+    exit(wxMaxima::OpenBenchmark(file) ? 0 : 1);
+
+  if (cmdLineParser.Found(wxT("autocomplete-benchmark")))
+    exit(AutoComplete::Benchmark() ? 0 : 1);
+
   if (cmdLineParser.Found(wxT("b")))
   {
     evalOnStartup = true;
     exitAfterEval = true;
   }
   
+  if (cmdLineParser.Found(wxT("export-html")))
+  {
+    evalOnStartup = true;
+    exitAfterEval = true;
+    wxMaxima::ExportHTMLOnExit();
+  }
+
   if (cmdLineParser.Found(wxT("e")))
     evalOnStartup = true;
 
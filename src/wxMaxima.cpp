@@ -91,13 +91,13 @@
 #include <wx/wfstream.h>
 #include <wx/txtstrm.h>
 #include <wx/sckstrm.h>
-#include <wx/fs_mem.h>
 #include <wx/persist/toplevel.h>
 
 #include <wx/url.h>
 #include <wx/sstream.h>
 #include <list>
 #include <memory>
+#include <iostream>
 
 #if defined __WXOSX__
 #define MACPREFIX "wxMaxima.app/Contents/Resources/"
@@ -196,6 +196,9 @@ wxMaxima::wxMaxima(wxWindow *parent, int id, wxLocale *locale, const wxString ti
   // everything.
   wxWindowUpdateLocker noUpdates(this);
   m_rawBytesSent = 0;
+  m_socketInputBuffer.resize(SOCKET_SIZE_LIMIT);
+  m_socketInputBufferFill = 0;
+  m_currentOutputSearchPos = 0;
   m_maximaBusy = true;
   m_evalOnStartup = false;
   m_dataFromMaximaIs = false;
@@ -244,8 +247,6 @@ wxMaxima::wxMaxima(wxWindow *parent, int id, wxLocale *locale, const wxString ti
 
   m_chmhelpFile = wxEmptyString;
 
-  wxFileSystem::AddHandler(new wxMemoryFSHandler); // for saving wxmx
-
   UpdateRecentDocuments();
 
   m_worksheet->m_findDialog = NULL;
@@ -263,6 +264,11 @@ wxMaxima::wxMaxima(wxWindow *parent, int id, wxLocale *locale, const wxString ti
   Connect(
     wxEVT_TIMER,
     wxTimerEventHandler(wxMaxima::OnTimerEvent), NULL, this);
+  Connect(
+    wxEVT_THREAD,
+    wxThreadEventHandler(wxMaxima::OnAutoSaveFinished), NULL, this);
+  m_autoSaveRunning = false;
+  m_autoSaveToCurrentFile = false;
 
 #if wxUSE_DRAG_AND_DROP
   m_worksheet->SetDropTarget(new MyDropTarget(this));
@@ -1241,12 +1247,12 @@ TextCell *wxMaxima::ConsoleAppend(wxString s, CellType type, wxString userLabel)
 
         // If the math tag ends inside this string we add the whole tag.
         int mthTagLen;
-        int end = FindTagEnd(s,"</mth>");
+        int end = s.Find("</mth>");
         if(end >= 0)
           mthTagLen = 5;
         else
         {
-          end = FindTagEnd(s,"</math>");
+          end = s.Find("</math>");
           mthTagLen = 6;
         }
         if (end == wxNOT_FOUND)
@@ -1371,6 +1377,7 @@ TextCell *wxMaxima::DoRawConsoleAppend(wxString s, CellType type)
       }
 
       incompleteTextCell->SetValue(newVal);
+      dynamic_cast<GroupCell *>(incompleteTextCell->GetGroup())->InvalidateSerializationCache();
       if(s == wxEmptyString)
       {
         dynamic_cast<GroupCell *>(incompleteTextCell->GetGroup())->ResetSize();
@@ -1477,7 +1484,10 @@ void wxMaxima::SendMaxima(wxString s, bool addToHistory)
 
     /// Add this command to History
     if (addToHistory)
+    {
       AddToHistory(s);
+      m_worksheet->AddSymbolUsage(s);
+    }
 
     StripLispComments(s);
 
@@ -1599,22 +1609,24 @@ void wxMaxima::TryToReadDataFromMaxima()
 
   m_statusBar->NetworkStatus(StatusBar::receive);
 
-  // Read all new lines of text we received.
-  wxChar chr;
+  if(m_bytesFromMaxima == 0)
+    m_bytesFromMaximaStopWatch.Start();
 
-  while((m_client->IsConnected()) && (m_client->IsData()) && (m_clientStream != NULL) &&
-        (!m_clientStream->Eof()))
+  // Drain everything the socket has for us in as few Read()s as possible.
+  size_t newChars_old = m_newCharsFromMaxima.Length();
+  while((m_client->IsConnected()) && (m_client->IsData()))
   {
-    chr = m_clientTextStream->GetChar();
-    if(chr == wxEOT)
+    m_client->Read(&m_socketInputBuffer[m_socketInputBufferFill],
+                   m_socketInputBuffer.size() - m_socketInputBufferFill);
+    size_t bytesRead = m_client->LastReadCount();
+    if(bytesRead == 0)
       break;
-    if(chr != '\0')
-      m_newCharsFromMaxima += chr;
+    m_bytesFromMaxima += bytesRead;
+    DecodeSocketInputBuffer(m_socketInputBufferFill + bytesRead);
   }
 
   if(m_pipeToStdout)
-    std::cout << m_newCharsFromMaxima;
-  m_bytesFromMaxima += m_newCharsFromMaxima.Length();
+    std::cout << m_newCharsFromMaxima.Mid(newChars_old);
 
   if(m_newCharsFromMaxima.EndsWith("\n") || m_newCharsFromMaxima.EndsWith(m_promptSuffix) || (m_first))
   {
@@ -1626,6 +1638,54 @@ void wxMaxima::TryToReadDataFromMaxima()
 }
 
 
+void wxMaxima::DecodeSocketInputBuffer(size_t bytes)
+{
+  const char *buf = &m_socketInputBuffer[0];
+
+  // Find out if the buffer ends in the middle of a multibyte character.
+  size_t complete = bytes;
+  for(size_t i = 1; (i <= 4) && (i <= bytes); i++)
+  {
+    unsigned char ch = buf[bytes - i];
+    // A continuation byte: The char starts further before.
+    if((ch & 0xC0) == 0x80)
+      continue;
+    size_t charLen = 1;
+    if((ch & 0xE0) == 0xC0)
+      charLen = 2;
+    else if((ch & 0xF0) == 0xE0)
+      charLen = 3;
+    else if((ch & 0xF8) == 0xF0)
+      charLen = 4;
+    if(charLen > i)
+      complete = bytes - i;
+    break;
+  }
+
+  // Maxima sometimes sends '\0' chars we don't want to have in our strings.
+  size_t start = 0;
+  for(size_t i = 0; i <= complete; i++)
+  {
+    if((i == complete) || (buf[i] == '\0'))
+    {
+      if(i > start)
+      {
+        wxString chunk = wxString::FromUTF8(buf + start, i - start);
+        // Invalid UTF-8 shouldn't make us lose data.
+        if(chunk.IsEmpty())
+          chunk = wxString(buf + start, wxConvISO8859_1, i - start);
+        m_newCharsFromMaxima += chunk;
+      }
+      start = i + 1;
+    }
+  }
+
+  // Keep the incomplete multibyte char for the next read.
+  m_socketInputBufferFill = bytes - complete;
+  if(m_socketInputBufferFill > 0)
+    memmove(&m_socketInputBuffer[0], buf + complete, m_socketInputBufferFill);
+}
+
 ///--------------------------------------------------------------------------------
 ///  Socket stuff
 ///--------------------------------------------------------------------------------
@@ -1707,6 +1767,7 @@ void wxMaxima::OnMaximaConnect()
   m_statusBar->NetworkStatus(StatusBar::idle);
   m_worksheet->QuestionAnswered();
   m_currentOutput = wxEmptyString;
+  m_currentOutputSearchPos = 0;
     
   m_client = std::shared_ptr<wxSocketBase>(m_server->Accept(false));
   if(!m_client)
@@ -1723,10 +1784,7 @@ void wxMaxima::OnMaximaConnect()
   else
   {
     wxLogMessage(_("Connected."));
-    m_clientStream = std::shared_ptr<wxSocketInputStream>(new wxSocketInputStream(*m_client));
-    m_clientTextStream = std::unique_ptr<wxTextInputStream>(
-      new wxTextInputStream(*m_clientStream, wxT('\t'),
-                            wxConvUTF8));
+    m_socketInputBufferFill = 0;
     m_client->SetEventHandler(*GetEventHandler());
     m_client->SetNotify(wxSOCKET_INPUT_FLAG|wxSOCKET_OUTPUT_FLAG|wxSOCKET_LOST_FLAG|wxSOCKET_CONNECTION_FLAG);
     m_client->Notify(true);
@@ -2058,6 +2116,7 @@ void wxMaxima::KillMaxima(bool logMessage)
   m_CWD = wxEmptyString;
   m_worksheet->QuestionAnswered();
   m_currentOutput = wxEmptyString;
+  m_currentOutputSearchPos = 0;
   // If we did close maxima by hand we already might have a new process
   // and therefore invalidate the wrong process in this step
   if (m_process)
@@ -2066,8 +2125,7 @@ void wxMaxima::KillMaxima(bool logMessage)
   m_maximaStdout = NULL;
   m_maximaStderr = NULL;
 
-  m_clientTextStream = NULL;
-  m_clientStream = NULL;
+  m_socketInputBufferFill = 0;
 
   if(m_client && (m_client->IsConnected()))
   {
@@ -2270,73 +2328,49 @@ void wxMaxima::ReadFirstPrompt(wxString &data)
     TriggerEvaluation();
 }
 
-int wxMaxima::GetMiscTextEnd(const wxString &data)
+size_t wxMaxima::GetMiscTextEnd(const wxString &data, size_t start)
 {
-  // These tests are redundant with later tests. But they are faster.
-  if(data.StartsWith("<mth>") || (data.StartsWith("<math>")))
-    return 0;
-  if(data.StartsWith("<lbl>"))
-    return 0;
-  if(data.StartsWith("<statusbar>"))
-    return 0;
-  if(data.StartsWith(m_promptPrefix))
-    return 0;
-  if(data.StartsWith(m_symbolsPrefix))
-    return 0;
-  if(data.StartsWith(m_variablesPrefix))
-    return 0;
-  if(data.StartsWith(m_addVariablesPrefix))
-    return 0;
-  if(data.StartsWith(m_suppressOutputPrefix))
-    return 0;
-
-  int mthpos = wxMax(data.Find("<mth>"), data.Find("<math>"));
-  int lblpos = data.Find("<lbl>");
-  int statpos = data.Find("<statusbar>");
-  int prmptpos = data.Find(m_promptPrefix);
-  int symbolspos = data.Find(m_symbolsPrefix);
-  int suppressOutputPos = data.Find(m_suppressOutputPrefix);
-  int variablespos = data.Find(m_variablesPrefix);
-  int addvariablespos = data.Find(m_addVariablesPrefix);
-
-  int tagPos = data.Length();
-  if ((mthpos != wxNOT_FOUND) && (mthpos < tagPos))
-    tagPos = mthpos;
-  if ((tagPos == wxNOT_FOUND) || ((lblpos != wxNOT_FOUND) && (lblpos < tagPos)))
-    tagPos = lblpos;
-  if ((tagPos == wxNOT_FOUND) || ((statpos != wxNOT_FOUND) && (statpos < tagPos)))
-    tagPos = statpos;
-  if ((tagPos == wxNOT_FOUND) || ((prmptpos != wxNOT_FOUND) && (prmptpos < tagPos)))
-    tagPos = prmptpos;
-  if ((tagPos == wxNOT_FOUND) || ((prmptpos != wxNOT_FOUND) && (prmptpos < tagPos)))
-    tagPos = prmptpos;
-  if ((tagPos == wxNOT_FOUND) || ((symbolspos != wxNOT_FOUND) && (symbolspos < tagPos)))
-    tagPos = symbolspos;
-  if ((tagPos == wxNOT_FOUND) || ((variablespos != wxNOT_FOUND) && (variablespos < tagPos)))
-    tagPos = variablespos;
-  if ((tagPos == wxNOT_FOUND) || ((addvariablespos != wxNOT_FOUND) && (addvariablespos < tagPos)))
-    tagPos = addvariablespos;
-  if ((tagPos == wxNOT_FOUND) || ((suppressOutputPos != wxNOT_FOUND) && (suppressOutputPos < tagPos)))
-    tagPos = suppressOutputPos;
-  return tagPos;
+  // Only a '<' can start a tag: Look at each of them only once.
+  size_t pos = start;
+  while((pos = data.find(wxT('<'), pos)) != wxString::npos)
+  {
+    if((data.compare(pos, 5, wxT("<mth>")) == 0) ||
+       (data.compare(pos, 6, wxT("<math>")) == 0) ||
+       (data.compare(pos, 5, wxT("<lbl>")) == 0) ||
+       (data.compare(pos, 11, wxT("<statusbar>")) == 0) ||
+       (data.compare(pos, m_promptPrefix.Length(), m_promptPrefix) == 0) ||
+       (data.compare(pos, m_symbolsPrefix.Length(), m_symbolsPrefix) == 0) ||
+       (data.compare(pos, m_variablesPrefix.Length(), m_variablesPrefix) == 0) ||
+       (data.compare(pos, m_addVariablesPrefix.Length(), m_addVariablesPrefix) == 0) ||
+       (data.compare(pos, m_suppressOutputPrefix.Length(), m_suppressOutputPrefix) == 0))
+      return pos;
+    pos++;
+  }
+  return data.Length();
 }
 
-void wxMaxima::ReadMiscText(wxString &data)
+size_t wxMaxima::FindFrameEnd(size_t start, const wxString &tag)
 {
-  if (data.IsEmpty())
-    return;
+  size_t searchStart = wxMax(start, m_currentOutputSearchPos);
+  size_t end = m_currentOutput.find(tag, searchStart);
+  if(end == wxString::npos)
+  {
+    // The next search only needs to look at the data that arrives in the meantime
+    // and at the few chars a split end tag might begin with.
+    if(m_currentOutput.Length() >= start + tag.Length())
+      m_currentOutputSearchPos = m_currentOutput.Length() - tag.Length() + 1;
+    return wxString::npos;
+  }
+  m_currentOutputSearchPos = 0;
+  return end + tag.Length();
+}
 
-  // Extract all text that isn't a xml tag known to us.
-  int miscTextLen = GetMiscTextEnd(data);
-  if(miscTextLen <= 0)
-  {
-    if(data != wxEmptyString)
-      m_worksheet->m_cellPointers.m_currentTextCell = NULL;
+void wxMaxima::ReadMiscText(const wxString &data)
+{
+  if (data.IsEmpty())
     return;
-  }
 
-  wxString miscText = data.Left(miscTextLen);
-  data = data.Right(data.Length() - miscTextLen);
+  wxString miscText = data;
 
   // Stupid DOS and MAC line endings. The first of these commands won't work
   // if the "\r" is the last char of a packet containing a part of a very long
@@ -2429,280 +2463,196 @@ void wxMaxima::ReadMiscText(wxString &data)
   }
   if(miscText.EndsWith("\n"))
     m_worksheet->m_cellPointers.m_currentTextCell = NULL;
-
-  if(data != wxEmptyString)
-    m_worksheet->m_cellPointers.m_currentTextCell = NULL;
 }
 
-int wxMaxima::FindTagEnd(wxString &data, const wxString &tag)
+void wxMaxima::ReadStatusBar(const wxString &data)
 {
-  if((m_currentOutputEnd == wxEmptyString) || (m_currentOutputEnd.Find(tag) != wxNOT_FOUND))
-    return data.Find(tag);
-  else
-    return wxNOT_FOUND;
-}
-
-void wxMaxima::ReadStatusBar(wxString &data)
-{
-  wxString statusbarStart = wxT("<statusbar>");
-  if (!data.StartsWith(statusbarStart))
-    return;
-
   m_worksheet->m_cellPointers.m_currentTextCell = NULL;
 
-  wxString sts = wxT("</statusbar>");
-  int end;
-  if ((end = FindTagEnd(data,sts)) != wxNOT_FOUND)
+  wxXmlDocument xmldoc;
+  wxStringInputStream xmlStream(data);
+  xmldoc.Load(xmlStream, wxT("UTF-8"));
+  wxXmlNode *node = xmldoc.GetRoot();
+  if(node != NULL)
   {
-    wxXmlDocument xmldoc;
-    wxString xml = data.Left( end + sts.Length());
-    wxStringInputStream xmlStream(xml);
-    xmldoc.Load(xmlStream, wxT("UTF-8"));
-    wxXmlNode *node = xmldoc.GetRoot();
-    if(node != NULL)
-    {
-      wxXmlNode *contents = node->GetChildren();
-      if(contents)
-        LeftStatusText(contents->GetContent(), false);
-    }
-    // Remove the status bar info from the data string
-    data = data.Right(data.Length()-end-sts.Length());
+    wxXmlNode *contents = node->GetChildren();
+    if(contents)
+      LeftStatusText(contents->GetContent(), false);
   }
 }
 
 /***
  * Checks if maxima displayed a new chunk of math
  */
-void wxMaxima::ReadMath(wxString &data)
+void wxMaxima::ReadMath(const wxString &data)
 {
-  if ((!data.StartsWith("<mth>")) && (!data.StartsWith("<math>")))
-    return;
-
   m_worksheet->m_cellPointers.m_currentTextCell = NULL;
 
   // Append everything from the "beginning of math" to the "end of math" marker
-  // to the console and remove it from the data we got.
-  int mthTagLen;
-  int end = FindTagEnd(data,"</mth>");
-  if(end >= 0)
-    mthTagLen = 6;
-  else
-  {
-    end = FindTagEnd(data,"</math>");
-    mthTagLen = 7;
-  }
-  if(end >= 0)
+  // to the console.
+  wxString o = data;
+  o.Trim(true);
+  o.Trim(false);
+  if (o.Length() > 0)
   {
-    wxString o = data.Left(end + mthTagLen);
-    data = data.Right(data.Length() - end - mthTagLen);
-    o.Trim(true);
-    o.Trim(false);
-    if (o.Length() > 0)
+    if (m_worksheet->m_configuration->UseUserLabels())
     {
-      if (m_worksheet->m_configuration->UseUserLabels())
-      {
-        ConsoleAppend(o, MC_TYPE_DEFAULT,m_worksheet->m_evaluationQueue.GetUserLabel());
-      }
-      else
-      {
-        ConsoleAppend(o, MC_TYPE_DEFAULT);
-      }
+      ConsoleAppend(o, MC_TYPE_DEFAULT,m_worksheet->m_evaluationQueue.GetUserLabel());
+    }
+    else
+    {
+      ConsoleAppend(o, MC_TYPE_DEFAULT);
     }
   }
 }
 
-void wxMaxima::ReadSuppressedOutput(wxString &data)
-{
-  if (!data.StartsWith(m_suppressOutputPrefix))
-    return;
-  int end = FindTagEnd(data, m_suppressOutputSuffix);
-  if (end != wxNOT_FOUND)
-  {
-    data = data.Right(data.Length()-end-m_suppressOutputSuffix.Length());
-  }
-}
-
-void wxMaxima::ReadLoadSymbols(wxString &data)
+void wxMaxima::ReadLoadSymbols(const wxString &data)
 {
-  if (!data.StartsWith(m_symbolsPrefix))
-    return;
-
   m_worksheet->m_cellPointers.m_currentTextCell = NULL;
 
-  int end = FindTagEnd(data, m_symbolsSuffix);
-
-  if (end != wxNOT_FOUND)
-  {
-    // Put the symbols into a separate string
-    wxString symbols = data.Left( end + m_symbolsSuffix.Length());
-    m_worksheet->AddSymbols(symbols);
-
-    // Remove the symbols from the data string
-    data = data.Right(data.Length()-end-m_symbolsSuffix.Length());
-  }
+  m_worksheet->AddSymbols(data);
 }
 
-void wxMaxima::ReadVariables(wxString &data)
+void wxMaxima::ReadVariables(const wxString &data)
 {
-  if (!data.StartsWith(m_variablesPrefix))
-    return;
-
-  int end = FindTagEnd(data, m_variablesSuffix);
-
-  if (end != wxNOT_FOUND)
+  int num = 0;
+  wxXmlDocument xmldoc;
+  wxStringInputStream xmlStream(data);
+  xmldoc.Load(xmlStream, wxT("UTF-8"));
+  wxXmlNode *node = xmldoc.GetRoot();
+  if(node != NULL)
   {
-    int num = 0;
-    wxXmlDocument xmldoc;
-    wxString xml = data.Left( end + m_variablesSuffix.Length());
-    wxStringInputStream xmlStream(xml);
-    xmldoc.Load(xmlStream, wxT("UTF-8"));
-    wxXmlNode *node = xmldoc.GetRoot();
-    if(node != NULL)
+    wxXmlNode *vars = node->GetChildren();
+    while (vars != NULL)
     {
-      wxXmlNode *vars = node->GetChildren();
-      while (vars != NULL)
+      wxXmlNode *var = vars->GetChildren();
+
+      wxString name;
+      wxString value;
+      bool bound = false;
+      while(var != NULL)
       {
-        wxXmlNode *var = vars->GetChildren();
+        if(var->GetName() == wxT("name"))
+        {
+          num++;
+          wxXmlNode *namenode = var->GetChildren();
+          if(namenode)
+            name = namenode->GetContent();
+        }
+        if(var->GetName() == wxT("value"))
+        {
+          wxXmlNode *valnode = var->GetChildren();
+          if(valnode)
+          {
+            bound = true;
+            value = valnode->GetContent();
+          }
+        }
 
-        wxString name;
-        wxString value;
-        bool bound = false;
-        while(var != NULL)
+        if(bound)
         {
-          if(var->GetName() == wxT("name"))
+          if(name == "maxima_userdir")
           {
-            num++;
-            wxXmlNode *namenode = var->GetChildren();
-            if(namenode)
-              name = namenode->GetContent();
+            Dirstructure::Get()->UserConfDir(value);
+            wxLogMessage(wxString::Format(_("Maxima user configuration lies in directory %s"),value.utf8_str()));
           }
-          if(var->GetName() == wxT("value"))
+          if(name == "maxima_tempdir")
           {
-            wxXmlNode *valnode = var->GetChildren();
-            if(valnode)
+            m_maximaTempDir = value;
+            wxLogMessage(wxString::Format(_("Maxima uses temp directory %s"),value.utf8_str()));
             {
-              bound = true;
-              value = valnode->GetContent();
+              // Sometimes people delete their temp dir
+              // and gnuplot won't create a new one for them.
+              wxLogNull logNull;
+              wxMkDir(value, wxS_DIR_DEFAULT);
             }
           }
-
-          if(bound)
+          if(name == "*autoconf-version*")
           {
-            if(name == "maxima_userdir")
-            {
-              Dirstructure::Get()->UserConfDir(value);
-              wxLogMessage(wxString::Format(_("Maxima user configuration lies in directory %s"),value.utf8_str()));
-            }
-            if(name == "maxima_tempdir")
-            {
-              m_maximaTempDir = value;
-              wxLogMessage(wxString::Format(_("Maxima uses temp directory %s"),value.utf8_str()));
-              {
-                // Sometimes people delete their temp dir
-                // and gnuplot won't create a new one for them.
-                wxLogNull logNull;
-                wxMkDir(value, wxS_DIR_DEFAULT);
-              }
-            }
-            if(name == "*autoconf-version*")
-            {
-              m_maximaVersion = value;
-              wxLogMessage(wxString::Format(_("Maxima version: %s"),value.utf8_str()));
-            }
-            if(name == "*autoconf-host*")
-            {
-              m_maximaArch = value;
-              wxLogMessage(wxString::Format(_("Maxima architecture: %s"),value.utf8_str()));
-            }
-            if(name == "*maxima-infodir*")
-            {
-              m_maximaDocDir = value;
-              wxLogMessage(wxString::Format(_("Maxima's manual lies in directory %s"),value.utf8_str()));
-            }
-            if(name == "gnuplot_command")
-            {
-              m_gnuplotcommand = value;
-              wxLogMessage(wxString::Format(_("Gnuplot can be found at %s"),value.utf8_str()));
-            }
-            if(name == "*maxima-sharedir*")
-            {
-              value.Trim(true);
-              m_worksheet->m_configuration->MaximaShareDir(value);
-              wxLogMessage(wxString::Format(_("Maxima's share files lie in directory %s"),value.utf8_str()));
-              /// READ FUNCTIONS FOR AUTOCOMPLETION
-              m_worksheet->LoadSymbols();
-            }
-            if(name == "*lisp-name*")
-            {
-              m_lispType = value;
-              wxLogMessage(wxString::Format(_("Maxima was compiled using %s"),value.utf8_str()));
-            }
-            if(name == "*lisp-version*")
-            {
-              m_lispVersion = value;
-              wxLogMessage(wxString::Format(_("Lisp version: %s"),value.utf8_str()));
-            }
-            if(name == "*wx-load-file-name*")
-            {
-              m_recentPackages.AddDocument(value);
-              wxLogMessage(wxString::Format(_("Maxima has loaded the file %s."),value.utf8_str()));
-            }
-            m_worksheet->m_variablesPane->VariableValue(name, value);
+            m_maximaVersion = value;
+            wxLogMessage(wxString::Format(_("Maxima version: %s"),value.utf8_str()));
           }
-          else
-            m_worksheet->m_variablesPane->VariableUndefined(name);
-
-          var = var->GetNext();
+          if(name == "*autoconf-host*")
+          {
+            m_maximaArch = value;
+            wxLogMessage(wxString::Format(_("Maxima architecture: %s"),value.utf8_str()));
+          }
+          if(name == "*maxima-infodir*")
+          {
+            m_maximaDocDir = value;
+            wxLogMessage(wxString::Format(_("Maxima's manual lies in directory %s"),value.utf8_str()));
+          }
+          if(name == "gnuplot_command")
+          {
+            m_gnuplotcommand = value;
+            wxLogMessage(wxString::Format(_("Gnuplot can be found at %s"),value.utf8_str()));
+          }
+          if(name == "*maxima-sharedir*")
+          {
+            value.Trim(true);
+            m_worksheet->m_configuration->MaximaShareDir(value);
+            wxLogMessage(wxString::Format(_("Maxima's share files lie in directory %s"),value.utf8_str()));
+            /// READ FUNCTIONS FOR AUTOCOMPLETION
+            m_worksheet->LoadSymbols();
+          }
+          if(name == "*lisp-name*")
+          {
+            m_lispType = value;
+            wxLogMessage(wxString::Format(_("Maxima was compiled using %s"),value.utf8_str()));
+          }
+          if(name == "*lisp-version*")
+          {
+            m_lispVersion = value;
+            wxLogMessage(wxString::Format(_("Lisp version: %s"),value.utf8_str()));
+          }
+          if(name == "*wx-load-file-name*")
+          {
+            m_recentPackages.AddDocument(value);
+            wxLogMessage(wxString::Format(_("Maxima has loaded the file %s."),value.utf8_str()));
+          }
+          m_worksheet->m_variablesPane->VariableValue(name, value);
         }
-        vars = vars->GetNext();
+        else
+          m_worksheet->m_variablesPane->VariableUndefined(name);
+
+        var = var->GetNext();
       }
+      vars = vars->GetNext();
     }
+  }
 
-    if(num>1)
-      wxLogMessage(_("Maxima sends a new set of auto-completable symbols."));
-    else
-      wxLogMessage(_("Maxima has sent a new variable value."));
+  if(num>1)
+    wxLogMessage(_("Maxima sends a new set of auto-completable symbols."));
+  else
+    wxLogMessage(_("Maxima has sent a new variable value."));
 
-    // Remove the symbols from the data string
-    data = data.Right(data.Length()-end-m_variablesSuffix.Length());
-    TriggerEvaluation();
-    QueryVariableValue();
-  }
+  TriggerEvaluation();
+  QueryVariableValue();
 }
 
-void wxMaxima::ReadAddVariables(wxString &data)
+void wxMaxima::ReadAddVariables(const wxString &data)
 {
-  if (!data.StartsWith(m_addVariablesPrefix))
-    return;
-
-  int end = FindTagEnd(data, m_addVariablesSuffix);
-
-  if (end != wxNOT_FOUND)
+  wxLogMessage(_("Maxima sends us a new set of variables for the watch list."));
+  wxXmlDocument xmldoc;
+  wxStringInputStream xmlStream(data);
+  xmldoc.Load(xmlStream, wxT("UTF-8"));
+  wxXmlNode *node = xmldoc.GetRoot();
+  if(node != NULL)
   {
-    wxLogMessage(_("Maxima sends us a new set of variables for the watch list."));
-    wxXmlDocument xmldoc;
-    wxString xml = data.Left( end + m_addVariablesSuffix.Length());
-    wxStringInputStream xmlStream(xml);
-    xmldoc.Load(xmlStream, wxT("UTF-8"));
-    wxXmlNode *node = xmldoc.GetRoot();
-    if(node != NULL)
+    wxXmlNode *var = node->GetChildren();
+    while (var != NULL)
     {
-      wxXmlNode *var = node->GetChildren();
-      while (var != NULL)
+      wxString name;
       {
-        wxString name;
+        if(var->GetName() == wxT("variable"))
         {
-          if(var->GetName() == wxT("variable"))
-          {
-            wxXmlNode *valnode = var->GetChildren();
-            if(valnode)
-              m_worksheet->m_variablesPane->AddWatch(valnode->GetContent());
-          }
+          wxXmlNode *valnode = var->GetChildren();
+          if(valnode)
+            m_worksheet->m_variablesPane->AddWatch(valnode->GetContent());
         }
-        var = var->GetNext();
       }
+      var = var->GetNext();
     }
-    data = data.Right(data.Length()-end-m_addVariablesSuffix.Length());
   }
 }
 
@@ -2735,30 +2685,16 @@ bool wxMaxima::QueryVariableValue()
 /***
  * Checks if maxima displayed a new prompt.
  */
-void wxMaxima::ReadPrompt(wxString &data)
+void wxMaxima::ReadPrompt(const wxString &data)
 {
-  m_evalOnStartup = false;
-  if (!data.StartsWith(m_promptPrefix))
-    return;
-
-  m_worksheet->m_cellPointers.m_currentTextCell = NULL;
-
-  // Assume we don't have a question prompt
-  m_worksheet->m_questionPrompt = false;
-  m_ready = true;
-  int end = FindTagEnd(data,m_promptSuffix);
-  // Did we find a prompt?
-  if (end == wxNOT_FOUND)
-    return;
-
   m_maximaBusy = false;
+  if(m_bytesFromMaxima > 1000000)
+    wxLogMessage(_("Read %li bytes from maxima at %.1f MB/s"),
+                 m_bytesFromMaxima, ReadSpeed());
   m_bytesFromMaxima = 0;
 
-  wxString o = data.SubString(m_promptPrefix.Length(), end - 1);
-  // Remove the prompt we will process from the string.
-  data = data.Right(data.Length()-end-m_promptSuffix.Length());
-  if(data == wxT(" "))
-    data = wxEmptyString;
+  wxString o = data.Mid(m_promptPrefix.Length(),
+                        data.Length() - m_promptPrefix.Length() - m_promptSuffix.Length());
 
   // If we got a prompt our connection to maxima was successful.
   if(m_unsuccessfulConnectionAttempts > 0)
@@ -2787,6 +2723,10 @@ void wxMaxima::ReadPrompt(wxString &data)
   {
     // Maxima displayed a new main prompt => We don't have a question
     m_worksheet->QuestionAnswered();
+    // The cell maxima has worked on won't receive more output => do the
+    // checks that have been deferred while output was appended to it.
+    if (m_worksheet->GetWorkingGroup() != NULL)
+      m_worksheet->GetWorkingGroup()->OutputFinished();
     // And we can remove one command from the evaluation queue.
     m_worksheet->m_evaluationQueue.RemoveFirst();
 
@@ -3345,101 +3285,49 @@ bool wxMaxima::OpenWXMXFile(wxString file, Worksheet *document, bool clearDocume
     return true;
   }
 
-  // open wxmx file
-  wxXmlDocument xmldoc;
-
-  // We get only absolute paths so the path should start with a "/"
-  //if(!file.StartsWith(wxT("/")))
-  //  file = wxT("/") + file;
-
-  wxFileSystem fs;
-  wxString wxmxURI = wxURI(wxT("file://") + file).BuildURI();
-  // wxURI doesn't know that a "#" in a file name is a literal "#" and
-  // not an anchor within the file so we have to care about url-encoding
-  // this char by hand.
-  wxmxURI.Replace("#", "%23");
-
-#ifdef  __WXMSW__
-  // Fixes a missing "///" after the "file:". This works because we always get absolute
-  // file names.
-  wxRegEx uriCorector1("^file:([a-zA-Z]):");
-  wxRegEx uriCorector2("^file:([a-zA-Z][a-zA-Z]):");
-
-  uriCorector1.ReplaceFirst(&wxmxURI, wxT("file:///\\1:"));
-  uriCorector2.ReplaceFirst(&wxmxURI, wxT("file:///\\1:"));
-#endif
-  // The URI of the wxm code contained within the .wxmx file
-  wxString filename = wxmxURI + wxT("#zip:content.xml");
-
-  // Open the file
-  wxFSFile *fsfile;
-  #ifdef HAVE_OPENMP_TASKS
-  #pragma omp critical (OpenFSFile)
-  #endif
-  fsfile = fs.OpenFile(filename);
-  if (!fsfile)
+  // Read the whole .wxmx file in one go. The images are loaded from memory, then.
+  wxMemoryBuffer contentXML;
+  std::shared_ptr<wxFileSystem> filesystem = Worksheet::ReadWXMX(file, contentXML);
+  if (!filesystem)
   {
-    filename = wxmxURI + wxT("#zip:/content.xml");
-    wxFSFile *fsfile;
-    #ifdef HAVE_OPENMP_TASKS
-    #pragma omp critical (OpenFSFile)
-    #endif
-    fsfile = fs.OpenFile(filename);
+    if(m_worksheet)
+    {
+      m_worksheet->RecalculateForce();
+      m_worksheet->RecalculateIfNeeded();
+    }
+    LoggingMessageBox(_("wxMaxima cannot open content.xml in the .wxmx zip archive ") + file,
+                      _("Error"), wxOK | wxICON_EXCLAMATION);
+    StatusMaximaBusy(waiting);
+    RightStatusText(_("File could not be opened"));
+    return false;
   }
 
-  // Did we succeed in opening the file?
-  if (fsfile)
+  // Let's see if we can load the XML contained in this file.
+  wxXmlDocument xmldoc;
   {
-    // Let's see if we can load the XML contained in this file.
-    if (!xmldoc.Load(*(fsfile->GetStream()), wxT("UTF-8"), wxXMLDOC_KEEP_WHITESPACE_NODES))
+    wxMemoryInputStream istream(contentXML.GetData(), contentXML.GetDataLen());
+    if (!xmldoc.Load(istream, wxT("UTF-8"), wxXMLDOC_KEEP_WHITESPACE_NODES))
     {
       // If we cannot read the file a typical error in old wxMaxima versions was to include
       // a letter of ascii code 27 in content.xml. Let's filter this char out.
+      wxString s((const char *)contentXML.GetData(), wxConvAuto(wxFONTENCODING_UTF8),
+                 contentXML.GetDataLen());
 
-      // Re-open the file.
-      wxFSFile *fsfile;
-      #ifdef HAVE_OPENMP_TASKS
-      #pragma omp critical (OpenFSFile)
-      #endif
-      fsfile = fs.OpenFile(filename);
-      if (fsfile)
-      {
-        // Read the file into a string
-        wxString s;
-        wxTextInputStream istream1(*fsfile->GetStream(), wxT('\t'), wxConvAuto(wxFONTENCODING_UTF8));
-        while (!fsfile->GetStream()->Eof())
-          s += istream1.ReadLine() + wxT("\n");
+      // Remove the illegal character
+      s.Replace(wxT('\u001b'), wxT("\u238B"));
 
-        // Remove the illegal character
-        s.Replace(wxT('\u001b'), wxT("\u238B"));
+      {
+        // Write the string into a memory buffer
+        wxMemoryOutputStream ostream;
+        wxTextOutputStream txtstrm(ostream);
+        txtstrm.WriteString(s);
+        wxMemoryInputStream istream(ostream);
 
-        {
-          // Write the string into a memory buffer
-          wxMemoryOutputStream ostream;
-          wxTextOutputStream txtstrm(ostream);
-          txtstrm.WriteString(s);
-          wxMemoryInputStream istream(ostream);
-
-          // Try to load the file from the memory buffer.
-          xmldoc.Load(istream, wxT("UTF-8"), wxXMLDOC_KEEP_WHITESPACE_NODES);
-        }
+        // Try to load the file from the memory buffer.
+        xmldoc.Load(istream, wxT("UTF-8"), wxXMLDOC_KEEP_WHITESPACE_NODES);
       }
     }
   }
-  else
-  {
-    if(m_worksheet)
-    {
-      m_worksheet->RecalculateForce();
-      m_worksheet->RecalculateIfNeeded();
-    }
-    LoggingMessageBox(_("wxMaxima cannot open content.xml in the .wxmx zip archive ") + file +
-                 wxT(", URI=") + filename, _("Error"),
-                 wxOK | wxICON_EXCLAMATION);
-    StatusMaximaBusy(waiting);
-    RightStatusText(_("File could not be opened"));
-    return false;
-  }
 
   if (!xmldoc.IsOk())
   {
@@ -3495,7 +3383,8 @@ bool wxMaxima::OpenWXMXFile(wxString file, Worksheet *document, bool clearDocume
 
   // Read the worksheet's contents.
   wxXmlNode *xmlcells = xmldoc.GetRoot();
-  GroupCell *tree = CreateTreeFromXMLNode(xmlcells, wxmxURI);
+  GroupCell *tree = CreateTreeFromXMLNode(xmlcells, filesystem);
+  filesystem.reset();
 
   // from here on code is identical for wxm and wxmx
   if (clearDocument)
@@ -3627,12 +3516,23 @@ bool wxMaxima::OpenXML(wxString file, Worksheet *document)
 }
 
 GroupCell *wxMaxima::CreateTreeFromXMLNode(wxXmlNode *xmlcells, wxString wxmxfilename)
+{
+  std::shared_ptr<wxFileSystem> filesystem;
+  if (wxmxfilename.Length() > 0)
+  {
+    filesystem = std::shared_ptr<wxFileSystem>(new wxFileSystem());
+    filesystem->ChangePathTo(wxmxfilename + wxT("#zip:/"), true);
+  }
+  return CreateTreeFromXMLNode(xmlcells, filesystem);
+}
+
+GroupCell *wxMaxima::CreateTreeFromXMLNode(wxXmlNode *xmlcells, const std::shared_ptr<wxFileSystem> &filesystem)
 {
   // Show a busy cursor as long as we export a .gif file (which might be a lengthy
   // action).
   wxBusyCursor crs;
 
-  MathParser mp(&m_worksheet->m_configuration, &m_worksheet->m_cellPointers, wxmxfilename);
+  MathParser mp(&m_worksheet->m_configuration, &m_worksheet->m_cellPointers, filesystem);
   GroupCell *tree = NULL;
   GroupCell *last = NULL;
 
@@ -3677,6 +3577,98 @@ GroupCell *wxMaxima::CreateTreeFromXMLNode(wxXmlNode *xmlcells, wxString wxmxfil
   return tree;
 }
 
+bool wxMaxima::OpenBenchmark(const wxString &file)
+{
+  wxStopWatch stopwatch;
+  wxMemoryBuffer contentXML;
+  std::shared_ptr<wxFileSystem> filesystem = Worksheet::ReadWXMX(file, contentXML);
+  if (!filesystem)
+  {
+    std::cerr << "Cannot read " << file << "\n";
+    return false;
+  }
+  long readTime = stopwatch.Time();
+
+  wxXmlDocument xmldoc;
+  wxMemoryInputStream istream(contentXML.GetData(), contentXML.GetDataLen());
+  if ((!xmldoc.Load(istream, wxT("UTF-8"), wxXMLDOC_KEEP_WHITESPACE_NODES)) ||
+      (xmldoc.GetRoot()->GetName() != wxT("wxMaximaDocument")))
+  {
+    std::cerr << file << " contains no wxMaxima worksheet\n";
+    return false;
+  }
+  long parseTime = stopwatch.Time();
+
+  // The cells are laid out for a window of the size BitmapOut uses, too.
+  const int screenSize = 1000;
+  wxBitmap bitmap(10, 10);
+  wxMemoryDC dc(bitmap);
+  Configuration *configuration = new Configuration(&dc);
+  configuration->SetClientWidth(screenSize);
+  configuration->SetClientHeight(screenSize);
+  Cell::CellPointers cellPointers(NULL);
+
+  GroupCell *tree = NULL;
+  long groups = 0;
+  {
+    MathParser mp(&configuration, &cellPointers, filesystem);
+    GroupCell *last = NULL;
+    for (wxXmlNode *node = xmldoc.GetRoot()->GetChildren(); node != NULL; node = node->GetNext())
+    {
+      if (node->GetType() == wxXML_TEXT_NODE)
+        continue;
+      GroupCell *cell = dynamic_cast<GroupCell *>(mp.ParseTag(node, false));
+      if (cell == NULL)
+        continue;
+      groups++;
+      if (last == NULL)
+        tree = cell;
+      else
+      {
+        last->m_next = last->m_nextToDraw = cell;
+        cell->m_previous = last;
+      }
+      last = cell;
+    }
+  }
+  filesystem.reset();
+  long treeTime = stopwatch.Time();
+
+  // Worksheet::RecalculateIfNeeded() lays out the cells that are visible first.
+  GroupCell *cell = tree;
+  int height = 0;
+  while ((cell != NULL) && (height < screenSize))
+  {
+    cell->Recalculate();
+    height += cell->GetHeight() + configuration->GetGroupSkip();
+    cell = cell->GetNext();
+  }
+  long firstPaintTime = stopwatch.Time();
+
+  while (cell != NULL)
+  {
+    cell->Recalculate();
+    cell = cell->GetNext();
+  }
+  // Wait for the images that are loaded in the background
+  #ifdef HAVE_OPENMP_TASKS
+  #pragma omp taskwait
+  #endif
+  long totalTime = stopwatch.Time();
+
+  std::cout << file << ": " << groups << " cells, "
+            << contentXML.GetDataLen() << " bytes of xml\n";
+  std::cout << "Reading the archive: " << readTime << " ms\n";
+  std::cout << "Parsing the xml:     " << parseTime - readTime << " ms\n";
+  std::cout << "Creating the cells:  " << treeTime - parseTime << " ms\n";
+  std::cout << "Time to first paint: " << firstPaintTime << " ms\n";
+  std::cout << "Total open time:     " << totalTime << " ms\n";
+
+  wxDELETE(tree);
+  wxDELETE(configuration);
+  return true;
+}
+
 wxString wxMaxima::EscapeForLisp(wxString str)
 {
   str.Replace(wxT("\\"), wxT("\\\\"));
@@ -4087,15 +4079,9 @@ bool wxMaxima::InterpretDataFromMaxima()
 
   if ((m_xmlInspector) && (IsPaneDisplayed(menu_pane_xmlInspector)))
     m_xmlInspector->Add_FromMaxima(m_newCharsFromMaxima);
-  // This way we can avoid searching the whole string for a
-  // ending tag if we have received only a few bytes of the
-  // data between 2 tags
-  m_currentOutputEnd = m_currentOutput.Right(30) + m_newCharsFromMaxima;
 
   m_currentOutput += m_newCharsFromMaxima;
   m_newCharsFromMaxima = wxEmptyString;
-  if ((m_xmlInspector) && (IsPaneDisplayed(menu_pane_xmlInspector)))
-    m_xmlInspector->Add_FromMaxima(m_newCharsFromMaxima);
 
   if (!m_dispReadOut &&
       (m_currentOutput != wxT("\n")) &&
@@ -4105,63 +4091,110 @@ bool wxMaxima::InterpretDataFromMaxima()
     m_dispReadOut = true;
   }
 
-  size_t length_old = 0;
-
-  while (length_old != m_currentOutput.Length())
+  if (m_first)
   {
-    if (m_currentOutput.StartsWith("\n<"))
-      m_currentOutput = m_currentOutput.Right(m_currentOutput.Length() - 1);
-
-    length_old = m_currentOutput.Length();
+    // This function determines the port maxima is running on from  the text
+    // maxima outputs at startup. This piece of text is afterwards discarded.
+    ReadFirstPrompt(m_currentOutput);
+    if (m_first)
+      return true;
+  }
 
-    GroupCell *oldActiveCell = NULL;
-    GroupCell *newActiveCell = NULL;
+  // Hand each complete frame to the reader for its tag. Frames are only
+  // cut out of m_currentOutput, which is shortened once after the loop
+  // instead of once per frame.
+  size_t start = 0;
+  while (start < m_currentOutput.Length())
+  {
+    if (m_currentOutput.compare(start, 2, wxT("\n<")) == 0)
+      start++;
 
-    // Handle text that isn't wrapped in a known tag
-    if (!m_first)
+    m_evalOnStartup = false;
+    size_t end = wxString::npos;
+    if (m_currentOutput.compare(start, m_promptPrefix.Length(), m_promptPrefix) == 0)
+    {
+      // Assume we don't have a question prompt
+      m_worksheet->m_cellPointers.m_currentTextCell = NULL;
+      m_worksheet->m_questionPrompt = false;
+      m_ready = true;
+      end = FindFrameEnd(start, m_promptSuffix);
+      if (end != wxString::npos)
+      {
+        // The prompt tells us that maxima awaits the next command: ReadPrompt()
+        // sends it to maxima so maxima can work while we interpret its output.
+        ReadPrompt(m_currentOutput.Mid(start, end - start));
+        if (m_currentOutput.compare(end, wxString::npos, wxT(" ")) == 0)
+          end++;
+      }
+    }
+    else if (m_currentOutput.compare(start, 5, wxT("<mth>")) == 0)
+    {
+      // The <mth> tag contains math output and sometimes text.
+      if ((end = FindFrameEnd(start, wxT("</mth>"))) != wxString::npos)
+        ReadMath(m_currentOutput.Mid(start, end - start));
+    }
+    else if (m_currentOutput.compare(start, 6, wxT("<math>")) == 0)
+    {
+      if ((end = FindFrameEnd(start, wxT("</math>"))) != wxString::npos)
+        ReadMath(m_currentOutput.Mid(start, end - start));
+    }
+    else if (m_currentOutput.compare(start, m_symbolsPrefix.Length(), m_symbolsPrefix) == 0)
+    {
+      if ((end = FindFrameEnd(start, m_symbolsSuffix)) != wxString::npos)
+        ReadLoadSymbols(m_currentOutput.Mid(start, end - start));
+    }
+    else if (m_currentOutput.compare(start, m_suppressOutputPrefix.Length(),
+                                     m_suppressOutputPrefix) == 0)
     {
-      // First read the prompt that tells us that maxima awaits the next command:
-      // If that is the case ReadPrompt() sends the next command to maxima and
-      // maxima can work while we interpret its output.
-      oldActiveCell = m_worksheet->GetWorkingGroup();
-      ReadPrompt(m_currentOutput);
-      newActiveCell = m_worksheet->GetWorkingGroup();
-
-      // Temporarily switch to the WorkingGroup the output we don't have interpreted yet
-      // was for
-      if(newActiveCell != oldActiveCell)
-        m_worksheet->m_cellPointers.SetWorkingGroup(oldActiveCell);
-      // Handle the <mth> tag that contains math output and sometimes text.
-      ReadMath(m_currentOutput);
-
-      // The following function calls each extract and remove one type of XML tag
-      // information from the beginning of the data string we got - but only do so
-      // after the closing tag has been transferred, as well.
-      ReadLoadSymbols(m_currentOutput);
-
       // Discard startup warnings
-      ReadSuppressedOutput(m_currentOutput);
-
-      // Let's see if maxima informs us about the values of variables
-      ReadVariables(m_currentOutput);
-
-      // Let's see if maxima tells us to add new symbols to the watchlist
-      ReadAddVariables(m_currentOutput);
-
-      // Handle the XML tag that contains Status bar updates
-      ReadStatusBar(m_currentOutput);
-
-      // Handle text that isn't XML output: Mostly Error messages or warnings.
-      ReadMiscText(m_currentOutput);
+      end = FindFrameEnd(start, m_suppressOutputSuffix);
+    }
+    else if (m_currentOutput.compare(start, m_variablesPrefix.Length(), m_variablesPrefix) == 0)
+    {
+      // Maxima informs us about the values of variables
+      if ((end = FindFrameEnd(start, m_variablesSuffix)) != wxString::npos)
+        ReadVariables(m_currentOutput.Mid(start, end - start));
+    }
+    else if (m_currentOutput.compare(start, m_addVariablesPrefix.Length(),
+                                     m_addVariablesPrefix) == 0)
+    {
+      // Maxima tells us to add new symbols to the watchlist
+      if ((end = FindFrameEnd(start, m_addVariablesSuffix)) != wxString::npos)
+        ReadAddVariables(m_currentOutput.Mid(start, end - start));
+    }
+    else if (m_currentOutput.compare(start, 11, wxT("<statusbar>")) == 0)
+    {
+      if ((end = FindFrameEnd(start, wxT("</statusbar>"))) != wxString::npos)
+        ReadStatusBar(m_currentOutput.Mid(start, end - start));
     }
     else
-      // This function determines the port maxima is running on from  the text
-      // maxima outputs at startup. This piece of text is afterwards discarded.
-      ReadFirstPrompt(m_currentOutput);
+    {
+      // Text that isn't XML output: Mostly Error messages or warnings.
+      end = GetMiscTextEnd(m_currentOutput, start);
+      if (end == start)
+      {
+        // A tag we don't have a reader for
+        m_worksheet->m_cellPointers.m_currentTextCell = NULL;
+        break;
+      }
+      ReadMiscText(m_currentOutput.Mid(start, end - start));
+      if (end < m_currentOutput.Length())
+        m_worksheet->m_cellPointers.m_currentTextCell = NULL;
+    }
+
+    // Wait for the rest of an incomplete frame
+    if (end == wxString::npos)
+      break;
+    start = end;
+  }
 
-    // Switch to the WorkingGroup the next bunch of data is for.
-    if(newActiveCell != oldActiveCell)
-      m_worksheet->m_cellPointers.SetWorkingGroup(newActiveCell);
+  if (start > 0)
+  {
+    m_currentOutput.erase(0, start);
+    if (m_currentOutputSearchPos >= start)
+      m_currentOutputSearchPos -= start;
+    else
+      m_currentOutputSearchPos = 0;
   }
   return true;
 }
@@ -4261,8 +4294,15 @@ void wxMaxima::OnIdle(wxIdleEvent &event)
 
   if(m_worksheet != NULL)
   {
-    bool requestMore = m_worksheet->RecalculateIfNeeded();
-    m_worksheet->ScrollToCellIfNeeded();
+    bool requestMore = m_worksheet->ExpandLazyCells();
+    // Layout big worksheets in time slices so the GUI stays responsive
+    requestMore = m_worksheet->RecalculateIfNeeded(true) || requestMore;
+    if(m_worksheet->RecalculationPending())
+      // Show the part we already know the layout of
+      m_worksheet->RedrawIfRequested();
+    else
+      m_worksheet->ScrollToCellIfNeeded();
+    m_worksheet->UpdateLookalikeWarnings();
     if(requestMore)
     {
       event.RequestMore();
@@ -5253,49 +5293,100 @@ bool wxMaxima::AutoSave()
 {
   if(!SaveNecessary())
     return true;
-  
+
+  // Don't start another autosave while the last one still writes its file.
+  if(m_autoSaveRunning)
+    return true;
+
   bool savedWas = m_worksheet->IsSaved();
-  bool saved;
   wxString oldTempFile = m_tempfileName;
   m_tempfileName = wxStandardPaths::Get().GetTempDir()+
     wxString::Format("/untitled_%li_%li.wxmx",
                      wxGetProcessId(),m_pid);
 
-  
+  wxString file;
   if (m_worksheet->m_configuration->AutoSaveAsTempFile() ||
       m_worksheet->m_currentFile.IsEmpty())
   {
-    saved = m_worksheet->ExportToWXMX(m_tempfileName);
-
+    file = m_tempfileName;
     wxLogMessage(wxString::Format(_("Autosaving as temp file %s"), m_tempfileName));
-    if((m_tempfileName != oldTempFile) && saved)
-    {
-      if(!oldTempFile.IsEmpty())
-      {
-        if(wxFileExists(oldTempFile))
-        {
-          SuppressErrorDialogs blocker;
-          wxLogMessage(wxString::Format(_("Trying to remove the old temp file %s"), oldTempFile));
-          wxRemoveFile(oldTempFile);
-        }
-      }
-    }
+    if(m_tempfileName == oldTempFile)
+      oldTempFile = wxEmptyString;
+    m_autoSaveToCurrentFile = false;
     RegisterAutoSaveFile();
   }
   else
   {
     wxLogMessage(wxString::Format(_("Autosaving the .wxmx file as %s"),
                                   m_worksheet->m_currentFile));
-    savedWas = saved = SaveFile(false);
+    if(!m_worksheet->m_currentFile.Lower().EndsWith(wxT(".wxmx")))
+    {
+      // .wxm files are small and therefore fast to write.
+      savedWas = SaveFile(false);
+      m_worksheet->SetSaved(savedWas);
+      ResetTitle(savedWas, true);
+      return savedWas;
+    }
+    file = m_worksheet->m_currentFile;
+    oldTempFile = wxEmptyString;
+    m_autoSaveToCurrentFile = true;
+    StatusSaveStart();
+    // The file will contain everything the worksheet contains now. If the save
+    // fails OnAutoSaveFinished() will tell.
+    savedWas = true;
   }
 
+  // Only collecting the data has to be done here: Serializing the cells that
+  // haven't changed since the last save is avoided by the cells' XML cache,
+  // checking the XML and zipping it is done in the background.
+  m_autoSaveRunning = true;
+  std::shared_ptr<Worksheet::WXMXSnapshot> snapshot = m_worksheet->GetWXMXSnapshot(file);
+  #ifdef HAVE_OPENMP_TASKS
+  #pragma omp task
+  #endif
+  AutoSave_Backgroundtask(snapshot, oldTempFile);
+
   m_worksheet->SetSaved(savedWas);
   ResetTitle(savedWas, true);
-
-  oldTempFile = m_tempfileName;
   return savedWas;
 }
 
+void wxMaxima::AutoSave_Backgroundtask(std::shared_ptr<Worksheet::WXMXSnapshot> snapshot,
+                                       wxString oldTempFile)
+{
+  bool saved = Worksheet::WriteWXMX(*snapshot);
+  if(saved && (!oldTempFile.IsEmpty()) && wxFileExists(oldTempFile))
+  {
+    SuppressErrorDialogs blocker;
+    wxLogMessage(wxString::Format(_("Trying to remove the old temp file %s"), oldTempFile));
+    wxRemoveFile(oldTempFile);
+  }
+  wxThreadEvent *event = new wxThreadEvent(wxEVT_THREAD);
+  event->SetInt(saved);
+  GetEventHandler()->QueueEvent(event);
+}
+
+void wxMaxima::OnAutoSaveFinished(wxThreadEvent &event)
+{
+  m_autoSaveRunning = false;
+  bool saved = event.GetInt();
+  if(!saved)
+    wxLogMessage(_("Autosaving the worksheet has failed."));
+  if(!m_autoSaveToCurrentFile)
+    return;
+  if(saved)
+  {
+    RemoveTempAutosavefile();
+    StatusSaveFinished();
+  }
+  else
+  {
+    StatusSaveFailed();
+    m_worksheet->SetSaved(false);
+    ResetTitle(false, true);
+  }
+}
+
 void wxMaxima::FileMenu(wxCommandEvent &event)
 {
   if(m_worksheet != NULL)
@@ -5466,7 +5557,12 @@ void wxMaxima::FileMenu(wxCommandEvent &event)
             // Show a busy cursor as long as we export a file.
             wxBusyCursor crs;
             fileExt = wxT("html");
-            if (!m_worksheet->ExportToHTML(file))
+            if (!m_worksheet->ExportToHTML(file,
+                                           [this](long done, long total){
+                                             SetStatusText(wxString::Format(_("Exporting... %li of %li cells"),
+                                                                            done, total), 1);
+                                             GetStatusBar()->Update();
+                                           }))
             {
               LoggingMessageBox(_("Exporting to HTML failed!"), _("Error!"),
                            wxOK);
@@ -8338,6 +8434,24 @@ void wxMaxima::OnClose(wxCloseEvent &event)
   if(event.GetEventType() == wxEVT_END_SESSION)
     KillMaxima();
 
+  // In batch mode the worksheet may need to be exported before we close it
+  if (m_exitAfterEval && m_exportHTMLOnExit && (!m_closing) &&
+      (m_worksheet->m_currentFile != wxEmptyString))
+  {
+    wxFileName htmlFile(m_worksheet->m_currentFile);
+    htmlFile.SetExt(wxT("html"));
+    if (!m_worksheet->ExportToHTML(htmlFile.GetFullPath(),
+                                   [](long done, long total){
+                                     // Report every 10% only
+                                     if ((done * 10 / total) != ((done - 1) * 10 / total))
+                                       wxLogMessage(_("Exported %li of %li cells to html"), done, total);
+                                   }))
+    {
+      wxLogError(_("Exporting %s to html failed!"), htmlFile.GetFullPath());
+      m_exitCode = -1;
+    }
+  }
+
   if(!SaveOnClose())
   {
     event.Veto();
@@ -9887,6 +10001,7 @@ void wxMaxima::ChangeCellStyle(wxCommandEvent& WXUNUSED(event))
 
 bool wxMaxima::m_pipeToStdout = false;
 bool wxMaxima::m_exitOnError = false;
+bool wxMaxima::m_exportHTMLOnExit = false;
 wxString wxMaxima::m_extraMaximaArgs;
 int wxMaxima::m_exitCode = 0;
 
@@ -47,6 +47,7 @@
 #include <wx/sckstrm.h>
 #include <wx/buffer.h>
 #include <memory>
+#include <vector>
 #ifdef __WXMSW__
 #include <windows.h>
 #endif
@@ -78,6 +79,9 @@
 //! How many miliseconds should we wait between polling for stdout+cpu power?
 #define MAXIMAPOLLMSECS 2000
 
+//! How many bytes of maxima's output do we try to read from the socket at once?
+#define SOCKET_SIZE_LIMIT 65536
+
 #ifndef __WXGTK__
 
 class MyAboutDialog : public wxDialog
@@ -110,8 +114,18 @@ public:
   //! Pipe maxima's output to stdout
   static void PipeToStdout(){m_pipeToStdout = true;}
   static void ExitOnError(){m_exitOnError = true;}
+  //! Export the worksheet to a .html file of the same name before batch mode closes it
+  static void ExportHTMLOnExit(){m_exportHTMLOnExit = true;}
   static void ExtraMaximaArgs(wxString args){m_extraMaximaArgs = args;}
 
+  /*! Measures how long opening a .wxmx file takes
+
+    Prints the time until the first screenful of the worksheet can be displayed
+    and the time until all cells are laid out and all images are loaded.
+    \return false, if the file could not be read.
+   */
+  static bool OpenBenchmark(const wxString &file);
+
   //! An enum of individual IDs for all timers this class handles
   enum TimerIDs
   {
@@ -215,6 +229,7 @@ private:
   wxString m_initialWorkSheetContents;
   static bool m_pipeToStdout;
   static bool m_exitOnError;
+  static bool m_exportHTMLOnExit;
   static wxString m_extraMaximaArgs;
   //! Search for the wxMaxima help file
   wxString SearchwxMaximaHelp();
@@ -497,61 +512,54 @@ protected:
 
     Every error message or other line maxima outputs should end in a newline character. 
     But sometimes it doesn't and a <code>\<mth\></code> tag comes first \f$ =>\f$ This 
-    function determines where the miscellaneous text ends.
+    function determines where the miscellaneous text that begins at start ends.
    */
-  int GetMiscTextEnd(const wxString &data);
+  size_t GetMiscTextEnd(const wxString &data, size_t start);
+
+  /*! Find the end of the frame in m_currentOutput that begins at start
 
-  //! Find the end of a tag in wxMaxima's output.
-  int FindTagEnd(wxString &data, const wxString &tag);
+    \param start Where the frame's start tag begins
+    \param tag   The end tag of the frame
+    \return The position after the end tag or wxString::npos if the frame
+             hasn't been transferred completely yet. In this case the next
+             search resumes at the end of the data we already have searched.
+   */
+  size_t FindFrameEnd(size_t start, const wxString &tag);
 
   /*! Reads text that isn't enclosed between xml tags.
 
      Some commands provide status messages before the math output or the command has finished.
      This function makes wxMaxima output them directly as they arrive.
-
-     After processing the lines not enclosed in xml tags they are removed from data.
    */
-  void ReadMiscText(wxString &data);
-
-  /*! Reads the input prompt from Maxima.
+  void ReadMiscText(const wxString &data);
 
-     After processing the input prompt it is removed from data.
-   */
-  void ReadPrompt(wxString &data);
+  //! Reads an input prompt, including its start and end marker, from Maxima.
+  void ReadPrompt(const wxString &data);
 
   /*! Reads the output of wxstatusbar() commands
 
     wxstatusbar allows the user to give and update visual feedback from long-running 
     commands and makes sure this feedback is deleted once the command is finished.
    */
-  void ReadStatusBar(wxString &data);
+  void ReadStatusBar(const wxString &data);
 
   /*! Reads the math cell's contents from Maxima.
      
      Math cells are enclosed between the tags \<mth\> and \</mth\>. 
-     This function removes the from data after appending them
-     to the console.
-
-     After processing the status bar marker is removed from data.
-   */
-  void ReadMath(wxString &data);
-
-  /*! Reads autocompletion templates we get on definition of a function or variable
-
-    After processing the templates they are removed from data.
+     This function appends them to the console.
    */
-  void ReadLoadSymbols(wxString &data);
+  void ReadMath(const wxString &data);
 
-  //! Read (and discard) suppressed output
-  void ReadSuppressedOutput(wxString &data);
+  //! Reads autocompletion templates we get on definition of a function or variable
+  void ReadLoadSymbols(const wxString &data);
 
   /*! Reads the variable values maxima advertises to us
    */
-  void ReadVariables(wxString &data);
+  void ReadVariables(const wxString &data);
   
   /*! Reads the "add variable to watch list" tag maxima can send us
    */
-  void ReadAddVariables(wxString &data);
+  void ReadAddVariables(const wxString &data);
 
 #ifndef __WXMSW__
 
@@ -631,6 +639,8 @@ protected:
 
   //! Loads a wxmx description
   GroupCell *CreateTreeFromXMLNode(wxXmlNode *xmlcells, wxString wxmxfilename = wxEmptyString);
+  //! Loads a wxmx description whose images are read from filesystem
+  GroupCell *CreateTreeFromXMLNode(wxXmlNode *xmlcells, const std::shared_ptr<wxFileSystem> &filesystem);
 
   /*! Saves the current file
 
@@ -645,6 +655,24 @@ protected:
     Returns false if a save was necessary, but not possible.
    */
   bool AutoSave();
+
+  /*! Write the file for an autosave
+
+    Runs as a background task and sends the wxMaxima window a wxEVT_THREAD
+    event when it is done.
+    \param snapshot The data Worksheet::GetWXMXSnapshot() has collected
+    \param oldTempFile A temp file to delete after a successful save
+  */
+  void AutoSave_Backgroundtask(std::shared_ptr<Worksheet::WXMXSnapshot> snapshot,
+                               wxString oldTempFile);
+
+  //! Called when AutoSave_Backgroundtask() has finished
+  void OnAutoSaveFinished(wxThreadEvent &event);
+
+  //! Is a background task currently writing an autosave?
+  bool m_autoSaveRunning;
+  //! Does the running autosave write to the file the worksheet has been loaded from?
+  bool m_autoSaveToCurrentFile;
   
   int SaveDocumentP();
 
@@ -658,8 +686,17 @@ protected:
   }
 
   std::shared_ptr<wxSocketBase> m_client;
-  std::shared_ptr<wxSocketInputStream> m_clientStream;
-  std::unique_ptr<wxTextInputStream> m_clientTextStream;
+  /*! The buffer the data from maxima's socket is read into in blocks
+
+    Maxima sends UTF-8. A block boundary may split a multibyte character:
+    Such an incomplete sequence is kept at the start of this buffer so the
+    next Read() completes it.
+   */
+  std::vector<char> m_socketInputBuffer;
+  //! The number of bytes of an incomplete UTF-8 sequence in m_socketInputBuffer
+  size_t m_socketInputBufferFill;
+  //! Decodes the complete UTF-8 chars in m_socketInputBuffer to m_newCharsFromMaxima
+  void DecodeSocketInputBuffer(size_t bytes);
   wxSocketServer *m_server;
   wxProcess *m_process;
   //! The stdout of the maxima process
@@ -669,17 +706,14 @@ protected:
   int m_port;
   //! All chars from maxima that still aren't part of m_currentOutput
   wxString m_newCharsFromMaxima;
-  /*! The end of maxima's current uninterpreted output, see m_currentOutput.
-   
-    If we just want to look if maxima's current output contains an ending tag
-    this is the place we can search in fast.
-
-    wxEmptyString means that the current output isn't long enought to make 
-    creating this string worthwile.
-   */
-  wxString m_currentOutputEnd;
   //! All from maxima's current output we still haven't interpreted
   wxString m_currentOutput;
+  /*! Where in m_currentOutput the search for the end of an incomplete frame resumes
+
+    Without this every packet of a long \<mth\> tag would make us search the
+    whole tag for its end again.
+   */
+  size_t m_currentOutputSearchPos;
   //! The marker for the start of a input prompt
   wxString m_promptPrefix;
   //! The marker for the end of a input prompt
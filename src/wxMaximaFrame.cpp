@@ -488,6 +488,14 @@ void wxMaximaFrame::EvaluationQueueLength(int length, int numberOfCommands)
   }
 }
 
+double wxMaximaFrame::ReadSpeed()
+{
+  long msecs = m_bytesFromMaximaStopWatch.Time();
+  if(msecs <= 0)
+    return 0;
+  return m_bytesFromMaxima / 1000.0 / msecs;
+}
+
 void wxMaximaFrame::UpdateStatusMaximaBusy()
 {
   if ((m_StatusMaximaBusy != m_StatusMaximaBusy_next) || (m_forceStatusbarUpdate) ||
@@ -539,7 +547,8 @@ void wxMaximaFrame::UpdateStatusMaximaBusy()
             RightStatusText(_("Reading Maxima output"),false);
           else
             RightStatusText(wxString::Format(
-                              _("Reading Maxima output: %li bytes"), m_bytesFromMaxima),
+                              _("Reading Maxima output: %li bytes (%.1f MB/s)"),
+                              m_bytesFromMaxima, ReadSpeed()),
                             false);
           break;
         case parsing:
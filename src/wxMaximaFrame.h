@@ -39,6 +39,7 @@ surrounding the worksheet.
 #include <wx/arrstr.h>
 #include <wx/aui/aui.h>
 #include <wx/notifmsg.h>
+#include <wx/stopwatch.h>
 
 #include "Worksheet.h"
 #include "RecentDocuments.h"
@@ -573,6 +574,10 @@ public:
 protected:
   //! How many bytes did maxima send us until now?
   long m_bytesFromMaxima;
+  //! Measures the time since maxima has started sending the current output
+  wxStopWatch m_bytesFromMaximaStopWatch;
+  //! The speed maxima's output is read with [MB/s]
+  double ReadSpeed();
   //! The process id of maxima. Is determined by ReadFirstPrompt.
   long m_pid;
   //! The last name GetTempAutosavefileName() has returned.
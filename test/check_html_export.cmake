@@ -0,0 +1,27 @@
+# -*- mode: CMake; cmake-tab-width: 4; -*-
+#
+# Checks that an html export has produced a non-empty .html file and
+# non-empty .png images.
+#
+# Usage: cmake -DHTML=<file.html> -P check_html_export.cmake
+
+if(NOT EXISTS "${HTML}")
+    message(FATAL_ERROR "${HTML} wasn't created")
+endif()
+file(READ "${HTML}" CONTENTS LIMIT 16)
+if(CONTENTS STREQUAL "")
+    message(FATAL_ERROR "${HTML} is empty")
+endif()
+
+get_filename_component(HTML_DIR "${HTML}" DIRECTORY)
+get_filename_component(HTML_NAME "${HTML}" NAME_WE)
+file(GLOB IMAGES "${HTML_DIR}/${HTML_NAME}_htmlimg/*.png")
+if(NOT IMAGES)
+    message(FATAL_ERROR "No .png images were written to ${HTML_DIR}/${HTML_NAME}_htmlimg")
+endif()
+foreach(IMAGE ${IMAGES})
+    file(READ "${IMAGE}" CONTENTS LIMIT 16 HEX)
+    if(CONTENTS STREQUAL "")
+        message(FATAL_ERROR "${IMAGE} is empty")
+    endif()
+endforeach()